@@ -0,0 +1,176 @@
+// Fuzzing harness of disasm-lib, built for the build machine with the sanity checks of
+// the disassembler enabled and with AddressSanitizer, so a failed assert or a read
+// beyond the end of the code is a crash the fuzzer picks up.
+//
+// The first byte of an input selects the mode, the rest is code, which is decoded
+// instruction by instruction the way a disassembler walks a function:
+//   bits 0-1   0=x86 1=x64 2=16-bit x86 3=x64
+//   bit 2      print the errors of the decoder rather than suppressing them
+//   bit 3      align the disassembly
+//
+// libFuzzer calls LLVMFuzzerTestOneInput itself (build with -DDISASM_FUZZ_LIBFUZZER).
+// Otherwise this runs the files given on the command line or stdin once each, as afl-fuzz
+// expects, or "-rCOUNT" random inputs for a quick run without a fuzzer.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disasm-lib/disasm.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// The code ends exactly where the allocation does, so AddressSanitizer notices the first
+// byte read past it
+static uint8_t *copyExactly(const uint8_t *data, size_t size)
+{
+    uint8_t *copy = malloc(size ? size : 1);
+    if (!copy)
+        abort();
+    memcpy(copy, data, size);
+    return copy;
+}
+
+static void decode(ARCHITECTURE_TYPE arch, const uint8_t *code, size_t size, U32 flags)
+{
+    DISASSEMBLER dis;
+    size_t at = 0;
+
+    if (!InitDisassembler(&dis, arch))
+        abort();
+
+    while (at < size) {
+        size_t left = size - at;
+        size_t take = left < X86_MAX_INSTRUCTION_LEN ? left : X86_MAX_INSTRUCTION_LEN;
+        X86_LENGTH_AND_TYPE info;
+        INSTRUCTION *ins;
+        uint8_t *window;
+        BOOL fast;
+
+        // the length decoder is told where the code ends and must not read beyond it
+        uint8_t *rest = copyExactly(code + at, left);
+        fast = X86_GetLengthAndType(arch, rest, (U32)left, &info);
+        free(rest);
+        if (fast && (!info.Length || info.Length > left)) {
+            fprintf(stderr, "length decoder: length %u with %zu bytes left at +%zx\n", info.Length, left, at);
+            abort();
+        }
+
+        // the full decoder isn't, it may read a whole instruction but nothing more
+        window = malloc(X86_MAX_INSTRUCTION_LEN);
+        if (!window)
+            abort();
+        memset(window, 0, X86_MAX_INSTRUCTION_LEN);
+        memcpy(window, code + at, take);
+        ins = GetInstruction(&dis, 0x401000 + at, window, flags);
+        free(window);
+
+        // Both have to agree on what they decode. Near the end the full decoder may also
+        // decode what the length decoder can't tell from the bytes left, as it goes by the
+        // padding to pick an instruction from a group even when it isn't a ModRM byte.
+        if (ins && ins->Length > left)
+            ins = NULL;
+        if ((fast && (!ins || ins->Length != info.Length || ins->Type != info.Type)) || (ins && !fast && left >= X86_MAX_INSTRUCTION_LEN)) {
+            size_t i;
+            fprintf(stderr, "decoders disagree at +%zx:", at);
+            for (i = 0; i < take; i++)
+                fprintf(stderr, " %02x", code[at + i]);
+            fprintf(stderr, "\nfull %d length %u type %x, fast %d length %u type %x\n",
+                    ins != NULL, ins ? ins->Length : 0, ins ? ins->Type : 0, fast, info.Length, info.Type);
+            abort();
+        }
+
+        at += ins ? ins->Length : 1;
+    }
+
+    CloseDisassembler(&dis);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static const ARCHITECTURE_TYPE archs[4] = { ARCH_X86, ARCH_X64, ARCH_X86_16, ARCH_X64 };
+    U32 flags = DISASM_DECODE | DISASM_DISASSEMBLE;
+
+    if (!size)
+        return 0;
+
+    if (!(data[0] & 4))
+        flags |= DISASM_SUPPRESSERRORS;
+    if (data[0] & 8)
+        flags |= DISASM_ALIGNOUTPUT;
+
+    decode(archs[data[0] & 3], data + 1, size - 1, flags);
+    return 0;
+}
+
+#ifndef DISASM_FUZZ_LIBFUZZER
+static int runFile(FILE *file)
+{
+    uint8_t *data = NULL;
+    size_t size = 0, capacity = 0, got;
+
+    do {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            data = realloc(data, capacity);
+            if (!data)
+                return 0;
+        }
+        got = fread(data + size, 1, capacity - size, file);
+        size += got;
+    } while (got);
+
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return 1;
+}
+
+// Random instructions, biased towards prefixes and escape bytes so that long and
+// truncated instructions come up often
+static void runRandom(unsigned count)
+{
+    static const uint8_t interesting[] = {
+        0x0f, 0x0f, 0x38, 0x3a, 0x66, 0x67, 0xf0, 0xf2, 0xf3, 0x2e, 0x3e, 0x26, 0x64, 0x65, 0x36,
+        0x40, 0x48, 0x4f, 0xc4, 0xc5, 0x8f, 0xd8, 0xdf, 0x9a, 0xea, 0xa0, 0xa3, 0xff, 0x00,
+    };
+    uint32_t seed = 1;
+    uint8_t data[48];
+    unsigned i, j;
+
+    for (i = 0; i < count; i++) {
+        size_t size = 1 + (i % (sizeof(data) - 1));
+        for (j = 0; j < size; j++) {
+            seed = seed * 1103515245 + 12345;
+            data[j] = (seed >> 16) & 1 ? interesting[(seed >> 17) % sizeof(interesting)] : (uint8_t)(seed >> 20);
+        }
+        data[0] &= ~4; // don't print errors
+        LLVMFuzzerTestOneInput(data, size);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if (argc < 2)
+        return runFile(stdin) ? 0 : 1;
+
+    for (i = 1; i < argc; i++) {
+        FILE *file;
+
+        if (strncmp(argv[i], "-r", 2) == 0) {
+            runRandom((unsigned)strtoul(argv[i] + 2, NULL, 0));
+            continue;
+        }
+
+        file = fopen(argv[i], "rb");
+        if (!file || !runFile(file)) {
+            fprintf(stderr, "disasm-fuzz: can't read %s\n", argv[i]);
+            return 1;
+        }
+        fclose(file);
+    }
+    return 0;
+}
+#endif
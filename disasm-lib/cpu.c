@@ -30,6 +30,7 @@ BYTE *GetAbsoluteAddressFromSegment(BYTE Segment, DWORD Offset)
 	}
 }
 
+#ifdef _WIN32
 // This is an GDT/LDT selector (pGDT+Selector)
 BYTE *GetAbsoluteAddressFromSelector(WORD Selector, DWORD Offset)
 {
@@ -90,4 +91,4 @@ BYTE *GetAbsoluteAddressFromSelector(WORD Selector, DWORD Offset)
 	}
 	return (BYTE *)Base + Offset;
 }
-
+#endif // _WIN32
@@ -6,7 +6,6 @@ extern "C" {
 #endif
 #pragma pack(push,1)
 
-#include <windows.h>
 #include "misc.h"
 
 ////////////////////////////////////////////////////////
@@ -268,7 +267,9 @@ typedef struct _GDT_ENTRY
 } GDT_ENTRY;
 
 BYTE *GetAbsoluteAddressFromSegment(BYTE Segment, DWORD Offset);
+#ifdef _WIN32
 BYTE *GetAbsoluteAddressFromSelector(WORD Selector, DWORD Offset);
+#endif
 
 #pragma pack(pop)
 #ifdef __cplusplus
@@ -1,7 +1,6 @@
 // Copyright (C) 2004, Matt Conover (mconover@gmail.com)
 #undef NDEBUG
 #include <assert.h>
-#include <windows.h>
 #include "disasm.h"
 
 #ifdef NO_SANITY_CHECKS
@@ -83,6 +82,9 @@ BOOL InitInstruction(INSTRUCTION *Instruction, DISASSEMBLER *Disassembler)
 //
 // If Disassemble = TRUE, then Instruction->String is valid (also requires Decode = TRUE)
 //
+// Nothing beyond the longest possible instruction is read at Address (15 bytes on x86),
+// code which might end sooner has to be padded
+//
 // WARNING: This will overwrite the previously obtained instruction
 INSTRUCTION *GetInstruction(DISASSEMBLER *Disassembler, U64 VirtualAddress, U8 *Address, U32 Flags)
 {
@@ -12,7 +12,6 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
-#include <windows.h>
 #include <stdio.h>
 #include "misc.h"
 
@@ -20,11 +19,25 @@ typedef signed char S8;
 typedef unsigned char U8;
 typedef signed short S16;
 typedef unsigned short U16;
+#ifdef _WIN32
 typedef signed long S32;
 typedef unsigned long U32;
+#else
+typedef int32_t S32; // long is 64-bit on other systems
+typedef uint32_t U32;
+#endif
 typedef LONG64 S64;
 typedef ULONG64 U64;
 
+// The size modifiers for printing S32/U32 and S64/U64, as in "%08" PRI64 "X"
+#ifdef _WIN32
+#define PRI32 "l"
+#define PRI64 "I64"
+#else
+#define PRI32 ""
+#define PRI64 "ll"
+#endif
+
 #ifdef SPEEDY
 // On Visual Studio 6, making the internal functions inline makes compiling take forever
 #define INTERNAL static _inline 
@@ -83,7 +83,7 @@
 { \
 	if (!Instruction->AnomalyOccurred && X86Instruction->HasOperandSizePrefix) \
 	{ \
-		if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Unexpected operand size prefix\n", VIRTUAL_ADDRESS); \
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Unexpected operand size prefix\n", VIRTUAL_ADDRESS); \
 		Instruction->AnomalyOccurred = TRUE; \
 		X86Instruction->HasOperandSizePrefix = FALSE; \
 		switch (X86Instruction->OperandSize) \
@@ -99,7 +99,7 @@
 { \
 	if (!Instruction->AnomalyOccurred && X86Instruction->HasAddressSizePrefix) \
 	{ \
-		if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Unexpected address size prefix\n", VIRTUAL_ADDRESS); \
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Unexpected address size prefix\n", VIRTUAL_ADDRESS); \
 		Instruction->AnomalyOccurred = TRUE; \
 	} \
 	X86Instruction->HasAddressSizePrefix = FALSE; \
@@ -114,7 +114,7 @@
 #define SANITY_CHECK_SEGMENT_OVERRIDE() \
 	if (!Instruction->AnomalyOccurred && X86Instruction->HasSegmentOverridePrefix) \
 	{ \
-		if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Unexpected segment override\n", VIRTUAL_ADDRESS); \
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Unexpected segment override\n", VIRTUAL_ADDRESS); \
 		Instruction->AnomalyOccurred = TRUE; \
 	}
 
@@ -124,13 +124,25 @@
 	Address += size; \
 }
 
+// Fails the instruction if it would get longer than an instruction can be
+// by reading another size bytes: nothing past X86_MAX_INSTRUCTION_LEN bytes
+// is ever read, so the code may end anywhere after that
+#define X86_CHECK_LENGTH(size, failure) \
+{ \
+	if (Instruction->Length + (size) > X86_MAX_INSTRUCTION_LEN) \
+	{ \
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: maximum instruction length reached\n", VIRTUAL_ADDRESS); \
+		failure; \
+	} \
+}
+
 #define X86_SET_TARGET() \
 { \
 	if (X86Instruction->HasSelector) \
 	{ \
 		if (!Instruction->AnomalyOccurred) \
 		{ \
-			if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: unexpected segment 0x%02X\n", VIRTUAL_ADDRESS, X86Instruction->Selector); \
+			if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: unexpected segment 0x%02X\n", VIRTUAL_ADDRESS, X86Instruction->Selector); \
 			Instruction->AnomalyOccurred = TRUE; \
 		} \
 	} \
@@ -635,16 +647,16 @@ BOOL X86_InitInstruction(INSTRUCTION *Instruction)
 	switch (Operand->Length) \
 	{ \
 		case 8: \
-			APPEND(OPCSTR, SIZE_LEFT, "0x%02I64X=", Operand->Value_U64); \
-			if (Operand->Value_S64 >= 0 || !(Operand->Flags & OP_SIGNED)) APPEND(OPCSTR, SIZE_LEFT, "%I64u", Operand->Value_U64); \
-			/*else APPEND(OPCSTR, SIZE_LEFT, "-0x%02I64X=%I64d", -Operand->Value_S64, Operand->Value_S64);*/ \
-			else APPEND(OPCSTR, SIZE_LEFT, "%I64d", Operand->Value_S64); \
+			APPEND(OPCSTR, SIZE_LEFT, "0x%02" PRI64 "X=", Operand->Value_U64); \
+			if (Operand->Value_S64 >= 0 || !(Operand->Flags & OP_SIGNED)) APPEND(OPCSTR, SIZE_LEFT, "%" PRI64 "u", Operand->Value_U64); \
+			/*else APPEND(OPCSTR, SIZE_LEFT, "-0x%02" PRI64 "X=%" PRI64 "d", -Operand->Value_S64, Operand->Value_S64);*/ \
+			else APPEND(OPCSTR, SIZE_LEFT, "%" PRI64 "d", Operand->Value_S64); \
 			break; \
 		case 4: \
-			APPEND(OPCSTR, SIZE_LEFT, "0x%02lX=", (U32)Operand->Value_U64); \
-			if (Operand->Value_S64 >= 0 || !(Operand->Flags & OP_SIGNED)) APPEND(OPCSTR, SIZE_LEFT, "%lu", (U32)Operand->Value_U64); \
-			/*else APPEND(OPCSTR, SIZE_LEFT, "-0x%02lX=%ld", (U32)-Operand->Value_S64, (S32)Operand->Value_S64);*/ \
-			else APPEND(OPCSTR, SIZE_LEFT, "%ld", (S32)Operand->Value_S64); \
+			APPEND(OPCSTR, SIZE_LEFT, "0x%02" PRI32 "X=", (U32)Operand->Value_U64); \
+			if (Operand->Value_S64 >= 0 || !(Operand->Flags & OP_SIGNED)) APPEND(OPCSTR, SIZE_LEFT, "%" PRI32 "u", (U32)Operand->Value_U64); \
+			/*else APPEND(OPCSTR, SIZE_LEFT, "-0x%02" PRI32 "X=%" PRI32 "d", (U32)-Operand->Value_S64, (S32)Operand->Value_S64);*/ \
+			else APPEND(OPCSTR, SIZE_LEFT, "%" PRI32 "d", (S32)Operand->Value_S64); \
 			break; \
 		case 2: \
 			APPEND(OPCSTR, SIZE_LEFT, "0x%02X=", (U16)Operand->Value_U64); \
@@ -667,10 +679,10 @@ BOOL X86_InitInstruction(INSTRUCTION *Instruction)
 	switch (X86Instruction->AddressSize) \
 	{ \
 		case 8: \
-			APPEND(OPCSTR, SIZE_LEFT, "0x%04I64X", X86Instruction->Displacement); \
+			APPEND(OPCSTR, SIZE_LEFT, "0x%04" PRI64 "X", X86Instruction->Displacement); \
 			break; \
 		case 4: \
-			APPEND(OPCSTR, SIZE_LEFT, "0x%04lX", (U32)X86Instruction->Displacement); \
+			APPEND(OPCSTR, SIZE_LEFT, "0x%04" PRI32 "X", (U32)X86Instruction->Displacement); \
 			break; \
 		case 2: \
 			APPEND(OPCSTR, SIZE_LEFT, "0x%04X", (U16)X86Instruction->Displacement); \
@@ -680,12 +692,12 @@ BOOL X86_InitInstruction(INSTRUCTION *Instruction)
 }
 
 #define X86_WRITE_RELATIVE_DISPLACEMENT64() \
-	if (X86Instruction->Displacement >= 0) APPEND(OPCSTR, SIZE_LEFT, "+0x%02I64X", X86Instruction->Displacement); \
-	else APPEND(OPCSTR, SIZE_LEFT, "-0x%02I64X", -X86Instruction->Displacement);
+	if (X86Instruction->Displacement >= 0) APPEND(OPCSTR, SIZE_LEFT, "+0x%02" PRI64 "X", X86Instruction->Displacement); \
+	else APPEND(OPCSTR, SIZE_LEFT, "-0x%02" PRI64 "X", -X86Instruction->Displacement);
 
 #define X86_WRITE_RELATIVE_DISPLACEMENT32() \
-	if (X86Instruction->Displacement >= 0) APPEND(OPCSTR, SIZE_LEFT, "+0x%02lX", (U32)X86Instruction->Displacement); \
-	else APPEND(OPCSTR, SIZE_LEFT, "-0x%02lX", (U32)-X86Instruction->Displacement);
+	if (X86Instruction->Displacement >= 0) APPEND(OPCSTR, SIZE_LEFT, "+0x%02" PRI32 "X", (U32)X86Instruction->Displacement); \
+	else APPEND(OPCSTR, SIZE_LEFT, "-0x%02" PRI32 "X", (U32)-X86Instruction->Displacement);
 
 #define X86_WRITE_RELATIVE_DISPLACEMENT16() \
 	if (X86Instruction->Displacement >= 0) APPEND(OPCSTR, SIZE_LEFT, "+0x%02X", (U16)X86Instruction->Displacement); \
@@ -716,13 +728,13 @@ BOOL X86_InitInstruction(INSTRUCTION *Instruction)
 			APPENDS("[rip+ilen"); \
 			assert((op)->TargetAddress); \
 			X86_WRITE_RELATIVE_DISPLACEMENT64() \
-			APPEND(OPCSTR, SIZE_LEFT, "]=0x%04I64X", (op)->TargetAddress+Instruction->VirtualAddressDelta); \
+			APPEND(OPCSTR, SIZE_LEFT, "]=0x%04" PRI64 "X", (op)->TargetAddress+Instruction->VirtualAddressDelta); \
 			break; \
 		case 4: \
 			APPENDS("[eip+ilen"); \
 			assert((op)->TargetAddress); \
 			X86_WRITE_RELATIVE_DISPLACEMENT32() \
-			APPEND(OPCSTR, SIZE_LEFT, "]=0x%04lX", (U32)((op)->TargetAddress+Instruction->VirtualAddressDelta)); \
+			APPEND(OPCSTR, SIZE_LEFT, "]=0x%04" PRI32 "X", (U32)((op)->TargetAddress+Instruction->VirtualAddressDelta)); \
 			break; \
 		case 2: \
 			APPENDS("[ip+ilen"); \
@@ -787,7 +799,7 @@ void OutputAddress(INSTRUCTION *Instruction, INSTRUCTION_OPERAND *Operand, U32 O
 			U64 Address = Operand->TargetAddress;
 			assert(Address);
 			APPLY_OFFSET(Address)
-			APPEND(OPCSTR, SIZE_LEFT, "=[0x%04I64X]", Address);
+			APPEND(OPCSTR, SIZE_LEFT, "=[0x%04" PRI64 "X]", Address);
 		}
 	}
 	else if (X86Instruction->HasIndexRegister)
@@ -1004,16 +1016,17 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 	//
 	while (TRUE)
 	{
+		X86_CHECK_LENGTH(1, goto abort)
 		Opcode = *Address;
 		INSTR_INC(1); // increment Instruction->Length and address
 		X86Opcode = &X86_Opcodes_1[Opcode];
 
 		// Handle a misplaced REX prefix -- AMD64 manual says it is just ignored
-		if (IS_AMD64() && (Opcode >= REX_PREFIX_START && Opcode <= REX_PREFIX_END) && X86_PREFIX((&X86_Opcodes_1[*Address])))
+		if (IS_AMD64() && (Opcode >= REX_PREFIX_START && Opcode <= REX_PREFIX_END) && Instruction->Length < X86_MAX_INSTRUCTION_LEN && X86_PREFIX((&X86_Opcodes_1[*Address])))
 		{
 			if (!Instruction->AnomalyOccurred)
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: REX prefix before legacy prefix 0x%02X\n", VIRTUAL_ADDRESS, Opcode);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: REX prefix before legacy prefix 0x%02X\n", VIRTUAL_ADDRESS, Opcode);
 				Instruction->AnomalyOccurred = TRUE;
 			}
 			continue;
@@ -1027,7 +1040,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				{
 					if (Instruction->Prefixes[i] == Opcode)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Duplicate prefix 0x%02X\n", VIRTUAL_ADDRESS, Opcode);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Duplicate prefix 0x%02X\n", VIRTUAL_ADDRESS, Opcode);
 						Instruction->AnomalyOccurred = TRUE;
 						break;
 					}
@@ -1040,7 +1053,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 					SSE_Prefix = Opcode;
 					if (!Instruction->AnomalyOccurred && X86Instruction->HasRepeatWhileEqualPrefix)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					Instruction->Repeat = TRUE;
@@ -1051,7 +1064,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 					SSE_Prefix = Opcode;
 					if (!Instruction->AnomalyOccurred && X86Instruction->HasRepeatWhileNotEqualPrefix)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 
@@ -1064,7 +1077,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 					SSE_Prefix = Opcode;
 					if (!Instruction->AnomalyOccurred && X86Instruction->HasOperandSizePrefix)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					
@@ -1081,7 +1094,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				case PREFIX_ADDRESS_SIZE:
 					if (!Instruction->AnomalyOccurred && X86Instruction->HasAddressSizePrefix)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 
@@ -1113,7 +1126,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 					}
 					else if (!Instruction->AnomalyOccurred)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Meaningless segment override\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Meaningless segment override\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					break;
@@ -1126,7 +1139,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 					}
 					else if (!Instruction->AnomalyOccurred)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Meaningless segment override\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Meaningless segment override\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					break;
@@ -1139,7 +1152,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 					}
 					else if (!Instruction->AnomalyOccurred)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Meaningless segment override\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Meaningless segment override\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					break;
@@ -1152,7 +1165,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 					}
 					else if (!Instruction->AnomalyOccurred)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Meaningless segment override\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Meaningless segment override\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					break;
@@ -1170,7 +1183,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				case PREFIX_LOCK:
 					if (!Instruction->AnomalyOccurred && X86Instruction->HasLockPrefix)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Conflicting prefix\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					X86Instruction->HasLockPrefix = TRUE;
@@ -1183,19 +1196,19 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 
 			if (Instruction->PrefixCount >= X86_MAX_INSTRUCTION_LEN)
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Reached maximum prefix count %d\n", VIRTUAL_ADDRESS, X86_MAX_PREFIX_LENGTH);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Reached maximum prefix count %d\n", VIRTUAL_ADDRESS, X86_MAX_PREFIX_LENGTH);
 				goto abort;
 			}
 			else if (Instruction->PrefixCount == X86_MAX_PREFIX_LENGTH)
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Reached maximum prefix count %d\n", VIRTUAL_ADDRESS, X86_MAX_PREFIX_LENGTH);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Reached maximum prefix count %d\n", VIRTUAL_ADDRESS, X86_MAX_PREFIX_LENGTH);
 				Instruction->AnomalyOccurred = TRUE;
 			}
 
 			assert(Instruction->AnomalyOccurred || Instruction->PrefixCount < X86_MAX_PREFIX_LENGTH);
 			Instruction->Prefixes[Instruction->PrefixCount] = Opcode;
 			Instruction->PrefixCount++;
-			//DISASM_OUTPUT(("[0x%08I64X] Prefix 0x%02X (prefix count %d)\n", VIRTUAL_ADDRESS, Opcode, Instruction->PrefixCount));
+			//DISASM_OUTPUT(("[0x%08" PRI64 "X] Prefix 0x%02X (prefix count %d)\n", VIRTUAL_ADDRESS, Opcode, Instruction->PrefixCount));
 		}
 		else
 		{
@@ -1210,12 +1223,12 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 	{
 		if (Instruction->PrefixCount >= X86_MAX_INSTRUCTION_LEN)
 		{
-			if (!SuppressErrors) printf("[0x%08I64X] ERROR: Reached maximum prefix count %d\n", VIRTUAL_ADDRESS, X86_MAX_PREFIX_LENGTH);
+			if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Reached maximum prefix count %d\n", VIRTUAL_ADDRESS, X86_MAX_PREFIX_LENGTH);
 			goto abort;
 		}
 		else if (!Instruction->AnomalyOccurred && Instruction->PrefixCount == AMD64_MAX_PREFIX_LENGTH)
 		{
-			if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Reached maximum prefix count %d\n", VIRTUAL_ADDRESS, X86_MAX_PREFIX_LENGTH);
+			if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Reached maximum prefix count %d\n", VIRTUAL_ADDRESS, X86_MAX_PREFIX_LENGTH);
 			Instruction->AnomalyOccurred = TRUE;
 		}
 
@@ -1225,7 +1238,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 		Instruction->PrefixCount++;
 		X86Instruction->rex_b = Opcode;
 		SET_REX(X86Instruction->rex, X86Instruction->rex_b);
-		DISASM_OUTPUT(("[0x%08I64X] REX prefix 0x%02X (prefix count %d, w=%d, r=%d, x=%d, b=%d)\n", VIRTUAL_ADDRESS, Opcode, Instruction->PrefixCount, X86Instruction->rex.w, X86Instruction->rex.r, X86Instruction->rex.x, X86Instruction->rex.b));
+		DISASM_OUTPUT(("[0x%08" PRI64 "X] REX prefix 0x%02X (prefix count %d, w=%d, r=%d, x=%d, b=%d)\n", VIRTUAL_ADDRESS, Opcode, Instruction->PrefixCount, X86Instruction->rex.w, X86Instruction->rex.r, X86Instruction->rex.x, X86Instruction->rex.b));
 
 		assert(X86Instruction->AddressSize >= 4);
 		if (X86Instruction->rex.w)
@@ -1241,25 +1254,26 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 		{
 			if (!Instruction->AnomalyOccurred)
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: meaningless REX prefix used\n", VIRTUAL_ADDRESS);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: meaningless REX prefix used\n", VIRTUAL_ADDRESS);
 				Instruction->AnomalyOccurred = TRUE;
 			}
 			X86Instruction->rex_b = 0;
 		}
 
+		X86_CHECK_LENGTH(1, goto abort)
 		Opcode = *Address;
 		INSTR_INC(1); // increment Instruction->Length and address
 
 		X86Opcode = &X86_Opcodes_1[Opcode];
 		assert(!X86_PREFIX(X86Opcode));
 	}
-	//DISASM_OUTPUT(("[0x%08I64X] OperandSize = %d, AddressSize = %d\n", VIRTUAL_ADDRESS, X86Instruction->OperandSize, X86Instruction->AddressSize));
+	//DISASM_OUTPUT(("[0x%08" PRI64 "X] OperandSize = %d, AddressSize = %d\n", VIRTUAL_ADDRESS, X86Instruction->OperandSize, X86Instruction->AddressSize));
 	Instruction->LastOpcode = Opcode;
 	Instruction->OpcodeAddress = Address-1;
 
 	if (X86_INVALID(X86Opcode))
 	{
-		if (!SuppressErrors) printf("[0x%08I64X] ERROR: Invalid opcode 0x%02X\n", VIRTUAL_ADDRESS, Opcode);
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Invalid opcode 0x%02X\n", VIRTUAL_ADDRESS, Opcode);
 		goto abort;
 	}
 
@@ -1269,6 +1283,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 		// Handle case that it is a group (with opcode extension), floating point, or two byte opcode
 		//
 		assert(!Instruction->OpcodeLength);
+		X86_CHECK_LENGTH(1, goto abort)
 		Instruction->LastOpcode = Opcode = *Address;
 		INSTR_INC(1); // increment Instruction->Length and address
 		assert(X86Opcode->Table == X86_Opcodes_2);
@@ -1279,7 +1294,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 		//
 		if (X86_INVALID(X86Opcode))
 		{
-			if (!SuppressErrors) printf("[0x%08I64X] ERROR: Invalid two byte opcode 0x%02X 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode);
+			if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Invalid two byte opcode 0x%02X 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode);
 			goto abort;
 		}
 		
@@ -1287,7 +1302,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 		{
 			if (X86_Invalid_Addr64_2[Opcode])
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Opcode 0x%02X 0x%02X (\"%s\") illegal in 64-bit mode\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, X86Opcode->Mnemonic);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Opcode 0x%02X 0x%02X (\"%s\") illegal in 64-bit mode\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, X86Opcode->Mnemonic);
 				goto abort;
 			}
 #if 0
@@ -1297,7 +1312,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 					 GET_REX_R(X86Instruction->rex_b) && !GET_REX_R(X86_REX_2[Opcode]) ||
 					 GET_REX_W(X86Instruction->rex_b) && !GET_REX_W(X86_REX_2[Opcode])))
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Illegal REX prefix 0x%02X for opcode 0x%02X 0x%02X\n", VIRTUAL_ADDRESS, X86Instruction->rex_b, X86_TWO_BYTE_OPCODE, Opcode);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Illegal REX prefix 0x%02X for opcode 0x%02X 0x%02X\n", VIRTUAL_ADDRESS, X86Instruction->rex_b, X86_TWO_BYTE_OPCODE, Opcode);
 				assert(0);
 				goto abort;
 			}
@@ -1306,19 +1321,23 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 
 		if (X86Instruction->OperandSize == 2 && X86_Invalid_Op16_2[Opcode])
 		{
-			if (!SuppressErrors) printf("[0x%08I64X] ERROR: Opcode 0x%02X 0x%02X (\"%s\") illegal with 16-bit operand size\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, X86Opcode->Mnemonic);
+			if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Opcode 0x%02X 0x%02X (\"%s\") illegal with 16-bit operand size\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, X86Opcode->Mnemonic);
 			goto abort;
 		}
 
 		X86Instruction->HasModRM = X86_ModRM_2[Opcode];
-		if (X86Instruction->HasModRM) X86Instruction->modrm_b = *Address;
+		if (X86Instruction->HasModRM)
+		{
+			X86_CHECK_LENGTH(1, goto abort)
+			X86Instruction->modrm_b = *Address;
+		}
 		Instruction->OpcodeBytes[0] = X86_TWO_BYTE_OPCODE;
 		Instruction->OpcodeBytes[1] = Opcode;
 		Instruction->OpcodeLength = 2;
 
 		if (X86_SPECIAL_EXTENSION(X86Opcode))
 		{
-			DISASM_OUTPUT(("[0x%08I64X] Special opcode extension 0x%02X 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode));
+			DISASM_OUTPUT(("[0x%08" PRI64 "X] Special opcode extension 0x%02X 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode));
 			SpecialExtension = TRUE;
 			goto HasSpecialExtension;
 		}
@@ -1353,7 +1372,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 
 			if (IS_X86_16())
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: SSE invalid in 16-bit mode\n", VIRTUAL_ADDRESS);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: SSE invalid in 16-bit mode\n", VIRTUAL_ADDRESS);
 				goto abort;
 			}
 		
@@ -1367,7 +1386,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 
 			if (X86_INVALID(X86Opcode))
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Illegal SSE instruction opcode 0x%02X 0x%02X + prefix 0x%02X\n", VIRTUAL_ADDRESS, Instruction->OpcodeBytes[0], Instruction->OpcodeBytes[1], Instruction->OpcodeBytes[2]);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Illegal SSE instruction opcode 0x%02X 0x%02X + prefix 0x%02X\n", VIRTUAL_ADDRESS, Instruction->OpcodeBytes[0], Instruction->OpcodeBytes[1], Instruction->OpcodeBytes[2]);
 				goto abort;
 			}
 			else if (X86_EXTENDED_OPCODE(X86Opcode))
@@ -1386,7 +1405,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 
 				if (X86_INVALID(X86Opcode))
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: Illegal SSE instruction opcode 0x%02X 0x%02X + prefix 0x%02X + extension %d\n", VIRTUAL_ADDRESS, Instruction->OpcodeBytes[0], Instruction->OpcodeBytes[1], Instruction->OpcodeBytes[2], OpcodeExtension);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Illegal SSE instruction opcode 0x%02X 0x%02X + prefix 0x%02X + extension %d\n", VIRTUAL_ADDRESS, Instruction->OpcodeBytes[0], Instruction->OpcodeBytes[1], Instruction->OpcodeBytes[2], OpcodeExtension);
 					goto abort;
 				}
 			}
@@ -1411,7 +1430,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 			if (X86_INVALID(X86Opcode))
 			{
 				Instruction->Length++;
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Invalid group opcode 0x%02X 0x%02X extension 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, OpcodeExtension);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Invalid group opcode 0x%02X 0x%02X extension 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, OpcodeExtension);
 				goto abort;
 			}
 
@@ -1420,14 +1439,18 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 			X86Instruction->Group = (U8)Group;
 			assert(Group > 0 && Group <= 19);
 			assert(X86Opcode->Mnemonic);
-			DISASM_OUTPUT(("[0x%08I64X] Group %d (bytes 0x%02X 0x%02X) extension 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, Group, X86_TWO_BYTE_OPCODE, Opcode, OpcodeExtension, X86Opcode->Mnemonic));
+			DISASM_OUTPUT(("[0x%08" PRI64 "X] Group %d (bytes 0x%02X 0x%02X) extension 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, Group, X86_TWO_BYTE_OPCODE, Opcode, OpcodeExtension, X86Opcode->Mnemonic));
 		}
 		else
 		{
 			assert(X86Opcode->Mnemonic);
-			DISASM_OUTPUT(("[0x%08I64X] Two byte opcode 0x%02X 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, X86Opcode->Mnemonic));
+			DISASM_OUTPUT(("[0x%08" PRI64 "X] Two byte opcode 0x%02X 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, X86Opcode->Mnemonic));
 			X86Instruction->HasModRM = X86_ModRM_2[Opcode];
-			if (X86Instruction->HasModRM) X86Instruction->modrm_b = *Address;
+			if (X86Instruction->HasModRM)
+			{
+				X86_CHECK_LENGTH(1, goto abort)
+				X86Instruction->modrm_b = *Address;
+			}
 		}
 	}
 	else // 1-byte opcode
@@ -1436,7 +1459,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 		{
 			if (X86_Invalid_Addr64_1[Opcode])
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Opcode 0x%02X (\"%s\") illegal in 64-bit mode\n", VIRTUAL_ADDRESS, Opcode, X86Opcode->Mnemonic);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Opcode 0x%02X (\"%s\") illegal in 64-bit mode\n", VIRTUAL_ADDRESS, Opcode, X86Opcode->Mnemonic);
 				goto abort;
 			}
 
@@ -1447,7 +1470,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				 GET_REX_R(X86Instruction->rex_b) && !GET_REX_R(X86_REX_1[Opcode]) ||
 				 GET_REX_W(X86Instruction->rex_b) && !GET_REX_W(X86_REX_1[Opcode])))
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Illegal REX prefix 0x%02X for opcode 0x%02X\n", VIRTUAL_ADDRESS, X86Instruction->rex_b, Opcode);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Illegal REX prefix 0x%02X for opcode 0x%02X\n", VIRTUAL_ADDRESS, X86Instruction->rex_b, Opcode);
 				assert(0);
 				goto abort;
 			}
@@ -1456,14 +1479,18 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 
 		if (X86Instruction->OperandSize == 2 && X86_Invalid_Op16_1[Opcode])
 		{
-			if (!SuppressErrors) printf("[0x%08I64X] ERROR: Opcode 0x%02X (\"%s\") illegal with 16-bit operand size\n", VIRTUAL_ADDRESS, Opcode, X86Opcode->Mnemonic);
+			if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Opcode 0x%02X (\"%s\") illegal with 16-bit operand size\n", VIRTUAL_ADDRESS, Opcode, X86Opcode->Mnemonic);
 			goto abort;
 		}
 
 		Instruction->OpcodeBytes[0] = Opcode;
 		Instruction->OpcodeLength = 1;
 		X86Instruction->HasModRM = X86_ModRM_1[Opcode];
-		if (X86Instruction->HasModRM) X86Instruction->modrm_b = *Address;
+		if (X86Instruction->HasModRM)
+		{
+			X86_CHECK_LENGTH(1, goto abort)
+			X86Instruction->modrm_b = *Address;
+		}
 
 		if (X86_EXTENDED_OPCODE(X86Opcode)) // a group
 		{
@@ -1472,7 +1499,7 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 
 			if (X86_SPECIAL_EXTENSION(X86Opcode))
 			{
-				DISASM_OUTPUT(("[0x%08I64X] Special opcode extension 0x%02X 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode));
+				DISASM_OUTPUT(("[0x%08" PRI64 "X] Special opcode extension 0x%02X 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode));
 				SpecialExtension = TRUE;
 				goto HasSpecialExtension;
 			}
@@ -1482,13 +1509,13 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 			if (X86_INVALID(X86Opcode))
 			{
 				Instruction->Length++;
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Invalid group opcode 0x%02X extension 0x%02X\n", VIRTUAL_ADDRESS, Opcode, OpcodeExtension);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Invalid group opcode 0x%02X extension 0x%02X\n", VIRTUAL_ADDRESS, Opcode, OpcodeExtension);
 				goto abort;
 			}
 
 			Group = X86_Groups_1[Opcode];
 			X86Instruction->Group = (U8)Group;
-			DISASM_OUTPUT(("[0x%08I64X] Group %d (byte 0x%02X) extension 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, Group, Opcode, OpcodeExtension, X86Opcode->Mnemonic));
+			DISASM_OUTPUT(("[0x%08" PRI64 "X] Group %d (byte 0x%02X) extension 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, Group, Opcode, OpcodeExtension, X86Opcode->Mnemonic));
 			assert(Group > 0 && Group <= 17);
 			assert(X86Opcode->Mnemonic);
 		}
@@ -1496,12 +1523,12 @@ BOOL X86_GetInstruction(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 		{
 			if (X86_SPECIAL_EXTENSION(X86Opcode))
 			{
-				DISASM_OUTPUT(("[0x%08I64X] Special opcode extension 0x%02X\n", VIRTUAL_ADDRESS, Opcode));
+				DISASM_OUTPUT(("[0x%08" PRI64 "X] Special opcode extension 0x%02X\n", VIRTUAL_ADDRESS, Opcode));
 				SpecialExtension = TRUE;
 				goto HasSpecialExtension;
 			}
 
-			DISASM_OUTPUT(("[0x%08I64X] One byte opcode 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, Opcode, X86Opcode->Mnemonic));
+			DISASM_OUTPUT(("[0x%08" PRI64 "X] One byte opcode 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, Opcode, X86Opcode->Mnemonic));
 		}
 	}
 
@@ -1516,7 +1543,7 @@ HasSpecialExtension:
 			X86Opcode = &X86Opcode->Table[*Address];
 			if (X86_INVALID(X86Opcode))
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Illegal opcode 0x%02X 0x%02X + modrm 0x%02X\n", VIRTUAL_ADDRESS, Instruction->OpcodeBytes[0], Instruction->OpcodeBytes[1], *Address);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Illegal opcode 0x%02X 0x%02X + modrm 0x%02X\n", VIRTUAL_ADDRESS, Instruction->OpcodeBytes[0], Instruction->OpcodeBytes[1], *Address);
 				goto abort;
 			}
 			else if (X86_EXTENDED_OPCODE(X86Opcode))
@@ -1529,7 +1556,7 @@ HasSpecialExtension:
 				if (X86_INVALID(X86Opcode))
 				{
 					Instruction->Length++;
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: Invalid group opcode 0x%02X 0x%02X extension 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, OpcodeExtension);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Invalid group opcode 0x%02X 0x%02X extension 0x%02X\n", VIRTUAL_ADDRESS, X86_TWO_BYTE_OPCODE, Opcode, OpcodeExtension);
 					goto abort;
 				}
 
@@ -1538,7 +1565,7 @@ HasSpecialExtension:
 				X86Instruction->Group = (U8)Group;
 				assert(Group > 0 && Group <= 19);
 				assert(X86Opcode->Mnemonic);
-				DISASM_OUTPUT(("[0x%08I64X] Group %d (bytes 0x%02X 0x%02X) extension 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, Group, X86_TWO_BYTE_OPCODE, Opcode, OpcodeExtension, X86Opcode->Mnemonic));
+				DISASM_OUTPUT(("[0x%08" PRI64 "X] Group %d (bytes 0x%02X 0x%02X) extension 0x%02X (\"%s\")\n", VIRTUAL_ADDRESS, Group, X86_TWO_BYTE_OPCODE, Opcode, OpcodeExtension, X86Opcode->Mnemonic));
 			}
 			else if (!X86_OPERAND_COUNT(X86Opcode))
 			{
@@ -1563,11 +1590,11 @@ HasSpecialExtension:
 
 			if (X86_INVALID(X86Opcode))
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Invalid FPU opcode 0x%02X + modrm extension 0x%02X (index 0x%02X)\n", VIRTUAL_ADDRESS, Opcode, X86Instruction->modrm_b, 0x08 + OpcodeExtension);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Invalid FPU opcode 0x%02X + modrm extension 0x%02X (index 0x%02X)\n", VIRTUAL_ADDRESS, Opcode, X86Instruction->modrm_b, 0x08 + OpcodeExtension);
 				goto abort;
 			}
 
-			DISASM_OUTPUT(("[0x%08I64X] FPU instruction is (\"%s\"): 0x%02X + modrm 0x%02X (index 0x%02X)\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic, Opcode, X86Instruction->modrm_b, 0x08 + OpcodeExtension));
+			DISASM_OUTPUT(("[0x%08" PRI64 "X] FPU instruction is (\"%s\"): 0x%02X + modrm 0x%02X (index 0x%02X)\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic, Opcode, X86Instruction->modrm_b, 0x08 + OpcodeExtension));
 			if (!X86_OPERAND_COUNT(X86Opcode)) INSTR_INC(1); // increment Instruction->Length and address
 		}
 		else if (X86Opcode->MnemonicFlags & ITYPE_EXT_SUFFIX)
@@ -1576,7 +1603,7 @@ HasSpecialExtension:
 			{
 				if (!Instruction->AnomalyOccurred && X86Opcode->Table == X86_3DNOW_0F)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: operand size prefix used with 3DNOW instruction\n", VIRTUAL_ADDRESS);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: operand size prefix used with 3DNOW instruction\n", VIRTUAL_ADDRESS);
 					Instruction->AnomalyOccurred = TRUE;
 				}
 				X86Instruction->HasOperandSizePrefix = FALSE;
@@ -1590,6 +1617,7 @@ HasSpecialExtension:
 			Instruction->Operands[2].Flags = X86Opcode->OperandFlags[2] & X86_OPFLAGS_MASK;
 			assert(Address == Instruction->Address + Instruction->Length);
 			if (!SetOperands(Instruction, Address, Flags & DISASM_SUPPRESSERRORS)) goto abort;
+			X86_CHECK_LENGTH(1, goto abort)
 			Suffix = Instruction->Address[Instruction->Length++];
 			Instruction->OpcodeBytes[2] = Suffix;
 			Instruction->OpcodeLength = 3;
@@ -1597,7 +1625,7 @@ HasSpecialExtension:
 			
 			if (X86_INVALID(X86Opcode))
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ERROR: Illegal opcode 0x%02X 0x%02X + suffix 0x%02X\n", VIRTUAL_ADDRESS, Instruction->OpcodeBytes[0], Instruction->OpcodeBytes[1], Suffix);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Illegal opcode 0x%02X 0x%02X + suffix 0x%02X\n", VIRTUAL_ADDRESS, Instruction->OpcodeBytes[0], Instruction->OpcodeBytes[1], Suffix);
 				goto abort;
 			}
 			assert(Instruction->Length >= 4 + Instruction->PrefixCount);
@@ -1614,12 +1642,12 @@ HasSpecialExtension:
 	// Detect incompatibilities	
 	if (IS_X86_16() && X86Opcode->CPU > CPU_I386)
 	{
-		if (!SuppressErrors) printf("[0x%08I64X] ERROR: Instruction \"%s\" (opcode 0x%02X) can't be used in 16-bit X86\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic, Instruction->LastOpcode);
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Instruction \"%s\" (opcode 0x%02X) can't be used in 16-bit X86\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic, Instruction->LastOpcode);
 		goto abort;
 	}
 	if (!IS_AMD64() && X86Opcode->CPU >= CPU_AMD64)
 	{
-		if (!SuppressErrors) printf("[0x%08I64X] ERROR: Instruction \"%s\" (opcode 0x%02X) can only be used in X86-64\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic, Instruction->LastOpcode);
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Instruction \"%s\" (opcode 0x%02X) can only be used in X86-64\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic, Instruction->LastOpcode);
 		goto abort;
 	}
 
@@ -1671,7 +1699,7 @@ HasSpecialExtension:
 
 					if (!Instruction->AnomalyOccurred)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: operand size prefix used with FPU/MMX/SSEx\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: operand size prefix used with FPU/MMX/SSEx\n", VIRTUAL_ADDRESS);
 						goto abort;
 					}
 					X86Instruction->HasOperandSizePrefix = FALSE;
@@ -1684,7 +1712,7 @@ HasSpecialExtension:
 					// The Intel manual says this results in unpredictable behavior -- it's not even
 					// clear which SSE prefix is used as the third opcode byte in this case
 					// (e.g., is it the first or last SSE prefix?)
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: rep/repne used with MMX/SSEx\n", VIRTUAL_ADDRESS);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: rep/repne used with MMX/SSEx\n", VIRTUAL_ADDRESS);
 					goto abort;
 
 				default:
@@ -1707,7 +1735,7 @@ HasSpecialExtension:
 					X86Instruction->HasOperandSizePrefix = FALSE;
 					if (!Instruction->AnomalyOccurred)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: use of operand size prefix meaningless when REX.w=1\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: use of operand size prefix meaningless when REX.w=1\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}				
 				}
@@ -1746,7 +1774,7 @@ HasSpecialExtension:
 			{
 				if (!Instruction->AnomalyOccurred)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: use of REX.w is meaningless (default operand size is 64)\n", VIRTUAL_ADDRESS);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: use of REX.w is meaningless (default operand size is 64)\n", VIRTUAL_ADDRESS);
 					Instruction->AnomalyOccurred = TRUE;
 				}
 				X86Instruction->rex_b &= ~8;
@@ -1780,7 +1808,7 @@ HasSpecialExtension:
 				{
 					if (!Instruction->AnomalyOccurred)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: REPNE should only be used with cmps/scas\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: REPNE should only be used with cmps/scas\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					// Treat it as just a "rep"
@@ -1793,7 +1821,7 @@ HasSpecialExtension:
 			default:
 				if (!Instruction->AnomalyOccurred)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Repeat prefix used with non-string instruction\n", VIRTUAL_ADDRESS);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Repeat prefix used with non-string instruction\n", VIRTUAL_ADDRESS);
 					Instruction->AnomalyOccurred = TRUE;
 				}
 				Instruction->Repeat = FALSE;
@@ -1844,7 +1872,7 @@ HasSpecialExtension:
 		InstructionLength = X86_GetLength(Instruction, Instruction->Address);
 		if (InstructionLength && Instruction->Length != InstructionLength)
 		{
-			printf("[0x%08I64X] WARNING: instruction lengths differ (%d vs %d)\n", VIRTUAL_ADDRESS, Instruction->Length, InstructionLength);
+			printf("[0x%08" PRI64 "X] WARNING: instruction lengths differ (%d vs %d)\n", VIRTUAL_ADDRESS, Instruction->Length, InstructionLength);
 			DumpInstruction(Instruction, TRUE, TRUE);
 			assert(0);
 		}
@@ -1869,7 +1897,7 @@ HasSpecialExtension:
 		{
 			if (!Instruction->AnomalyOccurred)
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: address size prefix used with no addressing\n", VIRTUAL_ADDRESS);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: address size prefix used with no addressing\n", VIRTUAL_ADDRESS);
 				Instruction->AnomalyOccurred = TRUE;
 			}
 			X86Instruction->HasAddressSizePrefix = FALSE;
@@ -1879,7 +1907,7 @@ HasSpecialExtension:
 		{
 			if (!Instruction->AnomalyOccurred)
 			{
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: segment override used with no addressing\n", VIRTUAL_ADDRESS);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: segment override used with no addressing\n", VIRTUAL_ADDRESS);
 				Instruction->AnomalyOccurred = TRUE;
 			}
 			X86Instruction->HasSegmentOverridePrefix = FALSE;
@@ -1899,23 +1927,23 @@ HasSpecialExtension:
  					case ITYPE_IN: case ITYPE_STRMOV: case ITYPE_STRCMP: case ITYPE_STRSTOR:
 						break;
 					default:
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: use of unexpected segment ES\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: use of unexpected segment ES\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 						break;
 				}
 				break;
 			case SEG_FS:
 				if (IS_X86_32() && !(Instruction->Groups & ITYPE_EXEC)) break;
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: use of unexpected segment FS\n", VIRTUAL_ADDRESS);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: use of unexpected segment FS\n", VIRTUAL_ADDRESS);
 				Instruction->AnomalyOccurred = TRUE;
 				break;
 			case SEG_GS:
 				if (IS_AMD64() && !(Instruction->Groups & ITYPE_EXEC)) break;
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: use of unexpected segment GS\n", VIRTUAL_ADDRESS);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: use of unexpected segment GS\n", VIRTUAL_ADDRESS);
 				Instruction->AnomalyOccurred = TRUE;
 				break;
 			default:
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: unexpected segment 0x%02X\n", VIRTUAL_ADDRESS, X86Instruction->Selector);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: unexpected segment 0x%02X\n", VIRTUAL_ADDRESS, X86Instruction->Selector);
 				Instruction->AnomalyOccurred = TRUE;
 				break;
 		}
@@ -1931,7 +1959,7 @@ HasSpecialExtension:
 				case PREFIX_BRANCH_NOT_TAKEN:
 					if (!Instruction->AnomalyOccurred && X86Instruction->Segment != SEG_CS)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Segment override used with conditional branch\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Segment override used with conditional branch\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					X86Instruction->HasSegmentOverridePrefix = FALSE;
@@ -1941,7 +1969,7 @@ HasSpecialExtension:
 				case PREFIX_BRANCH_TAKEN:
 					if (!Instruction->AnomalyOccurred && X86Instruction->Segment != SEG_DS)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Segment override used with conditional branch\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Segment override used with conditional branch\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					X86Instruction->HasSegmentOverridePrefix = FALSE;
@@ -1958,7 +1986,7 @@ HasSpecialExtension:
 	if (X86Instruction->HasLockPrefix && 
 		!IsValidLockPrefix(X86Instruction, Opcode, Instruction->OpcodeLength, Group, OpcodeExtension))
 	{
-		if (!SuppressErrors) printf("[0x%08I64X] ERROR: Illegal use of lock prefix for instruction \"%s\"\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic);
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: Illegal use of lock prefix for instruction \"%s\"\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic);
 		goto abort;
 	}
 
@@ -2103,7 +2131,7 @@ HasSpecialExtension:
 
 	if (!Instruction->Length || Instruction->Length > X86_MAX_INSTRUCTION_LEN)
 	{
-		if (!SuppressErrors) printf("[0x%08I64X] ERROR: maximum instruction length reached (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
+		if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: maximum instruction length reached (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 		goto abort;
 	}
 
@@ -2132,7 +2160,7 @@ HasSpecialExtension:
 			Operand1->TargetAddress >= (U64)Instruction->Address &&
 			Operand1->TargetAddress < (U64)Instruction->Address + Instruction->Length)
 		{
-			if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: branch into the middle of an instruction\n", VIRTUAL_ADDRESS);
+			if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: branch into the middle of an instruction\n", VIRTUAL_ADDRESS);
 			Instruction->AnomalyOccurred = TRUE;
 		}
 
@@ -2202,7 +2230,7 @@ HasSpecialExtension:
 					((X86Instruction->HasBaseRegister && !X86Instruction->HasIndexRegister) ||
 					 (!X86Instruction->HasBaseRegister && X86Instruction->HasIndexRegister)))
 				{
-					//DISASM_OUTPUT(("[0x%08I64X] Scale %d, displacement 0x%08I64x\n", VIRTUAL_ADDRESS, X86Instruction->Scale, X86Instruction->Displacement));
+					//DISASM_OUTPUT(("[0x%08" PRI64 "X] Scale %d, displacement 0x%08" PRI64 "x\n", VIRTUAL_ADDRESS, X86Instruction->Scale, X86Instruction->Displacement));
 					if (!X86Instruction->Scale)
 					{
 						assert(Operand1->Length <= 0xFF);
@@ -2278,7 +2306,7 @@ HasSpecialExtension:
 					Instruction->DataDst.Addresses[0] = Operand->TargetAddress;
 					Instruction->DataDst.DataSize = Operand->Length;
 					Instruction->DataDst.Operand = Operand;
-					DISASM_OUTPUT(("[0x%08I64X] Write of size %d to 0x%04I64X\n", VIRTUAL_ADDRESS, Operand->Length, Operand->TargetAddress));
+					DISASM_OUTPUT(("[0x%08" PRI64 "X] Write of size %d to 0x%04" PRI64 "X\n", VIRTUAL_ADDRESS, Operand->Length, Operand->TargetAddress));
 				}
 				if (Operand->Flags & OP_SRC)
 				{
@@ -2287,7 +2315,7 @@ HasSpecialExtension:
 					Instruction->DataSrc.Addresses[0] = Operand->TargetAddress;
 					Instruction->DataSrc.DataSize = Operand->Length;
 					Instruction->DataSrc.Operand = Operand;
-					DISASM_OUTPUT(("[0x%08I64X] Read of size %d to 0x%04I64X\n", VIRTUAL_ADDRESS, Operand->Length, Operand->TargetAddress));
+					DISASM_OUTPUT(("[0x%08" PRI64 "X] Read of size %d to 0x%04" PRI64 "X\n", VIRTUAL_ADDRESS, Operand->Length, Operand->TargetAddress));
 				}
 			}
 
@@ -2297,7 +2325,7 @@ HasSpecialExtension:
 				((X86Instruction->HasBaseRegister && !X86Instruction->HasIndexRegister) ||
 				 (!X86Instruction->HasBaseRegister && X86Instruction->HasIndexRegister)))
 			{
-				DISASM_OUTPUT(("[0x%08I64X] Data reference (scale %d, size %d, displacement 0x%08I64x)\n", VIRTUAL_ADDRESS, X86Instruction->Scale, Operand->Length, X86Instruction->Displacement));
+				DISASM_OUTPUT(("[0x%08" PRI64 "X] Data reference (scale %d, size %d, displacement 0x%08" PRI64 "x)\n", VIRTUAL_ADDRESS, X86Instruction->Scale, Operand->Length, X86Instruction->Displacement));
 				if (!X86Instruction->Scale)
 				{
 					assert(Operand->Length <= 0xFF);
@@ -2374,12 +2402,12 @@ HasSpecialExtension:
 				{
 					if (Instruction->Operands[1].Value_U64 & 3)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: ENTER has invalid operand 2\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: ENTER has invalid operand 2\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					if (Instruction->Operands[2].Value_U64 & ~0x1F)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: ENTER has invalid operand 3\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: ENTER has invalid operand 3\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 				}
@@ -2414,7 +2442,7 @@ HasSpecialExtension:
 					case 0xC2: // ret with 1 arg
 						if (!Instruction->AnomalyOccurred && (Operand1->Value_U64 & 3))
 						{
-							if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: ret has invalid operand 1\n", VIRTUAL_ADDRESS);
+							if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: ret has invalid operand 1\n", VIRTUAL_ADDRESS);
 							Instruction->AnomalyOccurred = TRUE;
 						}
 						Instruction->StackChange += (LONG)Operand1->Value_U64;
@@ -2428,7 +2456,7 @@ HasSpecialExtension:
 					case 0xCA: // far ret with 1 arg
 						if (!Instruction->AnomalyOccurred && (Operand1->Value_U64 & 3))
 						{
-							if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: retf has invalid operand 1\n", VIRTUAL_ADDRESS);
+							if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: retf has invalid operand 1\n", VIRTUAL_ADDRESS);
 							Instruction->AnomalyOccurred = TRUE;
 						}
 						Instruction->StackChange *= 2; // account for segment
@@ -2452,7 +2480,7 @@ HasSpecialExtension:
 			default:
 				if (!Instruction->AnomalyOccurred)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Instruction \"%s\" is modifying the stack\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Instruction \"%s\" is modifying the stack\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic);
 					Instruction->AnomalyOccurred = TRUE;
 				}
 				break;
@@ -2461,7 +2489,7 @@ HasSpecialExtension:
 		if (!Instruction->AnomalyOccurred &&
 			((X86Instruction->OperandSize != 2 && (Instruction->StackChange & 3)) || (Instruction->StackChange & 1)))
 		{
-			if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: \"%s\" has invalid stack change 0x%02X\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic, Instruction->StackChange);
+			if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: \"%s\" has invalid stack change 0x%02X\n", VIRTUAL_ADDRESS, X86Opcode->Mnemonic, Instruction->StackChange);
 			Instruction->AnomalyOccurred = TRUE;
 		}
 	}
@@ -2512,7 +2540,7 @@ abort:
 	if (!SuppressErrors)
 	{
 #ifdef TEST_DISASM
-		printf("Dump of 0x%04I64X:\n", VIRTUAL_ADDRESS);
+		printf("Dump of 0x%04" PRI64 "X:\n", VIRTUAL_ADDRESS);
 		__try { DumpAsBytes(stdout, Instruction->Address, (ULONG_PTR)VIRTUAL_ADDRESS, 16, TRUE); }
 		__except (GetExceptionCode() == EXCEPTION_ACCESS_VIOLATION ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {}
 #endif
@@ -2554,7 +2582,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 		rex = X86Instruction->rex;
 		SET_REX_MODRM(X86Instruction->rex_modrm, rex, modrm);
 		rex_modrm = X86Instruction->rex_modrm;
-		//DISASM_OUTPUT(("[0x%08I64X] ModRM = 0x%02X (mod=%d, reg=%d, rm=%d)\n", VIRTUAL_ADDRESS, X86Instruction->modrm_b, modrm.mod, rex_modrm.reg, rex_modrm.rm));
+		//DISASM_OUTPUT(("[0x%08" PRI64 "X] ModRM = 0x%02X (mod=%d, reg=%d, rm=%d)\n", VIRTUAL_ADDRESS, X86Instruction->modrm_b, modrm.mod, rex_modrm.reg, rex_modrm.rm));
 		INSTR_INC(1); // increment Instruction->Length and address
 	}
 	else
@@ -3257,7 +3285,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				break;
 
 			case OPTYPE_cpu:
-				if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Undocumented loadall instruction?\n", VIRTUAL_ADDRESS);
+				if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Undocumented loadall instruction?\n", VIRTUAL_ADDRESS);
 				Instruction->AnomalyOccurred = TRUE;
 				Operand->Length = 204;
 				//DISASM_OUTPUT(("[SetOperand] OPTYPE_cpu (size 204)\n"));
@@ -3296,7 +3324,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 			case OPTYPE_p: // 32-bit or 48-bit pointer depending on operand size
 				if (!Instruction->AnomalyOccurred && X86Instruction->HasSegmentOverridePrefix)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Segment override used when segment is explicit\n", VIRTUAL_ADDRESS);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Segment override used when segment is explicit\n", VIRTUAL_ADDRESS);
 					Instruction->AnomalyOccurred = TRUE;
 				}
 				switch (X86Instruction->OperandSize)
@@ -3465,6 +3493,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				if (Decode)
 				{
 					Operand->Type = OPTYPE_IMM;
+					X86_CHECK_LENGTH(Operand->Length, return NULL)
 					switch (Operand->Length)
 					{
 						case 8:
@@ -3543,6 +3572,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 						case 2: Operand->Register = X86_REG_IP; break;
 						default: assert(0); return NULL;
 					}
+					X86_CHECK_LENGTH(Operand->Length, return NULL)
 					switch (Operand->Length)
 					{
 						case 8: X86Instruction->Displacement = *((S64 *)Address); break;
@@ -3557,7 +3587,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 
 					if ((Operand->Flags & OP_COND) && !X86Instruction->Displacement)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: Both conditions of branch go to same address\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: Both conditions of branch go to same address\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 				}
@@ -3587,6 +3617,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				Operand->Type = OPTYPE_OFFSET;
 				Operand->Flags |= OP_ADDRESS;
 				SANITY_CHECK_OPERAND_SIZE();
+				X86_CHECK_LENGTH(X86Instruction->AddressSize, return NULL)
 				switch (X86Instruction->AddressSize)
 				{
 					case 8:
@@ -3627,6 +3658,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				SANITY_CHECK_SEGMENT_OVERRIDE();
 				X86Instruction->HasSelector = TRUE;
 				X86Instruction->HasSegmentOverridePrefix = FALSE;
+				X86_CHECK_LENGTH(Operand->Length, return NULL)
 				switch (Operand->Length)
 				{
 					case 6:
@@ -3698,7 +3730,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				{
 					if (!Instruction->AnomalyOccurred)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ANOMALY: segment override used with AMODE_Y\n", VIRTUAL_ADDRESS);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ANOMALY: segment override used with AMODE_Y\n", VIRTUAL_ADDRESS);
 						Instruction->AnomalyOccurred = TRUE;
 					}
 					Segment = X86Instruction->DstSegment = SEG_ES;
@@ -3727,17 +3759,17 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				assert(X86Instruction->HasModRM);
 				if (modrm.mod != 3)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: mod != 3 for AMODE_PR (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: mod != 3 for AMODE_PR (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				else if (rex_modrm.rm > 7)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: invalid mmx register %d for AMODE_PR (\"%s\")\n", VIRTUAL_ADDRESS, rex_modrm.rm, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: invalid mmx register %d for AMODE_PR (\"%s\")\n", VIRTUAL_ADDRESS, rex_modrm.rm, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				else if (X86Instruction->OperandSize == 2)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: AMODE_PR illegal in 16-bit mode (\"%s\")\n", VIRTUAL_ADDRESS, rex_modrm.rm, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: AMODE_PR illegal in 16-bit mode (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				if (!Decode) continue;
@@ -3759,12 +3791,12 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				assert(X86Instruction->HasModRM);
 				if (modrm.mod != 3)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: mod != 3 for AMODE_VR (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: mod != 3 for AMODE_VR (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				else if (X86Instruction->OperandSize == 2)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: AMODE_VR illegal in 16-bit mode (\"%s\")\n", VIRTUAL_ADDRESS, rex_modrm.rm, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: AMODE_VR illegal in 16-bit mode (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				if (!Decode) continue;
@@ -3785,12 +3817,12 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				assert(X86Instruction->HasModRM);
 				if (rex_modrm.reg > 7)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: invalid mmx register %d for AMODE_P (\"%s\")\n", VIRTUAL_ADDRESS, rex_modrm.reg, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: invalid mmx register %d for AMODE_P (\"%s\")\n", VIRTUAL_ADDRESS, rex_modrm.reg, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				else if (X86Instruction->OperandSize == 2)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: AMODE_P illegal in 16-bit mode (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: AMODE_P illegal in 16-bit mode (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				if (!Decode) continue;
@@ -3811,7 +3843,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				assert(X86Instruction->HasModRM);
 				if (X86Instruction->OperandSize == 2)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: AMODE_P illegal in 16-bit mode (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: AMODE_P illegal in 16-bit mode (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				if (!Decode) continue;
@@ -3832,7 +3864,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				assert(X86Instruction->HasModRM);
 				if (modrm.mod != 3)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: mod != 3 for AMODE_R (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: mod != 3 for AMODE_R (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				if (!Decode) continue;
@@ -3995,7 +4027,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				assert(X86Instruction->HasModRM);
 				if (modrm.mod == 3)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: mod = 3 for AMODE_M (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: mod = 3 for AMODE_M (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 				assert(X86Instruction->Segment == SEG_DS || X86Instruction->HasSegmentOverridePrefix);
@@ -4008,7 +4040,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				assert(X86Instruction->HasModRM);
 				if (OperandType == OPTYPE_p && modrm.mod == 3)
 				{
-					if (!SuppressErrors) printf("[0x%08I64X] ERROR: mod = 3 for AMODE_E with OPTYPE_p (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
+					if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: mod = 3 for AMODE_E with OPTYPE_p (\"%s\")\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic);
 					goto abort;
 				}
 
@@ -4029,7 +4061,7 @@ INTERNAL U8 *SetOperands(INSTRUCTION *Instruction, U8 *Address, U32 Flags)
 				{
 					if (rex_modrm.rm > 7)
 					{
-						if (!SuppressErrors) printf("[0x%08I64X] ERROR: invalid mmx register %d for AMODE_P (\"%s\")\n", VIRTUAL_ADDRESS, rex_modrm.rm, X86Instruction->Opcode.Mnemonic);
+						if (!SuppressErrors) printf("[0x%08" PRI64 "X] ERROR: invalid mmx register %d for AMODE_P (\"%s\")\n", VIRTUAL_ADDRESS, rex_modrm.rm, X86Instruction->Opcode.Mnemonic);
 						goto abort;
 					}
 					Operand->Register = X86_MMX_OFFSET + rex_modrm.rm;
@@ -4098,7 +4130,7 @@ abort:
 	if (!SuppressErrors)
 	{
 #ifdef TEST_DISASM
-		printf("Dump of 0x%04I64X:\n", VIRTUAL_ADDRESS);
+		printf("Dump of 0x%04" PRI64 "X:\n", VIRTUAL_ADDRESS);
 		__try { DumpAsBytes(stdout, Instruction->Address, (ULONG_PTR)VIRTUAL_ADDRESS, 16, TRUE); }
 		__except (GetExceptionCode() == EXCEPTION_ACCESS_VIOLATION ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {}
 #endif
@@ -4141,6 +4173,7 @@ INTERNAL U8 *SetModRM16(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERA
 	else if (modrm.mod == 0 && modrm.rm == 6)
 	{
 		//DISASM_OUTPUT(("[SetModRM16] Absolute addressing (displacement 0x%04X)\n", *(S16 *)Address));
+		X86_CHECK_LENGTH(2, return NULL)
 		X86Instruction->Displacement = (S64)(*((S16 *)Address));
 		if (IS_VALID_ADDRESS(X86Instruction->Displacement))
 		{
@@ -4165,11 +4198,13 @@ INTERNAL U8 *SetModRM16(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERA
 				break; 
 			case 1: // 8-bit signed displacement
 				//DISASM_OUTPUT(("[SetModRM16] Indirect addressing (displacement = 0x%02X, reg_rm = %d)\n", *(S8 *)Address, modrm.rm));
+				X86_CHECK_LENGTH(1, return NULL)
 				X86Instruction->Displacement = (S64)(*((S8 *)Address));
 				INSTR_INC(1); // increment Instruction->Length and address
 				break;
 			case 2: // 16-bit displacement
 				//DISASM_OUTPUT(("[SetModRM16] Indirect addressing (displacement = 0x%04X, reg_rm = %d)\n", *(S16 *)Address, modrm.rm));
+				X86_CHECK_LENGTH(2, return NULL)
 				X86Instruction->Displacement = (S64)(*((S16 *)Address));
 				if (IS_VALID_ADDRESS(X86Instruction->Displacement))
 				{
@@ -4277,6 +4312,7 @@ INTERNAL U8 *SetModRM32(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERA
 	{
 		//DISASM_OUTPUT(("[SetModRM32] Absolute addressing (displacement 0x%08lX)\n", *(S32 *)Address));
 		Operand->Flags |= OP_ADDRESS;
+		X86_CHECK_LENGTH(4, return NULL)
 		X86Instruction->Displacement = (S64)*((S32 *)Address);
 		INSTR_INC(4); // increment Instruction->Length and address
 
@@ -4357,11 +4393,7 @@ INTERNAL U8 *SetModRM32(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERA
 	{
 		// The X86_SET_*() is called from within SetSIB()
 		Address = SetSIB(Instruction, Address, Operand, OperandIndex, SuppressErrors);
-		if (!Address)
-		{
-			assert(0);
-			return NULL;
-		}
+		if (!Address) return NULL;
 
 		if (X86Instruction->sib.base != 5) // if base == 5, the displacement is handled in SetSIB
 		{
@@ -4369,11 +4401,13 @@ INTERNAL U8 *SetModRM32(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERA
 			{
 				case 1: // 8-bit displacement
 					//DISASM_OUTPUT(("[SetModRM32] After SIB: displacement 0x%02X\n", *((S8 *)Address)));
+					X86_CHECK_LENGTH(1, return NULL)
 					X86Instruction->Displacement = (S64)(*((S8 *)Address));
 					INSTR_INC(1); // increment Instruction->Length and address
 					break;
 				case 2: // 32-bit displacement
 					//DISASM_OUTPUT(("[SetModRM32] After SIB: displacement 0x%08lX\n", *((S32 *)Address)));
+					X86_CHECK_LENGTH(4, return NULL)
 					X86Instruction->Displacement = (S64)*((S32 *)Address);
 					if (IS_VALID_ADDRESS(X86Instruction->Displacement))
 					{
@@ -4411,11 +4445,13 @@ INTERNAL U8 *SetModRM32(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERA
 				break; 
 			case 1: // 8-bit signed displacement
 				//DISASM_OUTPUT(("[SetModRM32] Indirect addressing (displacement = 0x%02X, reg_rm = %d)\n", *(S8 *)Address, rex_modrm.rm));
+				X86_CHECK_LENGTH(1, return NULL)
 				X86Instruction->Displacement = (S64)(*((S8 *)Address));
 				INSTR_INC(1); // increment Instruction->Length and address
 				break;
 			case 2: // 32-bit displacement
 				//DISASM_OUTPUT(("[SetModRM32] Indirect addressing (displacement = 0x%08lX, reg_rm = %d)\n", *(S32 *)Address, rex_modrm.rm));
+				X86_CHECK_LENGTH(4, return NULL)
 				X86Instruction->Displacement = (S64)*((S32 *)Address);
 				if (IS_VALID_ADDRESS(X86Instruction->Displacement))
 				{
@@ -4438,6 +4474,7 @@ INTERNAL U8 *SetSIB(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERAND *
 	REX_SIB rex_sib;
 	X86_INSTRUCTION *X86Instruction = &Instruction->X86;
 
+	X86_CHECK_LENGTH(1, return NULL)
 	X86Instruction->sib_b = *Address;
 	SET_SIB(X86Instruction->sib, *Address);
 	sib = X86Instruction->sib;
@@ -4445,8 +4482,8 @@ INTERNAL U8 *SetSIB(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERAND *
 	SET_REX_SIB(X86Instruction->rex_sib, rex, sib);
 	rex_sib = X86Instruction->rex_sib;
 
-	//if (!X86Instruction->rex_b) DISASM_OUTPUT(("[0x%08I64X] SIB = 0x%02X (scale=%d, index=%d, base=%d)\n", VIRTUAL_ADDRESS, *Address, sib.scale, sib.index, sib.base)); \
-	//else DISASM_OUTPUT(("[0x%08I64X] SIB = 0x%02X (scale=%d, index=%d, base=%d)\n", VIRTUAL_ADDRESS, *Address, sib.scale, rex_sib.index, rex_sib.base)); \
+	//if (!X86Instruction->rex_b) DISASM_OUTPUT(("[0x%08" PRI64 "X] SIB = 0x%02X (scale=%d, index=%d, base=%d)\n", VIRTUAL_ADDRESS, *Address, sib.scale, sib.index, sib.base)); \
+	//else DISASM_OUTPUT(("[0x%08" PRI64 "X] SIB = 0x%02X (scale=%d, index=%d, base=%d)\n", VIRTUAL_ADDRESS, *Address, sib.scale, rex_sib.index, rex_sib.base)); \
 	//DISASM_OUTPUT(("[SetSIB] Current instruction length = %d\n", Instruction->Length));
 
 	Operand->Flags |= OP_ADDRESS;
@@ -4458,6 +4495,7 @@ INTERNAL U8 *SetSIB(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERAND *
 		switch (X86Instruction->modrm.mod)
 		{
 			case 0:
+				X86_CHECK_LENGTH(4, return NULL)
 				X86Instruction->Displacement = (S64)*((S32 *)Address);
 				if (IS_VALID_ADDRESS(X86Instruction->Displacement))
 				{
@@ -4468,6 +4506,7 @@ INTERNAL U8 *SetSIB(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERAND *
 				INSTR_INC(4);
 				break;
 			case 1:
+				X86_CHECK_LENGTH(1, return NULL)
 				X86Instruction->Displacement = (S64)(*((S8 *)Address));
 				if (rex_sib.base == 5)
 				{
@@ -4490,6 +4529,7 @@ INTERNAL U8 *SetSIB(INSTRUCTION *Instruction, U8 *Address, INSTRUCTION_OPERAND *
 				INSTR_INC(1);
 				break;
 			case 2:
+				X86_CHECK_LENGTH(4, return NULL)
 				X86Instruction->Displacement = (S64)*((S32 *)Address);
 				if (rex_sib.base == 5)
 				{
@@ -4654,9 +4694,577 @@ INTERNAL BOOL IsValidLockPrefix(X86_INSTRUCTION *X86Instruction, U8 Opcode, U32
 
 	if (!X86Instruction->HasModRM || X86Instruction->modrm.mod == 3 || !X86Instruction->HasDstAddressing)
 	{
-		DISASM_OUTPUT(("[0x%08I64X] ERROR: Instruction \"%s\" with LOCK prefix has invalid ModRM addressing\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic, X86Instruction->Instruction->Address));
+		DISASM_OUTPUT(("[0x%08" PRI64 "X] ERROR: Instruction \"%s\" with LOCK prefix has invalid ModRM addressing\n", VIRTUAL_ADDRESS, X86Instruction->Opcode.Mnemonic, X86Instruction->Instruction->Address));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Length decoder
+////////////////////////////////////////////////////////////////////////
+//
+// X86_GetLengthAndType condenses the opcode tables above, once per architecture, into
+// entries which know the immediate sizes and how the ModRM byte is used. The common
+// instructions then take a few table lookups. Whatever the condensed tables don't
+// describe (lock/rep/address size prefixes, SSE prefixes, 3DNow, moffs, far pointers,
+// control registers...) is left to X86_GetInstruction, so both always agree.
+
+#define LENGTH_INVALID      0x0001 // also when illegal in 64-bit mode
+#define LENGTH_SLOW         0x0002 // needs X86_GetInstruction
+#define LENGTH_GROUP        0x0004 // Extension + modrm.reg
+#define LENGTH_FPU          0x0008 // Extension + modrm.reg or Extension + 8 + (modrm & 0x3F)
+#define LENGTH_MODRM        0x0010 // the ModRM byte is consumed
+#define LENGTH_MEMORY       0x0020 // an operand may be in memory
+#define LENGTH_JUMP         0x0040 // the immediate is an IP-relative offset
+#define LENGTH_DEFAULT64    0x0080
+#define LENGTH_NO_OPSIZE    0x0100 // operand size prefix not allowed (FPU/MMX/SSE)
+#define LENGTH_INVALID_OP16 0x0200
+#define LENGTH_MMX_REG      0x0400 // modrm.reg is an MMX register (REX.R invalid)
+#define LENGTH_MMX_RM       0x0800 // modrm.rm is an MMX register if mod = 3 (REX.B invalid)
+#define LENGTH_SSE_PREFIX   0x1000 // an operand size prefix selects an SSE instruction
+#define LENGTH_INVALID_CPU  0x2000
+
+#define LENGTH_MAX_EXTENSIONS 1024
+#define LENGTH_REJECT(Memory, OperandSize) (1 << (3*(Memory) + ((OperandSize) >> 2))) // operand size 2, 4 or 8
+#define LENGTH_COPY_SIZE X86_MAX_INSTRUCTION_LEN // all X86_GetInstruction ever reads
+
+typedef struct _X86_LENGTH_ENTRY
+{
+	U32 Type;
+	U16 Flags; // LENGTH_*
+	U16 Immediate; // bytes after the ModRM operand, 4 bits per operand size (2, 4, 8)
+	U16 Extension; // first entry in Extensions
+	U8 Reject; // LENGTH_REJECT(), the operand sizes and ModRM forms X86_GetInstruction fails
+	U8 OperandCount;
+} X86_LENGTH_ENTRY;
+
+typedef struct _X86_LENGTH_TABLES
+{
+	volatile BOOL Ready;
+	X86_LENGTH_ENTRY Opcodes_1[0x100];
+	X86_LENGTH_ENTRY Opcodes_2[0x100];
+	X86_LENGTH_ENTRY Extensions[LENGTH_MAX_EXTENSIONS];
+	U32 ExtensionCount;
+} X86_LENGTH_TABLES;
+
+// Built on first use. Threads building them at the same time write the same values,
+// Ready is only set afterwards
+INTERNAL X86_LENGTH_TABLES X86_LengthTables[3]; // ARCH_X86_16, ARCH_X86, ARCH_X64
+
+INTERNAL BOOL IsFixedOperand(U32 OperandType)
+{
+	switch (OperandType)
+	{
+		case OPTYPE_0: case OPTYPE_1: case OPTYPE_FF:
+		case OPTYPE_TSC: case OPTYPE_CS_MSR: case OPTYPE_EIP_MSR: case OPTYPE_ESP_MSR:
+		case OPTYPE_KERNELBASE_MSR: case OPTYPE_STAR_MSR: case OPTYPE_CSTAR_MSR:
+		case OPTYPE_LSTAR_MSR: case OPTYPE_FMASK_MSR:
+		case OP_REG: case OPTYPE_REG8:
+		case OPTYPE_REG_AL: case OPTYPE_REG_CL: case OPTYPE_REG_AH: case OPTYPE_REG_AX:
+		case OPTYPE_REG_DX: case OPTYPE_REG_ECX: case OPTYPE_REG_xBP:
+		case OPTYPE_REG_xAX_BIG: case OPTYPE_REG_xAX_SMALL:
+		case OPTYPE_xCX_HI_xBX_LO: case OPTYPE_xDX_HI_xAX_LO:
+		case OPTYPE_EDX_HI_EAX_LO: case OPTYPE_EDX_ECX_EBX_EAX:
+		case OPTYPE_FLAGS: case OPTYPE_xFLAGS:
+		case OPTYPE_CS: case OPTYPE_DS: case OPTYPE_ES: case OPTYPE_FS: case OPTYPE_GS: case OPTYPE_SS:
+		case OPTYPE_CR0: case OPTYPE_STx: case OPTYPE_ST0: case OPTYPE_ST1:
+		case OPTYPE_FPU_STATUS: case OPTYPE_FPU_CONTROL: case OPTYPE_FPU_TAG:
+		case OPTYPE_FLDZ: case OPTYPE_FLD1: case OPTYPE_FLDPI: case OPTYPE_FLDL2T:
+		case OPTYPE_FLDL2E: case OPTYPE_FLDLG2: case OPTYPE_FLDLN2:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+// Same as SetOperands, 0 if it fails
+INTERNAL U32 GetOperandLength(U32 OperandType, ARCHITECTURE_TYPE Architecture, U32 OperandSize, BOOL Memory)
+{
+	switch (OperandType)
+	{
+		case OPTYPE_b: return 1;
+		case OPTYPE_w: return 2;
+		case OPTYPE_d: return 4;
+		case OPTYPE_q: return 8;
+		case OPTYPE_o: return 16;
+		case OPTYPE_dt: return Architecture == ARCH_X64 ? 10 : 6;
+		case OPTYPE_cpu: return 204;
+		case OPTYPE_z: return OperandSize == 2 ? 2 : 4;
+		case OPTYPE_v: return OperandSize;
+		case OPTYPE_a: return OperandSize == 2 ? 4 : 8;
+		case OPTYPE_p: return OperandSize == 2 ? 4 : 6;
+		case OPTYPE_dq: return OperandSize == 8 ? 8 : 4;
+		case OPTYPE_mw: return Memory ? 2 : OperandSize;
+		case OPTYPE_ps: case OPTYPE_ss: return 4;
+		case OPTYPE_pd: case OPTYPE_sd: return 8;
+		case OPTYPE_pb: case OPTYPE_se: return 10;
+		case OPTYPE_fev: return OperandSize == 2 ? 14 : 28;
+		case OPTYPE_fst1: return OperandSize == 2 ? 94 : 108;
+		case OPTYPE_fst2: return 512;
+		case OPTYPE_sso: return Memory ? 4 : 16;
+		case OPTYPE_sdo: return Memory ? 8 : 16;
+		default: return 0;
+	}
+}
+
+INTERNAL void SetLengthEntry(X86_LENGTH_ENTRY *Entry, X86_OPCODE *X86Opcode, ARCHITECTURE_TYPE Architecture, BOOL HasModRM, BOOL IsFPU, U32 OpcodeLength, U8 Opcode, U8 OpcodeExtension)
+{
+	U32 i, Memory, OperandSize, OperandType, AddressMode, OperandLength, Reject;
+	U32 Immediate[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } }, MemoryOperands = 0, Immediates = 0, Jumps = 0;
+	U32 Groups = X86Opcode->MnemonicFlags & ITYPE_GROUP_MASK;
+
+	if (X86_INVALID(X86Opcode))
+	{
+		Entry->Flags |= LENGTH_INVALID;
+		return;
+	}
+	if (X86_SPECIAL_EXTENSION(X86Opcode) || X86_EXTENDED_OPCODE(X86Opcode))
+	{
+		Entry->Flags |= LENGTH_SLOW;
+		return;
+	}
+
+	Entry->Type = X86_GET_TYPE(X86Opcode);
+	Entry->OperandCount = X86_OPERAND_COUNT(X86Opcode);
+	if ((Architecture == ARCH_X86_16 && X86Opcode->CPU > CPU_I386) || (Architecture != ARCH_X64 && X86Opcode->CPU >= CPU_AMD64))
+	{
+		Entry->Flags |= LENGTH_INVALID_CPU;
+	}
+	if (Groups & (ITYPE_FPU|ITYPE_MMX|ITYPE_SSE|ITYPE_SSE2|ITYPE_SSE3))
+	{
+		switch (Entry->Type)
+		{
+			case ITYPE_FSTOREENV: case ITYPE_FLOADENV: case ITYPE_FSAVE: case ITYPE_FRESTORE: break;
+			default: Entry->Flags |= LENGTH_NO_OPSIZE; break;
+		}
+	}
+	if (Architecture == ARCH_X64)
+	{
+		switch (Entry->Type)
+		{
+			case ITYPE_PUSH: case ITYPE_POP:
+			case ITYPE_PUSHF: case ITYPE_POPF:
+			case ITYPE_ENTER: case ITYPE_LEAVE:
+			case ITYPE_CALL: case ITYPE_BRANCH:
+			case ITYPE_LOOPCC: case ITYPE_RET:
+				Entry->Flags |= LENGTH_DEFAULT64;
+				break;
+			case ITYPE_SYSTEM:
+				if (OpcodeLength == 2 && (Opcode == 0x00 || Opcode == 0x01) && (OpcodeExtension == 0x02 || OpcodeExtension == 0x03))
+				{
+					Entry->Flags |= LENGTH_DEFAULT64;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	if ((HasModRM && Entry->OperandCount) || (IsFPU && !Entry->OperandCount)) Entry->Flags |= LENGTH_MODRM;
+
+	for (i = 0; i < Entry->OperandCount; i++)
+	{
+		OperandType = X86Opcode->OperandFlags[i] & X86_OPTYPE_MASK;
+		AddressMode = X86Opcode->OperandFlags[i] & X86_AMODE_MASK;
+		if (IsFixedOperand(OperandType)) continue;
+
+		switch (AddressMode)
+		{
+			case AMODE_E: case AMODE_M: case AMODE_Q: case AMODE_W: MemoryOperands++; break;
+			case AMODE_I: Immediates++; break;
+			case AMODE_J: Jumps++; break;
+			case AMODE_O: case AMODE_A: case AMODE_C: case AMODE_D: Entry->Flags |= LENGTH_SLOW; break;
+			case AMODE_P: Entry->Flags |= LENGTH_MMX_REG; break;
+			case AMODE_PR: Entry->Flags |= LENGTH_MMX_RM; break;
+			default: break;
+		}
+		if (AddressMode == AMODE_Q) Entry->Flags |= LENGTH_MMX_RM;
+		if (OperandType == OPTYPE_lea && AddressMode != AMODE_M) Entry->Flags |= LENGTH_SLOW;
+		if (!HasModRM && AddressMode != AMODE_I && AddressMode != AMODE_J && AddressMode != AMODE_X && AddressMode != AMODE_Y && AddressMode != AMODE_xlat)
+		{
+			// the ModRM fields would be 0 rather than read, let alone consumed
+			Entry->Flags |= LENGTH_SLOW;
+		}
+
+		for (Memory = 0; Memory <= 1; Memory++)
+		{
+			for (OperandSize = 2; OperandSize <= 8; OperandSize <<= 1)
+			{
+				Reject = LENGTH_REJECT(Memory, OperandSize);
+				if (OperandType == OPTYPE_lea) OperandLength = 0; // AMODE_M doesn't look at it
+				else if (!(OperandLength = GetOperandLength(OperandType, Architecture, OperandSize, Memory)))
+				{
+					Entry->Reject |= Reject;
+					continue;
+				}
+
+				switch (AddressMode)
+				{
+					case AMODE_I:
+					case AMODE_J:
+						if (OperandLength != 1 && OperandLength != 2 && OperandLength != 4 && OperandLength != 8) Entry->Reject |= Reject;
+						else Immediate[Memory][OperandSize >> 2] += OperandLength;
+						break;
+					case AMODE_R:
+						if (Memory) Entry->Reject |= Reject;
+						// fall through
+					case AMODE_G:
+						if (OperandLength != 1 && OperandLength != 2 && OperandLength != 4 && OperandLength != 8) Entry->Reject |= Reject;
+						break;
+					case AMODE_PR:
+					case AMODE_VR:
+						if (Memory || OperandSize == 2) Entry->Reject |= Reject;
+						break;
+					case AMODE_P:
+					case AMODE_V:
+						if (OperandSize == 2) Entry->Reject |= Reject;
+						break;
+					case AMODE_M:
+						if (!Memory) Entry->Reject |= Reject;
+						break;
+					case AMODE_E:
+						if (Memory) break;
+						if (OperandType == OPTYPE_p) Entry->Reject |= Reject;
+						else if (OperandLength != 1 && OperandLength != 2 && OperandLength != 4 && (OperandLength != 8 || Architecture == ARCH_X86_16)) Entry->Reject |= Reject;
+						break;
+					case AMODE_Q: case AMODE_W:
+					case AMODE_X: case AMODE_Y: case AMODE_xlat:
+					case AMODE_S: case AMODE_T:
+					case AMODE_O: case AMODE_A: case AMODE_C: case AMODE_D:
+						break;
+					default:
+						Entry->Reject |= Reject;
+						break;
+				}
+			}
+		}
+	}
+
+	if (MemoryOperands) Entry->Flags |= LENGTH_MEMORY;
+	if (Jumps) Entry->Flags |= LENGTH_JUMP;
+	// Only one ModRM operand, and the offset of a jump is the last thing
+	if (MemoryOperands > 1 || Jumps > 1 || (Jumps && Immediates)) Entry->Flags |= LENGTH_SLOW;
+
+	for (OperandSize = 2; OperandSize <= 8; OperandSize <<= 1)
+	{
+		i = OperandSize >> 2;
+		if (!(Entry->Reject & LENGTH_REJECT(0, OperandSize)) && !(Entry->Reject & LENGTH_REJECT(1, OperandSize)) &&
+			Immediate[0][i] != Immediate[1][i])
+		{
+			Entry->Flags |= LENGTH_SLOW;
+		}
+		if (Entry->Reject & LENGTH_REJECT(1, OperandSize)) Immediate[1][i] = Immediate[0][i];
+		if (Immediate[1][i] > 0xF) Entry->Flags |= LENGTH_SLOW;
+		else Entry->Immediate |= (U16)(Immediate[1][i] << (4*i));
+	}
+}
+
+// Entries for a group (8) or an FPU escape (0x48), FALSE if there's no room left
+INTERNAL BOOL SetLengthExtensions(X86_LENGTH_TABLES *Tables, X86_LENGTH_ENTRY *Entry, X86_OPCODE *Table, U32 Count, ARCHITECTURE_TYPE Architecture, BOOL HasModRM, BOOL IsFPU, U32 OpcodeLength, U8 Opcode)
+{
+	U32 i;
+
+	if (Tables->ExtensionCount + Count > LENGTH_MAX_EXTENSIONS)
+	{
+		assert(0);
 		return FALSE;
 	}
 
+	Entry->Extension = (U16)Tables->ExtensionCount;
+	Entry->Flags |= IsFPU ? LENGTH_FPU : LENGTH_GROUP;
+	for (i = 0; i < Count; i++)
+	{
+		SetLengthEntry(&Tables->Extensions[Tables->ExtensionCount + i], &Table[i], Architecture, HasModRM, IsFPU, OpcodeLength, Opcode, (U8)(IsFPU ? 0 : i));
+	}
+	Tables->ExtensionCount += Count;
+	return TRUE;
+}
+
+INTERNAL void BuildLengthTables(X86_LENGTH_TABLES *Tables, ARCHITECTURE_TYPE Architecture)
+{
+	U32 Opcode, OpcodeLength;
+	X86_OPCODE *X86Opcode;
+	X86_LENGTH_ENTRY *Entry;
+	BOOL HasModRM;
+
+	memset(Tables, 0, sizeof(X86_LENGTH_TABLES));
+	for (OpcodeLength = 1; OpcodeLength <= 2; OpcodeLength++)
+	{
+		for (Opcode = 0; Opcode < 0x100; Opcode++)
+		{
+			if (OpcodeLength == 1)
+			{
+				Entry = &Tables->Opcodes_1[Opcode];
+				X86Opcode = &X86_Opcodes_1[Opcode];
+				HasModRM = X86_ModRM_1[Opcode];
+				if (Architecture == ARCH_X64 && X86_Invalid_Addr64_1[Opcode]) Entry->Flags |= LENGTH_INVALID;
+				if (X86_Invalid_Op16_1[Opcode]) Entry->Flags |= LENGTH_INVALID_OP16;
+			}
+			else
+			{
+				Entry = &Tables->Opcodes_2[Opcode];
+				X86Opcode = &X86_Opcodes_2[Opcode];
+				HasModRM = X86_ModRM_2[Opcode];
+				if (Architecture == ARCH_X64 && X86_Invalid_Addr64_2[Opcode]) Entry->Flags |= LENGTH_INVALID;
+				if (X86_Invalid_Op16_2[Opcode]) Entry->Flags |= LENGTH_INVALID_OP16;
+				if (!X86_INVALID(&X86_SSE[Opcode])) Entry->Flags |= LENGTH_SSE_PREFIX;
+			}
+
+			if (X86_INVALID(X86Opcode))
+			{
+				Entry->Flags |= LENGTH_INVALID;
+			}
+			else if (X86_PREFIX(X86Opcode) || (OpcodeLength == 1 && Opcode == X86_TWO_BYTE_OPCODE))
+			{
+				Entry->Flags |= LENGTH_SLOW; // handled before the lookup
+			}
+			else if (X86Opcode->MnemonicFlags & ITYPE_EXT_64)
+			{
+				SetLengthEntry(Entry, &X86Opcode->Table[Architecture == ARCH_X64 ? 1 : 0], Architecture, HasModRM, FALSE, OpcodeLength, (U8)Opcode, 0);
+			}
+			else if (X86Opcode->MnemonicFlags & ITYPE_EXT_FPU)
+			{
+				if (!SetLengthExtensions(Tables, Entry, X86Opcode->Table, 0x48, Architecture, HasModRM, TRUE, OpcodeLength, (U8)Opcode)) Entry->Flags |= LENGTH_SLOW;
+			}
+			else if (X86_SPECIAL_EXTENSION(X86Opcode))
+			{
+				Entry->Flags |= LENGTH_SLOW;
+			}
+			else if (X86_EXTENDED_OPCODE(X86Opcode))
+			{
+				if (!SetLengthExtensions(Tables, Entry, X86Opcode->Table, 8, Architecture, HasModRM, FALSE, OpcodeLength, (U8)Opcode)) Entry->Flags |= LENGTH_SLOW;
+			}
+			else
+			{
+				SetLengthEntry(Entry, X86Opcode, Architecture, HasModRM, FALSE, OpcodeLength, (U8)Opcode, 0);
+			}
+		}
+	}
+	Tables->Ready = TRUE;
+}
+
+// Whatever the tables can't describe
+INTERNAL BOOL GetLengthAndTypeSlow(ARCHITECTURE_TYPE Architecture, U8 *Address, U32 Size, X86_LENGTH_AND_TYPE *Info)
+{
+	DISASSEMBLER Disassembler;
+	INSTRUCTION *Instruction;
+	U8 Copy[LENGTH_COPY_SIZE];
+	U32 i;
+
+	// X86_GetInstruction doesn't know where the code ends, it gets a copy padded with zeroes
+	memset(Copy, 0, sizeof(Copy));
+	memcpy(Copy, Address, MIN(Size, sizeof(Copy)));
+	if (!InitDisassembler(&Disassembler, Architecture)) return FALSE;
+	Instruction = GetInstruction(&Disassembler, (U64)(ULONG_PTR)Address, Copy, DISASM_DECODE|DISASM_SUPPRESSERRORS);
+	if (!Instruction || Instruction->Length > Size) return FALSE;
+
+	Info->Length = Instruction->Length;
+	Info->Type = Instruction->Type;
+	Info->OperandCount = (U8)Instruction->OperandCount;
+	Info->OperandSize = Instruction->X86.OperandSize;
+	for (i = 0; i < Instruction->OperandCount && i < MAX_OPERAND_COUNT; i++)
+	{
+		if (Instruction->Operands[i].Flags & OP_IPREL)
+		{
+			Info->IsIpRelative = TRUE;
+			Info->Displacement = Instruction->X86.Displacement;
+		}
+	}
+	return TRUE;
+}
+
+BOOL X86_GetLengthAndType(ARCHITECTURE_TYPE Architecture, U8 *Address, U32 Size, X86_LENGTH_AND_TYPE *Info)
+{
+	X86_LENGTH_TABLES *Tables;
+	X86_LENGTH_ENTRY *Entry;
+	U32 Length = 0, PrefixCount = 0, OperandSize, AddressSize, Immediate, DisplacementOffset = 0;
+	U8 Opcode, ModRM, Rex = 0, Prefix, Prefixes = 0;
+	BOOL HasOperandSizePrefix = FALSE, HasSegmentOverridePrefix = FALSE, AnomalyOccurred = FALSE, IsAmd64 = FALSE;
+
+	memset(Info, 0, sizeof(X86_LENGTH_AND_TYPE));
+	switch (Architecture)
+	{
+		case ARCH_X86_16: Tables = &X86_LengthTables[0]; OperandSize = AddressSize = 2; break;
+		case ARCH_X86: Tables = &X86_LengthTables[1]; OperandSize = AddressSize = 4; break;
+		case ARCH_X64: Tables = &X86_LengthTables[2]; OperandSize = 4; AddressSize = 8; IsAmd64 = TRUE; break;
+		default: assert(0); return FALSE;
+	}
+	if (!Tables->Ready) BuildLengthTables(Tables, Architecture);
+
+	//
+	// Prefixes, with the anomalies X86_GetInstruction would notice (they decide
+	// whether an operand size prefix is tolerated with FPU/MMX/SSE)
+	//
+	while (TRUE)
+	{
+		if (Length >= Size) return FALSE;
+		Opcode = Address[Length];
+
+		// Misplaced REX prefix, it is ignored
+		if (IsAmd64 && Opcode >= REX_PREFIX_START && Opcode <= REX_PREFIX_END && Length + 1 < Size && X86_PREFIX(&X86_Opcodes_1[Address[Length+1]]))
+		{
+			AnomalyOccurred = TRUE;
+			Length++;
+			continue;
+		}
+
+		switch (Opcode)
+		{
+			case PREFIX_OPERAND_SIZE: Prefix = 0x01; break;
+			case PREFIX_SEGMENT_OVERRIDE_ES: Prefix = 0x02; break;
+			case PREFIX_SEGMENT_OVERRIDE_CS: Prefix = 0x04; break;
+			case PREFIX_SEGMENT_OVERRIDE_SS: Prefix = 0x08; break;
+			case PREFIX_SEGMENT_OVERRIDE_DS: Prefix = 0x10; break;
+			case PREFIX_SEGMENT_OVERRIDE_FS: Prefix = 0x20; break;
+			case PREFIX_SEGMENT_OVERRIDE_GS: Prefix = 0x40; break;
+			case PREFIX_ADDRESS_SIZE: case PREFIX_LOCK: case PREFIX_REP: case PREFIX_REPNE:
+				return GetLengthAndTypeSlow(Architecture, Address, Size, Info);
+			default: Prefix = 0; break;
+		}
+		if (!Prefix) break;
+
+		if (Prefixes & Prefix) AnomalyOccurred = TRUE; // duplicate prefix
+		Prefixes |= Prefix;
+		if (Prefix == 0x01)
+		{
+			if (!HasOperandSizePrefix) OperandSize = OperandSize == 2 ? 4 : 2;
+			HasOperandSizePrefix = TRUE;
+		}
+		else
+		{
+			if (HasSegmentOverridePrefix) AnomalyOccurred = TRUE;
+			if (!IsAmd64 || Prefix >= 0x20) HasSegmentOverridePrefix = TRUE;
+			else AnomalyOccurred = TRUE; // meaningless in 64-bit mode
+		}
+
+		if (PrefixCount >= X86_MAX_INSTRUCTION_LEN) return FALSE;
+		else if (PrefixCount == X86_MAX_PREFIX_LENGTH) AnomalyOccurred = TRUE;
+		PrefixCount++;
+		Length++;
+	}
+
+	if (IsAmd64 && Opcode >= REX_PREFIX_START && Opcode <= REX_PREFIX_END)
+	{
+		if (PrefixCount >= X86_MAX_INSTRUCTION_LEN) return FALSE;
+		Rex = Opcode;
+		if (GET_REX_W(Rex))
+		{
+			OperandSize = 8;
+			HasOperandSizePrefix = FALSE;
+		}
+		else if (!HasOperandSizePrefix && Rex == REX_PREFIX_START)
+		{
+			AnomalyOccurred = TRUE;
+		}
+		if (++Length >= Size) return FALSE;
+		Opcode = Address[Length];
+	}
+	Length++;
+
+	//
+	// Opcode
+	//
+	if (Opcode == X86_TWO_BYTE_OPCODE)
+	{
+		if (Length >= Size) return FALSE;
+		Entry = &Tables->Opcodes_2[Address[Length++]];
+	}
+	else
+	{
+		Entry = &Tables->Opcodes_1[Opcode];
+	}
+
+	if (Entry->Flags & LENGTH_INVALID) return FALSE;
+	if (OperandSize == 2 && (Entry->Flags & LENGTH_INVALID_OP16)) return FALSE;
+	if ((Entry->Flags & LENGTH_SLOW) || ((Prefixes & 0x01) && (Entry->Flags & LENGTH_SSE_PREFIX)))
+	{
+		return GetLengthAndTypeSlow(Architecture, Address, Size, Info);
+	}
+	if (Entry->Flags & (LENGTH_GROUP|LENGTH_FPU))
+	{
+		if (Length >= Size) return FALSE;
+		ModRM = Address[Length];
+		if ((Entry->Flags & LENGTH_GROUP) || ModRM < 0xC0) Entry = &Tables->Extensions[Entry->Extension + GET_MODRM_EXT(ModRM)];
+		else Entry = &Tables->Extensions[Entry->Extension + 0x08 + (ModRM & 0x3F)];
+
+		if (Entry->Flags & LENGTH_INVALID) return FALSE;
+		if (Entry->Flags & LENGTH_SLOW) return GetLengthAndTypeSlow(Architecture, Address, Size, Info);
+	}
+
+	if (Entry->Flags & LENGTH_INVALID_CPU) return FALSE;
+	if ((Prefixes & 0x01) && !AnomalyOccurred && (Entry->Flags & LENGTH_NO_OPSIZE)) return FALSE;
+	if (Entry->Flags & LENGTH_DEFAULT64) OperandSize = HasOperandSizePrefix ? 2 : 8;
+
+	//
+	// ModRM, SIB and displacement
+	//
+	ModRM = 0;
+	if (Entry->Flags & LENGTH_MODRM)
+	{
+		if (Length >= Size) return FALSE;
+		ModRM = Address[Length++];
+		if (GET_MODRM_MOD(ModRM) == 3 && (Entry->Flags & LENGTH_MMX_RM) && GET_REX_B(Rex)) return FALSE;
+		if ((Entry->Flags & LENGTH_MMX_REG) && GET_REX_R(Rex)) return FALSE;
+	}
+	if (Entry->Reject & LENGTH_REJECT(GET_MODRM_MOD(ModRM) != 3, OperandSize)) return FALSE;
+
+	if ((Entry->Flags & (LENGTH_MODRM|LENGTH_MEMORY)) == (LENGTH_MODRM|LENGTH_MEMORY) && GET_MODRM_MOD(ModRM) != 3)
+	{
+		if (AddressSize == 2)
+		{
+			if (GET_MODRM_MOD(ModRM) == 0 && GET_MODRM_RM(ModRM) == 6) Length += 2;
+			else Length += GET_MODRM_MOD(ModRM);
+		}
+		else if (GET_MODRM_MOD(ModRM) == 0 && GET_MODRM_RM(ModRM) == 5)
+		{
+			if (IsAmd64)
+			{
+				Info->IsIpRelative = TRUE;
+				DisplacementOffset = Length;
+			}
+			Length += 4;
+		}
+		else
+		{
+			if (GET_MODRM_RM(ModRM) == 4)
+			{
+				if (Length >= Size) return FALSE;
+				if (GET_MODRM_MOD(ModRM) == 0 && GET_SIB_BASE(Address[Length]) == 5) Length += 4;
+				Length++;
+			}
+			if (GET_MODRM_MOD(ModRM) == 1) Length += 1;
+			else if (GET_MODRM_MOD(ModRM) == 2) Length += 4;
+		}
+	}
+
+	//
+	// Immediates
+	//
+	Immediate = (Entry->Immediate >> (4 * (OperandSize >> 2))) & 0xF;
+	if (Entry->Flags & LENGTH_JUMP)
+	{
+		Info->IsIpRelative = TRUE;
+		DisplacementOffset = Length;
+	}
+	Length += Immediate;
+	if (Length > Size || Length > X86_MAX_INSTRUCTION_LEN) return FALSE;
+
+	if (Info->IsIpRelative)
+	{
+		switch ((Entry->Flags & LENGTH_JUMP) ? Immediate : 4)
+		{
+			case 8: Info->Displacement = *((S64 *)&Address[DisplacementOffset]); break;
+			case 4: Info->Displacement = (S64)*((S32 *)&Address[DisplacementOffset]); break;
+			case 2: Info->Displacement = (S64)*((S16 *)&Address[DisplacementOffset]); break;
+			case 1: Info->Displacement = (S64)*((S8 *)&Address[DisplacementOffset]); break;
+			default: assert(0); return FALSE;
+		}
+	}
+
+	Info->Length = Length;
+	Info->Type = (INSTRUCTION_TYPE)Entry->Type;
+	Info->OperandCount = Entry->OperandCount;
+	Info->OperandSize = (U8)OperandSize;
 	return TRUE;
 }
@@ -830,6 +830,21 @@ BOOL X86_GetInstruction(struct _INSTRUCTION *Instruction, U8 *Address, DWORD Fla
 // Function finding
 U8 *X86_FindFunctionByPrologue(struct _INSTRUCTION *Instruction, U8 *StartAddress, U8 *EndAddress, DWORD Flags);
 
+// Length decoder: what X86_GetInstruction would say about the length and type of an
+// instruction and its IP-relative operand, mostly from tables and without building the
+// operands. Never reads beyond Address+Size, returns FALSE where X86_GetInstruction fails
+typedef struct _X86_LENGTH_AND_TYPE
+{
+	U32 Length;
+	INSTRUCTION_TYPE Type;
+	U8 OperandCount;
+	U8 OperandSize;
+	U8 IsIpRelative : 1; // relative branch or RIP-relative memory operand
+	S64 Displacement; // of the IP-relative operand
+} X86_LENGTH_AND_TYPE;
+
+BOOL X86_GetLengthAndType(ARCHITECTURE_TYPE Architecture, U8 *Address, U32 Size, X86_LENGTH_AND_TYPE *Info);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,7 +5,30 @@
 extern "C" {
 #endif
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+// The handful of Win32 types used by the disassembler, so it builds on
+// other systems as well, plus the C headers windows.h brings along
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef unsigned short USHORT;
+typedef unsigned char UCHAR;
+typedef long long LONG64;
+typedef unsigned long long ULONG64;
+typedef uintptr_t DWORD_PTR;
+#define TRUE 1
+#define FALSE 0
+#define _snprintf snprintf
+#endif
 #include <stdio.h>
 #include <stdarg.h>
 #include <assert.h>
@@ -27,9 +50,12 @@ extern "C" {
 #if defined(_WIN64)
 	#define VALID_ADDRESS_MAX 0x7FFEFFFFFFFFFFFF // Win64 specific
 	typedef unsigned __int64 ULONG_PTR, *PULONG_PTR;
-#else
+#elif defined(_WIN32)
 	#define VALID_ADDRESS_MAX 0x7FFEFFFF // Win32 specific
 	typedef unsigned long ULONG_PTR, *PULONG_PTR;
+#else
+	#define VALID_ADDRESS_MAX UINTPTR_MAX
+	typedef uintptr_t ULONG_PTR, *PULONG_PTR;
 #endif
 
 #ifndef DECLSPEC_ALIGN
@@ -18,6 +18,19 @@
 typedef void (DECLSPEC *SV_LogHandler_t)(const char *message, void *userdata);
 void DECLSPEC SV_SetLogHandler(SV_LogHandler_t handler, void *userdata);
 
+/*
+ * Selects how log messages get to the handler. With SV_LOG_SYNC (the default) the handler is
+ * called on the thread logging. With SV_LOG_ASYNC it is called on a background thread, so a
+ * slow handler doesn't stall rendering; if it can't keep up, messages are dropped and a
+ * message telling how many is logged instead. The background thread stops when the last view
+ * is destroyed and starts again with the next one, messages in between are handled on the
+ * thread logging. A host using SV_LOG_ASYNC without views has to switch back to SV_LOG_SYNC
+ * before unloading the dll, and must not switch while holding the loader lock.
+ */
+#define SV_LOG_SYNC  0
+#define SV_LOG_ASYNC 1
+void DECLSPEC SV_SetLogMode(int mode);
+
 /*
  * Creates a window displaying the contents of the given screen.
  *
@@ -25,12 +38,138 @@ void DECLSPEC SV_SetLogHandler(SV_LogHandler_t handler, void *userdata);
  *
  * The window and all associated resources can be freed by calling DestroyWindow on it.
  *
+ * Without a usable Direct3D 10 device, the view captures with GDI and draws on the CPU. It is
+ * slower, and SV_OPTION_ZERO_COPY has no effect then.
+ *
  * If the view couldn't be created, 0 will be returned.
  */
 HWND DECLSPEC SV_CreateView(HWND parent, int x, int y, int w, int h);
 
+/*
+ * Creates a window displaying the given rectangle of the desktop, which has to be inside
+ * a single monitor.
+ *
+ * Only the changed parts of the rectangle are copied, into a texture of its size, so a small
+ * region of a large monitor is far cheaper to show than the whole monitor. Each region view
+ * duplicates the monitor on its own, and SV_OPTION_ZERO_COPY isn't supported for regions
+ * smaller than the monitor. Needs Windows 8 or later, returns 0 otherwise.
+ *
+ * SV_ChangeScreen accepts regions for these views as well.
+ */
+HWND DECLSPEC SV_CreateRegionView(HWND parent, int x, int y, int w, int h);
+
+/*
+ * Creates a window displaying the given rectangle of the desktop, which may span any number
+ * of monitors.
+ *
+ * Every monitor under the rectangle is captured on its own, at its own rate and shared with the
+ * other views showing it, and whatever changed is stitched into one texture of the size of the
+ * rectangle. Parts of the rectangle outside of any monitor stay black. The rectangle can't be
+ * larger than the biggest texture the GPU supports. SV_OPTION_ZERO_COPY isn't supported.
+ * Needs Windows 8 or later, returns 0 otherwise.
+ *
+ * SV_ChangeScreen accepts any rectangle for these views as well.
+ */
+HWND DECLSPEC SV_CreateSpanningView(HWND parent, int x, int y, int w, int h);
+
 /*
  * Changes the screen displayed by the given view to the screen indicated by the
  * given coordinates
  */
-void DECLSPEC SV_ChangeScreen(HWND view, int x, int y, int w, int h);
\ No newline at end of file
+void DECLSPEC SV_ChangeScreen(HWND view, int x, int y, int w, int h);
+
+/*
+ * Options of a view, to be set with SV_SetViewOption
+ *
+ * SV_OPTION_THUMBNAIL: 1 keeps a pyramid of box filtered half resolution copies of the desktop
+ *                      and draws from the one matching the view size, which looks much better
+ *                      and is cheaper for views far smaller than the screen. 0 (the default)
+ *                      draws the desktop at full resolution.
+ *
+ * SV_OPTION_ZERO_COPY: 1 draws straight from the duplicated desktop surface instead of copying
+ *                      it into a texture of the view first. Only views using the desktop
+ *                      duplication API support it. 0 (the default) copies the changed regions.
+ *                      Views of SV_CreateView draw from the frames their monitor's shared
+ *                      capture hands out and never copy them, the option changes nothing there.
+ *
+ * SV_OPTION_ASPECT:    How the desktop is fitted into the view. SV_ASPECT_STRETCH (the default)
+ *                      covers the view, whatever its aspect ratio. SV_ASPECT_FIT shows the whole
+ *                      desktop with gray bars, SV_ASPECT_FILL covers the view and crops the
+ *                      desktop, both keeping its aspect ratio. SV_ASPECT_NATIVE draws it at its
+ *                      own resolution, centered. Whenever the desktop ends up magnified by whole
+ *                      numbers (1:1 included), it is drawn point sampled and stays sharp.
+ *
+ * SV_OPTION_CAPTURE_RATE: How many times per second the desktop is copied, for views which
+ *                      capture at a fixed rate instead of whenever the desktop changes. Only
+ *                      views hooking the DWM on Windows 7 do. The default is 20, 0 stops
+ *                      copying, e.g. while the view is hidden. Copying happens inside the
+ *                      DWM and slows down on its own if it takes too long.
+ */
+#define SV_OPTION_THUMBNAIL    0
+#define SV_OPTION_ZERO_COPY    1
+#define SV_OPTION_ASPECT       2
+#define SV_OPTION_CAPTURE_RATE 3
+
+#define SV_ASPECT_STRETCH 0
+#define SV_ASPECT_FIT     1
+#define SV_ASPECT_FILL    2
+#define SV_ASPECT_NATIVE  3
+
+void DECLSPEC SV_SetViewOption(HWND view, int option, int value);
+
+/*
+ * Records what the given view shows into a new file at path, a UTF-8 path, until
+ * SV_StopRecording is called, the view is destroyed, or the size of the desktop changes.
+ *
+ * Every frame stores the 64x64 tiles of the desktop which changed, the cursor position and
+ * when the frame was presented. A full frame is stored every 300 frames, so recordings can
+ * be played back from anywhere. Cursor shapes aren't recorded. Failures are logged.
+ *
+ * Recording reads the changed tiles back from the GPU, which costs some time per frame.
+ */
+void DECLSPEC SV_StartRecording(HWND view, const char *path);
+void DECLSPEC SV_StopRecording(HWND view);
+
+/*
+ * Frame pacing and latency statistics of all views and capture threads.
+ *
+ * The counters count from the start of the process, the histograms cover the
+ * last window_ms milliseconds. Bucket 0 counts durations below 1us, bucket i
+ * durations of [2^(i-1), 2^i) us, the last bucket everything longer.
+ *
+ * accumulated_frames - frames_acquired approximates the number of desktop
+ * updates which have never been shown on their own.
+ */
+#define SV_STATS_BUCKETS 20
+
+enum SV_Stage {
+    SV_STAGE_ACQUIRE = 0, /* waiting for a new frame */
+    SV_STAGE_COPY,        /* copying the frame into our textures */
+    SV_STAGE_DRAW,        /* drawing the view */
+    SV_STAGE_PRESENT,     /* presenting the view */
+    SV_STAGE_COUNT
+};
+
+typedef struct SV_Histogram {
+    unsigned long long buckets[SV_STATS_BUCKETS];
+    unsigned long long count;
+    unsigned long long total_us;
+    unsigned long long max_us;
+} SV_Histogram;
+
+typedef struct SV_Stats {
+    unsigned int       size;      /* set to sizeof(SV_Stats) before calling SV_GetStats */
+    unsigned int       window_ms;
+    unsigned long long frames_acquired;
+    unsigned long long frames_skipped;
+    unsigned long long frames_presented;
+    unsigned long long accumulated_frames;
+    SV_Histogram       stages[SV_STAGE_COUNT];
+} SV_Stats;
+
+/*
+ * Fills in the current statistics. They are cheap to collect, and always on.
+ *
+ * Returns 0 if stats->size doesn't match sizeof(SV_Stats), 1 otherwise.
+ */
+int DECLSPEC SV_GetStats(SV_Stats *stats);
\ No newline at end of file
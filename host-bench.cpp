@@ -0,0 +1,4201 @@
+/*
+ * Host-native benchmarks for the platform independent parts of the pipeline.
+ *
+ * Builds and runs on the build machine (make host-bench), no Windows or GPU needed.
+ */
+#include "src/synthetic_source.hpp"
+#include "src/cpu_surface.hpp"
+#include "src/frame_source.hpp"
+#include "src/cursor_convert.hpp"
+#include "src/frame_scheduler.hpp"
+#include "src/stats.hpp"
+#include "src/async_log.hpp"
+#include "src/pyramid.hpp"
+#include "src/frame_ring.hpp"
+#include "src/cpu_raster.hpp"
+#include "src/cpu_renderer.hpp"
+#include "src/view_geometry.hpp"
+#include "src/atlas.hpp"
+#include "src/capture_file.hpp"
+#include "src/replay_source.hpp"
+#include "src/tile_hash.hpp"
+#include "src/capture_rate.hpp"
+#include "src/shared_slots.hpp"
+#include "src/spsc_ring.hpp"
+#include "src/capture_hub.hpp"
+#include "mhook-lib/mhook_alloc.h"
+#include "mhook-lib/mhook_plan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// The register names of disasm-lib clash with those of <sys/ucontext.h>, its system headers are
+// included above already
+namespace disasm {
+#include "disasm-lib/disasm.h"
+}
+using namespace disasm;
+
+namespace {
+    typedef std::chrono::steady_clock bench_clock;
+
+    struct options {
+        int      width    = 1920;
+        int      height   = 1080;
+        unsigned frames   = 2000;
+        unsigned activity = SyntheticSource::ACTIVITY_ALL;
+    };
+
+    double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty())
+            return 0.0;
+
+        std::size_t index = static_cast<std::size_t>(p * static_cast<double>(values.size() - 1) + 0.5);
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+
+        return values[index];
+    }
+
+    // Drives a frame source the same way Renderer::render does, minus the drawing
+    template<class TSource>
+    void runPipeline(const char *name, TSource& source, const options& opt)
+    {
+        static_assert(frame_source::is_frame_source<TSource>::value, "not a frame source");
+
+        typename TSource::device_type device;
+        source.reinit(&device, 0, 0, opt.width, opt.height);
+
+        std::unique_ptr<typename TSource::texture_type> desktop(source.createDesktopTexture());
+        std::unique_ptr<typename TSource::texture_type> cursor(source.createCursorTexture());
+        std::unique_ptr<typename TSource::texture_type> cursorMask(source.createCursorMaskTexture());
+
+        frame_source::cursor_state cursorState;
+
+        std::vector<double> latencies;
+        latencies.reserve(opt.frames);
+
+        bench_clock::time_point start = bench_clock::now();
+
+        for (unsigned i = 0; i < opt.frames; ++i) {
+            bench_clock::time_point frameStart = bench_clock::now();
+
+            source.acquireFrame(0);
+            source.updateDesktop(desktop.get());
+            source.updateCursor(cursor.get(), cursorMask.get(), cursorState);
+            source.releaseFrame();
+
+            latencies.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - frameStart).count());
+        }
+
+        double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        std::printf("%-12s %dx%d %u frames: %9.1f frames/s  %10.0f bytes/frame  p50 %8.1f us  p99 %8.1f us\n",
+                    name, opt.width, opt.height, opt.frames,
+                    static_cast<double>(opt.frames) / seconds,
+                    static_cast<double>(device.bytes_copied) / static_cast<double>(opt.frames),
+                    percentile(latencies, 0.50),
+                    percentile(latencies, 0.99));
+    }
+
+    void benchPipeline(const options& opt)
+    {
+        const struct { const char *name; unsigned activity; } scenarios[] = {
+            { "idle",      0 },
+            { "scrolling", SyntheticSource::ACTIVITY_SCROLLING },
+            { "typing",    SyntheticSource::ACTIVITY_TYPING },
+            { "video",     SyntheticSource::ACTIVITY_VIDEO },
+            { "cursor",    SyntheticSource::ACTIVITY_CURSOR },
+            { "selected",  opt.activity },
+        };
+
+        for (const auto& scenario : scenarios) {
+            SyntheticSource source(scenario.activity);
+            runPipeline(scenario.name, source, opt);
+        }
+    }
+
+    // Simulated time for the render loop
+    struct fake_clock {
+        uint64_t ms = 0;
+
+        uint64_t now() { return ms; }
+        void sleep(unsigned d) { ms += d; }
+    };
+
+    // Stands in for Renderer: frames of the source become available with the display refresh,
+    // drawing is free. Keeps track of what the scheduler asked for.
+    template<class TSource>
+    struct fake_renderer {
+        static const unsigned REFRESH_MS = 16;
+
+        TSource&    source;
+        fake_clock& clock;
+        uint64_t    nextFrame = 0;
+        bool        waking    = false; // whether to claim the source wakes up by itself
+
+        typename TSource::device_type device;
+        std::unique_ptr<typename TSource::texture_type> desktop;
+        std::unique_ptr<typename TSource::texture_type> cursor;
+        std::unique_ptr<typename TSource::texture_type> cursorMask;
+        frame_source::cursor_state cursorState;
+
+        unsigned              longestWait = 0;
+        unsigned              shortestWait = ~0u;
+        uint64_t              acquired    = 0;
+        uint64_t              changed     = 0;
+        std::vector<uint64_t> presents;
+
+        fake_renderer(TSource& src, fake_clock& clk, const options& opt) : source(src), clock(clk)
+        {
+            source.reinit(&device, 0, 0, opt.width, opt.height);
+
+            desktop.reset(source.createDesktopTexture());
+            cursor.reset(source.createCursorTexture());
+            cursorMask.reset(source.createCursorMaskTexture());
+        }
+
+        bool wakesUp() { return waking; }
+
+        bool update(unsigned timeoutMs)
+        {
+            longestWait  = std::max(longestWait, timeoutMs);
+            shortestWait = std::min(shortestWait, timeoutMs);
+
+            if (nextFrame > clock.ms + timeoutMs) {
+                clock.ms += timeoutMs;
+                return false;
+            }
+
+            clock.ms  = std::max(clock.ms, nextFrame);
+            nextFrame = clock.ms + REFRESH_MS;
+
+            bool frameChanged = false;
+            if (source.acquireFrame(0)) {
+                ++acquired;
+                frameChanged = source.updateDesktop(desktop.get());
+                frameChanged = source.updateCursor(cursor.get(), cursorMask.get(), cursorState) || frameChanged;
+            }
+
+            source.releaseFrame();
+
+            changed += frameChanged;
+            return frameChanged;
+        }
+
+        void render() { presents.push_back(clock.ms); }
+
+        // the shortest time between two presents
+        uint64_t closestPresents() const
+        {
+            uint64_t closest = ~uint64_t(0);
+            for (std::size_t i = 1; i < presents.size(); ++i)
+                closest = std::min(closest, presents[i] - presents[i - 1]);
+
+            return closest;
+        }
+    };
+
+    // Runs the render loop scheduling for a minute of simulated time per scenario, and checks
+    // when it presents. Returns whether all checks pass.
+    bool benchScheduler(const options& opt)
+    {
+        const uint64_t DURATION_MS  = 60 * 1000;
+        const unsigned MIN_INTERVAL = 10;
+        const unsigned MAX_WAIT     = 16;
+        const unsigned WAKING_WAIT  = 1000;
+
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        const struct { const char *name; unsigned activity; } scenarios[] = {
+            { "idle",     0 },
+            { "typing",   SyntheticSource::ACTIVITY_TYPING },
+            { "cursor",   SyntheticSource::ACTIVITY_CURSOR },
+            { "selected", opt.activity },
+        };
+
+        for (const auto& scenario : scenarios) {
+            SyntheticSource source(scenario.activity);
+            fake_clock clock;
+            fake_renderer<SyntheticSource> renderer(source, clock, opt);
+            frame_scheduler::scheduler scheduler(MIN_INTERVAL, MAX_WAIT, WAKING_WAIT);
+
+            uint64_t passes = 0;
+            while (clock.now() < DURATION_MS) {
+                frame_scheduler::run_once(scheduler, renderer, clock);
+                ++passes;
+            }
+
+            const frame_scheduler::stats& counts = scheduler.counts();
+            std::printf("%-12s %6.1f s: %8llu passes  %8llu active  %8llu idle  %6.1f presents/s\n",
+                        scenario.name, static_cast<double>(clock.now()) / 1000.0,
+                        static_cast<unsigned long long>(passes),
+                        static_cast<unsigned long long>(counts.active),
+                        static_cast<unsigned long long>(counts.idle),
+                        static_cast<double>(counts.active) * 1000.0 / static_cast<double>(clock.now()));
+
+            std::string name(scenario.name);
+            std::string what = name + ": presents at least the minimum interval apart";
+            check(renderer.closestPresents() >= MIN_INTERVAL, what.c_str());
+
+            what = name + ": presents as often as render() is called";
+            check(renderer.presents.size() == counts.active, what.c_str());
+
+            what = name + ": waits bounded for sources which may poll";
+            check(renderer.longestWait == MAX_WAIT, what.c_str());
+
+            if (scenario.activity == 0) {
+                check(counts.active == 1, "idle: presents exactly once");
+
+                // the view changed, but the source didn't
+                scheduler.invalidate();
+                for (unsigned i = 0; i < 100; ++i)
+                    frame_scheduler::run_once(scheduler, renderer, clock);
+                check(counts.active == 2, "idle: invalidate() redraws exactly once");
+            }
+
+            if (scenario.activity == SyntheticSource::ACTIVITY_TYPING || scenario.activity == SyntheticSource::ACTIVITY_CURSOR) {
+                what = name + ": every frame changes and gets presented";
+                check(renderer.changed == renderer.acquired && counts.active == renderer.acquired &&
+                      renderer.acquired >= DURATION_MS / fake_renderer<SyntheticSource>::REFRESH_MS, what.c_str());
+            }
+        }
+
+        // sources which wake up for everything themselves may block for longer
+        {
+            SyntheticSource source(0);
+            fake_clock clock;
+            fake_renderer<SyntheticSource> renderer(source, clock, opt);
+            frame_scheduler::scheduler scheduler(MIN_INTERVAL, MAX_WAIT, WAKING_WAIT);
+
+            renderer.waking = true;
+            for (unsigned i = 0; i < 100; ++i)
+                frame_scheduler::run_once(scheduler, renderer, clock);
+
+            check(renderer.shortestWait == WAKING_WAIT && renderer.longestWait == WAKING_WAIT,
+                  "waking sources: waits bounded by the longer timeout");
+        }
+
+        std::printf("scheduler %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // A copy of util::get_pixel_from_row, whose header needs windows.h
+    template<unsigned bpp>
+    inline uint8_t getPixelFromRow(const uint8_t *row, int x)
+    {
+        return (row[x * bpp / 8] >> (8 - bpp - (x % (8 / bpp)) * bpp)) & ((1 << bpp) - 1);
+    }
+
+    // The per-pixel loops the cursor kernels replaced, writing into the texture byte by byte.
+    // The two mask textures never had loops of their own, they're written the same way.
+    void referenceMonochrome(const uint8_t *andRow, const uint8_t *xorRow, uint32_t *dst, unsigned width)
+    {
+        for (unsigned col = 0; col < width; ++col) {
+            uint8_t *target = reinterpret_cast<uint8_t*>(dst + col);
+
+            uint8_t alpha = getPixelFromRow<1>(andRow, col) ? 0 : 0xFF;
+            uint8_t rgb   = getPixelFromRow<1>(xorRow, col) ? 0xFF : 0;
+
+            target[0] = rgb;
+            target[1] = rgb;
+            target[2] = rgb;
+            target[3] = alpha;
+        }
+    }
+
+    void referenceMaskedColor(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        for (unsigned col = 0; col < width; ++col) {
+            uint8_t       *target = reinterpret_cast<uint8_t*>(dst + col);
+            const uint8_t *source = src + col * 4;
+
+            target[0] = source[0];
+            target[1] = source[1];
+            target[2] = source[2];
+            target[3] = 0xFF;
+        }
+    }
+
+    void referenceColorMask(const uint8_t *maskRow, uint32_t *dst, unsigned width)
+    {
+        for (unsigned col = 0; col < width; ++col) {
+            uint8_t       *target = reinterpret_cast<uint8_t*>(dst + col);
+            const uint8_t *source = maskRow + col * 4;
+
+            target[3] = 255 - source[0];
+        }
+    }
+
+    void referenceMonochromeMask(const uint8_t *andRow, uint32_t *dst, unsigned width)
+    {
+        for (unsigned col = 0; col < width; ++col) {
+            uint8_t *target = reinterpret_cast<uint8_t*>(dst + col);
+
+            uint8_t rgb = getPixelFromRow<1>(andRow, col) ? 0xFF : 0;
+
+            target[0] = rgb;
+            target[1] = rgb;
+            target[2] = rgb;
+            target[3] = 0xFF;
+        }
+    }
+
+    void referenceMaskedColorMask(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        for (unsigned col = 0; col < width; ++col) {
+            uint8_t       *target = reinterpret_cast<uint8_t*>(dst + col);
+            const uint8_t *source = src + col * 4;
+
+            target[0] = source[3];
+            target[1] = source[3];
+            target[2] = source[3];
+            target[3] = 0xFF;
+        }
+    }
+
+    // PShaderCursor and the blend state of the renderer on one pixel, the textures being 8 bit
+    // unorm: |desktop * mask - color| in rgb, blended over the desktop by the alpha of the mask
+    uint32_t shadeCursorPixel(uint32_t desktop, uint32_t color, uint32_t mask)
+    {
+        float    alpha = static_cast<float>(mask >> 24) / 255.0f;
+        uint32_t out   = 0;
+
+        for (unsigned shift = 0; shift < 24; shift += 8) {
+            float d = static_cast<float>((desktop >> shift) & 0xFF) / 255.0f;
+            float m = static_cast<float>((mask    >> shift) & 0xFF) / 255.0f;
+            float c = static_cast<float>((color   >> shift) & 0xFF) / 255.0f;
+
+            float shaded  = std::fabs(d * m - c);
+            float blended = shaded * alpha + d * (1.0f - alpha);
+
+            out |= static_cast<uint32_t>(blended * 255.0f + 0.5f) << shift;
+        }
+
+        return out;
+    }
+
+    // Checks every kernel set the CPU supports against the per-pixel loops they replaced, at
+    // every row width from 1 to 70 pixels so that all of the remainders are covered, then
+    // converts full 256x256 cursors with each of them. Returns whether all checks pass.
+    bool benchCursor(const options& opt)
+    {
+        const unsigned SIZE      = 256;
+        const unsigned MAX_WIDTH = 70;
+        const uint32_t GUARD     = 0xDEADBEEFu;
+
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        std::vector<uint8_t>  andMask(SIZE * SIZE / 8), xorMask(SIZE * SIZE / 8), color(4 * SIZE * SIZE);
+        std::vector<uint32_t> target(SIZE * SIZE);
+
+        std::srand(42);
+        for (uint8_t& b : andMask) b = static_cast<uint8_t>(std::rand());
+        for (uint8_t& b : xorMask) b = static_cast<uint8_t>(std::rand());
+        for (uint8_t& b : color)   b = static_cast<uint8_t>(std::rand());
+
+        // masked color cursors have either 0 or 0xFF in their alpha bytes
+        std::vector<uint8_t> maskedColor(color);
+        for (std::size_t i = 3; i < maskedColor.size(); i += 4)
+            maskedColor[i] = maskedColor[i] & 1 ? 0xFF : 0;
+
+        const struct { const char *name; cursor::isa id; } sets[] = {
+            { "scalar", cursor::isa::scalar },
+            { "sse2",   cursor::isa::sse2 },
+            { "avx2",   cursor::isa::avx2 },
+        };
+
+        typedef std::function<void(uint32_t *, unsigned)> row_kernel;
+
+        for (const auto& set : sets) {
+            const cursor::kernels *k = cursor::kernels_for(set.id);
+            if (!k) {
+                std::printf("%-8s not supported\n", set.name);
+                continue;
+            }
+
+            // each width reads its row from a different place of the sources
+            const struct { const char *name; row_kernel kernel, reference; } kernels[] = {
+                { "monochrome",
+                  [&](uint32_t *dst, unsigned w) { k->expand_monochrome(&andMask[w], &xorMask[w], dst, w); },
+                  [&](uint32_t *dst, unsigned w) { referenceMonochrome(&andMask[w], &xorMask[w], dst, w); } },
+                { "masked color",
+                  [&](uint32_t *dst, unsigned w) { k->expand_masked_color(&maskedColor[4 * w], dst, w); },
+                  [&](uint32_t *dst, unsigned w) { referenceMaskedColor(&maskedColor[4 * w], dst, w); } },
+                { "color mask",
+                  [&](uint32_t *dst, unsigned w) { k->apply_color_mask(&color[4 * w], dst, w); },
+                  [&](uint32_t *dst, unsigned w) { referenceColorMask(&color[4 * w], dst, w); } },
+                { "monochrome mask",
+                  [&](uint32_t *dst, unsigned w) { k->expand_monochrome_mask(&andMask[w], dst, w); },
+                  [&](uint32_t *dst, unsigned w) { referenceMonochromeMask(&andMask[w], dst, w); } },
+                { "masked color mask",
+                  [&](uint32_t *dst, unsigned w) { k->expand_masked_color_mask(&maskedColor[4 * w], dst, w); },
+                  [&](uint32_t *dst, unsigned w) { referenceMaskedColorMask(&maskedColor[4 * w], dst, w); } },
+            };
+
+            for (const auto& kernel : kernels) {
+                bool exact = true;
+
+                for (unsigned w = 1; w <= MAX_WIDTH; ++w) {
+                    // the color mask keeps the color of the texture, start from something other than zero
+                    std::vector<uint32_t> expected(w + 1, GUARD), got(w + 1, GUARD);
+                    for (unsigned x = 0; x < w; ++x)
+                        expected[x] = got[x] = 0x01020304u * (x + w);
+
+                    kernel.reference(expected.data(), w);
+                    kernel.kernel(got.data(), w);
+
+                    exact = exact && expected == got;
+                }
+
+                std::string what = std::string(set.name) + " " + kernel.name + " like the per-pixel loop at widths 1 to 70";
+                check(exact, what.c_str());
+            }
+
+            double mpixels = static_cast<double>(SIZE) * SIZE * opt.frames / 1e6;
+
+            bench_clock::time_point start = bench_clock::now();
+            for (unsigned i = 0; i < opt.frames; ++i)
+                for (unsigned row = 0; row < SIZE; ++row)
+                    k->expand_monochrome(&andMask[row * SIZE / 8], &xorMask[row * SIZE / 8], &target[row * SIZE], SIZE);
+            double monochrome = mpixels / std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            start = bench_clock::now();
+            for (unsigned i = 0; i < opt.frames; ++i)
+                for (unsigned row = 0; row < SIZE; ++row)
+                    k->expand_masked_color(&color[4 * row * SIZE], &target[row * SIZE], SIZE);
+            double masked = mpixels / std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            start = bench_clock::now();
+            for (unsigned i = 0; i < opt.frames; ++i)
+                for (unsigned row = 0; row < SIZE; ++row)
+                    k->apply_color_mask(&color[4 * row * SIZE], &target[row * SIZE], SIZE);
+            double mask = mpixels / std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            // the AND masks for the XOR cursor shader
+            start = bench_clock::now();
+            for (unsigned i = 0; i < opt.frames; ++i)
+                for (unsigned row = 0; row < SIZE; ++row) {
+                    k->expand_monochrome_mask(&andMask[row * SIZE / 8], &target[row * SIZE], SIZE);
+                    k->expand_masked_color_mask(&color[4 * row * SIZE], &target[row * SIZE], SIZE);
+                }
+            double andMasks = 2.0 * mpixels / std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            std::printf("%-8s monochrome %8.1f MPixel/s  masked color %8.1f MPixel/s  color mask %8.1f MPixel/s  and masks %8.1f MPixel/s\n",
+                        set.name, monochrome, masked, mask, andMasks);
+        }
+
+        // cursors with AND and XOR masks composited over a few backgrounds from the packed
+        // textures, against doing AND and XOR on the bytes
+        {
+            const unsigned W = 32, H = 32;
+
+            const cursor::kernels& k = cursor::best_kernels();
+
+            std::vector<std::vector<uint32_t>> backgrounds(4, std::vector<uint32_t>(W * H));
+            for (unsigned i = 0; i < W * H; ++i) {
+                backgrounds[0][i] = 0;
+                backgrounds[1][i] = 0xFFFFFF;
+                backgrounds[2][i] = (i % W * 8) | (i / W * 8) << 8 | ((i % W + i / W) * 4) << 16;
+                backgrounds[3][i] = static_cast<uint32_t>(std::rand()) & 0xFFFFFF;
+            }
+
+            // monochrome: transparent, inverting, black and white pixels
+            std::vector<uint8_t> andBits(W * H / 8), xorBits(W * H / 8);
+            for (unsigned i = 0; i < W * H / 8; ++i) {
+                andBits[i] = static_cast<uint8_t>(std::rand());
+                xorBits[i] = static_cast<uint8_t>(std::rand());
+            }
+
+            // masked color: colors where the mask is clear, black or white where it inverts
+            std::vector<uint8_t> masked(4 * W * H);
+            for (unsigned i = 0; i < W * H; ++i) {
+                bool inverting = std::rand() % 2;
+                uint32_t pixel = inverting ? (std::rand() % 2 ? 0xFF000000u | 0xFFFFFF : 0xFF000000u)
+                                           : static_cast<uint32_t>(std::rand()) & 0xFFFFFF;
+                std::memcpy(&masked[4 * i], &pixel, 4);
+            }
+
+            std::vector<uint32_t> color(W * H), mask(W * H);
+            bool monochromeExact = true, maskedExact = true;
+
+            for (unsigned row = 0; row < H; ++row) {
+                k.expand_monochrome(&andBits[row * W / 8], &xorBits[row * W / 8], &color[row * W], W);
+                k.expand_monochrome_mask(&andBits[row * W / 8], &mask[row * W], W);
+            }
+            for (const std::vector<uint32_t>& desktop : backgrounds) {
+                for (unsigned i = 0; i < W * H; ++i) {
+                    uint32_t andMask = getPixelFromRow<1>(&andBits[i / W * W / 8], i % W) ? 0xFFFFFF : 0;
+                    uint32_t xorMask = getPixelFromRow<1>(&xorBits[i / W * W / 8], i % W) ? 0xFFFFFF : 0;
+
+                    monochromeExact = monochromeExact && shadeCursorPixel(desktop[i], color[i], mask[i]) == ((desktop[i] & andMask) ^ xorMask);
+                }
+            }
+            check(monochromeExact, "monochrome cursors composited as desktop AND mask XOR color");
+
+            for (unsigned row = 0; row < H; ++row) {
+                k.expand_masked_color(&masked[4 * row * W], &color[row * W], W);
+                k.expand_masked_color_mask(&masked[4 * row * W], &mask[row * W], W);
+            }
+            for (const std::vector<uint32_t>& desktop : backgrounds) {
+                for (unsigned i = 0; i < W * H; ++i) {
+                    uint32_t pixel;
+                    std::memcpy(&pixel, &masked[4 * i], 4);
+
+                    uint32_t andMask = pixel >> 24 ? 0xFFFFFF : 0;
+                    maskedExact = maskedExact && shadeCursorPixel(desktop[i], color[i], mask[i]) == ((desktop[i] & andMask) ^ (pixel & 0xFFFFFF));
+                }
+            }
+            check(maskedExact, "masked color cursors composited as desktop AND mask XOR color");
+        }
+
+        // the per-pixel loop, for comparison
+        {
+            double mpixels = static_cast<double>(SIZE) * SIZE * opt.frames / 1e6;
+
+            bench_clock::time_point start = bench_clock::now();
+            for (unsigned i = 0; i < opt.frames; ++i)
+                for (unsigned row = 0; row < SIZE; ++row)
+                    referenceMonochrome(&andMask[row * SIZE / 8], &xorMask[row * SIZE / 8], &target[row * SIZE], SIZE);
+            double monochrome = mpixels / std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            std::printf("%-8s monochrome %8.1f MPixel/s\n", "loop", monochrome);
+        }
+
+        std::printf("cursor   %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // The levels of a thumbnail pyramid in system memory, level 0 is the desktop itself
+    struct cpu_pyramid {
+        std::vector<cpu_surface> levels;
+
+        cpu_pyramid(int width, int height)
+        {
+            for (unsigned i = 1; i <= pyramid::MAX_LEVELS; ++i)
+                levels.emplace_back(pyramid::level_extent(width, i), pyramid::level_extent(height, i));
+        }
+
+        // Downsamples @a rects of @a desktop through all levels, returns the pixels written
+        uint64_t update(const pyramid::kernels& k, const cpu_surface& desktop, std::vector<damage::rect> rects)
+        {
+            uint64_t pixels = 0;
+            const cpu_surface *source = &desktop;
+
+            for (cpu_surface& level : levels) {
+                pyramid::next_level_damage(rects, level.width, level.height);
+
+                for (const damage::rect& r : rects) {
+                    pyramid::downsample(k, source->pixels.data(), source->pitch, source->width, source->height,
+                                        level.pixels.data(), level.pitch, r);
+                    pixels += static_cast<uint64_t>(damage::area(r));
+                }
+
+                source = &level;
+            }
+
+            return pixels;
+        }
+    };
+
+    // Builds thumbnail pyramids of full 1080p and 4K desktops with every kernel set, then keeps
+    // one up to date over the damage of the synthetic desktop
+    bool benchPyramid(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        const struct { int width; int height; } sizes[] = {
+            { 1920, 1080 },
+            { 3840, 2160 },
+            { opt.width, opt.height },
+        };
+
+        const struct { const char *name; pyramid::isa id; } sets[] = {
+            { "scalar", pyramid::isa::scalar },
+            { "sse2",   pyramid::isa::sse2 },
+            { "avx2",   pyramid::isa::avx2 },
+        };
+
+        const unsigned rounds = std::max(1u, opt.frames / 20);
+
+        for (const auto& size : sizes) {
+            if (&size == &sizes[2] && ((size.width == 1920 && size.height == 1080) || (size.width == 3840 && size.height == 2160)))
+                continue;
+
+            cpu_surface desktop(size.width, size.height);
+            for (uint8_t& b : desktop.pixels)
+                b = static_cast<uint8_t>(std::rand());
+
+            std::vector<damage::rect> all(1, desktop.bounds());
+            std::unique_ptr<cpu_pyramid> reference;
+
+            for (const auto& set : sets) {
+                const pyramid::kernels *k = pyramid::kernels_for(set.id);
+                if (!k) {
+                    std::printf("%-8s not supported\n", set.name);
+                    continue;
+                }
+
+                std::unique_ptr<cpu_pyramid> levels(new cpu_pyramid(size.width, size.height));
+
+                uint64_t pixels = 0;
+                bench_clock::time_point start = bench_clock::now();
+                for (unsigned i = 0; i < rounds; ++i)
+                    pixels += levels->update(*k, desktop, all);
+                double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+                if (!reference) {
+                    reference = std::move(levels);
+                } else {
+                    bool exact = true;
+                    for (unsigned i = 0; i < pyramid::MAX_LEVELS; ++i)
+                        exact = exact && levels->levels[i].pixels == reference->levels[i].pixels;
+
+                    std::string what = std::string(set.name) + " pyramid like the scalar one";
+                    check(exact, what.c_str());
+                }
+
+                // the source pixels read per second are what counts
+                std::printf("%-8s %dx%d full pyramid %8.2f ms  %8.1f MPixel/s\n",
+                            set.name, size.width, size.height,
+                            1000.0 * seconds / rounds,
+                            4.0 * static_cast<double>(pixels) / seconds / 1e6);
+            }
+        }
+
+        // incremental updates over the regions the synthetic desktop changes, against rebuilding
+        SyntheticSource source(opt.activity);
+        cpu_device device;
+        source.reinit(&device, 0, 0, opt.width, opt.height);
+
+        std::unique_ptr<cpu_surface> desktop(source.createDesktopTexture());
+        cpu_pyramid levels(opt.width, opt.height);
+        std::vector<damage::rect> rects;
+
+        double incremental = 0.0;
+        uint64_t pixels = 0;
+
+        for (unsigned i = 0; i < opt.frames; ++i) {
+            source.acquireFrame(0);
+
+            rects.clear();
+            if (source.updateDesktop(desktop.get()) && !source.desktopDamage(rects))
+                rects.assign(1, desktop->bounds());
+
+            source.releaseFrame();
+
+            bench_clock::time_point start = bench_clock::now();
+            pixels += levels.update(pyramid::best_kernels(), *desktop, rects);
+            incremental += std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+        }
+
+        std::vector<damage::rect> all(1, desktop->bounds());
+        cpu_pyramid               rebuilt(opt.width, opt.height);
+        bench_clock::time_point   start = bench_clock::now();
+        rebuilt.update(pyramid::best_kernels(), *desktop, all);
+        double full = std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+
+        bool same = true;
+        for (unsigned i = 0; i < pyramid::MAX_LEVELS; ++i)
+            same = same && levels.levels[i].pixels == rebuilt.levels[i].pixels;
+        check(same, "incremental updates like a full rebuild");
+
+        std::printf("damage   %dx%d activity %u: %8.1f us/frame incremental  %8.1f us full rebuild  %8.0f pixels/frame\n",
+                    opt.width, opt.height, opt.activity,
+                    incremental / opt.frames, full,
+                    static_cast<double>(pixels) / opt.frames);
+
+        std::printf("pyramid  %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // Checks the histogram buckets, the rolling window and collecting the recorders of several
+    // threads, and measures the cost of recording and collecting. Returns whether all checks pass.
+    bool benchStats(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        const uint64_t SLOT_US   = stats::SLOT_MS * 1000;
+        const uint64_t WINDOW_US = stats::WINDOW_SLOTS * SLOT_US;
+
+        // bucket 0: < 1us, bucket i: [2^(i-1), 2^i) us, the last one is open ended
+        {
+            bool bucketed = stats::bucket_for(0) == 0 && stats::bucket_for(1) == 1;
+
+            for (unsigned k = 1; k < stats::BUCKETS - 1; ++k) {
+                uint64_t power = uint64_t(1) << k;
+                bucketed = bucketed && stats::bucket_for(power - 1) == k && stats::bucket_for(power) == k + 1;
+            }
+            check(bucketed, "buckets: 0, 1, 2^k-1 and 2^k");
+
+            uint64_t last = uint64_t(1) << (stats::BUCKETS - 1);
+            check(stats::bucket_for(last) == stats::BUCKETS - 1 && stats::bucket_for(last * 1000) == stats::BUCKETS - 1 &&
+                  stats::bucket_for(~uint64_t(0)) == stats::BUCKETS - 1, "buckets: everything above in the last one");
+        }
+
+        // the window
+        {
+            stats::rolling_histogram histogram;
+            SV_Histogram             out;
+
+            auto read = [&](uint64_t nowUs) {
+                std::memset(&out, 0, sizeof(out));
+                histogram.add_to(out, nowUs);
+            };
+
+            histogram.record(100, 300);
+            histogram.record(SLOT_US + 100, 5);
+
+            read(SLOT_US + 200);
+            check(out.count == 2 && out.total_us == 305 && out.max_us == 300 &&
+                  out.buckets[stats::bucket_for(300)] == 1 && out.buckets[stats::bucket_for(5)] == 1, "window: two slots summed up");
+
+            read(WINDOW_US - 1);
+            check(out.count == 2, "window: the first slot kept until the window has passed");
+
+            read(WINDOW_US);
+            check(out.count == 1 && out.max_us == 5, "window: the first slot expired");
+
+            read(WINDOW_US + SLOT_US);
+            check(out.count == 0 && out.max_us == 0, "window: everything expired");
+
+            // the first slot again, a whole window later, next to the second one which is still in it
+            histogram.record(WINDOW_US + 50, 7);
+            read(WINDOW_US + 60);
+            check(out.count == 2 && out.total_us == 12 && out.max_us == 7 && out.buckets[stats::bucket_for(300)] == 0,
+                  "window: a reused slot starts over");
+
+            read(50);
+            check(out.count == 0, "window: slots ahead of the time skipped");
+        }
+
+        SV_Stats before, after;
+        before.size = after.size = sizeof(SV_Stats);
+
+        // what the recorders which are gone have counted
+        {
+            stats::collect(before, 0);
+            {
+                stats::recorder gone;
+                gone.count(stats::FRAMES_ACQUIRED, 5);
+                gone.count(stats::ACCUMULATED_FRAMES, 9);
+                gone.time(SV_STAGE_COPY, 100, 10);
+
+                stats::collect(after, 100);
+                check(after.frames_acquired == before.frames_acquired + 5 && after.stages[SV_STAGE_COPY].count == before.stages[SV_STAGE_COPY].count + 1,
+                      "retired: counted while alive");
+            }
+            stats::collect(after, 100);
+            check(after.frames_acquired == before.frames_acquired + 5 && after.accumulated_frames == before.accumulated_frames + 9,
+                  "retired: counters kept once the recorder is gone");
+            check(after.stages[SV_STAGE_COPY].count == before.stages[SV_STAGE_COPY].count, "retired: histograms gone with the recorder");
+        }
+
+        // several threads, each with a recorder of its own
+        {
+            const unsigned THREADS = 4;
+            const unsigned FRAMES  = 1000;
+
+            std::mutex              mutex;
+            std::condition_variable cv;
+            unsigned                recorded = 0;
+            bool                    collected = false;
+
+            stats::collect(before, 0);
+
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < THREADS; ++t) {
+                threads.emplace_back([&, t] {
+                    stats::recorder mine;
+                    stats::recorder::set_current(&mine);
+
+                    for (unsigned i = 0; i < FRAMES; ++i) {
+                        stats::count(stats::FRAMES_PRESENTED);
+                        stats::time(SV_STAGE_PRESENT, i, t + 1);
+                    }
+
+                    // stay alive until the main thread collected
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ++recorded;
+                    cv.notify_all();
+                    cv.wait(lock, [&] { return collected; });
+
+                    stats::recorder::set_current(nullptr);
+                });
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return recorded == THREADS; });
+            }
+
+            stats::collect(after, FRAMES);
+            check(after.frames_presented == before.frames_presented + THREADS * FRAMES, "threads: counters summed up");
+            check(after.stages[SV_STAGE_PRESENT].count == before.stages[SV_STAGE_PRESENT].count + THREADS * FRAMES &&
+                  after.stages[SV_STAGE_PRESENT].total_us == before.stages[SV_STAGE_PRESENT].total_us + FRAMES * THREADS * (THREADS + 1) / 2 &&
+                  after.stages[SV_STAGE_PRESENT].max_us == THREADS, "threads: histograms summed up");
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                collected = true;
+            }
+            cv.notify_all();
+
+            for (std::thread& t : threads)
+                t.join();
+
+            stats::collect(after, FRAMES);
+            check(after.frames_presented == before.frames_presented + THREADS * FRAMES, "threads: counters kept once the threads are gone");
+        }
+
+        stats::recorder recorder;
+        stats::recorder::set_current(&recorder);
+
+        const unsigned records = opt.frames * 1000;
+        uint64_t nowUs = 0;
+
+        bench_clock::time_point start = bench_clock::now();
+        for (unsigned i = 0; i < records; ++i) {
+            nowUs += 16667;
+            stats::time(SV_STAGE_DRAW, nowUs, i & 0xFFF);
+            stats::count(stats::FRAMES_PRESENTED);
+        }
+        double record = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / records;
+
+        SV_Stats out;
+        out.size = sizeof(out);
+
+        const unsigned collects = opt.frames;
+
+        start = bench_clock::now();
+        for (unsigned i = 0; i < collects; ++i)
+            stats::collect(out, nowUs);
+        double collect = std::chrono::duration<double, std::micro>(bench_clock::now() - start).count() / collects;
+
+        stats::recorder::set_current(nullptr);
+
+        std::printf("record %6.1f ns  collect %6.2f us  (presented %llu, drawn in window %llu, max %llu us)\n",
+                    record, collect,
+                    static_cast<unsigned long long>(out.frames_presented),
+                    static_cast<unsigned long long>(out.stages[SV_STAGE_DRAW].count),
+                    static_cast<unsigned long long>(out.stages[SV_STAGE_DRAW].max_us));
+
+        // 16.667 ms apart, the window holds the current slot and the nine full ones before it
+        check(out.stages[SV_STAGE_DRAW].count >= (WINDOW_US - SLOT_US) / 16667 &&
+              out.stages[SV_STAGE_DRAW].count <= WINDOW_US / 16667 + 1, "benchmark: the window holds the last ten seconds");
+
+        std::printf("stats    %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // What the log handler has seen, checked after the drain thread stopped
+    struct log_check {
+        std::vector<long> last;     // per producer, the last sequence number delivered
+        uint64_t          received = 0;
+        uint64_t          reorders = 0;
+        uint64_t          dropReports = 0;
+        uint64_t          dropped  = 0;
+    };
+
+    void checkLogMessage(const char *message, void *userdata)
+    {
+        log_check *check = static_cast<log_check*>(userdata);
+
+        unsigned           producer;
+        long               sequence;
+        unsigned long long dropped;
+
+        if (std::sscanf(message, "producer %u message %ld", &producer, &sequence) == 2 && producer < check->last.size()) {
+            if (sequence <= check->last[producer])
+                ++check->reorders;
+
+            check->last[producer] = sequence;
+            ++check->received;
+        } else if (std::sscanf(message, "Logger: dropped %llu messages", &dropped) == 1) {
+            ++check->dropReports;
+            check->dropped += dropped;
+        }
+    }
+
+    // Several threads logging as fast as they can, through the asynchronous logger and,
+    // for comparison, through a handler behind a mutex like the synchronous logger
+    bool benchLogger(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        const unsigned producers = 4;
+        const unsigned messages  = opt.frames * 100;
+        const unsigned capacities[] = { 256, 65536 };
+
+        for (unsigned capacity : capacities) {
+            log_check log;
+            log.last.assign(producers, -1);
+
+            async_log::drain drain(checkLogMessage, &log, capacity);
+            drain.start();
+
+            bench_clock::time_point start = bench_clock::now();
+
+            std::vector<std::thread> threads;
+            for (unsigned p = 0; p < producers; ++p) {
+                threads.emplace_back([&drain, p, messages]() {
+                    char text[64];
+
+                    for (unsigned i = 0; i < messages; ++i) {
+                        int length = std::snprintf(text, sizeof(text), "producer %u message %u", p, i);
+                        drain.post(text, static_cast<std::size_t>(length));
+                    }
+                });
+            }
+
+            for (std::thread& t : threads)
+                t.join();
+
+            double post = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / messages;
+
+            drain.stop();
+
+            uint64_t sent = static_cast<uint64_t>(producers) * messages;
+            check(log.reorders == 0, "async: messages of a thread in order");
+            check(log.dropped == drain.dropped(), "async: drops reported as counted");
+            check(log.received + log.dropped == sent, "async: every message delivered or reported dropped");
+
+            std::printf("async   ring %6u  %u threads  %7.1f ns/message per thread  delivered %llu  dropped %llu\n",
+                        capacity, producers, post,
+                        static_cast<unsigned long long>(log.received),
+                        static_cast<unsigned long long>(drain.dropped()));
+        }
+
+        // posting on while the drain stops, as a thread can after SV_SetLogMode switched back,
+        // into a ring which never fills up
+        {
+            const unsigned stopping = 10000;
+
+            log_check log;
+            log.last.assign(producers, -1);
+
+            async_log::drain drain(checkLogMessage, &log, producers * stopping);
+            drain.start();
+
+            std::atomic<unsigned> posted(0);
+            std::atomic<bool>     stopped(false);
+
+            std::vector<std::thread> threads;
+            for (unsigned p = 0; p < producers; ++p) {
+                threads.emplace_back([&drain, &posted, &stopped, p, stopping]() {
+                    char text[64];
+
+                    for (unsigned i = 0; i < stopping; ++i) {
+                        // the last ones surely after stop() returned
+                        if (i == stopping - 100) {
+                            while (!stopped.load(std::memory_order_acquire))
+                                std::this_thread::yield();
+                        }
+
+                        int length = std::snprintf(text, sizeof(text), "producer %u message %u", p, i);
+                        drain.post(text, static_cast<std::size_t>(length));
+                        posted.fetch_add(1, std::memory_order_relaxed);
+                    }
+                });
+            }
+
+            while (posted.load(std::memory_order_relaxed) < producers * stopping / 2)
+                std::this_thread::yield();
+
+            drain.stop();
+            stopped.store(true, std::memory_order_release);
+
+            for (std::thread& t : threads)
+                t.join();
+
+            check(drain.dropped() == 0 && log.dropped == 0 && log.received == static_cast<uint64_t>(producers) * stopping,
+                  "stopping: messages posted after stop() delivered");
+            check(log.reorders == 0, "stopping: messages of a thread in order");
+        }
+
+        {
+            log_check  log;
+            std::mutex mutex;
+            log.last.assign(producers, -1);
+
+            bench_clock::time_point start = bench_clock::now();
+
+            std::vector<std::thread> threads;
+            for (unsigned p = 0; p < producers; ++p) {
+                threads.emplace_back([&log, &mutex, p, messages]() {
+                    char text[64];
+
+                    for (unsigned i = 0; i < messages; ++i) {
+                        std::snprintf(text, sizeof(text), "producer %u message %u", p, i);
+
+                        std::lock_guard<std::mutex> guard(mutex);
+                        checkLogMessage(text, &log);
+                    }
+                });
+            }
+
+            for (std::thread& t : threads)
+                t.join();
+
+            double call = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / messages;
+
+            std::printf("sync     mutex         %u threads  %7.1f ns/message per thread  delivered %llu\n",
+                        producers, call, static_cast<unsigned long long>(log.received));
+
+            check(log.received == static_cast<uint64_t>(producers) * messages && log.reorders == 0,
+                  "sync: every message delivered in order");
+        }
+
+        std::printf("logger   %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // The shared state of the ring handoff check: tiny "textures" of 64x64 pixels, which
+    // only the producer writes, and the checksum each slot had when it was committed
+    struct ring_check {
+        static const int SIZE = 64;
+
+        frame_ring::ring      ring;
+        std::vector<uint32_t> slots[frame_ring::MAX_SLOTS];
+        uint64_t              checksums[frame_ring::MAX_SLOTS] = {};
+        std::atomic<bool>     done;
+
+        ring_check() : ring(frame_ring::DEFAULT_SLOTS)
+        {
+            for (std::vector<uint32_t>& slot : slots)
+                slot.assign(SIZE * SIZE, 0);
+
+            done.store(false);
+        }
+    };
+
+    uint64_t checksum(const std::vector<uint32_t>& pixels)
+    {
+        uint64_t sum = 1469598103934665603ull;
+
+        for (uint32_t p : pixels)
+            sum = (sum ^ p) * 1099511628211ull;
+
+        return sum;
+    }
+
+    // Captures @a frames frames, each changing a few random rects, and publishes them the way
+    // OutputHub::captureLoop does, with the fence passing one frame later. Returns the number
+    // of slots whose damage based refresh didn't match the desktop.
+    unsigned produceRingFrames(ring_check& check, unsigned frames)
+    {
+        const int SIZE = ring_check::SIZE;
+
+        std::minstd_rand          random(7);
+        std::vector<uint32_t>     desktop(SIZE * SIZE, 0);
+        std::vector<damage::rect> changed, rects;
+        int                       pending = -1;
+        bool                      dirty   = false;
+        unsigned                  errors  = 0;
+
+        for (unsigned frame = 1; frame <= frames; ++frame) {
+            changed.clear();
+
+            // a capture takes a while, which lets the views interleave
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+
+            for (unsigned i = random() % 4; i > 0; --i) {
+                int x = static_cast<int>(random() % SIZE), y = static_cast<int>(random() % SIZE);
+                damage::rect r = { x, y, std::min(SIZE, x + 1 + static_cast<int>(random() % 16)),
+                                         std::min(SIZE, y + 1 + static_cast<int>(random() % 16)) };
+
+                for (int py = r.top; py < r.bottom; ++py)
+                    for (int px = r.left; px < r.right; ++px)
+                        desktop[py * SIZE + px] = frame;
+
+                changed.push_back(r);
+            }
+
+            if (!changed.empty()) {
+                // now and then, the source can't tell what changed
+                check.ring.add_damage(random() % 64 ? &changed : nullptr);
+                dirty = true;
+            }
+
+            if (pending >= 0) {
+                check.ring.commit(pending);
+                pending = -1;
+            }
+
+            if (!dirty)
+                continue;
+
+            bool full = true;
+            rects.clear();
+
+            int slot = check.ring.begin_write(rects, full);
+            if (slot < 0)
+                continue;
+
+            std::vector<uint32_t>& pixels = check.slots[slot];
+
+            if (full)
+                pixels = desktop;
+
+            for (const damage::rect& r : rects)
+                for (int py = r.top; py < r.bottom; ++py)
+                    for (int px = r.left; px < r.right; ++px)
+                        pixels[py * SIZE + px] = desktop[py * SIZE + px];
+
+            if (pixels != desktop)
+                ++errors;
+
+            check.checksums[slot] = checksum(pixels);
+            pending = slot;
+            dirty   = false;
+
+        }
+
+        if (pending >= 0)
+            check.ring.commit(pending);
+
+        return errors;
+    }
+
+    // Hands frames from a mock capture thread to mock views, checking that no slot changes
+    // while a view holds it, that views never go back in time, and that the damage based
+    // slot refreshes are right. Then compares capture and present in sequence against the
+    // pipelined handoff, with sleeps standing in for both.
+    bool benchRing(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        {
+            const unsigned readers = 3;
+            const unsigned frames  = opt.frames * 5;
+
+            ring_check            shared;
+            std::atomic<uint64_t> torn, backwards, seen;
+            torn.store(0);
+            backwards.store(0);
+            seen.store(0);
+
+            std::vector<std::thread> threads;
+            for (unsigned r = 0; r < readers; ++r) {
+                threads.emplace_back([&shared, &torn, &backwards, &seen, r]() {
+                    std::minstd_rand random(r + 1);
+                    uint64_t         last = 0;
+
+                    while (!shared.done.load()) {
+                        uint64_t frame;
+                        int      slot = shared.ring.acquire(frame);
+
+                        // like a view, only draw new frames
+                        if (slot < 0 || frame == last) {
+                            if (slot >= 0)
+                                shared.ring.release(slot);
+
+                            std::this_thread::yield();
+                            continue;
+                        }
+
+                        if (frame < last)
+                            backwards.fetch_add(1);
+
+                        seen.fetch_add(1);
+                        last = frame;
+
+                        // "draw" for a while, the slot must not change meanwhile
+                        uint64_t before = checksum(shared.slots[slot]);
+                        for (unsigned i = random() % 8; i > 0; --i)
+                            std::this_thread::yield();
+
+                        if (before != shared.checksums[slot] || checksum(shared.slots[slot]) != before)
+                            torn.fetch_add(1);
+
+                        shared.ring.release(slot);
+                    }
+                });
+            }
+
+            unsigned errors = produceRingFrames(shared, frames);
+
+            shared.done.store(true);
+            for (std::thread& t : threads)
+                t.join();
+
+            check(!errors, "handoff: refreshed slots hold the latest frame");
+            check(!torn.load(), "handoff: slots not written while drawn");
+            check(!backwards.load(), "handoff: frames only go forward");
+
+            std::printf("handoff   %u frames  %u views  committed %llu  views drew %llu  slots busy %llu\n",
+                        frames, readers,
+                        static_cast<unsigned long long>(shared.ring.latest_frame()),
+                        static_cast<unsigned long long>(seen.load()),
+                        static_cast<unsigned long long>(shared.ring.busy()));
+        }
+
+        {
+            const std::chrono::microseconds CAPTURE(4000), PRESENT(6000);
+            const unsigned frames = 200;
+
+            bench_clock::time_point start = bench_clock::now();
+            for (unsigned i = 0; i < frames; ++i) {
+                std::this_thread::sleep_for(CAPTURE);
+                std::this_thread::sleep_for(PRESENT);
+            }
+            double serial = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            frame_ring::ring      ring(frame_ring::DEFAULT_SLOTS);
+            std::atomic<bool>     done;
+            std::atomic<unsigned> presented;
+            done.store(false);
+            presented.store(0);
+
+            start = bench_clock::now();
+
+            std::thread view([&ring, &done, &presented, PRESENT]() {
+                uint64_t last = 0;
+
+                while (!done.load()) {
+                    uint64_t frame;
+                    int      slot = ring.acquire(frame);
+
+                    if (slot < 0 || frame == last) {
+                        if (slot >= 0)
+                            ring.release(slot);
+
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                        continue;
+                    }
+
+                    std::this_thread::sleep_for(PRESENT);
+                    ring.release(slot);
+
+                    last = frame;
+                    presented.fetch_add(1);
+                }
+            });
+
+            std::vector<damage::rect> rects;
+            bool full;
+
+            while (presented.load() < frames) {
+                std::this_thread::sleep_for(CAPTURE);
+
+                rects.clear();
+                int slot = ring.begin_write(rects, full);
+                if (slot >= 0)
+                    ring.commit(slot);
+            }
+
+            double pipelined = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            done.store(true);
+            view.join();
+
+            std::printf("capture %lld us + present %lld us: serial %6.1f frames/s  pipelined %6.1f frames/s\n",
+                        static_cast<long long>(CAPTURE.count()), static_cast<long long>(PRESENT.count()),
+                        static_cast<double>(frames) / serial, static_cast<double>(frames) / pipelined);
+        }
+
+        std::printf("ring     %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    struct chrono_clock {
+        uint64_t now_us()
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now().time_since_epoch()).count());
+        }
+    };
+
+    // Draws a random desktop into views of several sizes with every kernel set, checks that all
+    // of them produce the same pixels, then runs CpuRenderer over the synthetic desktop
+    bool benchRaster(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        const struct { int width; int height; } views[] = {
+            { opt.width, opt.height },         // 1:1, an exact copy
+            { opt.width / 2, opt.height / 2 },
+            { 1280, 720 },
+            { 320, 180 },
+            { opt.width * 4 / 3, opt.height * 4 / 3 },
+        };
+
+        const struct { const char *name; cpu_raster::isa id; } sets[] = {
+            { "scalar", cpu_raster::isa::scalar },
+            { "sse2",   cpu_raster::isa::sse2 },
+            { "avx2",   cpu_raster::isa::avx2 },
+        };
+
+        cpu_surface desktop(opt.width, opt.height);
+        for (uint8_t& b : desktop.pixels)
+            b = static_cast<uint8_t>(std::rand());
+
+        cpu_surface cursor(256, 256);
+        for (uint8_t& b : cursor.pixels)
+            b = static_cast<uint8_t>(std::rand());
+
+        const unsigned rounds = std::max(1u, opt.frames / 20);
+
+        for (const auto& size : views) {
+            cpu_surface reference;
+            cpu_raster::quad screen = { 0.0f, 0.0f, static_cast<float>(size.width), static_cast<float>(size.height) };
+            cpu_raster::quad pointer = { 100.5f, 50.25f, 100.5f + 256.0f * size.width / opt.width, 50.25f + 256.0f * size.height / opt.height };
+
+            for (const auto& set : sets) {
+                const cpu_raster::kernels *k = cpu_raster::kernels_for(set.id);
+                if (!k) {
+                    std::printf("%-8s not supported\n", set.name);
+                    continue;
+                }
+
+                cpu_surface view(size.width, size.height);
+
+                bench_clock::time_point start = bench_clock::now();
+                for (unsigned i = 0; i < rounds; ++i)
+                    cpu_raster::draw(*k, view, view.bounds(), screen, desktop, false);
+                double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+                start = bench_clock::now();
+                for (unsigned i = 0; i < rounds; ++i) {
+                    cpu_raster::draw(*k, view, view.bounds(), pointer, cursor, true);
+                    cpu_raster::draw_masked(*k, view, view.bounds(), pointer, cursor, cursor);
+                }
+                double cursorSeconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+                std::string what = std::string(set.name) + " " + std::to_string(size.width) + "x" + std::to_string(size.height);
+                if (reference.pixels.empty()) {
+                    reference = view;
+                } else {
+                    std::string like = what + " like the scalar kernels";
+                    check(view.pixels == reference.pixels, like.c_str());
+                }
+
+                // the first view doesn't scale at all, bilinear sampling has to be a plain copy
+                if (&size == &views[0]) {
+                    cpu_surface copy(size.width, size.height);
+                    cpu_raster::draw(*k, copy, copy.bounds(), screen, desktop, false);
+
+                    std::string plain = what + " unscaled is a plain copy";
+                    check(copy.pixels == desktop.pixels, plain.c_str());
+                }
+
+                std::printf("%-8s %dx%d -> %dx%d %8.2f ms  %8.1f MPixel/s  cursors %8.1f us\n",
+                            set.name, opt.width, opt.height, size.width, size.height,
+                            1000.0 * seconds / rounds,
+                            static_cast<double>(size.width) * size.height * rounds / seconds / 1e6,
+                            1e6 * cursorSeconds / rounds);
+            }
+        }
+
+        // the point sampled path for whole number magnifications
+        for (int scale = 1; scale <= 2; ++scale) {
+            cpu_surface      view(opt.width * scale, opt.height * scale);
+            cpu_raster::quad screen = { 0.0f, 0.0f, static_cast<float>(view.width), static_cast<float>(view.height) };
+
+            bench_clock::time_point start = bench_clock::now();
+            for (unsigned i = 0; i < rounds; ++i)
+                cpu_raster::draw_nearest(view, view.bounds(), screen, desktop);
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            std::printf("nearest  %dx%d -> %dx%d %8.2f ms  %8.1f MPixel/s\n",
+                        opt.width, opt.height, view.width, view.height,
+                        1000.0 * seconds / rounds,
+                        static_cast<double>(view.width) * view.height * rounds / seconds / 1e6);
+        }
+
+        // the whole CPU renderer, presenting every frame
+        CpuRenderer<SyntheticSource, chrono_clock> renderer(opt.activity);
+        renderer.resize(1280, 720);
+        renderer.reset(0, 0, opt.width, opt.height);
+
+        const struct { const char *name; int thumbnail; int aspect; } modes[] = {
+            { "full",      0, SV_ASPECT_STRETCH },
+            { "thumbnail", 1, SV_ASPECT_STRETCH },
+            { "fit",       0, SV_ASPECT_FIT },
+            { "native",    0, SV_ASPECT_NATIVE },
+        };
+
+        for (const auto& mode : modes) {
+            renderer.setOption(SV_OPTION_THUMBNAIL, mode.thumbnail);
+            renderer.setOption(SV_OPTION_ASPECT, mode.aspect);
+
+            unsigned drawn = 0;
+            bench_clock::time_point start = bench_clock::now();
+            for (unsigned i = 0; i < opt.frames; ++i) {
+                if (renderer.update(0)) {
+                    renderer.render();
+                    ++drawn;
+                }
+            }
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            std::printf("renderer %-9s %dx%d -> 1280x720 activity %u: %8.1f frames/s  %u of %u frames drawn\n",
+                        mode.name, opt.width, opt.height, opt.activity,
+                        static_cast<double>(opt.frames) / seconds, drawn, opt.frames);
+        }
+
+        std::printf("raster   %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // Checks view_geometry against hand computed layouts. Returns whether all of them match.
+    bool checkGeometry()
+    {
+        const struct {
+            int          desktopWidth, desktopHeight, viewWidth, viewHeight, mode;
+            damage::rect expected;
+            bool         point; // integer_scale() of the desktop onto the expected rectangle
+        } cases[] = {
+            // stretching covers the view, whatever it is
+            { 1920, 1080,  800,  600, SV_ASPECT_STRETCH, {    0,    0,  800,  600 }, false },
+            { 1920, 1080, 3840, 2160, SV_ASPECT_STRETCH, {    0,    0, 3840, 2160 }, true  },
+            { 1920, 1080, 3840, 3240, SV_ASPECT_STRETCH, {    0,    0, 3840, 3240 }, true  }, // 2x3
+            { 1920, 1080,  960,  540, SV_ASPECT_STRETCH, {    0,    0,  960,  540 }, false }, // minified
+            { 1920, 1080,  800,  600, 42,                {    0,    0,  800,  600 }, false }, // unknown mode
+
+            // letterboxed and pillarboxed
+            { 1920, 1080,  800,  600, SV_ASPECT_FIT,     {    0,   75,  800,  525 }, false },
+            { 1080, 1920,  800,  600, SV_ASPECT_FIT,     {  231,    0,  569,  600 }, false },
+            { 1920, 1080, 1920, 1200, SV_ASPECT_FIT,     {    0,   60, 1920, 1140 }, true  },
+            { 1920, 1080, 4000, 2160, SV_ASPECT_FIT,     {   80,    0, 3920, 2160 }, true  },
+            { 1920, 1080, 1920, 1080, SV_ASPECT_FIT,     {    0,    0, 1920, 1080 }, true  },
+            { 1280, 1024, 1920, 1080, SV_ASPECT_FIT,     {  285,    0, 1635, 1080 }, false },
+
+            // cropped
+            { 1920, 1080,  800,  600, SV_ASPECT_FILL,    { -133,    0,  934,  600 }, false },
+            { 1080, 1920,  800,  600, SV_ASPECT_FILL,    {    0, -411,  800, 1011 }, false },
+            { 1920, 1080, 3840, 1080, SV_ASPECT_FILL,    {    0, -540, 3840, 1620 }, true  },
+
+            // one to one, centered
+            { 1920, 1080,  800,  600, SV_ASPECT_NATIVE,  { -560, -240, 1360,  840 }, true  },
+            { 1920, 1080, 2560, 1440, SV_ASPECT_NATIVE,  {  320,  180, 2240, 1260 }, true  },
+
+            // nothing to show
+            { 1920, 1080,    0,  600, SV_ASPECT_FIT,     {    0,    0,    0,  600 }, false },
+            {    0,    0,  800,  600, SV_ASPECT_FIT,     {    0,    0,  800,  600 }, false },
+            { 1920, 1080,   -5,   -5, SV_ASPECT_NATIVE,  {    0,    0,    0,    0 }, false },
+        };
+
+        unsigned failures = 0;
+
+        for (const auto& c : cases) {
+            damage::rect r     = view_geometry::desktop_rect(c.desktopWidth, c.desktopHeight, c.viewWidth, c.viewHeight, c.mode);
+            bool         point = view_geometry::integer_scale(c.desktopWidth, c.desktopHeight, r);
+
+            bool ok = r.left == c.expected.left && r.top == c.expected.top &&
+                      r.right == c.expected.right && r.bottom == c.expected.bottom &&
+                      point == c.point;
+
+            if (!ok) {
+                std::printf("FAIL     %dx%d in %dx%d mode %d: (%d,%d)-(%d,%d)%s, expected (%d,%d)-(%d,%d)%s\n",
+                            c.desktopWidth, c.desktopHeight, c.viewWidth, c.viewHeight, c.mode,
+                            r.left, r.top, r.right, r.bottom, point ? " point" : "",
+                            c.expected.left, c.expected.top, c.expected.right, c.expected.bottom, c.point ? " point" : "");
+                ++failures;
+            }
+        }
+
+        // point sampling has to show every texel of an integer magnification exactly
+        cpu_surface desktop(61, 37);
+        for (uint8_t& b : desktop.pixels)
+            b = static_cast<uint8_t>(std::rand());
+
+        for (int scale = 1; scale <= 4; ++scale) {
+            cpu_surface      view(61 * scale + 10, 37 * scale + 6);
+            cpu_raster::quad q = { 5.0f, 3.0f, 5.0f + 61.0f * scale, 3.0f + 37.0f * scale };
+
+            cpu_raster::draw_nearest(view, view.bounds(), q, desktop);
+
+            bool exact = true;
+            for (int y = 0; y < 37 * scale; ++y) {
+                const uint32_t *in  = reinterpret_cast<const uint32_t*>(desktop.row(y / scale));
+                const uint32_t *out = reinterpret_cast<const uint32_t*>(view.row(y + 3)) + 5;
+
+                for (int x = 0; x < 61 * scale; ++x)
+                    exact = exact && out[x] == in[x / scale];
+            }
+
+            if (!exact) {
+                std::printf("FAIL     point sampling at %dx doesn't replicate the texels\n", scale);
+                ++failures;
+            }
+        }
+
+        std::printf("geometry %u checks, %u failed\n", static_cast<unsigned>(sizeof(cases) / sizeof(cases[0])) + 4, failures);
+
+        return failures == 0;
+    }
+
+    // Checks damage::crop against hand computed results, then measures what a region view of
+    // the synthetic desktop copies compared to the whole desktop. Returns whether all checks pass.
+    bool benchRegion(const options& opt)
+    {
+        const damage::rect region = { 100, 50, 740, 530 }; // 640x480
+
+        const struct {
+            damage::rect in;
+            bool         kept;
+            damage::rect out;
+            int64_t      removed;
+        } cases[] = {
+            { {  200, 100,  300,  200 }, true,  { 100,  50, 200, 150 },      0 }, // inside
+            { {    0,   0,  200,  100 }, true,  {   0,   0, 100,  50 },  15000 }, // top left corner
+            { {  700, 500,  800,  600 }, true,  { 600, 450, 640, 480 },   8800 }, // bottom right corner
+            { {    0,   0, 1920, 1080 }, true,  {   0,   0, 640, 480 }, 1766400 }, // everything
+            { {    0,   0,  100,   50 }, false, {   0,   0,   0,   0 },   5000 }, // touching the corner
+            { {  740, 100,  800,  200 }, false, {   0,   0,   0,   0 },   6000 }, // right next to it
+            { {  300, 300,  300,  400 }, false, {   0,   0,   0,   0 },      0 }, // empty
+        };
+
+        unsigned failures = 0;
+
+        for (const auto& c : cases) {
+            std::vector<damage::rect> rects(1, c.in);
+            int64_t removed = damage::crop(rects, region);
+
+            bool ok = removed == c.removed && rects.size() == (c.kept ? 1u : 0u);
+            if (ok && c.kept)
+                ok = rects[0].left == c.out.left && rects[0].top == c.out.top &&
+                     rects[0].right == c.out.right && rects[0].bottom == c.out.bottom;
+
+            if (!ok) {
+                std::printf("FAIL     crop (%d,%d)-(%d,%d): %u rects, %lld removed\n",
+                            c.in.left, c.in.top, c.in.right, c.in.bottom,
+                            static_cast<unsigned>(rects.size()), static_cast<long long>(removed));
+                ++failures;
+            }
+        }
+
+        // several at once, in order
+        std::vector<damage::rect> rects;
+        for (const auto& c : cases)
+            rects.push_back(c.in);
+
+        damage::crop(rects, region);
+        if (rects.size() != 4 || rects[1].left != 0 || rects[2].left != 600) {
+            std::printf("FAIL     crop of several rects\n");
+            ++failures;
+        }
+
+        std::printf("crop     %u checks, %u failed\n", static_cast<unsigned>(sizeof(cases) / sizeof(cases[0])) + 1, failures);
+
+        // a 640x480 region in the middle of the synthetic desktop
+        damage::rect middle = {
+            opt.width / 2 - 320, opt.height / 2 - 240,
+            opt.width / 2 + 320, opt.height / 2 + 240
+        };
+        middle = damage::intersection(middle, { 0, 0, opt.width, opt.height });
+
+        SyntheticSource source(opt.activity);
+        cpu_device device;
+        source.reinit(&device, 0, 0, opt.width, opt.height);
+
+        std::unique_ptr<cpu_surface> desktop(source.createDesktopTexture());
+
+        uint64_t full = 0, cropped = 0;
+        double   cropUs = 0.0;
+
+        for (unsigned i = 0; i < opt.frames; ++i) {
+            source.acquireFrame(0);
+
+            rects.clear();
+            if (source.updateDesktop(desktop.get()) && !source.desktopDamage(rects))
+                rects.assign(1, desktop->bounds());
+
+            source.releaseFrame();
+
+            for (const damage::rect& r : rects)
+                full += 4 * static_cast<uint64_t>(damage::area(r));
+
+            bench_clock::time_point start = bench_clock::now();
+            damage::crop(rects, middle);
+            cropUs += std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+
+            for (const damage::rect& r : rects)
+                cropped += 4 * static_cast<uint64_t>(damage::area(r));
+        }
+
+        std::printf("region   %dx%d of %dx%d activity %u: %10.0f bytes/frame instead of %10.0f (%5.1f%%), crop %6.2f us/frame\n",
+                    damage::width(middle), damage::height(middle), opt.width, opt.height, opt.activity,
+                    static_cast<double>(cropped) / opt.frames, static_cast<double>(full) / opt.frames,
+                    full ? 100.0 * static_cast<double>(cropped) / static_cast<double>(full) : 0.0,
+                    cropUs / opt.frames);
+        std::printf("         textures: %8.1f MB instead of %8.1f MB\n",
+                    4.0 * damage::area(middle) / (1024 * 1024),
+                    4.0 * opt.width * opt.height / (1024 * 1024));
+
+        return failures == 0;
+    }
+
+    // Checks the atlas layout and stitching, then stitches three synthetic outputs updating at
+    // different rates into the atlas of a view spanning them. Returns whether all checks pass.
+    bool benchAtlas(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        auto same = [](const damage::rect& a, const damage::rect& b) {
+            return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+        };
+
+        // 1080p, a taller 1440p one above the baseline, a gap, 1080p again, and one far away
+        {
+            std::vector<damage::rect> screens = {
+                {    0,    0, 1920, 1080 },
+                { 1920, -180, 4480, 1260 },
+                { 4600,    0, 6520, 1080 },
+                {    0, 2000, 1920, 3080 },
+            };
+            damage::rect view = { 960, -180, 5560, 1260 };
+
+            std::vector<atlas::part> parts = atlas::layout(view, screens);
+
+            check(parts.size() == 3, "layout: outputs outside of the view get no part");
+            if (parts.size() == 3) {
+                check(same(parts[0].source, { 960, 0, 1920, 1080 }) && parts[0].x == 0 && parts[0].y == 180,
+                      "layout: left output cropped");
+                check(same(parts[1].source, { 0, 0, 2560, 1440 }) && parts[1].x == 960 && parts[1].y == 0,
+                      "layout: middle output whole");
+                check(same(parts[2].source, { 0, 0, 960, 1080 }) && parts[2].x == 3640 && parts[2].y == 180,
+                      "layout: right output cropped");
+                check(same(atlas::bounds(parts[2]), { 3640, 180, 4600, 1260 }), "layout: bounds");
+
+                std::vector<damage::rect> rects;
+                atlas::to_atlas(parts[0], { { 0, 0, 100, 100 }, { 900, 1000, 1000, 1080 }, { 1800, 0, 1920, 10 } }, rects);
+                check(rects.size() == 2 && same(rects[0], { 0, 1180, 40, 1260 }) && same(rects[1], { 840, 180, 960, 190 }),
+                      "to_atlas: clipped and moved");
+                check(same(atlas::to_output(parts[0], rects[1]), { 1800, 0, 1920, 10 }), "to_output: inverse of to_atlas");
+            }
+        }
+
+        // copies to a position, clipped on both ends
+        {
+            cpu_device  device;
+            cpu_surface src(4, 4), dst(4, 4);
+            for (std::size_t i = 0; i < src.pixels.size(); ++i)
+                src.pixels[i] = static_cast<uint8_t>(i / 4 + 1);
+
+            device.copy_region(dst, 3, -1, src, { 0, 0, 2, 2 });  // reads (0, 1) only
+            device.copy_region(dst, 0, 0, src, { -1, -1, 1, 1 }); // writes (1, 1) only
+
+            bool ok = device.bytes_copied == 8 && dst.row(0)[12] == 5 && dst.row(1)[4] == 1;
+            for (int y = 0; y < 4; ++y)
+                for (int x = 0; x < 4; ++x)
+                    ok = ok && (dst.row(y)[4 * x] == 0) == !((x == 3 && y == 0) || (x == 1 && y == 1));
+            check(ok, "copy_region: clipping");
+        }
+
+        // Three outputs of the given size and a larger one, the view cuts the outer ones in half.
+        // The outputs update at different rates.
+        const int w = opt.width, h = opt.height;
+        const int bigW = w * 4 / 3, bigH = h * 4 / 3;
+
+        std::vector<damage::rect> screens = {
+            { 0,            0,      w,                h },
+            { w,            -h / 6, w + bigW,         -h / 6 + bigH },
+            { w + bigW + 8, 0,      2 * w + bigW + 8, h },
+        };
+        damage::rect view = { w / 2, -h / 6, w + bigW + 8 + w / 2, -h / 6 + bigH };
+
+        std::vector<atlas::part> parts = atlas::layout(view, screens);
+        const unsigned rates[] = { 1, 2, 3 };
+
+        struct output {
+            std::unique_ptr<SyntheticSource> source;
+            std::unique_ptr<cpu_surface>     desktop;
+            cpu_device                       device;
+        };
+
+        std::vector<output> outputs(parts.size());
+        for (std::size_t i = 0; i < parts.size(); ++i) {
+            output& out = outputs[i];
+            out.source.reset(new SyntheticSource(opt.activity));
+            out.source->reinit(&out.device, parts[i].output.left, parts[i].output.top,
+                               damage::width(parts[i].output), damage::height(parts[i].output));
+            out.desktop.reset(out.source->createDesktopTexture());
+        }
+
+        cpu_device  device;
+        cpu_surface atlasSurface(damage::width(view), damage::height(view));
+
+        std::vector<damage::rect> outputRects, atlasRects;
+        uint64_t wholeBytes = 0;
+        double   stitchUs   = 0.0;
+
+        for (unsigned frame = 0; frame < opt.frames; ++frame) {
+            for (std::size_t i = 0; i < outputs.size(); ++i) {
+                output& out = outputs[i];
+
+                if (frame % rates[i])
+                    continue;
+
+                out.source->acquireFrame(0);
+
+                outputRects.clear();
+                if (out.source->updateDesktop(out.desktop.get()) && !out.source->desktopDamage(outputRects))
+                    outputRects.assign(1, out.desktop->bounds());
+
+                out.source->releaseFrame();
+
+                if (outputRects.empty())
+                    continue;
+
+                bench_clock::time_point start = bench_clock::now();
+
+                atlasRects.clear();
+                atlas::to_atlas(parts[i], outputRects, atlasRects);
+                atlas::stitch(device, atlasSurface, parts[i], *out.desktop, atlasRects);
+
+                stitchUs   += std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+                wholeBytes += 4 * static_cast<uint64_t>(damage::area(atlas::bounds(parts[i])));
+            }
+        }
+
+        // every part matches its output, the gaps stay black
+        bool matches = parts.size() == 3;
+        for (std::size_t i = 0; i < parts.size() && matches; ++i) {
+            const damage::rect b = atlas::bounds(parts[i]);
+            const damage::rect o = atlas::to_output(parts[i], b);
+
+            for (int y = 0; y < damage::height(b) && matches; ++y)
+                matches = std::memcmp(atlasSurface.row(b.top + y) + 4 * b.left,
+                                      outputs[i].desktop->row(o.top + y) + 4 * o.left,
+                                      4 * static_cast<std::size_t>(damage::width(b))) == 0;
+        }
+        check(matches, "stitch: the atlas matches the outputs");
+
+        bool black = true;
+        for (int y = 0; y < atlasSurface.height; ++y) {
+            for (int x = 0; x < atlasSurface.width; ++x) {
+                bool covered = false;
+                for (const atlas::part& p : parts) {
+                    const damage::rect b = atlas::bounds(p);
+                    covered = covered || (x >= b.left && x < b.right && y >= b.top && y < b.bottom);
+                }
+
+                if (!covered)
+                    black = black && std::memcmp(atlasSurface.row(y) + 4 * x, "\0\0\0\0", 4) == 0;
+            }
+        }
+        check(black, "stitch: the gaps stay black");
+
+        std::printf("atlas    %u checks, %u failed\n", checks, failures);
+        std::printf("stitch   %dx%d atlas of %u outputs, activity %u, rates 1/%u 1/%u 1/%u: %10.0f bytes/frame instead of %10.0f (%5.1f%%), %7.2f us/frame\n",
+                    atlasSurface.width, atlasSurface.height, static_cast<unsigned>(parts.size()), opt.activity,
+                    rates[0], rates[1], rates[2],
+                    static_cast<double>(device.bytes_copied) / opt.frames,
+                    static_cast<double>(wholeBytes) / opt.frames,
+                    wholeBytes ? 100.0 * static_cast<double>(device.bytes_copied) / static_cast<double>(wholeBytes) : 0.0,
+                    stitchUs / opt.frames);
+
+        return failures == 0;
+    }
+
+    uint64_t hashSurface(const cpu_surface& surface)
+    {
+        // FNV-1a over 32 bit words
+        uint64_t hash = 14695981039346656037ULL;
+
+        const uint32_t *words = reinterpret_cast<const uint32_t*>(surface.pixels.data());
+        for (std::size_t i = 0; i < surface.pixels.size() / 4; ++i)
+            hash = (hash ^ words[i]) * 1099511628211ULL;
+
+        return hash;
+    }
+
+    // Records the synthetic desktop into a capture file, reads it back sequentially and by
+    // seeking, checks both against the recorded desktop, and plays it through CpuRenderer.
+    // Returns whether all checks pass.
+    bool benchRecord(const options& opt)
+    {
+        static const char    *PATH       = "host-bench.svrec";
+        static const unsigned CHECKPOINT = 50;  // the desktop is hashed every that many frames
+        static const unsigned MAX_FRAMES = 900; // about 4 GB at 1080p with the default activity
+
+        unsigned frames = std::min(opt.frames, MAX_FRAMES);
+
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        // recording
+        std::vector<uint64_t> hashes; // of the desktop after every CHECKPOINTth recorded frame
+        std::vector<double>   latencies;
+        uint64_t              recorded = 0;
+        uint64_t              fileBytes, tileBytes;
+
+        {
+            SyntheticSource source(opt.activity);
+            cpu_device      device;
+            source.reinit(&device, 0, 0, opt.width, opt.height);
+
+            std::unique_ptr<cpu_surface> desktop(source.createDesktopTexture());
+            std::unique_ptr<cpu_surface> cursor(source.createCursorTexture());
+            std::unique_ptr<cpu_surface> cursorMask(source.createCursorMaskTexture());
+
+            capture_file::writer writer;
+            if (!writer.open(PATH, opt.width, opt.height)) {
+                std::printf("FAIL     can't create %s\n", PATH);
+                return false;
+            }
+
+            capture_file::frame_info  info;
+            std::vector<damage::rect> rects;
+
+            for (unsigned i = 0; i < frames; ++i) {
+                source.acquireFrame(0);
+
+                bool desktopChanged = source.updateDesktop(desktop.get());
+                bool damageKnown    = true;
+
+                rects.clear();
+                if (desktopChanged)
+                    damageKnown = source.desktopDamage(rects);
+
+                bool cursorChanged = source.updateCursor(cursor.get(), cursorMask.get(), info.cursor);
+
+                if (desktopChanged || cursorChanged) {
+                    info.present_us  = source.presentTime();
+                    info.recorded_us = i;
+
+                    bench_clock::time_point start = bench_clock::now();
+                    writer.append(desktop->pixels.data(), desktop->pitch, damageKnown ? &rects : nullptr, info);
+                    latencies.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - start).count());
+
+                    if (recorded++ % CHECKPOINT == 0)
+                        hashes.push_back(hashSurface(*desktop));
+                }
+
+                source.releaseFrame();
+            }
+
+            fileBytes = writer.bytes();
+            tileBytes = writer.tile_bytes();
+        }
+
+        double raw = 4.0 * opt.width * opt.height * static_cast<double>(recorded);
+
+        std::printf("write    %dx%d activity %u: %llu frames, %8.1f MB file (%5.2f%% of raw frames, %8.1f MB of tiles), p50 %8.1f us  p99 %8.1f us\n",
+                    opt.width, opt.height, opt.activity, static_cast<unsigned long long>(recorded),
+                    static_cast<double>(fileBytes) / (1024 * 1024), raw > 0 ? 100.0 * static_cast<double>(fileBytes) / raw : 0.0,
+                    static_cast<double>(tileBytes) / (1024 * 1024),
+                    percentile(latencies, 0.50), percentile(latencies, 0.99));
+
+        // reading it back in order
+        {
+            bench_clock::time_point start = bench_clock::now();
+
+            capture_file::reader reader;
+            bool opened = reader.open(PATH);
+
+            double openMs = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+
+            check(opened && reader.frames() == recorded && reader.width() == opt.width && reader.height() == opt.height,
+                  "read: the index covers every frame");
+
+            cpu_surface desktop(reader.width(), reader.height());
+            bool        matches = true;
+            uint64_t    copied  = 0;
+
+            start = bench_clock::now();
+            for (uint64_t i = 0; i < reader.frames(); ++i) {
+                copied += reader.apply(i, desktop, nullptr);
+
+                if (i % CHECKPOINT == 0)
+                    matches = matches && hashSurface(desktop) == hashes[i / CHECKPOINT];
+            }
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            check(matches, "read: frames read in order match the recorded desktop");
+
+            capture_file::frame_info info;
+            check(reader.info(0, info) && info.key && reader.info(recorded - 1, info) && info.recorded_us < frames,
+                  "read: frame info");
+
+            std::printf("read     open %6.2f ms, %9.1f frames/s, %8.1f MB/s\n",
+                        openMs, static_cast<double>(reader.frames()) / seconds, static_cast<double>(copied) / (1024 * 1024) / seconds);
+
+            // seeking to random checkpoints
+            std::mt19937 random(42);
+            bool         seeked = true;
+            unsigned     seeks  = std::min<unsigned>(100, static_cast<unsigned>(hashes.size()));
+
+            start = bench_clock::now();
+            for (unsigned i = 0; i < seeks; ++i) {
+                uint64_t checkpoint = random() % hashes.size();
+
+                reader.seek(checkpoint * CHECKPOINT, desktop);
+                seeked = seeked && hashSurface(desktop) == hashes[checkpoint];
+            }
+            seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            check(seeked, "seek: frames seeked to match the recorded desktop");
+
+            std::printf("seek     %u random seeks, key frames every %u frames: %8.2f ms per seek\n",
+                        seeks, capture_file::KEY_INTERVAL, seeks ? 1000.0 * seconds / seeks : 0.0);
+        }
+
+        // playing it back through the CPU renderer
+        {
+            CpuRenderer<ReplaySource, chrono_clock> renderer(PATH);
+            renderer.resize(1280, 720);
+            renderer.reset(0, 0, opt.width, opt.height);
+
+            check(renderer.source().ok() && renderer.source().frames() == recorded, "replay: opened");
+
+            unsigned drawn = 0;
+            bench_clock::time_point start = bench_clock::now();
+            while (renderer.update(0)) {
+                renderer.render();
+                ++drawn;
+            }
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            check(renderer.source().position() == recorded, "replay: every frame played");
+
+            std::printf("replay   %dx%d -> 1280x720: %8.1f frames/s, %u frames drawn, %10.0f bytes copied/frame\n",
+                        opt.width, opt.height, drawn ? static_cast<double>(drawn) / seconds : 0.0, drawn,
+                        drawn ? static_cast<double>(renderer.bytesCopied()) / drawn : 0.0);
+        }
+
+        // recording from the renderer, the first frame is a key frame
+        {
+            CpuRenderer<SyntheticSource, chrono_clock> renderer(opt.activity);
+            renderer.resize(640, 360);
+            renderer.reset(0, 0, opt.width, opt.height);
+
+            check(renderer.startRecording(PATH), "renderer: recording started");
+
+            unsigned changed = 0;
+            for (unsigned i = 0; i < 100; ++i)
+                changed += renderer.update(0) ? 1 : 0;
+
+            uint64_t frames = renderer.recording() ? renderer.recording()->frames() : 0;
+            renderer.stopRecording();
+
+            capture_file::reader reader;
+            check(frames == changed && reader.open(PATH) && reader.frames() == changed, "renderer: every changed frame recorded");
+        }
+
+        std::remove(PATH);
+
+        std::printf("record   %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // The tiles covered by @a rects, as flags row by row
+    std::vector<uint8_t> coveredTiles(const std::vector<damage::rect>& rects, int columns, int rows)
+    {
+        std::vector<uint8_t> tiles(static_cast<std::size_t>(columns) * rows, 0);
+
+        for (const damage::rect& r : rects) {
+            for (int row = r.top / tile_hash::TILE_SIZE; row * tile_hash::TILE_SIZE < r.bottom && row < rows; ++row)
+                for (int column = r.left / tile_hash::TILE_SIZE; column * tile_hash::TILE_SIZE < r.right && column < columns; ++column)
+                    ++tiles[static_cast<std::size_t>(row) * columns + column];
+        }
+
+        return tiles;
+    }
+
+    // Times hashing every tile of a desktop of the given size, with and without SSE2
+    void benchTileHashing(int width, int height, unsigned frames)
+    {
+        cpu_surface  desktop(width, height);
+        std::mt19937 random(7);
+
+        for (uint8_t& byte : desktop.pixels)
+            byte = static_cast<uint8_t>(random());
+
+        struct {
+            const char *name;
+            uint64_t  (*hash)(const uint8_t*, std::size_t, int, int);
+        } variants[] = {
+            { "portable", tile_hash::hash_portable },
+            { "hash",     tile_hash::hash },
+        };
+
+        for (const auto& variant : variants) {
+            uint64_t sum = 0;
+
+            bench_clock::time_point start = bench_clock::now();
+            for (unsigned f = 0; f < frames; ++f) {
+                for (int y = 0; y < height; y += tile_hash::TILE_SIZE)
+                    for (int x = 0; x < width; x += tile_hash::TILE_SIZE)
+                        sum += variant.hash(desktop.row(y) + 4 * x, desktop.pitch,
+                                            std::min(tile_hash::TILE_SIZE, width - x), std::min(tile_hash::TILE_SIZE, height - y));
+            }
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            std::printf("hash     %5dx%-5d %-8s %s: %7.2f ms/frame, %6.2f GB/s (%016llx)\n",
+                        width, height, variant.name, variant.hash == tile_hash::hash && tile_hash::simd() ? "sse2" : "    ",
+                        1000.0 * seconds / frames, static_cast<double>(desktop.pixels.size()) * frames / seconds / 1e9,
+                        static_cast<unsigned long long>(sum));
+        }
+
+        // a frame in which a few tiles changed, like a blinking caret and a ticking clock
+        tile_hash::detector       detector;
+        std::vector<damage::rect> rects;
+        std::vector<double>       latencies;
+
+        detector.reset(width, height);
+        detector.update(desktop.pixels.data(), desktop.pitch, rects);
+
+        for (unsigned f = 0; f < frames; ++f) {
+            desktop.row(height / 2)[4 * (width / 3)] ^= 0xFF;
+            desktop.row(height - 1)[4 * (width - 1)] ^= 0xFF;
+
+            rects.clear();
+
+            bench_clock::time_point start = bench_clock::now();
+            detector.update(desktop.pixels.data(), desktop.pitch, rects);
+            latencies.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - start).count());
+        }
+
+        std::printf("detect   %5dx%-5d %5d tiles: p50 %8.1f us  p99 %8.1f us, %u rects\n",
+                    width, height, detector.tiles(), percentile(latencies, 0.50), percentile(latencies, 0.99),
+                    static_cast<unsigned>(rects.size()));
+    }
+
+    // Checks the hashes and the change detection against the tiles which really changed in
+    // the synthetic desktop, and times them at 1080p and 4K. Returns whether all checks pass.
+    bool benchTiles(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        // both implementations agree, for every tile size at the edges
+        {
+            cpu_surface  block(tile_hash::TILE_SIZE, tile_hash::TILE_SIZE);
+            std::mt19937 random(1);
+
+            for (uint8_t& byte : block.pixels)
+                byte = static_cast<uint8_t>(random());
+
+            bool same = true;
+            for (int w = 1; w <= tile_hash::TILE_SIZE; ++w)
+                for (int h = 1; h <= tile_hash::TILE_SIZE; h += 7)
+                    same = same && tile_hash::hash(block.pixels.data(), block.pitch, w, h) ==
+                                   tile_hash::hash_portable(block.pixels.data(), block.pitch, w, h);
+
+            check(same, "hash: SSE2 and portable hashes differ");
+
+            uint64_t original = tile_hash::hash(block.pixels.data(), block.pitch, 64, 64);
+
+            block.row(10)[4 * 20 + 1] ^= 1;
+            check(tile_hash::hash(block.pixels.data(), block.pitch, 64, 64) != original, "hash: a changed bit goes unnoticed");
+            block.row(10)[4 * 20 + 1] ^= 1;
+
+            std::vector<uint8_t> row(block.row(3), block.row(3) + block.pitch);
+            std::copy(block.row(4), block.row(4) + block.pitch, block.row(3));
+            std::copy(row.begin(), row.end(), block.row(4));
+            check(tile_hash::hash(block.pixels.data(), block.pitch, 64, 64) != original, "hash: swapped rows go unnoticed");
+            std::copy(block.row(4), block.row(4) + block.pitch, block.row(3));
+            std::copy(row.begin(), row.end(), block.row(4));
+
+            uint32_t *pixels = reinterpret_cast<uint32_t*>(block.row(0));
+            std::swap(pixels[0], pixels[5]);
+            check(tile_hash::hash(block.pixels.data(), block.pitch, 64, 64) != original, "hash: swapped pixels go unnoticed");
+        }
+
+        // merging into rectangles
+        {
+            cpu_surface               desktop(300, 200); // 5x4 tiles, the last column and row partial
+            tile_hash::detector       detector;
+            std::vector<damage::rect> rects;
+
+            detector.reset(desktop.width, desktop.height);
+            check(!detector.update(desktop.pixels.data(), desktop.pitch, rects) && rects.empty(), "detect: the first frame counts as changed");
+            check(detector.update(desktop.pixels.data(), desktop.pitch, rects) && rects.empty(), "detect: nothing changed");
+
+            // an L shape: tiles (1,1), (2,1), (1,2), (2,2), (1,3) and the partial corner (4,3)
+            const int changed[][2] = { { 1, 1 }, { 2, 1 }, { 1, 2 }, { 2, 2 }, { 1, 3 }, { 4, 3 } };
+            for (const auto& tile : changed)
+                desktop.row(tile[1] * 64 + 5)[4 * (tile[0] * 64 + 5)] = 1;
+
+            rects.clear();
+            detector.update(desktop.pixels.data(), desktop.pitch, rects);
+
+            bool merged = rects.size() == 3 &&
+                          rects[0].left ==  64 && rects[0].top ==  64 && rects[0].right == 192 && rects[0].bottom == 192 &&
+                          rects[1].left ==  64 && rects[1].top == 192 && rects[1].right == 128 && rects[1].bottom == 200 &&
+                          rects[2].left == 256 && rects[2].top == 192 && rects[2].right == 300 && rects[2].bottom == 200;
+            check(merged, "detect: changed tiles merged into rectangles");
+
+            detector.invalidate();
+            rects.clear();
+            check(!detector.update(desktop.pixels.data(), desktop.pitch, rects) && rects.empty(), "detect: invalidated");
+        }
+
+        // the synthetic desktop, compared with the tiles which really changed
+        {
+            SyntheticSource source(opt.activity);
+            cpu_device      device;
+            source.reinit(&device, 0, 0, opt.width, opt.height);
+
+            std::unique_ptr<cpu_surface> desktop(source.createDesktopTexture());
+            cpu_surface                  previous(opt.width, opt.height);
+
+            tile_hash::detector detector;
+            detector.reset(opt.width, opt.height);
+
+            int columns = (opt.width  + tile_hash::TILE_SIZE - 1) / tile_hash::TILE_SIZE;
+            int rows    = (opt.height + tile_hash::TILE_SIZE - 1) / tile_hash::TILE_SIZE;
+
+            std::vector<damage::rect> detected, reported;
+            bool     exact = true, disjoint = true;
+            int64_t  detectedArea = 0, reportedArea = 0;
+            unsigned frames = std::min(opt.frames, 300u);
+
+            for (unsigned f = 0; f < frames; ++f) {
+                source.acquireFrame(0);
+
+                reported.clear();
+                bool changed = source.updateDesktop(desktop.get());
+                if (changed && !source.desktopDamage(reported))
+                    reported.assign(1, damage::rect { 0, 0, opt.width, opt.height });
+
+                source.releaseFrame();
+
+                detected.clear();
+                if (detector.update(desktop->pixels.data(), desktop->pitch, detected)) {
+                    std::vector<uint8_t> covered = coveredTiles(detected, columns, rows);
+
+                    for (int row = 0; row < rows; ++row) {
+                        for (int column = 0; column < columns; ++column) {
+                            bool really = false;
+                            for (int y = row * 64; y < std::min(row * 64 + 64, opt.height) && !really; ++y)
+                                really = std::memcmp(desktop->row(y) + 4 * column * 64, previous.row(y) + 4 * column * 64,
+                                                     4 * std::min(64, opt.width - column * 64)) != 0;
+
+                            uint8_t times = covered[static_cast<std::size_t>(row) * columns + column];
+                            exact    = exact && really == (times > 0);
+                            disjoint = disjoint && times <= 1;
+                        }
+                    }
+
+                    for (const damage::rect& r : detected)
+                        detectedArea += damage::area(r);
+                    for (const damage::rect& r : reported)
+                        reportedArea += damage::area(r);
+                }
+
+                previous.pixels = desktop->pixels;
+            }
+
+            check(exact, "synthetic: detected tiles are exactly the changed ones");
+            check(disjoint, "synthetic: detected rectangles overlap");
+
+            std::printf("detect   %dx%d activity %u, %u frames: %5.1f%% of the area the source reported as damage\n",
+                        opt.width, opt.height, opt.activity, frames,
+                        reportedArea ? 100.0 * static_cast<double>(detectedArea) / static_cast<double>(reportedArea) : 0.0);
+        }
+
+        std::printf("tiles    %u checks, %u failed\n", checks, failures);
+
+        benchTileHashing(1920, 1080, std::max(opt.frames / 20, 10u));
+        benchTileHashing(3840, 2160, std::max(opt.frames / 80, 10u));
+
+        return failures == 0;
+    }
+
+    // What the DWM hook did while being simulated
+    struct rate_result {
+        unsigned copies  = 0;
+        double   fps     = 0;
+        double   load    = 0; // share of the time spent copying
+    };
+
+    // Simulates the DWM presenting every @a presentUs microseconds for @a seconds, copying
+    // whenever the controller says so, each copy taking @a costUs. The time goes on from @a now.
+    rate_result simulatePresents(capture_rate::controller& rate, uint64_t& now, uint64_t presentUs, uint64_t costUs, unsigned seconds)
+    {
+        rate_result result;
+        uint64_t    end    = now + 1000000ULL * seconds;
+        uint64_t    copied = 0;
+
+        while (now < end) {
+            uint64_t present = now;
+
+            // the copy holds up the present
+            if (rate.present(now)) {
+                rate.captured(costUs);
+                ++result.copies;
+                copied += costUs;
+                now    += costUs;
+            }
+
+            now = std::max(now, present + presentUs);
+        }
+
+        result.fps  = result.copies / static_cast<double>(seconds);
+        result.load = static_cast<double>(copied) / (1e6 * seconds);
+
+        return result;
+    }
+
+    // Checks the capture rate controller of the DWM hook with a simulated DWM. Returns whether
+    // all checks pass.
+    bool benchRate(const options&)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what, const rate_result *r) {
+            ++checks;
+            if (r)
+                std::printf("%s %-48s %6.1f fps, %5.2f%% of the time copying\n", ok ? "ok  " : "FAIL", what, r->fps, 100.0 * r->load);
+            else
+                std::printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+            if (!ok)
+                ++failures;
+        };
+
+        const uint64_t HZ60  = 16667;
+        const uint64_t HZ144 = 6944;
+        const uint64_t HZ30  = 33333;
+
+        {
+            capture_rate::controller rate;
+            uint64_t now = 0;
+
+            rate_result r = simulatePresents(rate, now, HZ60, 500, 10);
+            check(r.fps > 19.0 && r.fps < 21.0, "default rate at 60 Hz", &r);
+
+            rate.set_target(0);
+            r = simulatePresents(rate, now, HZ60, 500, 10);
+            check(r.copies == 0, "stopped, nobody watching", &r);
+
+            rate.set_target(20);
+            check(rate.present(now), "resumed, copying right away", nullptr);
+        }
+
+        {
+            capture_rate::controller rate(30);
+            uint64_t now = 0;
+
+            rate_result r = simulatePresents(rate, now, HZ144, 500, 10);
+            check(r.fps > 29.0 && r.fps < 31.0, "30 fps at 144 Hz", &r);
+        }
+
+        {
+            capture_rate::controller rate(24);
+            uint64_t now = 0;
+
+            // counting from the last copy, every copy would be three presents after the previous one
+            rate_result r = simulatePresents(rate, now, HZ60, 500, 10);
+            check(r.fps > 22.5 && r.fps < 25.5, "24 fps at 60 Hz, not rounded down to 20", &r);
+        }
+
+        {
+            capture_rate::controller rate(60);
+            uint64_t now = 0;
+
+            rate_result r = simulatePresents(rate, now, HZ30, 500, 10);
+            check(r.fps > 29.0 && r.fps < 31.0, "60 fps at 30 Hz, every present", &r);
+        }
+
+        {
+            capture_rate::controller rate(60);
+            uint64_t now = 0;
+
+            // 8ms copies at 60 fps would take up half of the time
+            rate_result r = simulatePresents(rate, now, HZ60, 8000, 10);
+            check(r.load <= capture_rate::MAX_LOAD * 1.2 && rate.backing_off(), "slow copies, backing off", &r);
+
+            // the moving average of the cost takes a few seconds to follow
+            simulatePresents(rate, now, HZ60, 300, 5);
+            r = simulatePresents(rate, now, HZ60, 300, 10);
+            check(r.fps > 59.0 && !rate.backing_off(), "fast copies again, back to 60 fps", &r);
+
+            // copies taking longer than a twentieth of a second still get done once a second
+            simulatePresents(rate, now, HZ60, 100000, 5);
+            r = simulatePresents(rate, now, HZ60, 100000, 10);
+            check(r.fps > 0.9 && r.fps < 1.1 && rate.interval() == capture_rate::MAX_BACKOFF_INTERVAL, "hopelessly slow copies, once a second", &r);
+        }
+
+        {
+            capture_rate::controller rate(1000);
+            check(rate.target() == capture_rate::MAX_FPS, "rates clamped", nullptr);
+        }
+
+        {
+            CpuRenderer<SyntheticSource, chrono_clock> renderer(0u);
+            check(!renderer.setOption(SV_OPTION_CAPTURE_RATE, 10), "sources without a rate refuse one", nullptr);
+        }
+
+        std::printf("rate     %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // Checks the slot exchange between the DWM hook and the view, step by step and with the
+    // producer and the consumer on threads of their own, textures being plain memory. Returns
+    // whether all checks pass.
+    bool benchSlots(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        const uint32_t handles[shared_slots::SLOTS] = { 11, 12, 13 };
+        uint32_t       textures[shared_slots::SLOTS];
+        int32_t        width, height;
+        uint32_t       frame;
+
+        // step by step
+        {
+            std::unique_ptr<shared_slots::control> ctl(new shared_slots::control());
+
+            shared_slots::producer producer(ctl.get());
+            shared_slots::consumer consumer(ctl.get());
+
+            check(!producer.sync(textures, width, height) && !producer.commit() && consumer.acquire(frame) < 0,
+                  "nothing before the first textures");
+
+            consumer.publish(handles, 640, 480);
+            check(producer.sync(textures, width, height) && textures[2] == 13 && width == 640 && height == 480,
+                  "textures published");
+            check(!producer.sync(textures, width, height), "textures published once");
+
+            check(consumer.acquire(frame) < 0, "no frame before the first commit");
+
+            uint32_t written = producer.slot();
+            check(producer.commit() == 1 && consumer.acquire(frame) == static_cast<int>(written) && frame == 1,
+                  "first frame handed over");
+            check(consumer.acquire(frame) < 0, "frames handed over once");
+
+            producer.commit();
+            written = producer.slot();
+            producer.commit();
+            check(consumer.acquire(frame) == static_cast<int>(written) && frame == 3, "the latest frame is handed over");
+
+            // whatever happens, the producer and the consumer never share a slot
+            std::mt19937 random(3);
+            bool         apart = true;
+
+            for (unsigned i = 0; i < 10000; ++i) {
+                if (random() % 2)
+                    producer.commit();
+                else
+                    consumer.acquire(frame);
+
+                apart = apart && producer.slot() != consumer.slot();
+            }
+            check(apart, "producer and consumer slots apart");
+
+            consumer.publish(handles, 800, 600);
+            check(!producer.commit() && consumer.acquire(frame) < 0, "frames for old textures dropped");
+            check(producer.sync(textures, width, height) && width == 800 && producer.commit() && consumer.acquire(frame) >= 0,
+                  "new textures picked up");
+        }
+
+        // on two threads, with the consumer publishing new textures every now and then
+        {
+            static const unsigned WORDS        = 64 * 1024;
+            static const unsigned GENERATIONS  = 20;
+            static const unsigned REPUBLISHING = 16; // acquired frames between new textures
+
+            unsigned frames = opt.frames * 50;
+
+            std::unique_ptr<shared_slots::control> ctl(new shared_slots::control());
+
+            // the textures of every generation, handle n is buffers[n - 1]
+            std::vector<std::vector<uint32_t>> buffers(GENERATIONS * shared_slots::SLOTS, std::vector<uint32_t>(WORDS, 0));
+
+            std::atomic<bool> done(false);
+            uint64_t          committed = 0, dropped = 0;
+
+            std::thread writer([&] {
+                shared_slots::producer producer(ctl.get());
+
+                uint32_t current[shared_slots::SLOTS];
+                int32_t  w, h;
+
+                while (committed < frames) {
+                    producer.sync(current, w, h);
+                    if (!producer.ready()) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    // every word of a frame is its frame number
+                    uint32_t next = ctl->frame.load() + 1;
+                    std::vector<uint32_t>& buffer = buffers[current[producer.slot()] - 1];
+                    std::fill(buffer.begin(), buffer.end(), next);
+
+                    if (producer.commit())
+                        ++committed;
+                    else
+                        ++dropped;
+                }
+
+                done.store(true);
+            });
+
+            shared_slots::consumer consumer(ctl.get());
+
+            unsigned generation = 0;
+            uint32_t published[shared_slots::SLOTS];
+            uint32_t last     = 0;
+            uint64_t acquired = 0, torn = 0, backwards = 0;
+
+            auto publish = [&] {
+                for (uint32_t i = 0; i < shared_slots::SLOTS; ++i)
+                    published[i] = generation * shared_slots::SLOTS + i + 1;
+
+                consumer.publish(published, 1920, 1080);
+                ++generation;
+            };
+
+            publish();
+
+            bench_clock::time_point start = bench_clock::now();
+
+            for (;;) {
+                bool finished = done.load();
+
+                int slot = consumer.acquire(frame);
+                if (slot >= 0) {
+                    const std::vector<uint32_t>& buffer = buffers[published[slot] - 1];
+
+                    ++acquired;
+                    torn      += std::count(buffer.begin(), buffer.end(), frame) != static_cast<std::ptrdiff_t>(WORDS);
+                    backwards += frame <= last;
+                    last       = frame;
+
+                    if (acquired % REPUBLISHING == 0 && generation < GENERATIONS)
+                        publish();
+                } else if (finished) {
+                    break;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            writer.join();
+
+            check(torn == 0, "threads: no torn frames");
+            check(backwards == 0, "threads: frame numbers only go up");
+            check(last == ctl->frame.load(), "threads: the last frame arrives");
+            check(generation > 1, "threads: textures replaced while running");
+
+            std::printf("slots    %llu frames committed, %llu acquired, %llu dropped for old textures, %u generations: %9.0f frames/s\n",
+                        static_cast<unsigned long long>(committed), static_cast<unsigned long long>(acquired),
+                        static_cast<unsigned long long>(dropped), generation, static_cast<double>(committed) / seconds);
+        }
+
+        std::printf("slots    %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // The payload of message @a n of the channel suite, of varying size
+    std::string channelPayload(uint32_t n)
+    {
+        std::string payload(n * 7 % 200, '\0');
+
+        for (std::size_t i = 0; i < payload.size(); ++i)
+            payload[i] = static_cast<char>(n + i);
+
+        return payload;
+    }
+
+    // Checks the message rings between the view and the DWM hook, in one process and between
+    // two sharing memory from shm_open. Returns whether all checks pass.
+    bool benchChannel(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        uint32_t    type;
+        std::string payload;
+
+        // in one process
+        {
+            std::unique_ptr<spsc_ring::ring<256>> ring(new spsc_ring::ring<256>());
+
+            check(spsc_ring::empty(*ring) && !spsc_ring::pop(*ring, type, payload), "nothing in a zeroed ring");
+
+            check(spsc_ring::push(*ring, 7, "hello", 5) && spsc_ring::pop(*ring, type, payload) && type == 7 && payload == "hello",
+                  "message handed over");
+            check(spsc_ring::push(*ring, 8, nullptr, 0) && spsc_ring::pop(*ring, type, payload) && type == 8 && payload.empty(),
+                  "empty message handed over");
+            check(!spsc_ring::push(*ring, 9, std::string(129, 'x').data(), 129), "oversized message refused");
+
+            // 100 bytes take 112 with the record, so two fit
+            std::string large(100, 'y');
+            unsigned    pushed = 0;
+            while (spsc_ring::push(*ring, 10, large.data(), 100))
+                ++pushed;
+            check(pushed == 2, "full ring refuses messages");
+            check(spsc_ring::pop(*ring, type, payload) && spsc_ring::push(*ring, 11, large.data(), 100),
+                  "space reused once read");
+            while (spsc_ring::pop(*ring, type, payload)) {}
+
+            // messages of all sizes across the end of the ring
+            bool intact = true;
+            for (uint32_t n = 0; n < 10000; ++n) {
+                std::string sent = channelPayload(n).substr(0, n % 120);
+
+                intact = intact && spsc_ring::push(*ring, n, sent.data(), static_cast<uint32_t>(sent.size()))
+                                && spsc_ring::pop(*ring, type, payload) && type == n && payload == sent;
+            }
+            check(intact, "messages intact across the end of the ring");
+
+            // a corrupt size empties the ring instead of reading garbage
+            spsc_ring::push(*ring, 12, "abc", 3);
+            uint32_t garbage = 0xfffffff0;
+            std::memcpy(ring->data + (ring->head.read.load() & 255), &garbage, sizeof(garbage));
+            check(!spsc_ring::pop(*ring, type, payload) && spsc_ring::empty(*ring), "corrupt ring emptied");
+            check(spsc_ring::push(*ring, 13, "def", 3) && spsc_ring::pop(*ring, type, payload) && payload == "def",
+                  "ring usable after corruption");
+        }
+
+        // between two processes: the parent sends numbered messages, the child checks them and
+        // sends them back, the parent checks the echoes
+        {
+            struct rings {
+                spsc_ring::ring<4096> requests;
+                spsc_ring::ring<4096> replies;
+            };
+
+            uint32_t messages = opt.frames * 100;
+
+            char name[64];
+            std::snprintf(name, sizeof(name), "/screenview-bench-%ld", static_cast<long>(getpid()));
+
+            int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd < 0 || ftruncate(fd, sizeof(rings)) != 0) {
+                std::printf("FAIL     shm_open: %s\n", std::strerror(errno));
+                return false;
+            }
+
+            // both processes get the mapping, the name isn't needed anymore
+            void *view = mmap(nullptr, sizeof(rings), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            shm_unlink(name);
+            close(fd);
+
+            if (view == MAP_FAILED) {
+                std::printf("FAIL     mmap: %s\n", std::strerror(errno));
+                return false;
+            }
+
+            rings *shared = static_cast<rings*>(view);
+
+            std::fflush(stdout);
+            pid_t child = fork();
+
+            if (child == 0) {
+                uint32_t expected = 0;
+                bool     intact   = true;
+
+                while (expected < messages) {
+                    if (!spsc_ring::pop(shared->requests, type, payload)) {
+                        sched_yield();
+                        continue;
+                    }
+
+                    intact = intact && type == expected && payload == channelPayload(expected);
+                    ++expected;
+
+                    while (!spsc_ring::push(shared->replies, type, payload.data(), static_cast<uint32_t>(payload.size())))
+                        sched_yield();
+                }
+
+                _exit(intact ? 0 : 1);
+            }
+
+            uint32_t sent = 0, received = 0;
+            bool     intact = true, alive = child > 0;
+
+            bench_clock::time_point start = bench_clock::now();
+
+            while (alive && received < messages) {
+                bool busy = false;
+
+                if (sent < messages) {
+                    std::string message = channelPayload(sent);
+
+                    if (spsc_ring::push(shared->requests, sent, message.data(), static_cast<uint32_t>(message.size()))) {
+                        ++sent;
+                        busy = true;
+                    }
+                }
+
+                while (spsc_ring::pop(shared->replies, type, payload)) {
+                    intact = intact && type == received && payload == channelPayload(received);
+                    ++received;
+                    busy = true;
+                }
+
+                if (!busy) {
+                    // don't wait forever for a child which died
+                    alive = waitpid(child, nullptr, WNOHANG) == 0;
+                    sched_yield();
+                }
+            }
+
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            int status = -1;
+            if (child > 0 && alive)
+                waitpid(child, &status, 0);
+
+            check(child > 0, "processes: child started");
+            check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "processes: requests arrive intact and in order");
+            check(received == messages && intact, "processes: replies arrive intact and in order");
+
+            std::printf("channel  %u messages there and back between two processes: %9.0f round trips/s\n",
+                        received, static_cast<double>(received) / seconds);
+
+            munmap(view, sizeof(rings));
+        }
+
+        std::printf("channel  %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // Just enough of an x64 decoder for the code the hooks suite plans hooks on
+    int decodeTestCode(const uint8_t *code, MHOOK_INSTRUCTION *ins, void *)
+    {
+        int32_t displacement;
+
+        switch (code[0]) {
+        case 0x53: // push rbx
+        case 0x55: // push rbp
+        case 0x90: // nop
+            ins->cbLength = 1;
+            return 1;
+        case 0xc3: // ret
+            ins->cbLength   = 1;
+            ins->bStopsFlow = 1;
+            return 1;
+        case 0xe8: // call rel32
+        case 0xe9: // jmp rel32
+            ins->cbLength   = 5;
+            ins->bStopsFlow = 1;
+            return 1;
+        case 0x48:
+            if (code[1] == 0x89 && code[2] == 0xe5) { // mov rbp, rsp
+                ins->cbLength = 3;
+                return 1;
+            }
+            if (code[1] == 0x83 && code[2] == 0xec) { // sub rsp, imm8
+                ins->cbLength = 4;
+                return 1;
+            }
+            if ((code[1] == 0x8b || code[1] == 0x8d || code[1] == 0x3b) && code[2] == 0x05) { // mov, lea, cmp rax, [rip+imm32]
+                std::memcpy(&displacement, code + 3, sizeof(displacement));
+
+                ins->cbLength      = 7;
+                ins->bIpRelative   = 1;
+                ins->bRelocatable  = code[1] != 0x3b;
+                ins->nDisplacement = displacement;
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    // Where a rel32 jump or call at @a code goes
+    const uint8_t *jumpTarget(const uint8_t *code)
+    {
+        int32_t relative;
+        std::memcpy(&relative, code + 1, sizeof(relative));
+
+        return code + 5 + relative;
+    }
+
+    // Checks planning hooks and laying out their trampolines with the platform independent half
+    // of mhook, on byte buffers. Returns whether all checks pass.
+    bool benchHooks(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        // the functions at the start, the trampolines in the middle, the hook functions at the end
+        std::vector<uint8_t> memory(8192, 0xcc);
+
+        uint8_t *functions   = memory.data();
+        uint8_t *hooks       = memory.data() + 6144;
+        uint8_t *jumpToHook  = memory.data() + 4096;
+        uint8_t *trampoline  = memory.data() + 4096 + MHOOK_PLAN_MAX_CODE_BYTES;
+        uint8_t *untouched   = memory.data() + 4096 + 2 * MHOOK_PLAN_MAX_CODE_BYTES;
+
+        auto place = [&](unsigned slot, std::initializer_list<uint8_t> code) {
+            uint8_t *function = functions + slot * 64;
+            std::copy(code.begin(), code.end(), function);
+            return function;
+        };
+
+        MHOOK_PLAN plan;
+
+        // push rbp; mov rbp, rsp; sub rsp, 0x20; nop; ret
+        uint8_t *prologue = place(0, { 0x55, 0x48, 0x89, 0xe5, 0x48, 0x83, 0xec, 0x20, 0x90, 0xc3 });
+
+        check(MhookPlan_Prepare(&plan, prologue, hooks, decodeTestCode, nullptr) && plan.cbOverwrittenCode == 8 && plan.nRipCnt == 0,
+              "whole instructions overwritten");
+
+        MhookPlan_Layout(&plan, trampoline, jumpToHook, untouched);
+        check(std::equal(prologue, prologue + 8, trampoline) && std::equal(prologue, prologue + 8, untouched),
+              "overwritten code saved");
+        check(trampoline[8] == 0xe9 && jumpTarget(trampoline + 8) == prologue + 8, "trampoline continues in the function");
+        check(plan.cbPatch == 5 && plan.codePatch[0] == 0xe9 && jumpTarget(plan.codePatch) - plan.codePatch + prologue == hooks,
+              "function jumps to the hook");
+        check(prologue[0] == 0x55, "function untouched until committed");
+
+        // mov rax, [rip+0x100]; ret
+        uint8_t *relative = place(1, { 0x48, 0x8b, 0x05, 0x00, 0x01, 0x00, 0x00, 0xc3 });
+
+        check(MhookPlan_Prepare(&plan, relative, hooks, decodeTestCode, nullptr) && plan.cbOverwrittenCode == 7 &&
+              plan.nRipCnt == 1 && plan.rips[0].dwOffset == 3 && plan.nLimitUp == 0x100, "IP-relative operand found");
+
+        MhookPlan_Layout(&plan, trampoline, jumpToHook, untouched);
+
+        int32_t displacement;
+        std::memcpy(&displacement, trampoline + 3, sizeof(displacement));
+        check(trampoline + 7 + displacement == relative + 7 + 0x100, "IP-relative operand still points to the same place");
+        check(std::equal(relative, relative + 7, untouched), "IP-relative operand saved unchanged");
+
+        // too short, or unmovable
+        uint8_t *tiny = place(2, { 0x90, 0xc3 });
+        check(!MhookPlan_Prepare(&plan, tiny, hooks, decodeTestCode, nullptr), "functions shorter than a jump refused");
+
+        uint8_t *compare = place(3, { 0x48, 0x3b, 0x05, 0x00, 0x01, 0x00, 0x00, 0xc3 });
+        check(!MhookPlan_Prepare(&plan, compare, hooks, decodeTestCode, nullptr), "unsupported IP-relative operands refused");
+
+        uint8_t *call = place(4, { 0x53, 0xe8, 0x00, 0x00, 0x00, 0x00, 0xc3 });
+        check(!MhookPlan_Prepare(&plan, call, hooks, decodeTestCode, nullptr), "calls end the overwritable code");
+
+        uint8_t *garbage = place(5, { 0x0f, 0x0b, 0x90, 0x90, 0x90, 0x90 });
+        check(!MhookPlan_Prepare(&plan, garbage, hooks, decodeTestCode, nullptr), "undecodable code refused");
+
+        // a hook function too far away for a direct jump, which is never dereferenced
+        uint8_t *farHook = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(prologue) + 0xc0000000u);
+        uint8_t *target;
+
+        check(MhookPlan_Prepare(&plan, prologue, farHook, decodeTestCode, nullptr), "far hook planned");
+        MhookPlan_Layout(&plan, trampoline, jumpToHook, untouched);
+        std::memcpy(&target, jumpToHook + 6, sizeof(target));
+        check(jumpToHook[0] == 0xff && jumpToHook[1] == 0x25 && target == farHook, "far hook reached through a stub");
+        check(jumpTarget(plan.codePatch) - plan.codePatch + prologue == jumpToHook, "function jumps to the stub");
+
+        // jumps in front of the real function: jmp rel32, jmp rel8, jmp [rip+0]
+        uint8_t *real     = prologue;
+        uint8_t *indirect = place(6, { 0xff, 0x25, 0x00, 0x00, 0x00, 0x00 });
+        std::memcpy(indirect + 6, &real, sizeof(real));
+        uint8_t *shortJump = place(7, { 0xeb, static_cast<uint8_t>(indirect - (functions + 7 * 64) - 2) });
+        uint8_t *longJump  = place(8, { 0xe9 });
+        int32_t  relativeJump = static_cast<int32_t>(shortJump - (longJump + 5));
+        std::memcpy(longJump + 1, &relativeJump, sizeof(relativeJump));
+
+        check(MhookPlan_SkipJumps(longJump) == real, "jumps to the real function skipped");
+        check(MhookPlan_SkipJumps(real) == real, "real function kept");
+
+        // planning throughput, for what it's worth next to suspending threads
+        unsigned plans = opt.frames * 500;
+        unsigned hooked = 0;
+
+        bench_clock::time_point start = bench_clock::now();
+        for (unsigned i = 0; i < plans; ++i) {
+            uint8_t *function = i % 2 ? prologue : relative;
+
+            if (MhookPlan_Prepare(&plan, function, hooks, decodeTestCode, nullptr)) {
+                MhookPlan_Layout(&plan, trampoline, jumpToHook, untouched);
+                ++hooked;
+            }
+        }
+        double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        check(hooked == plans, "all hooks planned");
+
+        std::printf("hooks    %u hooks planned and laid out: %9.0f hooks/s\n", hooked, static_cast<double>(hooked) / seconds);
+        std::printf("hooks    %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // Hands out the memory of an arena of address space reserved with mmap to the trampoline
+    // allocator, some of it taken up front by mock modules and other allocations
+    struct arena_pages {
+        static const size_t GRANULE = 64 * 1024;
+
+        uint8_t             *base = nullptr;
+        size_t               size = 0;
+        std::vector<uint8_t> used; // for every granule
+        unsigned             queries = 0;
+
+        uint8_t *view = nullptr;
+
+        explicit arena_pages(size_t granules) : used(granules, 0)
+        {
+            // one granule more, blocks are aligned to them
+            void *reserved = mmap(nullptr, (granules + 1) * GRANULE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (reserved != MAP_FAILED) {
+                view = static_cast<uint8_t*>(reserved);
+                base = view + (GRANULE - reinterpret_cast<uintptr_t>(view) % GRANULE) % GRANULE;
+                size = granules * GRANULE;
+            }
+        }
+
+        ~arena_pages()
+        {
+            if (view)
+                munmap(view, size + GRANULE);
+        }
+
+        void take(size_t first, size_t count)
+        {
+            for (size_t i = first; i < first + count && i < used.size(); ++i)
+                used[i] = 1;
+        }
+
+        MHOOK_PAGE_PROVIDER provider()
+        {
+            MHOOK_PAGE_PROVIDER p = { query, alloc, this };
+            return p;
+        }
+
+        static int query(void *context, uint8_t *address, uint8_t **regionBase, size_t *regionSize, int *isFree)
+        {
+            arena_pages *self = static_cast<arena_pages*>(context);
+            ++self->queries;
+
+            // everything around the arena is in use
+            if (address < self->base) {
+                *regionBase = nullptr;
+                *regionSize = static_cast<size_t>(self->base - static_cast<uint8_t*>(nullptr));
+                *isFree     = 0;
+                return 1;
+            }
+            if (address >= self->base + self->size) {
+                *regionBase = self->base + self->size;
+                *regionSize = UINTPTR_MAX - reinterpret_cast<uintptr_t>(*regionBase);
+                *isFree     = 0;
+                return 1;
+            }
+
+            size_t granule = static_cast<size_t>(address - self->base) / GRANULE;
+            size_t first   = granule, last = granule;
+            uint8_t state  = self->used[granule];
+
+            while (first > 0 && self->used[first - 1] == state)
+                --first;
+            while (last + 1 < self->used.size() && self->used[last + 1] == state)
+                ++last;
+
+            *regionBase = self->base + first * GRANULE;
+            *regionSize = (last - first + 1) * GRANULE;
+            *isFree     = !state;
+            return 1;
+        }
+
+        static void *alloc(void *context, uint8_t *address, size_t bytes)
+        {
+            arena_pages *self = static_cast<arena_pages*>(context);
+
+            if (address < self->base || address + bytes > self->base + self->size ||
+                (address - self->base) % GRANULE || bytes % GRANULE)
+                return nullptr;
+
+            size_t first = static_cast<size_t>(address - self->base) / GRANULE;
+            for (size_t i = first; i < first + bytes / GRANULE; ++i) {
+                if (self->used[i])
+                    return nullptr;
+            }
+
+            if (mprotect(address, bytes, PROT_READ | PROT_WRITE) != 0)
+                return nullptr;
+
+            self->take(first, bytes / GRANULE);
+            return address;
+        }
+    };
+
+    // Checks the trampoline allocator of mhook over an arena of mmapped memory with mock modules,
+    // and times it against looking up trampolines in a list, like mhook used to. Returns whether
+    // all checks pass.
+    bool benchTrampolines(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        static const size_t GRANULES      = 4096; // 256MB
+        static const size_t MODULES       = 32;
+        static const size_t MODULE_SPAN   = GRANULES / MODULES;
+        static const size_t MODULE_SIZE   = 16;
+        static const size_t SLOT_SIZE     = 128;  // about a trampoline
+        static const size_t ENTRY_OFFSET  = 40;   // where the trampoline code would be
+        static const size_t RANGE         = 32 * 1024 * 1024;
+
+        arena_pages pages(GRANULES);
+        if (!pages.base) {
+            std::printf("FAIL     mmap: %s\n", std::strerror(errno));
+            return false;
+        }
+
+        // modules with a few other allocations next to them, every other granule
+        for (size_t m = 0; m < MODULES; ++m) {
+            size_t first = m * MODULE_SPAN + MODULE_SPAN / 2;
+
+            pages.take(first, MODULE_SIZE);
+            for (size_t i = 1; i <= 2; ++i) {
+                pages.take(first - 2 * i, 1);
+                pages.take(first + MODULE_SIZE + 2 * i - 1, 1);
+            }
+        }
+
+        auto moduleFunction = [&](unsigned i) {
+            size_t module = i % MODULES;
+            return pages.base + (module * MODULE_SPAN + MODULE_SPAN / 2) * arena_pages::GRANULE + (i * 4099u) % (MODULE_SIZE * arena_pages::GRANULE);
+        };
+
+        MHOOK_PAGE_PROVIDER provider = pages.provider();
+        MHOOK_ALLOCATOR     allocator;
+        MhookAlloc_Init(&allocator, &provider, arena_pages::GRANULE, SLOT_SIZE);
+
+        unsigned hooks = std::max(opt.frames * 5, 1000u);
+
+        std::vector<uint8_t*> slots;
+        std::set<uint8_t*>    distinct;
+        bool                  inRange = true;
+
+        bench_clock::time_point start = bench_clock::now();
+
+        for (unsigned i = 0; i < hooks; ++i) {
+            uint8_t *function = moduleFunction(i);
+            uint8_t *slot     = static_cast<uint8_t*>(MhookAlloc_Alloc(&allocator, function, function - RANGE, function + RANGE));
+
+            if (!slot)
+                break;
+
+            inRange = inRange && slot > function - RANGE && slot < function + RANGE;
+            slots.push_back(slot);
+        }
+
+        double allocSeconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        distinct.insert(slots.begin(), slots.end());
+
+        check(slots.size() == hooks, "all trampolines allocated");
+        check(inRange, "trampolines in range of their functions");
+        check(distinct.size() == slots.size(), "trampolines handed out once");
+        check(pages.queries < allocator.nBlocks * 8, "free address space remembered");
+
+        // lookups by the address of the code in the trampoline
+        start = bench_clock::now();
+
+        bool found = true;
+        for (uint8_t *slot : slots)
+            found = found && MhookAlloc_Find(&allocator, slot + ENTRY_OFFSET, ENTRY_OFFSET) == slot;
+
+        double findSeconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        check(found, "trampolines found by their code");
+        check(!MhookAlloc_Find(&allocator, slots[0] + ENTRY_OFFSET + 1, ENTRY_OFFSET), "addresses inside of trampolines not taken for them");
+        check(!MhookAlloc_Find(&allocator, moduleFunction(0), 0), "addresses outside of blocks not taken for trampolines");
+
+        // the old way: walking a list of all hooks
+        start = bench_clock::now();
+
+        bool listed = true;
+        for (uint8_t *slot : slots)
+            listed = listed && *std::find(slots.begin(), slots.end(), slot) == slot;
+
+        double listSeconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+        // freed trampolines are only reused if no code ever ran through them, checked on a full block
+        uint8_t *retired = slots[0];
+        uint8_t *block   = pages.base + (retired - pages.base) / arena_pages::GRANULE * arena_pages::GRANULE;
+        uint8_t *unused  = *std::find_if(slots.begin() + 1, slots.end(), [&](uint8_t *slot) {
+            return slot >= block && slot < block + arena_pages::GRANULE;
+        });
+
+        while (MhookAlloc_Alloc(&allocator, block, block - 1, block + arena_pages::GRANULE)) {}
+
+        MhookAlloc_Free(&allocator, retired, 0);
+        check(!MhookAlloc_Find(&allocator, retired + ENTRY_OFFSET, ENTRY_OFFSET), "freed trampolines not found");
+        check(!MhookAlloc_Alloc(&allocator, block, block - 1, block + arena_pages::GRANULE), "used trampolines never handed out again");
+
+        MhookAlloc_Free(&allocator, unused, 1);
+        check(MhookAlloc_Alloc(&allocator, block, block - 1, block + arena_pages::GRANULE) == unused, "unused trampolines handed out again");
+
+        // no room in a range covering nothing but a module
+        uint8_t *module = pages.base + (MODULE_SPAN / 2) * arena_pages::GRANULE;
+        check(!MhookAlloc_Alloc(&allocator, module, module, module + MODULE_SIZE * arena_pages::GRANULE), "no trampoline out of range");
+
+        std::printf("trampolines %u allocated in %u blocks with %u queries: %9.0f allocations/s\n",
+                    static_cast<unsigned>(slots.size()), allocator.nBlocks, pages.queries, static_cast<double>(slots.size()) / allocSeconds);
+        std::printf("trampolines lookups: %9.0f/s, walking a list of all of them: %9.0f/s%s\n",
+                    static_cast<double>(slots.size()) / findSeconds, static_cast<double>(slots.size()) / listSeconds, listed ? "" : " (!)");
+
+        MhookAlloc_Release(&allocator);
+
+        std::printf("trampolines %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // The executable sections of an ELF file on the build machine
+    struct elf_code {
+        ARCHITECTURE_TYPE    arch = ARCH_UNKNOWN;
+        std::vector<uint8_t> bytes;
+    };
+
+    template <class Ehdr, class Shdr>
+    bool readElfSections(int fd, elf_code& code, size_t limit)
+    {
+        Ehdr header;
+        if (pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) || header.e_shentsize != sizeof(Shdr))
+            return false;
+
+        switch (header.e_machine) {
+        case EM_X86_64: code.arch = ARCH_X64; break;
+        case EM_386:    code.arch = ARCH_X86; break;
+        default:        return false;
+        }
+
+        std::vector<Shdr> sections(header.e_shnum);
+        ssize_t size = static_cast<ssize_t>(sections.size() * sizeof(Shdr));
+        if (sections.empty() || pread(fd, sections.data(), static_cast<size_t>(size), static_cast<off_t>(header.e_shoff)) != size)
+            return false;
+
+        for (const Shdr& section : sections) {
+            if (section.sh_type != SHT_PROGBITS || !(section.sh_flags & SHF_EXECINSTR))
+                continue;
+
+            size_t take = std::min(static_cast<size_t>(section.sh_size), limit - code.bytes.size());
+            size_t at   = code.bytes.size();
+            code.bytes.resize(at + take);
+            if (pread(fd, code.bytes.data() + at, take, static_cast<off_t>(section.sh_offset)) != static_cast<ssize_t>(take))
+                code.bytes.resize(at);
+        }
+
+        return !code.bytes.empty();
+    }
+
+    // Reads up to @a limit bytes of code out of the ELF file at @a path
+    bool readElfCode(const char *path, elf_code& code, size_t limit)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        unsigned char ident[EI_NIDENT];
+        bool ok = pread(fd, ident, sizeof(ident), 0) == static_cast<ssize_t>(sizeof(ident)) &&
+                  std::memcmp(ident, ELFMAG, SELFMAG) == 0;
+        if (ok && ident[EI_CLASS] == ELFCLASS64)
+            ok = readElfSections<Elf64_Ehdr, Elf64_Shdr>(fd, code, limit);
+        else if (ok && ident[EI_CLASS] == ELFCLASS32)
+            ok = readElfSections<Elf32_Ehdr, Elf32_Shdr>(fd, code, limit);
+        else
+            ok = false;
+
+        close(fd);
+        return ok;
+    }
+
+    // Collects up to @a limit bytes of code of each architecture from the libraries and
+    // programs of the build machine, at most @a perFile out of each
+    void collectElfCode(std::vector<uint8_t>& x64, std::vector<uint8_t>& x86, size_t limit, size_t perFile)
+    {
+        static const char *const directories[] = {
+            "/usr/lib/x86_64-linux-gnu", "/usr/lib32", "/usr/lib/i386-linux-gnu", "/usr/bin",
+        };
+
+        std::set<ino_t> seen;
+        for (const char *directory : directories) {
+            DIR *dir = opendir(directory);
+            if (!dir)
+                continue;
+
+            std::vector<std::string> names;
+            while (dirent *entry = readdir(dir))
+                names.push_back(entry->d_name);
+            closedir(dir);
+            std::sort(names.begin(), names.end());
+
+            for (const std::string& name : names) {
+                std::string path = std::string(directory) + "/" + name;
+                struct stat st;
+                if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || !seen.insert(st.st_ino).second)
+                    continue;
+
+                elf_code code;
+                if (!readElfCode(path.c_str(), code, perFile))
+                    continue;
+
+                std::vector<uint8_t>& all = code.arch == ARCH_X64 ? x64 : x86;
+                if (all.size() < limit)
+                    all.insert(all.end(), code.bytes.begin(), code.bytes.begin() + std::min(code.bytes.size(), limit - all.size()));
+            }
+        }
+    }
+
+    // The full decoder of disasm-lib, told where the code ends the way X86_GetLengthAndType is
+    bool fullDecode(DISASSEMBLER *dis, const uint8_t *code, size_t size, uint32_t flags, X86_LENGTH_AND_TYPE *info)
+    {
+        uint8_t copy[64] = {};
+        const uint8_t *at = code;
+        if (size < sizeof(copy)) {
+            std::memcpy(copy, code, size);
+            at = copy;
+        }
+
+        INSTRUCTION *ins = GetInstruction(dis, reinterpret_cast<uintptr_t>(code), const_cast<uint8_t *>(at), flags);
+        std::memset(info, 0, sizeof(*info));
+        if (!ins || ins->Length > size)
+            return false;
+
+        info->Length       = ins->Length;
+        info->Type         = ins->Type;
+        info->OperandCount = static_cast<U8>(ins->OperandCount);
+        info->OperandSize  = ins->X86.OperandSize;
+        for (U32 i = 0; i < ins->OperandCount && i < MAX_OPERAND_COUNT; ++i) {
+            if (ins->Operands[i].Flags & OP_IPREL) {
+                info->IsIpRelative = 1;
+                info->Displacement = ins->X86.Displacement;
+            }
+        }
+        return true;
+    }
+
+    // Decodes @a code instruction by instruction with both decoders, going on with the next
+    // byte where they fail. Returns the number of instructions on which they disagree.
+    unsigned compareDecoders(ARCHITECTURE_TYPE arch, const std::vector<uint8_t>& code, const char *what, unsigned& instructions)
+    {
+        DISASSEMBLER dis;
+        InitDisassembler(&dis, arch);
+
+        unsigned mismatches = 0;
+        instructions = 0;
+        for (size_t at = 0; at < code.size();) {
+            size_t              size = code.size() - at;
+            X86_LENGTH_AND_TYPE full, fast;
+
+            bool fullOk = fullDecode(&dis, &code[at], size, DISASM_DECODE | DISASM_SUPPRESSERRORS, &full);
+            bool fastOk = X86_GetLengthAndType(arch, const_cast<uint8_t *>(&code[at]), static_cast<U32>(size), &fast) != 0;
+
+            bool same = fullOk == fastOk;
+            if (same && fullOk)
+                same = full.Length == fast.Length && full.Type == fast.Type && full.OperandCount == fast.OperandCount &&
+                       full.OperandSize == fast.OperandSize && full.IsIpRelative == fast.IsIpRelative &&
+                       (!full.IsIpRelative || full.Displacement == fast.Displacement);
+
+            if (!same && ++mismatches <= 8) {
+                std::printf("         %s +%zx:", what, at);
+                for (size_t i = 0; i < std::min<size_t>(size, 15); ++i)
+                    std::printf(" %02x", code[at + i]);
+                std::printf("\n         full %d length %u type %x operands %u size %u iprel %u; fast %d length %u type %x operands %u size %u iprel %u\n",
+                            fullOk, full.Length, full.Type, full.OperandCount, full.OperandSize, full.IsIpRelative,
+                            fastOk, fast.Length, fast.Type, fast.OperandCount, fast.OperandSize, fast.IsIpRelative);
+            }
+
+            if (fullOk)
+                ++instructions;
+            at += fullOk ? full.Length : 1;
+        }
+
+        CloseDisassembler(&dis);
+        return mismatches;
+    }
+
+    // Checks the length decoder of disasm-lib against its full decoder over the code of the build
+    // machine and over random bytes, in every mode, and times both. Returns whether all checks pass.
+    bool benchDecoder(const options& opt)
+    {
+        (void)opt;
+
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        std::vector<uint8_t> x64, x86;
+        collectElfCode(x64, x86, 16 << 20, 1 << 20);
+        std::printf("decoder  %zu bytes of x64 code, %zu bytes of x86 code\n", x64.size(), x86.size());
+        check(!x64.empty() || !x86.empty(), "code found on the build machine");
+
+        std::vector<uint8_t> noise(1 << 20);
+        std::mt19937 random(7);
+        for (uint8_t& byte : noise)
+            byte = static_cast<uint8_t>(random());
+
+        struct sweep {
+            ARCHITECTURE_TYPE           arch;
+            const std::vector<uint8_t> *code;
+            const char                 *what;
+        } sweeps[] = {
+            { ARCH_X64,    &x64,   "x64 code" },
+            { ARCH_X86,    &x86,   "x86 code" },
+            { ARCH_X86,    &x64,   "x64 code as x86" },
+            { ARCH_X86_16, &x64,   "x64 code as 16-bit x86" },
+            { ARCH_X64,    &noise, "random bytes as x64" },
+            { ARCH_X86,    &noise, "random bytes as x86" },
+            { ARCH_X86_16, &noise, "random bytes as 16-bit x86" },
+        };
+
+        for (const sweep& s : sweeps) {
+            if (s.code->empty())
+                continue;
+
+            unsigned instructions = 0;
+            unsigned mismatches   = compareDecoders(s.arch, *s.code, s.what, instructions);
+            std::printf("decoder  %-26s %9u instructions, %u decoded differently\n", s.what, instructions, mismatches);
+
+            std::string what = std::string(s.what) + ": the length decoder agrees with the full decoder";
+            check(mismatches == 0, what.c_str());
+        }
+
+        // truncated instructions are rejected rather than read beyond the end
+        static const uint8_t call[] = { 0xe8, 0x10, 0x20, 0x30, 0x40 };
+        X86_LENGTH_AND_TYPE info;
+        check(X86_GetLengthAndType(ARCH_X64, const_cast<uint8_t *>(call), sizeof(call), &info) && info.Length == 5 &&
+              info.Type == ITYPE_CALL && info.IsIpRelative && info.Displacement == 0x40302010, "call rel32 decoded");
+        check(!X86_GetLengthAndType(ARCH_X64, const_cast<uint8_t *>(call), sizeof(call) - 1, &info), "truncated call rejected");
+
+        // throughput over the x64 code, the way mhook walks function prologues
+        const std::vector<uint8_t>& code = x64.empty() ? x86 : x64;
+        ARCHITECTURE_TYPE           arch = x64.empty() ? ARCH_X86 : ARCH_X64;
+        DISASSEMBLER dis;
+        InitDisassembler(&dis, arch);
+
+        auto sweepSeconds = [&](const std::function<uint32_t(const uint8_t *, size_t)>& decode, unsigned& instructions) {
+            bench_clock::time_point start = bench_clock::now();
+            instructions = 0;
+            for (size_t at = 0; at < code.size();) {
+                uint32_t length = decode(&code[at], code.size() - at);
+                instructions += length != 0;
+                at += length ? length : 1;
+            }
+            return std::chrono::duration<double>(bench_clock::now() - start).count();
+        };
+
+        unsigned decoded[3];
+        double   seconds[3];
+        seconds[0] = sweepSeconds([&](const uint8_t *at, size_t size) -> uint32_t {
+            INSTRUCTION *ins = GetInstruction(&dis, reinterpret_cast<uintptr_t>(at), const_cast<uint8_t *>(at),
+                                              DISASM_DECODE | DISASM_DISASSEMBLE | DISASM_ALIGNOUTPUT | DISASM_SUPPRESSERRORS);
+            return ins && ins->Length <= size ? ins->Length : 0;
+        }, decoded[0]);
+        seconds[1] = sweepSeconds([&](const uint8_t *at, size_t size) -> uint32_t {
+            INSTRUCTION *ins = GetInstruction(&dis, reinterpret_cast<uintptr_t>(at), const_cast<uint8_t *>(at), DISASM_DECODE | DISASM_SUPPRESSERRORS);
+            return ins && ins->Length <= size ? ins->Length : 0;
+        }, decoded[1]);
+        seconds[2] = sweepSeconds([&](const uint8_t *at, size_t size) -> uint32_t {
+            X86_LENGTH_AND_TYPE fast;
+            return X86_GetLengthAndType(arch, const_cast<uint8_t *>(at), static_cast<U32>(size), &fast) ? fast.Length : 0;
+        }, decoded[2]);
+        CloseDisassembler(&dis);
+
+        std::printf("decoder  disassembling (as mhook did): %9.0f instructions/s\n", decoded[0] / seconds[0]);
+        std::printf("decoder  full decoder:                 %9.0f instructions/s\n", decoded[1] / seconds[1]);
+        std::printf("decoder  length decoder:               %9.0f instructions/s (%.1fx)\n", decoded[2] / seconds[2],
+                    (decoded[2] / seconds[2]) / (decoded[1] / seconds[1]));
+
+        std::printf("decoder  %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // Hubs of the hub suite: counted, and the next one destroyed calls hubStopping, so the
+    // suite can look at the registry while a hub is being stopped
+    std::atomic<int>      hubsLive(0);
+    std::atomic<int>      hubsCreated(0);
+    std::function<void()> hubStopping;
+
+    struct CountedHub {
+        capture_hub::output out;
+        int                 id;
+
+        explicit CountedHub(const capture_hub::output& o) : out(o), id(++hubsCreated) { ++hubsLive; }
+
+        ~CountedHub()
+        {
+            std::function<void()> stopping;
+            stopping.swap(hubStopping);
+            if (stopping)
+                stopping();
+            --hubsLive;
+        }
+    };
+
+    // Runs @a f on a thread of its own and tells whether it finished within @a ms. The thread
+    // is joined either way, so a call blocked for good hangs the suite rather than crashing it.
+    bool finishesWithin(unsigned ms, const std::function<void()>& f)
+    {
+        std::atomic<bool> done(false);
+        std::thread       thread([&] { f(); done.store(true); });
+
+        bench_clock::time_point until = bench_clock::now() + std::chrono::milliseconds(ms);
+        while (!done.load() && bench_clock::now() < until)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        bool finished = done.load();
+        thread.join();
+        return finished;
+    }
+
+    // Checks the registry of capture hubs and the fanout of their frames to the views, step by
+    // step and with views coming and going while frames are published. Returns whether all
+    // checks pass.
+    bool benchHub(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        typedef capture_hub::registry<CountedHub> registry;
+
+        const capture_hub::output left  = { 0, 0, 1920, 1080 };
+        const capture_hub::output right = { 1920, 0, 1920, 1080 };
+
+        // reference counts
+        {
+            registry hubs;
+
+            CountedHub *a = hubs.attach(left);
+            CountedHub *b = hubs.attach(left);
+            CountedHub *c = hubs.attach(right);
+            check(a == b && a != c && hubsLive.load() == 2 && hubs.size() == 2, "one hub per output");
+            check(hubs.refs(left) == 2 && hubs.refs(right) == 1, "views counted per output");
+
+            hubs.detach(left);
+            check(hubsLive.load() == 2 && hubs.refs(left) == 1, "hub kept while a view is attached");
+
+            hubs.detach(right);
+            check(hubsLive.load() == 1 && hubs.refs(right) == 0 && hubs.size() == 1, "hub destroyed with the last view");
+
+            hubs.detach(right);
+            check(hubsLive.load() == 1 && hubs.size() == 1, "detaching an unknown output does nothing");
+
+            // the registry has to be usable from the destructor, stopping a hub must not block the others
+            bool unlocked = false;
+            hubStopping = [&] {
+                unlocked = finishesWithin(1000, [&] { hubs.size(); hubs.refs(right); });
+            };
+            hubs.detach(left);
+            check(unlocked, "hub destroyed outside the lock");
+            check(hubsLive.load() == 0 && hubs.size() == 0, "all hubs gone");
+        }
+
+        // attaching again while the last hub of the output is being stopped
+        {
+            registry hubs;
+
+            int  stopped = hubs.attach(left)->id;
+            int  fresh   = 0;
+            bool quick   = false;
+
+            hubStopping = [&] {
+                quick = finishesWithin(1000, [&] { fresh = hubs.attach(left)->id; });
+                check(hubsLive.load() == 2, "re-attach: old and new hub live at the same time");
+
+                // the stopping hub takes its time, nobody waits for it
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            };
+            hubs.detach(left);
+
+            check(quick, "re-attach: not blocked by the stopping hub");
+            check(fresh != stopped && fresh != 0, "re-attach: a new hub");
+            check(hubs.refs(left) == 1 && hubsLive.load() == 1, "re-attach: the new hub counted once");
+
+            hubs.detach(left);
+            check(hubsLive.load() == 0, "re-attach: new hub destroyed");
+        }
+
+        typedef capture_hub::fanout                   fanout;
+        typedef std::vector<damage::rect>             rects;
+
+        auto damageAt = [](int32_t x) {
+            return rects(1, damage::rect{ x, 0, x + 1, 1 });
+        };
+
+        frame_source::cursor_state cursor;
+        auto nobody = [](void *) {};
+
+        // damage collected per subscriber
+        {
+            fanout            hub;
+            fanout::subscriber a, b;
+            rects              got;
+
+            hub.subscribe(a);
+            check(!hub.take_damage(a, got) && got.empty(), "damage unknown before the first take");
+            check(hub.take_damage(a, got) && got.empty(), "no damage after taking it");
+
+            rects one = damageAt(1);
+            hub.publish(true, &one, false, cursor, nobody);
+            rects two = damageAt(2);
+            hub.publish(true, &two, false, cursor, nobody);
+            check(hub.take_damage(a, got) && got.size() == 2 && got[0].left == 1 && got[1].left == 2,
+                  "damage accumulated in order");
+
+            hub.subscribe(b);
+            hub.publish(true, &one, false, cursor, nobody);
+            got.clear();
+            check(!hub.take_damage(b, got) && got.empty(), "new subscriber: damage unknown");
+            check(hub.take_damage(a, got) && got.size() == 1, "old subscriber: damage still known");
+
+            hub.publish(true, nullptr, false, cursor, nobody);
+            got.clear();
+            check(!hub.take_damage(a, got) && !hub.take_damage(b, got) && got.empty(), "null damage: unknown");
+
+            // damage piling up beyond the limit
+            rects many(fanout::MAX_PENDING_DAMAGE, damage::rect{ 0, 0, 1, 1 });
+            hub.publish(true, &many, false, cursor, nobody);
+            got.clear();
+            check(hub.take_damage(a, got) && got.size() == fanout::MAX_PENDING_DAMAGE, "damage up to the limit kept");
+
+            hub.publish(true, &many, false, cursor, nobody);
+            hub.publish(true, &one, false, cursor, nobody);
+            got.clear();
+            check(!hub.take_damage(a, got) && got.empty(), "damage beyond the limit: unknown");
+            check(hub.take_damage(a, got) && got.empty(), "unknown damage reset by taking it");
+
+            hub.publish(true, &one, false, cursor, nobody);
+            hub.publish(true, &many, false, cursor, nobody);
+            got.clear();
+            check(!hub.take_damage(a, got), "damage reaching beyond the limit in one frame: unknown");
+
+            // the cursor alone doesn't damage the desktop
+            hub.take_damage(b, got);
+            hub.publish(false, nullptr, true, cursor, nobody);
+            got.clear();
+            check(hub.take_damage(b, got) && got.empty(), "cursor frames leave the damage alone");
+        }
+
+        // polling several subscribers
+        {
+            fanout             hub;
+            fanout::subscriber a, b;
+            bool               desktop, cursorMoved;
+            frame_source::cursor_state seen;
+
+            int wakeupA = 0, wakeupB = 0;
+            a.wakeup = &wakeupA;
+            b.wakeup = &wakeupB;
+
+            auto wake = [](void *wakeup) { ++*static_cast<int *>(wakeup); };
+
+            hub.subscribe(a);
+            frame_source::cursor_state moved;
+            moved.x = 10;
+            moved.y = 20;
+            hub.publish(true, nullptr, true, moved, wake);
+            check(wakeupA == 1 && wakeupB == 0, "only subscribers woken");
+
+            hub.subscribe(b);
+            hub.poll(b, desktop, cursorMoved, seen);
+            check(desktop && cursorMoved && seen.x == 10 && seen.y == 20, "new subscriber sees the current frame as new");
+
+            hub.poll(b, desktop, cursorMoved, seen);
+            check(!desktop && !cursorMoved, "frames seen once");
+
+            seen.x = -1;
+            hub.publish(true, nullptr, false, moved, wake);
+            hub.poll(a, desktop, cursorMoved, seen);
+            check(desktop && cursorMoved && seen.x == 10, "frames missed in between are still new");
+            hub.poll(b, desktop, cursorMoved, seen);
+            check(desktop && !cursorMoved, "cursor unchanged");
+
+            seen.x = -1;
+            moved.x = 11;
+            hub.publish(false, nullptr, true, moved, wake);
+            hub.publish(false, nullptr, true, moved, wake);
+            hub.poll(b, desktop, cursorMoved, seen);
+            check(!desktop && cursorMoved && seen.x == 11, "cursor frames don't change the desktop");
+            check(wakeupA == 4 && wakeupB == 3, "every subscriber woken on every frame");
+
+            hub.unsubscribe(a);
+            hub.publish(true, nullptr, false, moved, wake);
+            check(wakeupA == 4 && wakeupB == 4 && hub.subscribers() == 1, "unsubscribed views not woken");
+
+            hub.unsubscribe(b);
+            hub.unsubscribe(b);
+            check(hub.subscribers() == 0, "unsubscribing twice does nothing");
+        }
+
+        // views coming and going while frames are published
+        {
+            static const unsigned CHURNING = 3;
+
+            // stays below the limit, so a subscriber for the whole time gets all of the damage
+            const unsigned frames = static_cast<unsigned>(fanout::MAX_PENDING_DAMAGE) - 1;
+
+            fanout             hub;
+            fanout::subscriber steady;
+            rects              got;
+
+            hub.subscribe(steady);
+            hub.take_damage(steady, got);
+
+            std::atomic<bool>     done(false);
+            std::atomic<unsigned> strangers(0), disordered(0), subscriptions(0);
+            std::set<void *>      known;
+            std::mutex            knownMutex;
+
+            std::vector<std::unique_ptr<fanout::subscriber>> views;
+            for (unsigned i = 0; i < CHURNING; ++i) {
+                views.emplace_back(new fanout::subscriber());
+                views.back()->wakeup = views.back().get();
+            }
+            steady.wakeup = &steady;
+
+            auto wake = [&](void *wakeup) {
+                std::lock_guard<std::mutex> guard(knownMutex);
+                if (!known.count(wakeup))
+                    ++strangers;
+            };
+
+            known.insert(&steady);
+
+            std::vector<std::thread> churning;
+            for (unsigned i = 0; i < CHURNING; ++i) {
+                churning.emplace_back([&, i] {
+                    fanout::subscriber& view = *views[i];
+
+                    while (!done.load()) {
+                        {
+                            std::lock_guard<std::mutex> guard(knownMutex);
+                            known.insert(&view);
+                        }
+                        hub.subscribe(view);
+                        ++subscriptions;
+
+                        rects taken;
+                        bool  desktop, cursorMoved;
+                        frame_source::cursor_state seen;
+
+                        for (unsigned n = 0; n < 4; ++n) {
+                            hub.poll(view, desktop, cursorMoved, seen);
+
+                            taken.clear();
+                            if (hub.take_damage(view, taken)) {
+                                for (std::size_t r = 1; r < taken.size(); ++r)
+                                    disordered += taken[r].left <= taken[r - 1].left;
+                            }
+                            std::this_thread::yield();
+                        }
+
+                        hub.unsubscribe(view);
+                        {
+                            std::lock_guard<std::mutex> guard(knownMutex);
+                            known.erase(&view);
+                        }
+                    }
+                });
+            }
+
+            // all views have been there once before the first frame
+            while (subscriptions.load() < CHURNING)
+                std::this_thread::yield();
+
+            bench_clock::time_point start = bench_clock::now();
+            unsigned                published = 0;
+
+            for (unsigned round = 0; round < std::max(1u, opt.frames / 100); ++round) {
+                for (unsigned f = 0; f < frames; ++f) {
+                    rects one = damageAt(static_cast<int32_t>(published));
+                    hub.publish(true, &one, f % 4 == 0, cursor, wake);
+                    ++published;
+
+                    // let the views come and go in between
+                    if (f % 8 == 0)
+                        std::this_thread::yield();
+                }
+
+                got.clear();
+                bool all = hub.take_damage(steady, got);
+                bool inOrder = all && got.size() == frames;
+                for (std::size_t r = 0; inOrder && r < got.size(); ++r)
+                    inOrder = got[r].left == static_cast<int32_t>(round * frames + r);
+                if (!inOrder) {
+                    check(false, "threads: all damage for a steady subscriber, in order");
+                    break;
+                }
+            }
+
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            done.store(true);
+            for (std::thread& thread : churning)
+                thread.join();
+
+            check(strangers.load() == 0, "threads: only subscribers woken");
+            check(disordered.load() == 0, "threads: damage of churning views in order");
+            check(hub.subscribers() == 1, "threads: churning views all gone");
+
+            std::printf("hub      %u frames to %u churning views, %u subscriptions: %9.0f frames/s\n",
+                        published, CHURNING, subscriptions.load(), static_cast<double>(published) / seconds);
+        }
+
+        std::printf("hub      %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    // The kinds of damage the damage suite replays
+    enum damage_stream {
+        STREAM_SCROLL,   // one move overlapping its own source
+        STREAM_SWAP,     // two moves reading from each other
+        STREAM_ROTATE,   // moves reading from each other in a circle
+        STREAM_CHAIN,    // moves reading from the next one's destination
+        STREAM_RANDOM,   // anything, destinations apart
+        STREAMS
+    };
+
+    const char *streamName(damage_stream stream)
+    {
+        static const char *names[STREAMS] = { "scroll", "swap", "rotate", "chain", "random" };
+        return names[stream];
+    }
+
+    // Rectangles of the given size, none of them overlapping another, as many as fit in a few tries
+    std::vector<damage::rect> placeApart(std::mt19937& random, int width, int height, int w, int h, unsigned count)
+    {
+        std::vector<damage::rect> placed;
+
+        for (unsigned tries = 0; placed.size() < count && tries < 100; ++tries) {
+            int32_t x = static_cast<int32_t>(random() % static_cast<unsigned>(width - w + 1));
+            int32_t y = static_cast<int32_t>(random() % static_cast<unsigned>(height - h + 1));
+
+            damage::rect r = { x, y, x + w, y + h };
+
+            bool apart = true;
+            for (const damage::rect& other : placed)
+                apart = apart && !damage::overlaps(r, other);
+
+            if (apart)
+                placed.push_back(r);
+        }
+
+        return placed;
+    }
+
+    // The moves of one frame of @a stream, their destinations don't overlap like those of DXGI
+    std::vector<damage::move> streamMoves(std::mt19937& random, damage_stream stream, int width, int height)
+    {
+        std::vector<damage::move> moves;
+
+        auto add = [&](const damage::rect& dst, int32_t srcX, int32_t srcY) {
+            damage::move m = { srcX, srcY, dst, false };
+            moves.push_back(m);
+        };
+
+        int w = 16 + static_cast<int>(random() % static_cast<unsigned>(width / 4));
+        int h = 16 + static_cast<int>(random() % static_cast<unsigned>(height / 4));
+
+        switch (stream) {
+        case STREAM_SCROLL: {
+            // a band scrolled by up to 40 pixels, either way
+            int32_t top    = static_cast<int32_t>(random() % static_cast<unsigned>(height / 2));
+            int32_t bottom = top + h;
+            int32_t dy     = static_cast<int32_t>(random() % 81) - 40;
+
+            damage::rect dst = { 0, std::max(top, top - dy), width, std::min(bottom, bottom - dy) };
+            if (random() % 4 == 0)
+                add(damage::rect{ std::max(0, -dy), top, std::min(width, width - dy), bottom }, std::max(0, dy), top); // sideways
+            else
+                add(dst, 0, dst.top + dy);
+            break;
+        }
+
+        case STREAM_SWAP:
+        case STREAM_ROTATE:
+        case STREAM_CHAIN: {
+            unsigned count = stream == STREAM_SWAP ? 2 : 3 + random() % 4;
+            std::vector<damage::rect> places = placeApart(random, width, height, w, h, count);
+
+            for (std::size_t i = 0; i < places.size(); ++i) {
+                if (stream == STREAM_CHAIN && i + 1 == places.size())
+                    break;
+
+                const damage::rect& from = places[(i + 1) % places.size()];
+                add(places[i], from.left, from.top);
+            }
+            break;
+        }
+
+        default: {
+            // sources anywhere, even overlapping their own or another destination
+            std::vector<damage::rect> places = placeApart(random, width, height, w, h, 1 + random() % 6);
+
+            for (const damage::rect& dst : places) {
+                int32_t srcX = static_cast<int32_t>(random() % static_cast<unsigned>(width - w + 1));
+                int32_t srcY = static_cast<int32_t>(random() % static_cast<unsigned>(height - h + 1));
+                if (random() % 2)
+                    srcY = std::max(0, std::min(height - h, dst.top + static_cast<int32_t>(random() % 9) - 4));
+
+                add(dst, srcX, srcY);
+            }
+            break;
+        }
+        }
+
+        return moves;
+    }
+
+    // Replays streams of moves and dirty rects the way the sources do, by ordering the moves
+    // and coalescing the dirty rects, into a framebuffer holding the previous frame, and checks
+    // the result byte for byte against the new frame. Returns whether all checks pass.
+    bool benchDamage(const options& opt)
+    {
+        unsigned failures = 0;
+        unsigned checks   = 0;
+
+        auto check = [&](bool ok, const char *what) {
+            ++checks;
+            if (!ok) {
+                std::printf("FAIL     %s\n", what);
+                ++failures;
+            }
+        };
+
+        const int          width  = opt.width;
+        const int          height = opt.height;
+        const std::size_t  pitch  = static_cast<std::size_t>(width) * 4;
+        const damage::rect bounds = { 0, 0, width, height };
+
+        // moves partly outside of the desktop are clipped on both ends
+        {
+            std::vector<damage::move> moves = {
+                { -50, 10, { 0, 10, 100, 60 }, false },
+                { width - 30, 0, { 10, height - 20, 110, height + 30 }, false },
+                { 0, 0, { width, 0, width + 10, 10 }, false },
+            };
+            damage::order_moves(moves, bounds);
+
+            bool inside = moves.size() == 2;
+            for (const damage::move& m : moves) {
+                damage::rect src = damage::source(m);
+                inside = inside && damage::area(damage::intersection(m.dst, bounds)) == damage::area(m.dst) &&
+                         damage::area(damage::intersection(src, bounds)) == damage::area(src) && !damage::empty(m.dst);
+            }
+            check(inside, "moves clipped to the desktop");
+        }
+
+        // a swap can't be ordered without saving one source
+        {
+            std::vector<damage::move> moves = {
+                { 0, 0, { 100, 0, 150, 50 }, false },
+                { 100, 0, { 0, 0, 50, 50 }, false },
+            };
+            damage::order_moves(moves, bounds);
+            check(moves.size() == 2 && moves[0].staged != moves[1].staged, "cycle broken by staging one move");
+        }
+
+        std::mt19937 random(11);
+
+        std::vector<uint8_t> previous(pitch * height), next(pitch * height), shown, full(pitch * height);
+        for (uint8_t& b : previous)
+            b = static_cast<uint8_t>(random());
+
+        unsigned frames = std::max(1u, opt.frames / 20);
+
+        for (int s = 0; s < STREAMS; ++s) {
+            damage_stream stream = static_cast<damage_stream>(s);
+
+            shown = previous;
+
+            double   replaySeconds = 0.0, fullSeconds = 0.0;
+            uint64_t copied        = 0;
+            unsigned staged        = 0, replayed = 0;
+            bool     same          = true, apart = true;
+
+            for (unsigned frame = 0; frame < frames && same; ++frame, ++replayed) {
+                std::vector<damage::move> moves = streamMoves(random, stream, width, height);
+
+                // the new frame: all moves read from the previous frame at once, then the dirty rects change
+                next = previous;
+                for (const damage::move& m : moves) {
+                    for (int32_t y = 0; y < damage::height(m.dst); ++y)
+                        std::memcpy(&next[(m.dst.top + y) * pitch + m.dst.left * 4],
+                                    &previous[(m.src_y + y) * pitch + m.src_x * 4],
+                                    static_cast<std::size_t>(damage::width(m.dst)) * 4);
+                }
+
+                std::vector<damage::rect> dirty;
+                for (unsigned n = random() % 12; n > 0; --n) {
+                    int32_t x = static_cast<int32_t>(random() % static_cast<unsigned>(width + 40)) - 20;
+                    int32_t y = static_cast<int32_t>(random() % static_cast<unsigned>(height + 40)) - 20;
+
+                    // mostly small, like typing, and every now and then a big one
+                    int32_t size = random() % 8 ? 24 : 400;
+                    damage::rect r = { x, y, x + 1 + static_cast<int32_t>(random() % size), y + 1 + static_cast<int32_t>(random() % size) };
+                    dirty.push_back(r);
+
+                    damage::rect c = damage::intersection(r, bounds);
+                    for (int32_t row = c.top; row < c.bottom; ++row)
+                        for (int32_t col = c.left * 4; col < c.right * 4; ++col)
+                            next[row * pitch + col] = static_cast<uint8_t>(random());
+                }
+
+                // the replay
+                bench_clock::time_point start = bench_clock::now();
+
+                damage::order_moves(moves, bounds);
+                damage::apply_moves(shown.data(), pitch, moves);
+
+                damage::coalesce(dirty, bounds);
+                for (const damage::rect& r : dirty) {
+                    for (int32_t row = r.top; row < r.bottom; ++row)
+                        std::memcpy(&shown[row * pitch + r.left * 4], &next[row * pitch + r.left * 4],
+                                    static_cast<std::size_t>(damage::width(r)) * 4);
+                    copied += static_cast<uint64_t>(damage::area(r)) * 4;
+                }
+
+                bench_clock::time_point end = bench_clock::now();
+                replaySeconds += std::chrono::duration<double>(end - start).count();
+
+                std::memcpy(full.data(), next.data(), next.size());
+                fullSeconds += std::chrono::duration<double>(bench_clock::now() - end).count();
+
+                for (const damage::move& m : moves) {
+                    copied += static_cast<uint64_t>(damage::area(m.dst)) * (m.staged ? 8 : 4);
+                    staged += m.staged;
+                }
+
+                for (std::size_t i = 0; i < dirty.size(); ++i) {
+                    apart = apart && damage::area(damage::intersection(dirty[i], bounds)) == damage::area(dirty[i]);
+                    for (std::size_t j = i + 1; j < dirty.size(); ++j)
+                        apart = apart && !damage::overlaps(dirty[i], dirty[j]);
+                }
+
+                same = std::memcmp(shown.data(), next.data(), next.size()) == 0;
+                if (!same)
+                    std::printf("MISMATCH %s, frame %u\n", streamName(stream), frame);
+
+                previous.swap(next);
+            }
+
+            std::string what = std::string(streamName(stream)) + ": replay matches the new frames";
+            check(same, what.c_str());
+            what = std::string(streamName(stream)) + ": coalesced rects inside and apart";
+            check(apart, what.c_str());
+
+            std::printf("damage   %-7s %u frames, %4u staged moves: replay %7.3f ms/frame, full copy %7.3f ms/frame, %5.1f%% of the bytes\n",
+                        streamName(stream), replayed, staged, 1000.0 * replaySeconds / replayed, 1000.0 * fullSeconds / replayed,
+                        100.0 * static_cast<double>(copied) / (static_cast<double>(next.size()) * replayed));
+        }
+
+        std::printf("damage   %u checks, %u failed\n", checks, failures);
+
+        return failures == 0;
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+                     "host-bench [SUITE] [-wWIDTH] [-hHEIGHT] [-nFRAMES] [-aACTIVITY]\n"
+                     "Runs benchmarks of the platform independent code.\n"
+                     "\n"
+                     "SUITES\n"
+                     "   pipeline    The synthetic capture pipeline: frames/s, bytes copied per frame\n"
+                     "               and frame latency percentiles (default)\n"
+                     "   cursor      Cursor conversion kernels, checked against the per-pixel loops\n"
+                     "               they replaced at every width up to 70, and XOR cursors composited\n"
+                     "               from the packed masks; exits with 1 if a check fails\n"
+                     "   scheduler   Render loop scheduling against simulated time: active and idle\n"
+                     "               passes, presents per second; exits with 1 if a check fails\n"
+                     "   pyramid     Thumbnail pyramid downsampling kernels at 1080p, 4K and the given\n"
+                     "               size, and incremental updates over the synthetic desktop damage;\n"
+                     "               exits with 1 if a check fails\n"
+                     "   stats       Histogram buckets, the rolling window and collecting the statistics\n"
+                     "               of several threads, and the cost of recording and collecting them;\n"
+                     "               exits with 1 if a check fails\n"
+                     "   logger      Asynchronous logger under load from several threads: throughput,\n"
+                     "               dropped messages, and a check that nothing got lost or reordered;\n"
+                     "               exits with 1 if a check fails\n"
+                     "   ring        Frame ring handoff between a mock capture thread and mock views:\n"
+                     "               consistency checks, and serial against pipelined frame rates;\n"
+                     "               exits with 1 if a check fails\n"
+                     "   raster      CPU renderer: scaling and cursor kernels from the given size to\n"
+                     "               several view sizes, checked against each other, point sampling,\n"
+                     "               and the whole renderer over the synthetic desktop; exits with 1\n"
+                     "               if a check fails\n"
+                     "   geometry    Checks of the view layouts of all aspect modes and of point\n"
+                     "               sampling, exits with 1 if any of them fails\n"
+                     "   region      Checks of cropping damage to a region, and the copies a 640x480\n"
+                     "               region view saves over the synthetic desktop; exits with 1 if\n"
+                     "               a check fails\n"
+                     "   atlas       Checks of the layout and stitching of views spanning several\n"
+                     "               outputs, and stitching three synthetic outputs updating at\n"
+                     "               different rates; exits with 1 if a check fails\n"
+                     "   record      Recording the synthetic desktop into a capture file, reading it\n"
+                     "               back in order and by seeking, and playing it through the CPU\n"
+                     "               renderer; exits with 1 if a check fails\n"
+                     "   tiles       Change detection by tile hashes, checked against the synthetic\n"
+                     "               desktop and timed at 1080p and 4K; exits with 1 if a check fails\n"
+                     "   rate        The capture rate controller of the DWM hook with a simulated DWM;\n"
+                     "               exits with 1 if a check fails\n"
+                     "   slots       Handing frames from the DWM hook to the view, step by step and on\n"
+                     "               two threads; exits with 1 if a check fails\n"
+                     "   channel     The message rings between the view and the DWM hook, in one process\n"
+                     "               and between two processes sharing memory; exits with 1 if a check\n"
+                     "               fails\n"
+                     "   hooks       Planning hooks and laying out their trampolines on byte buffers;\n"
+                     "               exits with 1 if a check fails\n"
+                     "   trampolines The trampoline allocator of the hooks over mmapped memory, with\n"
+                     "               thousands of hooks; exits with 1 if a check fails\n"
+                     "   decoder     The length decoder of disasm-lib against its full decoder, over the\n"
+                     "               code of this machine and random bytes, and the speed of both; exits\n"
+                     "               with 1 if a check fails\n"
+                     "   damage      Replaying moves and dirty rects, scrolling, swapped and in circles,\n"
+                     "               into the previous frame, checked byte for byte against the new\n"
+                     "               one and timed against a full copy; exits with 1 if a check fails\n"
+                     "   hub         The capture hubs shared by the views of one output: reference\n"
+                     "               counts, stopping hubs, and damage and frames handed to views\n"
+                     "               coming and going; exits with 1 if a check fails\n"
+                     "\n"
+                     "OPTIONS\n"
+                     "   -aACTIVITY  Bit mask of synthetic activity: 1=scrolling 2=typing 4=video 8=cursor\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    const char *suite = "pipeline";
+
+    int first = 1;
+    if (argc > 1 && argv[1][0] != '-')
+        suite = argv[first++];
+
+    for (int i = first; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (std::strncmp(arg, "-w", 2) == 0)
+            opt.width = std::atoi(arg + 2);
+        else if (std::strncmp(arg, "-h", 2) == 0)
+            opt.height = std::atoi(arg + 2);
+        else if (std::strncmp(arg, "-n", 2) == 0)
+            opt.frames = static_cast<unsigned>(std::atoi(arg + 2));
+        else if (std::strncmp(arg, "-a", 2) == 0)
+            opt.activity = static_cast<unsigned>(std::strtoul(arg + 2, nullptr, 0));
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (opt.width <= 0 || opt.height <= 0 || !opt.frames) {
+        usage();
+        return 1;
+    }
+
+    if (std::strcmp(suite, "pipeline") == 0) {
+        benchPipeline(opt);
+    } else if (std::strcmp(suite, "cursor") == 0) {
+        return benchCursor(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "scheduler") == 0) {
+        return benchScheduler(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "pyramid") == 0) {
+        return benchPyramid(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "stats") == 0) {
+        return benchStats(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "logger") == 0) {
+        return benchLogger(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "ring") == 0) {
+        return benchRing(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "raster") == 0) {
+        return benchRaster(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "geometry") == 0) {
+        return checkGeometry() ? 0 : 1;
+    } else if (std::strcmp(suite, "region") == 0) {
+        return benchRegion(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "atlas") == 0) {
+        return benchAtlas(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "record") == 0) {
+        return benchRecord(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "tiles") == 0) {
+        return benchTiles(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "rate") == 0) {
+        return benchRate(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "slots") == 0) {
+        return benchSlots(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "damage") == 0) {
+        return benchDamage(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "hub") == 0) {
+        return benchHub(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "channel") == 0) {
+        return benchChannel(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "hooks") == 0) {
+        return benchHooks(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "trampolines") == 0) {
+        return benchTrampolines(opt) ? 0 : 1;
+    } else if (std::strcmp(suite, "decoder") == 0) {
+        return benchDecoder(opt) ? 0 : 1;
+    } else {
+        usage();
+        return 1;
+    }
+
+    return 0;
+}
@@ -20,8 +20,11 @@
 
 #include <windows.h>
 #include <tlhelp32.h>
+#include <stddef.h>
 #include <stdio.h>
 #include "mhook.h"
+#include "mhook_alloc.h"
+#include "mhook_plan.h"
 #include "../disasm-lib/disasm.h"
 
 //=========================================================================
@@ -77,8 +80,8 @@ inline void __cdecl odprintf(PCWSTR format, ...) {
 #endif //#ifndef ODPRINTF
 
 //=========================================================================
-#define MHOOKS_MAX_CODE_BYTES	32
-#define MHOOKS_MAX_RIPS			 4
+#define MHOOKS_MAX_CODE_BYTES	MHOOK_PLAN_MAX_CODE_BYTES
+#define MHOOKS_MAX_TRANSACTION	64
 
 //=========================================================================
 // The trampoline structure - stores every bit of info about a hook
@@ -97,32 +100,34 @@ typedef struct _MHOOKS_TRAMPOLINE {
 } MHOOKS_TRAMPOLINE;
 
 //=========================================================================
-// The patch data structures - store info about rip-relative instructions
-// during hook placement
-typedef struct _MHOOKS_RIPINFO
+// A hook added to the current transaction, placed on commit
+typedef struct _MHOOKS_PENDING
 {
-	DWORD	dwOffset;
-	S64		nDisplacement;
-} MHOOKS_RIPINFO;
+	PVOID*				ppSystemFunction;
+	MHOOKS_TRAMPOLINE*	pTrampoline;
+	MHOOK_PLAN			plan;
+} MHOOKS_PENDING;
 
-typedef struct _MHOOKS_PATCHDATA
+// Code no thread may be executing while it's being patched
+typedef struct _MHOOKS_CODE_RANGE
 {
-	S64				nLimitUp;
-	S64				nLimitDown;
-	DWORD			nRipCnt;
-	MHOOKS_RIPINFO	rips[MHOOKS_MAX_RIPS];
-} MHOOKS_PATCHDATA;
+	PBYTE	pbCode;
+	DWORD	cbBytes;
+} MHOOKS_CODE_RANGE;
 
 //=========================================================================
 // Global vars
 static BOOL g_bVarsInitialized = FALSE;
 static CRITICAL_SECTION g_cs;
-static MHOOKS_TRAMPOLINE* g_pHooks = NULL;
-static MHOOKS_TRAMPOLINE* g_pFreeList = NULL;
+static MHOOK_ALLOCATOR g_allocator;
+static BOOL g_bAllocatorInitialized = FALSE;
 static DWORD g_nHooksInUse = 0;
 static HANDLE* g_hThreadHandles = NULL;
 static DWORD g_nThreadHandles = 0;
-#define MHOOK_JMPSIZE 5
+static BOOL g_bInTransaction = FALSE;
+static MHOOKS_PENDING g_pending[MHOOKS_MAX_TRANSACTION];
+static DWORD g_nPending = 0;
+#define MHOOK_JMPSIZE MHOOK_PLAN_JMPSIZE
 #define MHOOK_MINALLOCSIZE 4096
 
 //=========================================================================
@@ -155,45 +160,6 @@ static void initToolhelpFunctions() {
     fnThread32Next = (_Thread32Next) GetProcAddress(GetModuleHandle(L"kernel32"), "Thread32Next");
 }
 
-//=========================================================================
-// Internal function:
-//
-// Remove the trampoline from the specified list, updating the head pointer
-// if necessary.
-//=========================================================================
-static VOID ListRemove(MHOOKS_TRAMPOLINE** pListHead, MHOOKS_TRAMPOLINE* pNode) {
-	if (pNode->pPrevTrampoline) {
-		pNode->pPrevTrampoline->pNextTrampoline = pNode->pNextTrampoline;
-	}
-
-	if (pNode->pNextTrampoline) {
-		pNode->pNextTrampoline->pPrevTrampoline = pNode->pPrevTrampoline;
-	}
-
-	if ((*pListHead) == pNode) {
-		(*pListHead) = pNode->pNextTrampoline;
-		if (*pListHead)
-            assert((*pListHead)->pPrevTrampoline == NULL);
-	}
-
-	pNode->pPrevTrampoline = NULL;
-	pNode->pNextTrampoline = NULL;
-}
-
-//=========================================================================
-// Internal function:
-//
-// Prepend the trampoline from the specified list and update the head pointer.
-//=========================================================================
-static VOID ListPrepend(MHOOKS_TRAMPOLINE** pListHead, MHOOKS_TRAMPOLINE* pNode) {
-	pNode->pPrevTrampoline = NULL;
-	pNode->pNextTrampoline = (*pListHead);
-	if ((*pListHead)) {
-		(*pListHead)->pPrevTrampoline = pNode;
-	}
-	(*pListHead) = pNode;
-}
-
 //=========================================================================
 static VOID EnterCritSec() {
 	if (!g_bVarsInitialized) {
@@ -208,181 +174,49 @@ static VOID LeaveCritSec() {
 	LeaveCriticalSection(&g_cs);
 }
 
-//=========================================================================
-// Internal function:
-// 
-// Skip over jumps that lead to the real function. Gets around import
-// jump tables, etc.
-//=========================================================================
-static PBYTE SkipJumps(PBYTE pbCode) {
-	PBYTE pbOrgCode = pbCode;
-#ifdef _M_IX86_X64
-#ifdef _M_IX86
-	//mov edi,edi: hot patch point
-	if (pbCode[0] == 0x8b && pbCode[1] == 0xff)
-		pbCode += 2;
-	// push ebp; mov ebp, esp; pop ebp;
-	// "collapsed" stackframe generated by MSVC
-	if (pbCode[0] == 0x55 && pbCode[1] == 0x8b && pbCode[2] == 0xec && pbCode[3] == 0x5d)
-		pbCode += 4;
-#endif	
-	if (pbCode[0] == 0xff && pbCode[1] == 0x25) {
-#ifdef _M_IX86
-		// on x86 we have an absolute pointer...
-		PBYTE pbTarget = *(PBYTE *)&pbCode[2];
-		// ... that shows us an absolute pointer.
-		return SkipJumps(*(PBYTE *)pbTarget);
-#elif defined _M_X64
-		// on x64 we have a 32-bit offset...
-		INT32 lOffset = *(INT32 *)&pbCode[2];
-		// ... that shows us an absolute pointer
-		return SkipJumps(*(PBYTE*)(pbCode + 6 + lOffset));
-	} else if (pbCode[0] == 0x48 && pbCode[1] == 0xff && pbCode[2] == 0x25) {
-		// or we can have the same with a REX prefix
-		INT32 lOffset = *(INT32 *)&pbCode[3];
-		// ... that shows us an absolute pointer
-		return SkipJumps(*(PBYTE*)(pbCode + 7 + lOffset));
-#endif
-	} else if (pbCode[0] == 0xe9) {
-		// here the behavior is identical, we have...
-		// ...a 32-bit offset to the destination.
-		return SkipJumps(pbCode + 5 + *(INT32 *)&pbCode[1]);
-	} else if (pbCode[0] == 0xeb) {
-		// and finally an 8-bit offset to the destination
-		return SkipJumps(pbCode + 2 + *(CHAR *)&pbCode[1]);
-	}
-#else
-#error unsupported platform
-#endif
-	return pbOrgCode;
-}
-
 //=========================================================================
 // Internal function:
 //
-// Writes code at pbCode that jumps to pbJumpTo. Will attempt to do this
-// in as few bytes as possible. Important on x64 where the long jump
-// (0xff 0x25 ....) can take up 14 bytes.
-//=========================================================================
-static PBYTE EmitJump(PBYTE pbCode, PBYTE pbJumpTo) {
-#ifdef _M_IX86_X64
-	PBYTE pbJumpFrom = pbCode + 5;
-	SIZE_T cbDiff = pbJumpFrom > pbJumpTo ? pbJumpFrom - pbJumpTo : pbJumpTo - pbJumpFrom;
-	ODPRINTF((L"mhooks: EmitJump: Jumping from %p to %p, diff is %p", pbJumpFrom, pbJumpTo, cbDiff));
-	if (cbDiff <= 0x7fff0000) {
-		pbCode[0] = 0xe9;
-		pbCode += 1;
-		*((PDWORD)pbCode) = (DWORD)(DWORD_PTR)(pbJumpTo - pbJumpFrom);
-		pbCode += sizeof(DWORD);
-	} else {
-		pbCode[0] = 0xff;
-		pbCode[1] = 0x25;
-		pbCode += 2;
-#ifdef _M_IX86
-		// on x86 we write an absolute address (just behind the instruction)
-		*((PDWORD)pbCode) = (DWORD)(DWORD_PTR)(pbCode + sizeof(DWORD));
-#elif defined _M_X64
-		// on x64 we write the relative address of the same location
-		*((PDWORD)pbCode) = (DWORD)0;
-#endif
-		pbCode += sizeof(DWORD);
-		*((PDWORD_PTR)pbCode) = (DWORD_PTR)(pbJumpTo);
-		pbCode += sizeof(DWORD_PTR);
-	}
-#else 
-#error unsupported platform
-#endif
-	return pbCode;
+// The page provider of the trampoline allocator: the address space of
+// this process. Used ranges are reported from the start of their
+// allocation, so whole modules are skipped at once.
+//=========================================================================
+static int QueryPages(void* pContext, uint8_t* pbAddress, uint8_t** ppbBase, size_t* pcbSize, int* pbFree) {
+	MEMORY_BASIC_INFORMATION mbi;
+	(void)pContext;
+	ODPRINTF((L"mhooks: QueryPages: Looking at address %p", pbAddress));
+	if (!VirtualQuery(pbAddress, &mbi, sizeof(mbi)))
+		return 0;
+	*pbFree = mbi.State == MEM_FREE;
+	*ppbBase = (*pbFree || !mbi.AllocationBase) ? (PBYTE)mbi.BaseAddress : (PBYTE)mbi.AllocationBase;
+	*pcbSize = (PBYTE)mbi.BaseAddress + mbi.RegionSize - *ppbBase;
+	return 1;
 }
 
-
-//=========================================================================
-// Internal function:
-//
-// Round down to the next multiple of rndDown
-//=========================================================================
-static size_t RoundDown(size_t addr, size_t rndDown)
-{
-	return (addr / rndDown) * rndDown;
-}
-
-//=========================================================================
-// Internal function:
-//
-// Will attempt allocate a block of memory within the specified range, as 
-// near as possible to the specified function.
-//=========================================================================
-static MHOOKS_TRAMPOLINE* BlockAlloc(PBYTE pSystemFunction, PBYTE pbLower, PBYTE pbUpper) {
-	SYSTEM_INFO sSysInfo;
-	memset(&sSysInfo, 0, sizeof(sSysInfo));
-	GetSystemInfo(&sSysInfo);
-
-	// Always allocate in bulk, in case the system actually has a smaller allocation granularity than MINALLOCSIZE.
-	const ptrdiff_t cAllocSize = max(sSysInfo.dwAllocationGranularity, MHOOK_MINALLOCSIZE);
-
-	MHOOKS_TRAMPOLINE* pRetVal = NULL;
-	PBYTE pModuleGuess = (PBYTE) RoundDown((size_t)pSystemFunction, cAllocSize);
-	int loopCount = 0;
-	for (PBYTE pbAlloc = pModuleGuess; pbLower < pbAlloc && pbAlloc < pbUpper; ++loopCount) {
-		// determine current state
-		MEMORY_BASIC_INFORMATION mbi;
-		ODPRINTF((L"mhooks: BlockAlloc: Looking at address %p", pbAlloc));
-		if (!VirtualQuery(pbAlloc, &mbi, sizeof(mbi)))
-			break;
-		// free & large enough?
-		if (mbi.State == MEM_FREE && mbi.RegionSize >= (unsigned)cAllocSize) {
-			// and then try to allocate it
-			pRetVal = (MHOOKS_TRAMPOLINE*) VirtualAlloc(pbAlloc, cAllocSize, MEM_COMMIT|MEM_RESERVE, PAGE_EXECUTE_READWRITE);
-			if (pRetVal) {
-				size_t trampolineCount = cAllocSize / sizeof(MHOOKS_TRAMPOLINE);
-				ODPRINTF((L"mhooks: BlockAlloc: Allocated block at %p as %d trampolines", pRetVal, trampolineCount));
-
-				pRetVal[0].pPrevTrampoline = NULL;
-				pRetVal[0].pNextTrampoline = &pRetVal[1];
-
-				// prepare them by having them point down the line at the next entry.
-				for (size_t s = 1; s < trampolineCount; ++s) {
-					pRetVal[s].pPrevTrampoline = &pRetVal[s - 1];
-					pRetVal[s].pNextTrampoline = &pRetVal[s + 1];
-				}
-
-				// last entry points to the current head of the free list
-				pRetVal[trampolineCount - 1].pNextTrampoline = g_pFreeList;
-				break;
-			}
-		}
-				
-		// This is a spiral, should be -1, 1, -2, 2, -3, 3, etc. (* cAllocSize)
-		ptrdiff_t bytesToOffset = (cAllocSize * (loopCount + 1) * ((loopCount % 2 == 0) ? -1 : 1));
-		pbAlloc = pbAlloc + bytesToOffset;
-	}
-	
+static void* AllocPages(void* pContext, uint8_t* pbAddress, size_t cbSize) {
+	(void)pContext;
+	PVOID pRetVal = VirtualAlloc(pbAddress, cbSize, MEM_COMMIT|MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+	ODPRINTF((L"mhooks: AllocPages: Allocated block at %p", pRetVal));
 	return pRetVal;
 }
 
 //=========================================================================
 // Internal function:
 //
-// Will try to allocate a big block of memory inside the required range. 
-//=========================================================================
-static MHOOKS_TRAMPOLINE* FindTrampolineInRange(PBYTE pLower, PBYTE pUpper) {
-	if (!g_pFreeList) {
-		return NULL;
-	}
-
-	// This is a standard free list, except we're doubly linked to deal with soem return shenanigans.
-	MHOOKS_TRAMPOLINE* curEntry = g_pFreeList;
-	while (curEntry) {
-		if ((MHOOKS_TRAMPOLINE*) pLower < curEntry && curEntry < (MHOOKS_TRAMPOLINE*) pUpper) {
-			ListRemove(&g_pFreeList, curEntry);
-
-			return curEntry;
-		}
-
-		curEntry = curEntry->pNextTrampoline;
+// The trampoline allocator, set up on first use.
+//=========================================================================
+static MHOOK_ALLOCATOR* Allocator() {
+	if (!g_bAllocatorInitialized) {
+		SYSTEM_INFO sSysInfo;
+		memset(&sSysInfo, 0, sizeof(sSysInfo));
+		GetSystemInfo(&sSysInfo);
+
+		// Always allocate in bulk, in case the system actually has a smaller allocation granularity than MINALLOCSIZE.
+		MHOOK_PAGE_PROVIDER provider = { QueryPages, AllocPages, NULL };
+		MhookAlloc_Init(&g_allocator, &provider, max(sSysInfo.dwAllocationGranularity, MHOOK_MINALLOCSIZE), sizeof(MHOOKS_TRAMPOLINE));
+		g_bAllocatorInitialized = TRUE;
 	}
-
-	return NULL;
+	return &g_allocator;
 }
 
 //=========================================================================
@@ -406,18 +240,10 @@ static MHOOKS_TRAMPOLINE* TrampolineAlloc(PBYTE pSystemFunction, S64 nLimitUp, S
 		(PBYTE)(pUpper + (DWORD_PTR)0x7ff80000) : (PBYTE)(DWORD_PTR)0xfffffffffff80000;
 	ODPRINTF((L"mhooks: TrampolineAlloc: Allocating for %p between %p and %p", pSystemFunction, pLower, pUpper));
 
-	// try to find a trampoline in the specified range
-	pTrampoline = FindTrampolineInRange(pLower, pUpper);
-	if (!pTrampoline) {
-		// if it we can't find it, then we need to allocate a new block and 
-		// try again. Just fail if that doesn't work 
-		g_pFreeList = BlockAlloc(pSystemFunction, pLower, pUpper);
-		pTrampoline = FindTrampolineInRange(pLower, pUpper);
-	}
-
-	// found and allocated a trampoline?
+	// reuses a block in range or allocates a new one near the function
+	pTrampoline = (MHOOKS_TRAMPOLINE*)MhookAlloc_Alloc(Allocator(), pSystemFunction, pLower, pUpper);
 	if (pTrampoline) {
-		ListPrepend(&g_pHooks, pTrampoline);
+		ZeroMemory(pTrampoline, sizeof(MHOOKS_TRAMPOLINE));
 	}
 
 	return pTrampoline;
@@ -429,17 +255,7 @@ static MHOOKS_TRAMPOLINE* TrampolineAlloc(PBYTE pSystemFunction, S64 nLimitUp, S
 // Return the internal trampoline structure that belongs to a hooked function.
 //=========================================================================
 static MHOOKS_TRAMPOLINE* TrampolineGet(PBYTE pTrampoline) {
-	MHOOKS_TRAMPOLINE* pCurrent = g_pHooks;
-
-	while (pCurrent) {
-		if ((PBYTE)&(pCurrent->codeTrampoline) == pTrampoline)  {
-			return pCurrent;
-		}
-
-		pCurrent = pCurrent->pNextTrampoline;
-	}
-
-	return NULL;
+	return (MHOOKS_TRAMPOLINE*)MhookAlloc_Find(Allocator(), pTrampoline, offsetof(MHOOKS_TRAMPOLINE, codeTrampoline));
 }
 
 //=========================================================================
@@ -448,26 +264,32 @@ static MHOOKS_TRAMPOLINE* TrampolineGet(PBYTE pTrampoline) {
 // Free a trampoline structure.
 //=========================================================================
 static VOID TrampolineFree(MHOOKS_TRAMPOLINE* pTrampoline, BOOL bNeverUsed) {
-	ListRemove(&g_pHooks, pTrampoline);
-
-	// If a thread could feasinbly have some of our trampoline code 
-	// on its stack and we yank the region from underneath it then it will
-	// surely crash upon returning. So instead of freeing the 
-	// memory we just let it leak. Ugly, but safe.
-	if (bNeverUsed) {
-		ListPrepend(&g_pFreeList, pTrampoline);
-	}
+	// only trampolines no thread ever ran through are handed out again
+	MhookAlloc_Free(Allocator(), pTrampoline, bNeverUsed);
 
 	g_nHooksInUse--;
 }
 
+//=========================================================================
+// Internal function:
+//
+// Whether the instruction pointer is in any of the given ranges.
+//=========================================================================
+static BOOL IpInRanges(PBYTE pIp, const MHOOKS_CODE_RANGE* pRanges, DWORD nRanges) {
+	for (DWORD i = 0; i < nRanges; i++) {
+		if (pIp >= pRanges[i].pbCode && pIp < (pRanges[i].pbCode + pRanges[i].cbBytes))
+			return TRUE;
+	}
+	return FALSE;
+}
+
 //=========================================================================
 // Internal function:
 //
 // Suspend a given thread and try to make sure that its instruction
-// pointer is not in the given range.
+// pointer is not in any of the given ranges.
 //=========================================================================
-static HANDLE SuspendOneThread(DWORD dwThreadId, PBYTE pbCode, DWORD cbBytes) {
+static HANDLE SuspendOneThread(DWORD dwThreadId, const MHOOKS_CODE_RANGE* pRanges, DWORD nRanges) {
 	// open the thread
 	HANDLE hThread = OpenThread(THREAD_ALL_ACCESS, FALSE, dwThreadId);
 	if (GOOD_HANDLE(hThread)) {
@@ -484,7 +306,7 @@ static HANDLE SuspendOneThread(DWORD dwThreadId, PBYTE pbCode, DWORD cbBytes) {
 #elif defined _M_X64
 				PBYTE pIp = (PBYTE)(DWORD_PTR)ctx.Rip;
 #endif
-				if (pIp >= pbCode && pIp < (pbCode + cbBytes)) {
+				if (IpInRanges(pIp, pRanges, nRanges)) {
 					if (nTries < 3) {
 						// oops - we should try to get the instruction pointer out of here. 
 						ODPRINTF((L"mhooks: SuspendOneThread: suspended thread %d - IP is at %p - IS COLLIDING WITH CODE", dwThreadId, pIp));
@@ -543,9 +365,9 @@ static VOID ResumeOtherThreads() {
 // Internal function:
 //
 // Suspend all threads in this process while trying to make sure that their 
-// instruction pointer is not in the given range.
+// instruction pointer is not in any of the given ranges.
 //=========================================================================
-static BOOL SuspendOtherThreads(PBYTE pbCode, DWORD cbBytes) {
+static BOOL SuspendOtherThreads(const MHOOKS_CODE_RANGE* pRanges, DWORD nRanges) {
 	BOOL bRet = FALSE;
 	// make sure we're the most important thread in the process
 	INT nOriginalPriority = GetThreadPriority(GetCurrentThread());
@@ -582,7 +404,7 @@ static BOOL SuspendOtherThreads(PBYTE pbCode, DWORD cbBytes) {
 						if (te.th32OwnerProcessID == GetCurrentProcessId()) {
 							if (te.th32ThreadID != GetCurrentThreadId()) {
 								// attempt to suspend it
-								g_hThreadHandles[nCurrentThread] = SuspendOneThread(te.th32ThreadID, pbCode, cbBytes);
+								g_hThreadHandles[nCurrentThread] = SuspendOneThread(te.th32ThreadID, pRanges, nRanges);
 								if (GOOD_HANDLE(g_hThreadHandles[nCurrentThread])) {
 									ODPRINTF((L"mhooks: SuspendOtherThreads: successfully suspended %d", te.th32ThreadID));
 									nCurrentThread++;
@@ -622,41 +444,52 @@ static BOOL SuspendOtherThreads(PBYTE pbCode, DWORD cbBytes) {
 }
 
 //=========================================================================
-// if IP-relative addressing has been detected, fix up the code so the
-// offset points to the original location
-static void FixupIPRelativeAddressing(PBYTE pbNew, PBYTE pbOriginal, MHOOKS_PATCHDATA* pdata)
-{
+// Internal function:
+//
+// The decoder for the planner, backed by the length decoder of the
+// disassembler: the planner only needs lengths and IP-relative operands.
+//=========================================================================
+static int DecodeWithDisasm(const uint8_t* pbCode, MHOOK_INSTRUCTION* pInstruction, void* pContext) {
+	ARCHITECTURE_TYPE arch = *(ARCHITECTURE_TYPE*)pContext;
+	U8* pLoc = (U8*)pbCode;
+	X86_LENGTH_AND_TYPE ins;
+
+	if (!X86_GetLengthAndType(arch, pLoc, X86_MAX_INSTRUCTION_LEN, &ins))
+		return 0;
+
+	ODPRINTF((L"mhooks: DecodeWithDisasm: %p:(0x%2.2x) type 0x%x", pLoc, ins.Length, ins.Type));
+	pInstruction->cbLength = ins.Length;
+	pInstruction->bStopsFlow = ins.Type == ITYPE_RET || ins.Type == ITYPE_BRANCH || ins.Type == ITYPE_BRANCHCC ||
+							   ins.Type == ITYPE_CALL || ins.Type == ITYPE_CALLCC;
+
 #if defined _M_X64
-	S64 diff = pbNew - pbOriginal;
-	for (DWORD i = 0; i < pdata->nRipCnt; i++) {
-		DWORD dwNewDisplacement = (DWORD)(pdata->rips[i].nDisplacement - diff);
-		ODPRINTF((L"mhooks: fixing up RIP instruction operand for code at 0x%p: "
-			L"old displacement: 0x%8.8x, new displacement: 0x%8.8x", 
-			pbNew + pdata->rips[i].dwOffset, 
-			(DWORD)pdata->rips[i].nDisplacement, 
-			dwNewDisplacement));
-		*(PDWORD)(pbNew + pdata->rips[i].dwOffset) = dwNewDisplacement;
+	pInstruction->bIpRelative = ins.IsIpRelative;
+
+	// rip-addressing "mov reg, [rip+imm32]" or "mov [rip+imm32], reg", lea alike
+	if ((ins.Type == ITYPE_MOV || ins.Type == ITYPE_LEA) && ins.IsIpRelative &&
+		(ins.OperandSize == 8) && (ins.OperandCount == 2))
+	{
+		ODPRINTF((L"mhooks: DecodeWithDisasm: found OP_IPREL with displacement 0x%x (in memory: 0x%x)", (DWORD)ins.Displacement, *(PDWORD)(pLoc+3)));
+		pInstruction->bRelocatable = TRUE;
+	} else if (pInstruction->bIpRelative) {
+		// unsupported rip-addressing, dump instruction bytes to the debug output
+		for (DWORD i=0; i<ins.Length; i++) {
+			ODPRINTF((L"mhooks: DecodeWithDisasm: unsupported OP_IPREL, instr byte %2.2d: 0x%2.2x", i, pLoc[i]));
+		}
 	}
-#else
-    // remove warnings
-    (void)pbNew;
-    (void)pbOriginal;
-    (void)pdata;
+	pInstruction->nDisplacement = ins.Displacement;
 #endif
+
+	return 1;
 }
 
 //=========================================================================
-// Examine the machine code at the target function's entry point, and
-// skip bytes in a way that we'll always end on an instruction boundary.
-// We also detect branches and subroutine calls (as well as returns)
-// at which point disassembly must stop.
-// Finally, detect and collect information on IP-relative instructions
-// that we can patch.
-static DWORD DisassembleAndSkip(PVOID pFunction, DWORD dwMinLen, MHOOKS_PATCHDATA* pdata) {
-	DWORD dwRet = 0;
-	pdata->nLimitDown = 0;
-	pdata->nLimitUp = 0;
-	pdata->nRipCnt = 0;
+// Internal function:
+//
+// Finds out how much of the function has to be overwritten and what the
+// trampoline has to look like, see mhook_plan.h.
+//=========================================================================
+static BOOL PlanHook(MHOOK_PLAN* pPlan, PBYTE pSystemFunction, PBYTE pHookFunction) {
 #ifdef _M_IX86
 	ARCHITECTURE_TYPE arch = ARCH_X86;
 #elif defined _M_X64
@@ -664,214 +497,146 @@ static DWORD DisassembleAndSkip(PVOID pFunction, DWORD dwMinLen, MHOOKS_PATCHDAT
 #else
 	#error unsupported platform
 #endif
-	DISASSEMBLER dis;
-	if (InitDisassembler(&dis, arch)) {
-		INSTRUCTION* pins = NULL;
-		U8* pLoc = (U8*)pFunction;
-		DWORD dwFlags = DISASM_DECODE | DISASM_DISASSEMBLE | DISASM_ALIGNOUTPUT;
-
-		ODPRINTF((L"mhooks: DisassembleAndSkip: Disassembling %p", pLoc));
-		while ( (dwRet < dwMinLen) && (pins = GetInstruction(&dis, (ULONG_PTR)pLoc, pLoc, dwFlags)) ) {
-			ODPRINTF(("mhooks: DisassembleAndSkip: %p:(0x%2.2x) %s", pLoc, pins->Length, pins->String));
-			if (pins->Type == ITYPE_RET		) break;
-			if (pins->Type == ITYPE_BRANCH	) break;
-			if (pins->Type == ITYPE_BRANCHCC) break;
-			if (pins->Type == ITYPE_CALL	) break;
-			if (pins->Type == ITYPE_CALLCC	) break;
-
-			#if defined _M_X64
-				BOOL bProcessRip = FALSE;
-				// mov or lea to register from rip+imm32
-				if ((pins->Type == ITYPE_MOV || pins->Type == ITYPE_LEA) && (pins->X86.Relative) && 
-					(pins->X86.OperandSize == 8) && (pins->OperandCount == 2) &&
-					(pins->Operands[1].Flags & OP_IPREL) && (pins->Operands[1].Register == AMD64_REG_RIP))
-				{
-					// rip-addressing "mov reg, [rip+imm32]"
-					ODPRINTF((L"mhooks: DisassembleAndSkip: found OP_IPREL on operand %d with displacement 0x%x (in memory: 0x%x)", 1, pins->X86.Displacement, *(PDWORD)(pLoc+3)));
-					bProcessRip = TRUE;
-				}
-				// mov or lea to rip+imm32 from register
-				else if ((pins->Type == ITYPE_MOV || pins->Type == ITYPE_LEA) && (pins->X86.Relative) && 
-					(pins->X86.OperandSize == 8) && (pins->OperandCount == 2) &&
-					(pins->Operands[0].Flags & OP_IPREL) && (pins->Operands[0].Register == AMD64_REG_RIP))
-				{
-					// rip-addressing "mov [rip+imm32], reg"
-					ODPRINTF((L"mhooks: DisassembleAndSkip: found OP_IPREL on operand %d with displacement 0x%x (in memory: 0x%x)", 0, pins->X86.Displacement, *(PDWORD)(pLoc+3)));
-					bProcessRip = TRUE;
-				}
-				else if ( (pins->OperandCount >= 1) && (pins->Operands[0].Flags & OP_IPREL) )
-				{
-					// unsupported rip-addressing
-					ODPRINTF((L"mhooks: DisassembleAndSkip: found unsupported OP_IPREL on operand %d", 0));
-					// dump instruction bytes to the debug output
-					for (DWORD i=0; i<pins->Length; i++) {
-						ODPRINTF((L"mhooks: DisassembleAndSkip: instr byte %2.2d: 0x%2.2x", i, pLoc[i]));
-					}
-					break;
-				}
-				else if ( (pins->OperandCount >= 2) && (pins->Operands[1].Flags & OP_IPREL) )
-				{
-					// unsupported rip-addressing
-					ODPRINTF((L"mhooks: DisassembleAndSkip: found unsupported OP_IPREL on operand %d", 1));
-					// dump instruction bytes to the debug output
-					for (DWORD i=0; i<pins->Length; i++) {
-						ODPRINTF((L"mhooks: DisassembleAndSkip: instr byte %2.2d: 0x%2.2x", i, pLoc[i]));
-					}
-					break;
-				}
-				else if ( (pins->OperandCount >= 3) && (pins->Operands[2].Flags & OP_IPREL) )
-				{
-					// unsupported rip-addressing
-					ODPRINTF((L"mhooks: DisassembleAndSkip: found unsupported OP_IPREL on operand %d", 2));
-					// dump instruction bytes to the debug output
-					for (DWORD i=0; i<pins->Length; i++) {
-						ODPRINTF((L"mhooks: DisassembleAndSkip: instr byte %2.2d: 0x%2.2x", i, pLoc[i]));
-					}
-					break;
-				}
-				// follow through with RIP-processing if needed
-				if (bProcessRip) {
-					// calculate displacement relative to function start
-					S64 nAdjustedDisplacement = pins->X86.Displacement + (pLoc - (U8*)pFunction);
-					// store displacement values furthest from zero (both positive and negative)
-					if (nAdjustedDisplacement < pdata->nLimitDown)
-						pdata->nLimitDown = nAdjustedDisplacement;
-					if (nAdjustedDisplacement > pdata->nLimitUp)
-						pdata->nLimitUp = nAdjustedDisplacement;
-					// store patch info
-					if (pdata->nRipCnt < MHOOKS_MAX_RIPS) {
-						pdata->rips[pdata->nRipCnt].dwOffset = dwRet + 3;
-						pdata->rips[pdata->nRipCnt].nDisplacement = pins->X86.Displacement;
-						pdata->nRipCnt++;
-					} else {
-						// no room for patch info, stop disassembly
-						break;
-					}
-				}
-			#endif
-
-			dwRet += pins->Length;
-			pLoc  += pins->Length;
-		}
+	ODPRINTF((L"mhooks: PlanHook: Disassembling %p", pSystemFunction));
+	return MhookPlan_Prepare(pPlan, pSystemFunction, pHookFunction, DecodeWithDisasm, &arch);
+}
 
-		CloseDisassembler(&dis);
+//=========================================================================
+BOOL Mhook_BeginTransaction(void) {
+	EnterCritSec();
+	if (g_bInTransaction) {
+		// the critical section is recursive, this is the same thread
+		ODPRINTF((L"mhooks: Mhook_BeginTransaction: already in a transaction"));
+		LeaveCritSec();
+		return FALSE;
 	}
-
-	return dwRet;
+	g_bInTransaction = TRUE;
+	g_nPending = 0;
+	// stays entered until the commit
+	return TRUE;
 }
 
 //=========================================================================
-BOOL Mhook_SetHook(PVOID *ppSystemFunction, PVOID pHookFunction) {
-	MHOOKS_TRAMPOLINE* pTrampoline = NULL;
-	PVOID pSystemFunction = *ppSystemFunction;
-	// ensure thread-safety
-	EnterCritSec();
-	ODPRINTF((L"mhooks: Mhook_SetHook: Started on the job: %p / %p", pSystemFunction, pHookFunction));
+BOOL Mhook_AddHook(PVOID *ppSystemFunction, PVOID pHookFunction) {
+	if (!g_bInTransaction || g_nPending >= MHOOKS_MAX_TRANSACTION)
+		return FALSE;
+
+	MHOOKS_PENDING* pPending = &g_pending[g_nPending];
 	// find the real functions (jump over jump tables, if any)
-	pSystemFunction = SkipJumps((PBYTE)pSystemFunction);
-	pHookFunction   = SkipJumps((PBYTE)pHookFunction);
-	ODPRINTF((L"mhooks: Mhook_SetHook: Started on the job: %p / %p", pSystemFunction, pHookFunction));
+	PBYTE pSystemFunction = MhookPlan_SkipJumps((PBYTE)*ppSystemFunction);
+	pHookFunction = MhookPlan_SkipJumps((PBYTE)pHookFunction);
+	ODPRINTF((L"mhooks: Mhook_AddHook: Started on the job: %p / %p", pSystemFunction, pHookFunction));
+
 	// figure out the length of the overwrite zone
-	MHOOKS_PATCHDATA patchdata = {0};
-	DWORD dwInstructionLength = DisassembleAndSkip(pSystemFunction, MHOOK_JMPSIZE, &patchdata);
-	if (dwInstructionLength >= MHOOK_JMPSIZE) {
-		ODPRINTF((L"mhooks: Mhook_SetHook: disassembly signals %d bytes", dwInstructionLength));
-		// suspend every other thread in this process, and make sure their IP 
-		// is not in the code we're about to overwrite.
-		SuspendOtherThreads((PBYTE)pSystemFunction, dwInstructionLength);
-		// allocate a trampoline structure (TODO: it is pretty wasteful to get
-		// VirtualAlloc to grab chunks of memory smaller than 100 bytes)
-		pTrampoline = TrampolineAlloc((PBYTE)pSystemFunction, patchdata.nLimitUp, patchdata.nLimitDown);
-		if (pTrampoline) {
-			ODPRINTF((L"mhooks: Mhook_SetHook: allocated structure at %p", pTrampoline));
-			DWORD dwOldProtectSystemFunction = 0;
-			DWORD dwOldProtectTrampolineFunction = 0;
-			// set the system function to PAGE_EXECUTE_READWRITE
-			if (VirtualProtect(pSystemFunction, dwInstructionLength, PAGE_EXECUTE_READWRITE, &dwOldProtectSystemFunction)) {
-				ODPRINTF((L"mhooks: Mhook_SetHook: readwrite set on system function"));
-				// mark our trampoline buffer to PAGE_EXECUTE_READWRITE
-				if (VirtualProtect(pTrampoline, sizeof(MHOOKS_TRAMPOLINE), PAGE_EXECUTE_READWRITE, &dwOldProtectTrampolineFunction)) {
-					ODPRINTF((L"mhooks: Mhook_SetHook: readwrite set on trampoline structure"));
-
-					// create our trampoline function
-					PBYTE pbCode = pTrampoline->codeTrampoline;
-					// save original code..
-					for (DWORD i = 0; i<dwInstructionLength; i++) {
-						pTrampoline->codeUntouched[i] = pbCode[i] = ((PBYTE)pSystemFunction)[i];
-					}
-					pbCode += dwInstructionLength;
-					// plus a jump to the continuation in the original location
-					pbCode = EmitJump(pbCode, ((PBYTE)pSystemFunction) + dwInstructionLength);
-					ODPRINTF((L"mhooks: Mhook_SetHook: updated the trampoline"));
-
-					// fix up any IP-relative addressing in the code
-					FixupIPRelativeAddressing(pTrampoline->codeTrampoline, (PBYTE)pSystemFunction, &patchdata);
-
-					DWORD_PTR dwDistance = (PBYTE)pHookFunction < (PBYTE)pSystemFunction ? 
-						(PBYTE)pSystemFunction - (PBYTE)pHookFunction : (PBYTE)pHookFunction - (PBYTE)pSystemFunction;
-					if (dwDistance > 0x7fff0000) {
-						// create a stub that jumps to the replacement function.
-						// we need this because jumping from the API to the hook directly 
-						// will be a long jump, which is 14 bytes on x64, and we want to 
-						// avoid that - the API may or may not have room for such stuff. 
-						// (remember, we only have 5 bytes guaranteed in the API.)
-						// on the other hand we do have room, and the trampoline will always be
-						// within +/- 2GB of the API, so we do the long jump in there. 
-						// the API will jump to the "reverse trampoline" which
-						// will jump to the user's hook code.
-						pbCode = pTrampoline->codeJumpToHookFunction;
-						pbCode = EmitJump(pbCode, (PBYTE)pHookFunction);
-						ODPRINTF((L"mhooks: Mhook_SetHook: created reverse trampoline"));
-						FlushInstructionCache(GetCurrentProcess(), pTrampoline->codeJumpToHookFunction, 
-							pbCode - pTrampoline->codeJumpToHookFunction);
-
-						// update the API itself
-						pbCode = (PBYTE)pSystemFunction;
-						pbCode = EmitJump(pbCode, pTrampoline->codeJumpToHookFunction);
-					} else {
-						// the jump will be at most 5 bytes so we can do it directly
-						// update the API itself
-						pbCode = (PBYTE)pSystemFunction;
-						pbCode = EmitJump(pbCode, (PBYTE)pHookFunction);
-					}
+	if (!PlanHook(&pPending->plan, pSystemFunction, (PBYTE)pHookFunction)) {
+		ODPRINTF((L"mhooks: Mhook_AddHook: disassembly signals %d bytes (unacceptable)", pPending->plan.cbOverwrittenCode));
+		return FALSE;
+	}
+	ODPRINTF((L"mhooks: Mhook_AddHook: disassembly signals %d bytes", pPending->plan.cbOverwrittenCode));
+
+	// every function can only be patched once
+	for (DWORD i = 0; i < g_nPending; i++) {
+		PBYTE pOther = g_pending[i].plan.pSystemFunction;
+		if (pSystemFunction < pOther + g_pending[i].plan.cbOverwrittenCode &&
+			pOther < pSystemFunction + pPending->plan.cbOverwrittenCode) {
+			ODPRINTF((L"mhooks: Mhook_AddHook: %p is already being hooked", pSystemFunction));
+			return FALSE;
+		}
+	}
 
-					// update data members
-					pTrampoline->cbOverwrittenCode = dwInstructionLength;
-					pTrampoline->pSystemFunction = (PBYTE)pSystemFunction;
-					pTrampoline->pHookFunction = (PBYTE)pHookFunction;
+	// allocate a trampoline structure (TODO: it is pretty wasteful to get
+	// VirtualAlloc to grab chunks of memory smaller than 100 bytes)
+	MHOOKS_TRAMPOLINE* pTrampoline = TrampolineAlloc(pSystemFunction, pPending->plan.nLimitUp, pPending->plan.nLimitDown);
+	if (!pTrampoline) {
+		ODPRINTF((L"mhooks: Mhook_AddHook: no trampoline near %p", pSystemFunction));
+		return FALSE;
+	}
+	ODPRINTF((L"mhooks: Mhook_AddHook: allocated structure at %p", pTrampoline));
+
+	// nobody can reach the trampoline before the commit, so it's written right away
+	DWORD dwOldProtectTrampolineFunction = 0;
+	if (!VirtualProtect(pTrampoline, sizeof(MHOOKS_TRAMPOLINE), PAGE_EXECUTE_READWRITE, &dwOldProtectTrampolineFunction)) {
+		ODPRINTF((L"mhooks: Mhook_AddHook: failed VirtualProtect 2: %d", gle()));
+		TrampolineFree(pTrampoline, TRUE);
+		return FALSE;
+	}
+	MhookPlan_Layout(&pPending->plan, pTrampoline->codeTrampoline, pTrampoline->codeJumpToHookFunction, pTrampoline->codeUntouched);
+	FlushInstructionCache(GetCurrentProcess(), pTrampoline->codeJumpToHookFunction, sizeof(pTrampoline->codeJumpToHookFunction));
+	FlushInstructionCache(GetCurrentProcess(), pTrampoline->codeTrampoline, sizeof(pTrampoline->codeTrampoline));
+	VirtualProtect(pTrampoline, sizeof(MHOOKS_TRAMPOLINE), dwOldProtectTrampolineFunction, &dwOldProtectTrampolineFunction);
+	ODPRINTF((L"mhooks: Mhook_AddHook: updated the trampoline"));
+
+	pPending->ppSystemFunction = ppSystemFunction;
+	pPending->pTrampoline = pTrampoline;
+	g_nPending++;
+	return TRUE;
+}
 
-					// flush instruction cache and restore original protection
-					FlushInstructionCache(GetCurrentProcess(), pTrampoline->codeTrampoline, dwInstructionLength);
-					VirtualProtect(pTrampoline, sizeof(MHOOKS_TRAMPOLINE), dwOldProtectTrampolineFunction, &dwOldProtectTrampolineFunction);
-				} else {
-					ODPRINTF((L"mhooks: Mhook_SetHook: failed VirtualProtect 2: %d", gle()));
-				}
-				// flush instruction cache and restore original protection
-				FlushInstructionCache(GetCurrentProcess(), pSystemFunction, dwInstructionLength);
-				VirtualProtect(pSystemFunction, dwInstructionLength, dwOldProtectSystemFunction, &dwOldProtectSystemFunction);
-			} else {
-				ODPRINTF((L"mhooks: Mhook_SetHook: failed VirtualProtect 1: %d", gle()));
-			}
-			if (pTrampoline->pSystemFunction) {
-				// this is what the application will use as the entry point
-				// to the "original" unhooked function.
-				*ppSystemFunction = pTrampoline->codeTrampoline;
-				ODPRINTF((L"mhooks: Mhook_SetHook: Hooked the function!"));
-			} else {
-				// if we failed discard the trampoline (forcing VirtualFree)
-				TrampolineFree(pTrampoline, TRUE);
-				pTrampoline = NULL;
-			}
+//=========================================================================
+DWORD Mhook_Commit(void) {
+	MHOOKS_CODE_RANGE ranges[MHOOKS_MAX_TRANSACTION];
+	DWORD nHooked = 0;
+
+	if (!g_bInTransaction)
+		return 0;
+
+	for (DWORD i = 0; i < g_nPending; i++) {
+		ranges[i].pbCode = g_pending[i].plan.pSystemFunction;
+		ranges[i].cbBytes = g_pending[i].plan.cbOverwrittenCode;
+	}
+
+	// suspend every other thread in this process once for all of the hooks,
+	// and make sure their IP is not in any code we're about to overwrite.
+	if (g_nPending)
+		SuspendOtherThreads(ranges, g_nPending);
+
+	for (DWORD i = 0; i < g_nPending; i++) {
+		MHOOK_PLAN* pPlan = &g_pending[i].plan;
+		MHOOKS_TRAMPOLINE* pTrampoline = g_pending[i].pTrampoline;
+		DWORD dwOldProtectSystemFunction = 0;
+		// set the system function to PAGE_EXECUTE_READWRITE
+		if (VirtualProtect(pPlan->pSystemFunction, pPlan->cbOverwrittenCode, PAGE_EXECUTE_READWRITE, &dwOldProtectSystemFunction)) {
+			// update the API itself
+			CopyMemory(pPlan->pSystemFunction, pPlan->codePatch, pPlan->cbPatch);
+
+			// update data members
+			pTrampoline->cbOverwrittenCode = pPlan->cbOverwrittenCode;
+			pTrampoline->pSystemFunction = pPlan->pSystemFunction;
+			pTrampoline->pHookFunction = pPlan->pHookFunction;
+
+			// flush instruction cache and restore original protection
+			FlushInstructionCache(GetCurrentProcess(), pPlan->pSystemFunction, pPlan->cbOverwrittenCode);
+			VirtualProtect(pPlan->pSystemFunction, pPlan->cbOverwrittenCode, dwOldProtectSystemFunction, &dwOldProtectSystemFunction);
+
+			// this is what the application will use as the entry point
+			// to the "original" unhooked function.
+			*g_pending[i].ppSystemFunction = pTrampoline->codeTrampoline;
+			nHooked++;
+			ODPRINTF((L"mhooks: Mhook_Commit: Hooked %p!", pPlan->pSystemFunction));
+		} else {
+			ODPRINTF((L"mhooks: Mhook_Commit: failed VirtualProtect 1: %d", gle()));
+			// discard the trampoline, it was never reachable
+			TrampolineFree(pTrampoline, TRUE);
 		}
-		// resume everybody else
-		ResumeOtherThreads();
-	} else {
-		ODPRINTF((L"mhooks: disassembly signals %d bytes (unacceptable)", dwInstructionLength));
 	}
+
+	// resume everybody else
+	if (g_nPending)
+		ResumeOtherThreads();
+
+	g_nPending = 0;
+	g_bInTransaction = FALSE;
 	LeaveCritSec();
-	return (pTrampoline != NULL);
+	return nHooked;
 }
 
+//=========================================================================
+BOOL Mhook_SetHook(PVOID *ppSystemFunction, PVOID pHookFunction) {
+	if (!Mhook_BeginTransaction())
+		return FALSE;
+	Mhook_AddHook(ppSystemFunction, pHookFunction);
+	return Mhook_Commit() == 1;
+}
 //=========================================================================
 BOOL Mhook_Unhook(PVOID *ppHookedFunction) {
 	ODPRINTF((L"mhooks: Mhook_Unhook: %p", *ppHookedFunction));
@@ -881,7 +646,8 @@ BOOL Mhook_Unhook(PVOID *ppHookedFunction) {
 	MHOOKS_TRAMPOLINE* pTrampoline = TrampolineGet((PBYTE)*ppHookedFunction);
 	if (pTrampoline) {
 		// make sure nobody's executing code where we're about to overwrite a few bytes
-		SuspendOtherThreads(pTrampoline->pSystemFunction, pTrampoline->cbOverwrittenCode);
+		MHOOKS_CODE_RANGE range = { pTrampoline->pSystemFunction, pTrampoline->cbOverwrittenCode };
+		SuspendOtherThreads(&range, 1);
 		ODPRINTF((L"mhooks: Mhook_Unhook: found struct at %p", pTrampoline));
 		DWORD dwOldProtectSystemFunction = 0;
 		// make memory writable
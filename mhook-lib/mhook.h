@@ -31,6 +31,16 @@ extern "C" {
 BOOL Mhook_SetHook(PVOID *ppSystemFunction, PVOID pHookFunction);
 BOOL Mhook_Unhook(PVOID *ppHookedFunction);
 
+// Setting several hooks at once: every Mhook_SetHook suspends all other
+// threads of the process, a transaction suspends them once for all of its
+// hooks. Mhook_AddHook plans a hook and prepares its trampoline, returning
+// FALSE if the function can't be hooked. Mhook_Commit patches all of them
+// and returns how many got hooked, *ppSystemFunction only changes then.
+// Other threads wait for the commit before they can use mhook.
+BOOL  Mhook_BeginTransaction(void);
+BOOL  Mhook_AddHook(PVOID *ppSystemFunction, PVOID pHookFunction);
+DWORD Mhook_Commit(void);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,374 @@
+//Copyright (c) 2007-2008, Marton Anka
+//
+//Permission is hereby granted, free of charge, to any person obtaining a
+//copy of this software and associated documentation files (the "Software"),
+//to deal in the Software without restriction, including without limitation
+//the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//and/or sell copies of the Software, and to permit persons to whom the
+//Software is furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included
+//in all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+//IN THE SOFTWARE.
+
+#include <stdlib.h>
+#include <string.h>
+#include "mhook_alloc.h"
+
+//=========================================================================
+// The state of a slot
+#define SLOT_FREE		0
+#define SLOT_USED		1
+#define SLOT_RETIRED	2	// freed, but never to be used again
+
+#define NO_SLOT			((uint32_t)-1)
+
+//=========================================================================
+// Internal function:
+//
+// Rounding addresses to block boundaries.
+//=========================================================================
+static uintptr_t RoundDown(uintptr_t addr, size_t rndDown) {
+	return (addr / rndDown) * rndDown;
+}
+
+static uintptr_t RoundUp(uintptr_t addr, size_t rndUp) {
+	uintptr_t rounded = RoundDown(addr, rndUp);
+	return rounded == addr ? addr : rounded + rndUp;
+}
+
+//=========================================================================
+// Internal function:
+//
+// The index of the first block which ends behind pbAddress.
+//=========================================================================
+static uint32_t FirstBlockEndingAfter(MHOOK_ALLOCATOR* pAlloc, const uint8_t* pbAddress) {
+	uint32_t nLow = 0, nHigh = pAlloc->nBlocks;
+	while (nLow < nHigh) {
+		uint32_t nMid = nLow + (nHigh - nLow) / 2;
+		if (pAlloc->pBlocks[nMid].pbBase + pAlloc->cbBlock <= pbAddress)
+			nLow = nMid + 1;
+		else
+			nHigh = nMid;
+	}
+	return nLow;
+}
+
+//=========================================================================
+// Internal function:
+//
+// Takes a free slot strictly between pbLower and pbUpper out of the block.
+//=========================================================================
+static void* TakeSlot(MHOOK_ALLOCATOR* pAlloc, MHOOK_ALLOC_BLOCK* pBlock, uint8_t* pbLower, uint8_t* pbUpper) {
+	uint32_t iPrev = NO_SLOT;
+	uint32_t iSlot = pBlock->iFree;
+
+	// blocks at the edges of the range are only partially in it
+	while (iSlot != NO_SLOT) {
+		uint8_t* pbSlot = pBlock->pbBase + iSlot * pAlloc->cbSlot;
+		if (pbLower < pbSlot && pbSlot < pbUpper)
+			break;
+		iPrev = iSlot;
+		iSlot = pBlock->pNextFree[iSlot];
+	}
+	if (iSlot == NO_SLOT)
+		return NULL;
+
+	if (iPrev == NO_SLOT)
+		pBlock->iFree = pBlock->pNextFree[iSlot];
+	else
+		pBlock->pNextFree[iPrev] = pBlock->pNextFree[iSlot];
+
+	pBlock->pState[iSlot] = SLOT_USED;
+	pBlock->nFree--;
+	return pBlock->pbBase + iSlot * pAlloc->cbSlot;
+}
+
+//=========================================================================
+// Internal function:
+//
+// Adds the bookkeeping for a block of new memory, keeping the blocks
+// sorted.
+//=========================================================================
+static MHOOK_ALLOC_BLOCK* AddBlock(MHOOK_ALLOCATOR* pAlloc, uint8_t* pbBase) {
+	MHOOK_ALLOC_BLOCK block;
+	uint32_t i;
+
+	if (pAlloc->nBlocks == pAlloc->nBlocksAllocated) {
+		uint32_t nAllocated = pAlloc->nBlocksAllocated ? 2 * pAlloc->nBlocksAllocated : 16;
+		MHOOK_ALLOC_BLOCK* pBlocks = (MHOOK_ALLOC_BLOCK*)realloc(pAlloc->pBlocks, nAllocated * sizeof(MHOOK_ALLOC_BLOCK));
+		if (!pBlocks)
+			return NULL;
+		pAlloc->pBlocks = pBlocks;
+		pAlloc->nBlocksAllocated = nAllocated;
+	}
+
+	block.pbBase = pbBase;
+	block.nFree = pAlloc->nSlotsPerBlock;
+	block.iFree = 0;
+	block.pNextFree = (uint32_t*)malloc(pAlloc->nSlotsPerBlock * sizeof(uint32_t));
+	block.pState = (uint8_t*)calloc(pAlloc->nSlotsPerBlock, 1);
+	if (!block.pNextFree || !block.pState) {
+		free(block.pNextFree);
+		free(block.pState);
+		return NULL;
+	}
+
+	// prepare them by having them point down the line at the next entry.
+	for (i = 0; i < pAlloc->nSlotsPerBlock; i++)
+		block.pNextFree[i] = i + 1 < pAlloc->nSlotsPerBlock ? i + 1 : NO_SLOT;
+
+	i = FirstBlockEndingAfter(pAlloc, pbBase);
+	memmove(&pAlloc->pBlocks[i + 1], &pAlloc->pBlocks[i], (pAlloc->nBlocks - i) * sizeof(MHOOK_ALLOC_BLOCK));
+	pAlloc->pBlocks[i] = block;
+	pAlloc->nBlocks++;
+	return &pAlloc->pBlocks[i];
+}
+
+//=========================================================================
+// Internal function:
+//
+// Where in the free range a block would be both in the allowed range and
+// as close to pbNear as possible, or 0 if it doesn't fit.
+//=========================================================================
+static uintptr_t PlaceBlock(MHOOK_ALLOCATOR* pAlloc, uint8_t* pbBase, size_t cbSize, uint8_t* pbNear, uint8_t* pbLower, uint8_t* pbUpper) {
+	uintptr_t uFirst = RoundUp((uintptr_t)pbBase, pAlloc->cbBlock);
+	uintptr_t uEnd = (uintptr_t)pbBase + cbSize;
+	uintptr_t uLast, uStart;
+
+	if (uEnd < (uintptr_t)pbBase)
+		uEnd = UINTPTR_MAX;
+	if (uEnd < pAlloc->cbBlock)
+		return 0;
+	uLast = RoundDown(uEnd - pAlloc->cbBlock, pAlloc->cbBlock);
+
+	// the block itself has to be strictly inside the range
+	if (uFirst <= (uintptr_t)pbLower)
+		uFirst = RoundDown((uintptr_t)pbLower, pAlloc->cbBlock) + pAlloc->cbBlock;
+	if (uLast >= (uintptr_t)pbUpper)
+		uLast = RoundDown((uintptr_t)pbUpper - 1, pAlloc->cbBlock);
+	if (uFirst == 0 || uFirst > uLast)
+		return 0;
+
+	uStart = RoundDown((uintptr_t)pbNear, pAlloc->cbBlock);
+	if (uStart < uFirst)
+		uStart = uFirst;
+	if (uStart > uLast)
+		uStart = uLast;
+	return uStart;
+}
+
+//=========================================================================
+// Internal function:
+//
+// Remembers free address space, dropping the smallest if there are too
+// many.
+//=========================================================================
+static void RememberRegion(MHOOK_ALLOCATOR* pAlloc, uintptr_t uBase, uintptr_t uEnd) {
+	uint32_t iSmallest = 0, i;
+
+	if (uEnd <= uBase || uEnd - uBase < pAlloc->cbBlock)
+		return;
+
+	if (pAlloc->nRegions < MHOOK_ALLOC_MAX_REGIONS) {
+		iSmallest = pAlloc->nRegions++;
+	} else {
+		for (i = 1; i < pAlloc->nRegions; i++) {
+			if (pAlloc->regions[i].cbSize < pAlloc->regions[iSmallest].cbSize)
+				iSmallest = i;
+		}
+		if (pAlloc->regions[iSmallest].cbSize >= uEnd - uBase)
+			return;
+	}
+
+	pAlloc->regions[iSmallest].pbBase = (uint8_t*)uBase;
+	pAlloc->regions[iSmallest].cbSize = uEnd - uBase;
+}
+
+//=========================================================================
+// Internal function:
+//
+// Allocates a block at uStart in the free range, remembering what's left
+// of the range on both sides.
+//=========================================================================
+static uint8_t* AllocInRegion(MHOOK_ALLOCATOR* pAlloc, uint8_t* pbBase, size_t cbSize, uintptr_t uStart) {
+	uintptr_t uEnd = (uintptr_t)pbBase + cbSize;
+
+	if (!pAlloc->provider.fnAlloc(pAlloc->provider.pContext, (uint8_t*)uStart, pAlloc->cbBlock))
+		return NULL;
+
+	if (uEnd < (uintptr_t)pbBase)
+		uEnd = UINTPTR_MAX;
+	RememberRegion(pAlloc, (uintptr_t)pbBase, uStart);
+	RememberRegion(pAlloc, uStart + pAlloc->cbBlock, uEnd);
+	return (uint8_t*)uStart;
+}
+
+//=========================================================================
+// Internal function:
+//
+// Looks for free address space in range, first among what's been found
+// before, then alternately below and above pbNear, skipping whole ranges
+// in use at once.
+//=========================================================================
+static uint8_t* NewBlock(MHOOK_ALLOCATOR* pAlloc, uint8_t* pbNear, uint8_t* pbLower, uint8_t* pbUpper) {
+	uint32_t i = 0;
+	while (i < pAlloc->nRegions) {
+		MHOOK_ALLOC_REGION region = pAlloc->regions[i];
+		uintptr_t uStart = PlaceBlock(pAlloc, region.pbBase, region.cbSize, pbNear, pbLower, pbUpper);
+		if (!uStart) {
+			i++;
+			continue;
+		}
+
+		// whatever happens, the remainders are remembered anew or the space is gone
+		pAlloc->regions[i] = pAlloc->regions[--pAlloc->nRegions];
+		uint8_t* pbBlock = AllocInRegion(pAlloc, region.pbBase, region.cbSize, uStart);
+		if (pbBlock)
+			return pbBlock;
+	}
+
+	uintptr_t uDown = RoundDown((uintptr_t)pbNear, pAlloc->cbBlock);
+	uintptr_t uUp = uDown + pAlloc->cbBlock;
+	int bDown = 1, bUp = uUp > uDown;
+
+	while (bDown || bUp) {
+		uint8_t* pbBase;
+		size_t cbSize;
+		int bFree;
+		uintptr_t uStart;
+
+		if (bDown) {
+			// determine current state
+			pAlloc->nQueries++;
+			if (uDown <= (uintptr_t)pbLower || !pAlloc->provider.fnQuery(pAlloc->provider.pContext, (uint8_t*)uDown, &pbBase, &cbSize, &bFree)) {
+				bDown = 0;
+			} else {
+				// free & large enough?
+				if (bFree && (uStart = PlaceBlock(pAlloc, pbBase, cbSize, pbNear, pbLower, pbUpper)) != 0) {
+					uint8_t* pbBlock = AllocInRegion(pAlloc, pbBase, cbSize, uStart);
+					if (pbBlock)
+						return pbBlock;
+				}
+				// go on below the range
+				if ((uintptr_t)pbBase < pAlloc->cbBlock || (uintptr_t)pbBase > uDown)
+					bDown = 0;
+				else
+					uDown = RoundDown((uintptr_t)pbBase - 1, pAlloc->cbBlock);
+			}
+		}
+
+		if (bUp) {
+			pAlloc->nQueries++;
+			if (uUp >= (uintptr_t)pbUpper || !pAlloc->provider.fnQuery(pAlloc->provider.pContext, (uint8_t*)uUp, &pbBase, &cbSize, &bFree)) {
+				bUp = 0;
+			} else {
+				if (bFree && (uStart = PlaceBlock(pAlloc, pbBase, cbSize, pbNear, pbLower, pbUpper)) != 0) {
+					uint8_t* pbBlock = AllocInRegion(pAlloc, pbBase, cbSize, uStart);
+					if (pbBlock)
+						return pbBlock;
+				}
+				// go on above the range
+				uintptr_t uEnd = RoundUp((uintptr_t)pbBase + cbSize, pAlloc->cbBlock);
+				if (uEnd <= uUp)
+					bUp = 0;
+				else
+					uUp = uEnd;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+//=========================================================================
+void MhookAlloc_Init(MHOOK_ALLOCATOR* pAlloc, const MHOOK_PAGE_PROVIDER* pProvider, size_t cbBlock, size_t cbSlot) {
+	memset(pAlloc, 0, sizeof(*pAlloc));
+	pAlloc->provider = *pProvider;
+	pAlloc->cbBlock = cbBlock;
+	pAlloc->cbSlot = cbSlot;
+	pAlloc->nSlotsPerBlock = (uint32_t)(cbBlock / cbSlot);
+}
+
+//=========================================================================
+void MhookAlloc_Release(MHOOK_ALLOCATOR* pAlloc) {
+	uint32_t i;
+	for (i = 0; i < pAlloc->nBlocks; i++) {
+		free(pAlloc->pBlocks[i].pNextFree);
+		free(pAlloc->pBlocks[i].pState);
+	}
+	free(pAlloc->pBlocks);
+	memset(pAlloc, 0, sizeof(*pAlloc));
+}
+
+//=========================================================================
+void* MhookAlloc_Alloc(MHOOK_ALLOCATOR* pAlloc, uint8_t* pbNear, uint8_t* pbLower, uint8_t* pbUpper) {
+	uint32_t i;
+
+	// try to find a slot in the blocks in range
+	for (i = FirstBlockEndingAfter(pAlloc, pbLower + 1); i < pAlloc->nBlocks && pAlloc->pBlocks[i].pbBase < pbUpper; i++) {
+		if (pAlloc->pBlocks[i].nFree) {
+			void* pSlot = TakeSlot(pAlloc, &pAlloc->pBlocks[i], pbLower, pbUpper);
+			if (pSlot)
+				return pSlot;
+		}
+	}
+
+	// if we can't find it, then we need to allocate a new block and
+	// try again. Just fail if that doesn't work
+	uint8_t* pbBlock = NewBlock(pAlloc, pbNear, pbLower, pbUpper);
+	if (!pbBlock)
+		return NULL;
+
+	MHOOK_ALLOC_BLOCK* pBlock = AddBlock(pAlloc, pbBlock);
+	return pBlock ? TakeSlot(pAlloc, pBlock, pbLower, pbUpper) : NULL;
+}
+
+//=========================================================================
+void* MhookAlloc_Find(MHOOK_ALLOCATOR* pAlloc, const uint8_t* pbAddress, size_t cbOffset) {
+	const uint8_t* pbSlot = pbAddress - cbOffset;
+	uint32_t i = FirstBlockEndingAfter(pAlloc, pbSlot);
+
+	if (i == pAlloc->nBlocks || pbSlot < pAlloc->pBlocks[i].pbBase)
+		return NULL;
+
+	size_t cbInBlock = (size_t)(pbSlot - pAlloc->pBlocks[i].pbBase);
+	uint32_t iSlot = (uint32_t)(cbInBlock / pAlloc->cbSlot);
+	if (cbInBlock % pAlloc->cbSlot || iSlot >= pAlloc->nSlotsPerBlock || pAlloc->pBlocks[i].pState[iSlot] != SLOT_USED)
+		return NULL;
+
+	return (void*)pbSlot;
+}
+
+//=========================================================================
+void MhookAlloc_Free(MHOOK_ALLOCATOR* pAlloc, void* pSlot, int bReuse) {
+	uint32_t i = FirstBlockEndingAfter(pAlloc, (uint8_t*)pSlot);
+	if (i == pAlloc->nBlocks || (uint8_t*)pSlot < pAlloc->pBlocks[i].pbBase)
+		return;
+
+	MHOOK_ALLOC_BLOCK* pBlock = &pAlloc->pBlocks[i];
+	uint32_t iSlot = (uint32_t)(((uint8_t*)pSlot - pBlock->pbBase) / pAlloc->cbSlot);
+	if (iSlot >= pAlloc->nSlotsPerBlock || pBlock->pState[iSlot] != SLOT_USED)
+		return;
+
+	// If a thread could feasibly have some of our trampoline code
+	// on its stack and we yank the region from underneath it then it will
+	// surely crash upon returning. So instead of reusing the
+	// memory we just let it leak. Ugly, but safe.
+	if (!bReuse) {
+		pBlock->pState[iSlot] = SLOT_RETIRED;
+		return;
+	}
+
+	pBlock->pState[iSlot] = SLOT_FREE;
+	pBlock->pNextFree[iSlot] = pBlock->iFree;
+	pBlock->iFree = iSlot;
+	pBlock->nFree++;
+}
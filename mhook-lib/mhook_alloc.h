@@ -0,0 +1,89 @@
+// The trampoline allocator of mhook. Trampolines have to be within +/- 2GB
+// of the function they belong to, so they are handed out from blocks of
+// memory allocated near the hooked modules. The blocks are kept sorted by
+// address, each with a free list of its own, so finding a trampoline in
+// range only looks at the blocks in range, and finding the trampoline a
+// pointer belongs to is a binary search plus some arithmetic. Free address
+// space found next to new blocks is remembered, which saves walking the
+// address space again for the next block near the same module.
+//
+// Where the memory comes from is up to a page provider, which makes the
+// allocator usable on the build machine as well.
+
+#ifndef MHOOK_ALLOC_H
+#define MHOOK_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================================================================
+#define MHOOK_ALLOC_MAX_REGIONS		32
+
+//=========================================================================
+// The source of memory for the blocks
+typedef struct _MHOOK_PAGE_PROVIDER {
+	// Finds a range around pbAddress which is either completely free or
+	// completely in use, returns 0 if the address can't be queried
+	int		(*fnQuery)(void* pContext, uint8_t* pbAddress, uint8_t** ppbBase, size_t* pcbSize, int* pbFree);
+	// Commits cbSize bytes of executable memory at exactly pbAddress,
+	// returns NULL if that didn't work
+	void*	(*fnAlloc)(void* pContext, uint8_t* pbAddress, size_t cbSize);
+	void*	pContext;
+} MHOOK_PAGE_PROVIDER;
+
+//=========================================================================
+typedef struct _MHOOK_ALLOC_BLOCK {
+	uint8_t*	pbBase;
+	uint32_t	nFree;
+	uint32_t	iFree;			// the first free slot
+	uint32_t*	pNextFree;		// for every free slot, the next one
+	uint8_t*	pState;			// for every slot, see mhook_alloc.c
+} MHOOK_ALLOC_BLOCK;
+
+typedef struct _MHOOK_ALLOC_REGION {
+	uint8_t*	pbBase;
+	size_t		cbSize;
+} MHOOK_ALLOC_REGION;
+
+typedef struct _MHOOK_ALLOCATOR {
+	MHOOK_PAGE_PROVIDER	provider;
+	size_t				cbBlock;		// a multiple of the allocation granularity
+	size_t				cbSlot;
+	uint32_t			nSlotsPerBlock;
+
+	MHOOK_ALLOC_BLOCK*	pBlocks;		// sorted by address
+	uint32_t			nBlocks;
+	uint32_t			nBlocksAllocated;
+
+	MHOOK_ALLOC_REGION	regions[MHOOK_ALLOC_MAX_REGIONS];	// free address space near the blocks
+	uint32_t			nRegions;
+
+	uint32_t			nQueries;		// of the page provider, for statistics
+} MHOOK_ALLOCATOR;
+
+//=========================================================================
+void MhookAlloc_Init(MHOOK_ALLOCATOR* pAlloc, const MHOOK_PAGE_PROVIDER* pProvider, size_t cbBlock, size_t cbSlot);
+
+// Frees the bookkeeping, but none of the blocks: code might still be running in them
+void MhookAlloc_Release(MHOOK_ALLOCATOR* pAlloc);
+
+// Hands out a slot strictly between pbLower and pbUpper, as close to pbNear
+// as it gets when a new block is needed. Returns NULL if there is no room.
+void* MhookAlloc_Alloc(MHOOK_ALLOCATOR* pAlloc, uint8_t* pbNear, uint8_t* pbLower, uint8_t* pbUpper);
+
+// The slot in use for which pbAddress is cbOffset bytes into it, or NULL
+void* MhookAlloc_Find(MHOOK_ALLOCATOR* pAlloc, const uint8_t* pbAddress, size_t cbOffset);
+
+// Gives a slot back. Slots which threads might still be executing must not
+// be handed out again, they are only reused if bReuse is set.
+void MhookAlloc_Free(MHOOK_ALLOCATOR* pAlloc, void* pSlot, int bReuse);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MHOOK_ALLOC_H
@@ -0,0 +1,215 @@
+//Copyright (c) 2007-2008, Marton Anka
+//
+//Permission is hereby granted, free of charge, to any person obtaining a
+//copy of this software and associated documentation files (the "Software"),
+//to deal in the Software without restriction, including without limitation
+//the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//and/or sell copies of the Software, and to permit persons to whom the
+//Software is furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included
+//in all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+//IN THE SOFTWARE.
+
+#include <string.h>
+#include "mhook_plan.h"
+
+//=========================================================================
+// Internal function:
+//
+// Reads unaligned little endian values out of code.
+//=========================================================================
+static int32_t ReadInt32(const uint8_t* pbCode) {
+	int32_t nValue;
+	memcpy(&nValue, pbCode, sizeof(nValue));
+	return nValue;
+}
+
+static uint8_t* ReadPointer(const uint8_t* pbCode) {
+	uint8_t* pValue;
+	memcpy(&pValue, pbCode, sizeof(pValue));
+	return pValue;
+}
+
+//=========================================================================
+// Skip over jumps that lead to the real function. Gets around import
+// jump tables, etc.
+//=========================================================================
+uint8_t* MhookPlan_SkipJumps(uint8_t* pbCode) {
+	uint8_t* pbOrgCode = pbCode;
+#ifdef MHOOK_PLAN_X86
+	//mov edi,edi: hot patch point
+	if (pbCode[0] == 0x8b && pbCode[1] == 0xff)
+		pbCode += 2;
+	// push ebp; mov ebp, esp; pop ebp;
+	// "collapsed" stackframe generated by MSVC
+	if (pbCode[0] == 0x55 && pbCode[1] == 0x8b && pbCode[2] == 0xec && pbCode[3] == 0x5d)
+		pbCode += 4;
+#endif
+	if (pbCode[0] == 0xff && pbCode[1] == 0x25) {
+#ifdef MHOOK_PLAN_X86
+		// on x86 we have an absolute pointer...
+		uint8_t* pbTarget = ReadPointer(&pbCode[2]);
+		// ... that shows us an absolute pointer.
+		return MhookPlan_SkipJumps(ReadPointer(pbTarget));
+#else
+		// on x64 we have a 32-bit offset...
+		int32_t lOffset = ReadInt32(&pbCode[2]);
+		// ... that shows us an absolute pointer
+		return MhookPlan_SkipJumps(ReadPointer(pbCode + 6 + lOffset));
+	} else if (pbCode[0] == 0x48 && pbCode[1] == 0xff && pbCode[2] == 0x25) {
+		// or we can have the same with a REX prefix
+		int32_t lOffset = ReadInt32(&pbCode[3]);
+		// ... that shows us an absolute pointer
+		return MhookPlan_SkipJumps(ReadPointer(pbCode + 7 + lOffset));
+#endif
+	} else if (pbCode[0] == 0xe9) {
+		// here the behavior is identical, we have...
+		// ...a 32-bit offset to the destination.
+		return MhookPlan_SkipJumps(pbCode + 5 + ReadInt32(&pbCode[1]));
+	} else if (pbCode[0] == 0xeb) {
+		// and finally an 8-bit offset to the destination
+		return MhookPlan_SkipJumps(pbCode + 2 + (int8_t)pbCode[1]);
+	}
+	return pbOrgCode;
+}
+
+//=========================================================================
+// Internal function:
+//
+// Writes code to pbOut that jumps to pbJumpTo once it is at pbCode. Will
+// attempt to do this in as few bytes as possible. Important on x64 where
+// the long jump (0xff 0x25 ....) can take up 14 bytes. Returns the number
+// of bytes written.
+//=========================================================================
+static uint32_t EmitJumpAt(uint8_t* pbOut, uint8_t* pbCode, uint8_t* pbJumpTo) {
+	uint8_t* pbJumpFrom = pbCode + 5;
+	uintptr_t cbDiff = pbJumpFrom > pbJumpTo ? (uintptr_t)(pbJumpFrom - pbJumpTo) : (uintptr_t)(pbJumpTo - pbJumpFrom);
+	if (cbDiff <= 0x7fff0000) {
+		int32_t nRelative = (int32_t)(pbJumpTo - pbJumpFrom);
+		pbOut[0] = 0xe9;
+		memcpy(pbOut + 1, &nRelative, sizeof(nRelative));
+		return 1 + sizeof(nRelative);
+	} else {
+		uint32_t dwOperand;
+		pbOut[0] = 0xff;
+		pbOut[1] = 0x25;
+#ifdef MHOOK_PLAN_X86
+		// on x86 we write an absolute address (just behind the instruction)
+		dwOperand = (uint32_t)(uintptr_t)(pbCode + 2 + sizeof(dwOperand));
+#else
+		// on x64 we write the relative address of the same location
+		dwOperand = 0;
+#endif
+		memcpy(pbOut + 2, &dwOperand, sizeof(dwOperand));
+		memcpy(pbOut + 2 + sizeof(dwOperand), &pbJumpTo, sizeof(pbJumpTo));
+		return 2 + sizeof(dwOperand) + sizeof(pbJumpTo);
+	}
+}
+
+//=========================================================================
+uint8_t* MhookPlan_EmitJump(uint8_t* pbCode, uint8_t* pbJumpTo) {
+	return pbCode + EmitJumpAt(pbCode, pbCode, pbJumpTo);
+}
+
+//=========================================================================
+// Examine the machine code at the target function's entry point, and
+// skip bytes in a way that we'll always end on an instruction boundary.
+// We also detect branches and subroutine calls (as well as returns)
+// at which point disassembly must stop.
+// Finally, collect information on IP-relative instructions that we can
+// patch.
+//=========================================================================
+int MhookPlan_Prepare(MHOOK_PLAN* pPlan, uint8_t* pSystemFunction, uint8_t* pHookFunction,
+					  MHOOK_DECODER fnDecode, void* pContext) {
+	MHOOK_INSTRUCTION ins;
+	uint32_t dwRet = 0;
+
+	memset(pPlan, 0, sizeof(*pPlan));
+	pPlan->pSystemFunction = pSystemFunction;
+	pPlan->pHookFunction = pHookFunction;
+
+	while (dwRet < MHOOK_PLAN_JMPSIZE) {
+		uint8_t* pLoc = pSystemFunction + dwRet;
+
+		memset(&ins, 0, sizeof(ins));
+		if (!fnDecode(pLoc, &ins, pContext) || !ins.cbLength)
+			break;
+		if (ins.bStopsFlow)
+			break;
+
+		if (ins.bIpRelative) {
+			// anything but a plain mov or lea can't be moved
+			if (!ins.bRelocatable)
+				break;
+			// calculate displacement relative to function start
+			int64_t nAdjustedDisplacement = ins.nDisplacement + dwRet;
+			// store displacement values furthest from zero (both positive and negative)
+			if (nAdjustedDisplacement < pPlan->nLimitDown)
+				pPlan->nLimitDown = nAdjustedDisplacement;
+			if (nAdjustedDisplacement > pPlan->nLimitUp)
+				pPlan->nLimitUp = nAdjustedDisplacement;
+			// no room for patch info, stop disassembly
+			if (pPlan->nRipCnt >= MHOOK_PLAN_MAX_RIPS)
+				break;
+			pPlan->rips[pPlan->nRipCnt].dwOffset = dwRet + 3;
+			pPlan->rips[pPlan->nRipCnt].nDisplacement = ins.nDisplacement;
+			pPlan->nRipCnt++;
+		}
+
+		dwRet += ins.cbLength;
+	}
+
+	// the trampoline only has room for so much
+	if (dwRet + MHOOK_PLAN_JMPSIZE > MHOOK_PLAN_MAX_CODE_BYTES)
+		return 0;
+
+	pPlan->cbOverwrittenCode = dwRet;
+	return dwRet >= MHOOK_PLAN_JMPSIZE;
+}
+
+//=========================================================================
+void MhookPlan_Layout(MHOOK_PLAN* pPlan, uint8_t* pbTrampoline, uint8_t* pbJumpToHook, uint8_t* pbUntouched) {
+	uint8_t* pbHookTarget = pPlan->pHookFunction;
+	uintptr_t dwDistance;
+	uint32_t i;
+
+	// save original code..
+	memcpy(pbUntouched, pPlan->pSystemFunction, pPlan->cbOverwrittenCode);
+	memcpy(pbTrampoline, pPlan->pSystemFunction, pPlan->cbOverwrittenCode);
+	// plus a jump to the continuation in the original location
+	MhookPlan_EmitJump(pbTrampoline + pPlan->cbOverwrittenCode, pPlan->pSystemFunction + pPlan->cbOverwrittenCode);
+
+	// if IP-relative addressing has been detected, fix up the code so the
+	// offset points to the original location
+	for (i = 0; i < pPlan->nRipCnt; i++) {
+		int32_t nNewDisplacement = (int32_t)(pPlan->rips[i].nDisplacement - (pbTrampoline - pPlan->pSystemFunction));
+		memcpy(pbTrampoline + pPlan->rips[i].dwOffset, &nNewDisplacement, sizeof(nNewDisplacement));
+	}
+
+	dwDistance = pPlan->pHookFunction < pPlan->pSystemFunction ?
+		(uintptr_t)(pPlan->pSystemFunction - pPlan->pHookFunction) : (uintptr_t)(pPlan->pHookFunction - pPlan->pSystemFunction);
+	if (dwDistance > 0x7fff0000) {
+		// create a stub that jumps to the replacement function.
+		// we need this because jumping from the API to the hook directly
+		// will be a long jump, which is 14 bytes on x64, and we want to
+		// avoid that - the API may or may not have room for such stuff.
+		// (remember, we only have 5 bytes guaranteed in the API.)
+		// on the other hand we do have room, and the trampoline will always be
+		// within +/- 2GB of the API, so we do the long jump in there.
+		// the API will jump to the "reverse trampoline" which
+		// will jump to the user's hook code.
+		MhookPlan_EmitJump(pbJumpToHook, pPlan->pHookFunction);
+		pbHookTarget = pbJumpToHook;
+	}
+
+	// the jump will be at most 5 bytes, it's only written once the threads are suspended
+	pPlan->cbPatch = EmitJumpAt(pPlan->codePatch, pPlan->pSystemFunction, pbHookTarget);
+}
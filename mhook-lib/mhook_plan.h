@@ -0,0 +1,93 @@
+// The planning half of mhook: everything that can be decided by looking at
+// code bytes, without suspending threads or changing page protections.
+// Finding where a hook jump can go, copying the overwritten instructions into
+// a trampoline and laying out the patch itself only ever touch memory, so
+// this compiles for the build machine as well and can be tried on plain byte
+// buffers.
+
+#ifndef MHOOK_PLAN_H
+#define MHOOK_PLAN_H
+
+#include <stdint.h>
+
+#if defined(_M_IX86) || defined(__i386__)
+#define MHOOK_PLAN_X86
+#elif defined(_M_X64) || defined(__x86_64__)
+#define MHOOK_PLAN_X64
+#else
+#error unsupported platform
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//=========================================================================
+#define MHOOK_PLAN_MAX_CODE_BYTES	32
+#define MHOOK_PLAN_MAX_RIPS			 4
+#define MHOOK_PLAN_JMPSIZE			 5
+
+//=========================================================================
+// What the planner needs to know about a single instruction
+typedef struct _MHOOK_INSTRUCTION {
+	uint32_t	cbLength;			// 0 if the bytes could not be decoded
+	int			bStopsFlow;			// return, branch or call: nothing behind it may be moved
+	int			bIpRelative;		// has an IP-relative operand (x64 only)
+	int			bRelocatable;		// ...which is "mov/lea reg, [rip+imm32]" or the
+									//   reverse, with the displacement at offset 3
+	int64_t		nDisplacement;		// of the IP-relative operand
+} MHOOK_INSTRUCTION;
+
+// Decodes the instruction at pbCode, returns 0 if it could not
+typedef int (*MHOOK_DECODER)(const uint8_t* pbCode, MHOOK_INSTRUCTION* pInstruction, void* pContext);
+
+//=========================================================================
+// IP-relative instructions in the overwritten code, which need their
+// displacement fixed up once they are moved into the trampoline
+typedef struct _MHOOK_PLAN_RIP {
+	uint32_t	dwOffset;
+	int64_t		nDisplacement;
+} MHOOK_PLAN_RIP;
+
+//=========================================================================
+// Everything about one hook, before it is placed
+typedef struct _MHOOK_PLAN {
+	uint8_t*		pSystemFunction;						// the function to hook, after skipping jumps
+	uint8_t*		pHookFunction;							// where the hooked function jumps to
+	uint32_t		cbOverwrittenCode;						// the instructions replaced by the jump
+
+	int64_t			nLimitUp;								// the trampoline has to be this close to
+	int64_t			nLimitDown;								//   the function for the IP-relative code
+	uint32_t		nRipCnt;
+	MHOOK_PLAN_RIP	rips[MHOOK_PLAN_MAX_RIPS];
+
+	uint8_t			codePatch[MHOOK_PLAN_MAX_CODE_BYTES];	// written over the start of the function
+	uint32_t		cbPatch;
+} MHOOK_PLAN;
+
+//=========================================================================
+// Follows jumps that lead to the real function, import jump tables etc.
+uint8_t* MhookPlan_SkipJumps(uint8_t* pbCode);
+
+// Writes code at pbCode that jumps to pbJumpTo in as few bytes as possible,
+// returns the end of it
+uint8_t* MhookPlan_EmitJump(uint8_t* pbCode, uint8_t* pbJumpTo);
+
+// Decodes the start of pSystemFunction up to an instruction boundary at
+// least MHOOK_PLAN_JMPSIZE bytes in, stopping at branches, calls and
+// returns. Returns whether there is enough room for the jump.
+int MhookPlan_Prepare(MHOOK_PLAN* pPlan, uint8_t* pSystemFunction, uint8_t* pHookFunction,
+					  MHOOK_DECODER fnDecode, void* pContext);
+
+// Lays out the hook for a trampoline at the given places, which must be
+// within +/- 2GB of the function: copies the overwritten code to pbUntouched
+// and pbTrampoline followed by a jump back, writes a stub jumping to the hook
+// function to pbJumpToHook if the hook is too far away for a direct jump,
+// and puts the jump to write over the function into codePatch.
+void MhookPlan_Layout(MHOOK_PLAN* pPlan, uint8_t* pbTrampoline, uint8_t* pbJumpToHook, uint8_t* pbUntouched);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MHOOK_PLAN_H
@@ -0,0 +1,231 @@
+#include "async_log.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+    // Posting doesn't take the mutex, so the drain thread may miss a wakeup. It looks again
+    // after this long at the latest.
+    static const std::chrono::milliseconds DRAIN_POLL_INTERVAL(50);
+
+    uint32_t roundUpToPowerOfTwo(unsigned value)
+    {
+        uint32_t result = 1;
+
+        while (result < value)
+            result <<= 1;
+
+        return result;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ring
+//////////////////////////////////////////////////////////////////////////////
+async_log::ring::ring(unsigned capacity)
+{
+    uint32_t size = roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity);
+
+    m_records.reset(new record[size]);
+    m_mask = size - 1;
+
+    for (uint32_t i = 0; i < size; ++i)
+        m_records[i].sequence.store(i, std::memory_order_relaxed);
+
+    m_head.store(0, std::memory_order_relaxed);
+    m_tail = 0;
+}
+
+bool
+async_log::ring::push(const char *text, std::size_t length)
+{
+    // Every record carries the position it is free for next. A producer claims a position
+    // by advancing the head, fills the record and publishes it with position + 1.
+    uint32_t pos = m_head.load(std::memory_order_relaxed);
+    record  *rec;
+
+    for (;;) {
+        rec = &m_records[pos & m_mask];
+
+        int32_t diff = static_cast<int32_t>(rec->sequence.load(std::memory_order_acquire) - pos);
+
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // the consumer hasn't freed this record yet
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    if (length > RECORD_SIZE - 1)
+        length = RECORD_SIZE - 1;
+
+    std::memcpy(rec->text, text, length);
+    rec->text[length] = '\0';
+    rec->length = static_cast<uint32_t>(length);
+
+    rec->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool
+async_log::ring::pop(char *text)
+{
+    record *rec = &m_records[m_tail & m_mask];
+
+    if (rec->sequence.load(std::memory_order_acquire) != m_tail + 1)
+        return false;
+
+    std::memcpy(text, rec->text, rec->length + 1);
+
+    // free for the producers' next round
+    rec->sequence.store(m_tail + m_mask + 1, std::memory_order_release);
+    ++m_tail;
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// drain
+//////////////////////////////////////////////////////////////////////////////
+async_log::drain::drain(handler h, void *userdata, unsigned capacity)
+    : m_ring(capacity), m_handler(h), m_userdata(userdata)
+{
+    m_dropped.store(0, std::memory_order_relaxed);
+    m_quit.store(false, std::memory_order_relaxed);
+    m_sleeping.store(false, std::memory_order_relaxed);
+    m_running.store(false, std::memory_order_relaxed);
+    m_posting.store(0, std::memory_order_relaxed);
+}
+
+async_log::drain::~drain()
+{
+    // A static drain is destroyed in DLL_PROCESS_DETACH, under the loader lock, which the
+    // thread needs to exit. So it is only told to quit here, owners stop() it before.
+    if (!m_thread.joinable())
+        return;
+
+    m_running.store(false, std::memory_order_seq_cst);
+    m_quit.store(true, std::memory_order_relaxed);
+    m_wakeup.notify_one();
+
+    m_thread.detach();
+}
+
+void
+async_log::drain::start()
+{
+    if (m_thread.joinable())
+        return;
+
+    m_quit.store(false, std::memory_order_relaxed);
+    m_thread = std::thread(&drain::run, this);
+
+    m_running.store(true, std::memory_order_seq_cst);
+}
+
+void
+async_log::drain::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    std::lock_guard<std::mutex> guard(m_stopMutex);
+
+    // A post either sees the drain stopping or is counted in m_posting before this looks,
+    // so everything that went into the ring is there for the last round of the thread.
+    m_running.store(false, std::memory_order_seq_cst);
+
+    while (m_posting.load(std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+
+    m_quit.store(true, std::memory_order_relaxed);
+    m_wakeup.notify_one();
+
+    m_thread.join();
+}
+
+bool
+async_log::drain::post(const char *text, std::size_t length)
+{
+    m_posting.fetch_add(1, std::memory_order_seq_cst);
+
+    if (!m_running.load(std::memory_order_seq_cst)) {
+        m_posting.fetch_sub(1, std::memory_order_release);
+
+        deliverNow(text, length);
+        return true;
+    }
+
+    bool pushed = m_ring.push(text, length);
+
+    m_posting.fetch_sub(1, std::memory_order_release);
+
+    if (!pushed) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // only bother the drain thread if it is waiting
+    if (m_sleeping.load(std::memory_order_seq_cst))
+        m_wakeup.notify_one();
+
+    return true;
+}
+
+void
+async_log::drain::deliverNow(const char *text, std::size_t length)
+{
+    char copy[RECORD_SIZE];
+
+    if (length > RECORD_SIZE - 1)
+        length = RECORD_SIZE - 1;
+
+    std::memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    // after what a stop() in progress still delivers, so that the messages of a thread stay in order
+    std::lock_guard<std::mutex> guard(m_stopMutex);
+    m_handler(copy, m_userdata);
+}
+
+void
+async_log::drain::deliver()
+{
+    char text[RECORD_SIZE];
+
+    while (m_ring.pop(text))
+        m_handler(text, m_userdata);
+
+    uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+
+    if (dropped != m_reported) {
+        std::snprintf(text, sizeof(text), "Logger: dropped %llu messages",
+                      static_cast<unsigned long long>(dropped - m_reported));
+        m_reported = dropped;
+
+        m_handler(text, m_userdata);
+    }
+}
+
+void
+async_log::drain::run()
+{
+    while (!m_quit.load(std::memory_order_relaxed)) {
+        deliver();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_sleeping.store(true, std::memory_order_seq_cst);
+        m_wakeup.wait_for(lock, DRAIN_POLL_INTERVAL);
+        m_sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    // whatever made it in before stop()
+    deliver();
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/** @file async_log.hpp
+ *
+ * Hands log messages to a background thread, so logging never blocks the thread it happens on.
+ *
+ * Messages go into a bounded ring of preallocated records, any number of threads may post.
+ * A single drain thread passes them on to the handler. If the ring is full the message is
+ * dropped and counted, the drain thread reports how many were lost once it catches up.
+ * While the drain thread isn't running, messages go to the handler right away.
+ */
+namespace async_log {
+    /**
+     * The longest message a record holds, including the terminating NUL. Longer ones are cut.
+     */
+    static const std::size_t RECORD_SIZE = 512;
+
+    typedef void (*handler)(const char *message, void *userdata);
+
+    /**
+     * A bounded multi producer, single consumer queue of messages
+     */
+    class ring {
+        struct record {
+            std::atomic<uint32_t> sequence;
+            uint32_t              length;
+            char                  text[RECORD_SIZE];
+        };
+
+        std::unique_ptr<record[]> m_records;
+        uint32_t                  m_mask;
+
+        alignas(64) std::atomic<uint32_t> m_head; // next record to post to
+        alignas(64) uint32_t              m_tail; // next record to take, consumer only
+
+    public:
+        /**
+         * @param capacity Number of records, rounded up to a power of two
+         */
+        explicit ring(unsigned capacity);
+
+        ring(const ring&) = delete;
+        ring& operator=(const ring&) = delete;
+
+        /**
+         * Copies a message into the ring. Returns false, if it is full.
+         */
+        bool push(const char *text, std::size_t length);
+
+        /**
+         * Takes the oldest message out of the ring, @a text must hold RECORD_SIZE chars.
+         * Returns false, if the ring is empty. Only one thread at a time may pop.
+         */
+        bool pop(char *text);
+    };
+
+    /**
+     * A ring and the thread delivering its messages
+     */
+    class drain {
+        ring      m_ring;
+        handler   m_handler;
+        void     *m_userdata;
+
+        std::atomic<uint64_t> m_dropped;
+        uint64_t              m_reported = 0;
+
+        std::mutex              m_mutex;
+        std::condition_variable m_wakeup;
+        std::atomic<bool>       m_quit;
+        std::atomic<bool>       m_sleeping;
+        std::thread             m_thread;
+
+        // posts go into the ring only while running, stop() waits for those in flight
+        std::atomic<bool>     m_running;
+        std::atomic<unsigned> m_posting;
+        std::mutex            m_stopMutex;
+
+        void run();
+        void deliver();
+        void deliverNow(const char *text, std::size_t length);
+
+    public:
+        drain(handler h, void *userdata, unsigned capacity);
+
+        /**
+         * Doesn't wait for the drain thread, it only tells it to quit. Call stop() before.
+         */
+        ~drain();
+
+        drain(const drain&) = delete;
+        drain& operator=(const drain&) = delete;
+
+        /**
+         * Starts the drain thread, if it isn't running yet
+         */
+        void start();
+
+        /**
+         * Delivers what has been posted so far and stops the drain thread
+         */
+        void stop();
+
+        /**
+         * Queues a message for the handler. Never blocks while the drain thread runs, otherwise
+         * it calls the handler itself, after a stop() in progress has finished. Returns false,
+         * if the message was dropped.
+         */
+        bool post(const char *text, std::size_t length);
+
+        /**
+         * Number of messages dropped because the ring was full, since construction
+         */
+        uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+    };
+}
@@ -0,0 +1,54 @@
+#include "atlas.hpp"
+
+std::vector<atlas::part>
+atlas::layout(const damage::rect& view, const std::vector<damage::rect>& outputs)
+{
+    std::vector<part> parts;
+
+    for (const damage::rect& out : outputs) {
+        damage::rect shown = damage::intersection(out, view);
+        if (damage::empty(shown))
+            continue;
+
+        part p = {
+            out,
+            { shown.left - out.left, shown.top - out.top, shown.right - out.left, shown.bottom - out.top },
+            shown.left - view.left,
+            shown.top  - view.top
+        };
+        parts.push_back(p);
+    }
+
+    return parts;
+}
+
+void
+atlas::to_atlas(const part& p, const std::vector<damage::rect>& outputRects, std::vector<damage::rect>& atlasRects)
+{
+    int32_t dx = p.x - p.source.left;
+    int32_t dy = p.y - p.source.top;
+
+    for (const damage::rect& r : outputRects) {
+        damage::rect shown = damage::intersection(r, p.source);
+        if (damage::empty(shown))
+            continue;
+
+        damage::rect a = { shown.left + dx, shown.top + dy, shown.right + dx, shown.bottom + dy };
+        atlasRects.push_back(a);
+    }
+}
+
+void
+atlas::stitch(cpu_device& device, cpu_surface& dst, const part& p, const cpu_surface& output,
+              const std::vector<damage::rect>& atlasRects)
+{
+    damage::rect covered = bounds(p);
+
+    for (const damage::rect& r : atlasRects) {
+        damage::rect clipped = damage::intersection(r, covered);
+        if (damage::empty(clipped))
+            continue;
+
+        device.copy_region(dst, clipped.left, clipped.top, output, to_output(p, clipped));
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "cpu_surface.hpp"
+#include "damage.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/** @file atlas.hpp
+ *
+ * Stitching the outputs under a view which spans several monitors into one texture, the atlas.
+ *
+ * The atlas has the size of the view, its top left corner is the top left corner of the view.
+ * Every output intersecting the view contributes a part, which is copied from the output's own
+ * capture. The outputs are captured independently, so each one only copies the parts of the
+ * atlas it changed. Whatever no output covers, e.g. the gaps next to a smaller monitor, stays
+ * black.
+ */
+namespace atlas {
+    /**
+     * Where an output goes in the atlas
+     */
+    struct part {
+        damage::rect output; // the whole output, in desktop coordinates
+        damage::rect source; // what the view shows of it, in output coordinates
+        int32_t      x;      // where the top left corner of source goes in the atlas
+        int32_t      y;
+    };
+
+    /**
+     * The part of the atlas covered by @a p
+     */
+    inline damage::rect bounds(const part& p)
+    {
+        damage::rect r = { p.x, p.y, p.x + damage::width(p.source), p.y + damage::height(p.source) };
+        return r;
+    }
+
+    /**
+     * The parts of the outputs intersecting @a view, in the order of @a outputs. Outputs outside
+     * of the view don't get a part.
+     *
+     * @param view    In desktop coordinates
+     * @param outputs In desktop coordinates
+     */
+    std::vector<part> layout(const damage::rect& view, const std::vector<damage::rect>& outputs);
+
+    /**
+     * Clips the damage of the output of @a p (in output coordinates) to what the view shows of
+     * it, and appends it to @a atlasRects in atlas coordinates
+     */
+    void to_atlas(const part& p, const std::vector<damage::rect>& outputRects, std::vector<damage::rect>& atlasRects);
+
+    /**
+     * Where the output of @a p has to be read for @a r, a rectangle of bounds(p)
+     */
+    inline damage::rect to_output(const part& p, const damage::rect& r)
+    {
+        int32_t dx = p.source.left - p.x;
+        int32_t dy = p.source.top  - p.y;
+
+        damage::rect o = { r.left + dx, r.top + dy, r.right + dx, r.bottom + dy };
+        return o;
+    }
+
+    /**
+     * Copies @a atlasRects, which have to be in bounds(p), from the capture of the output of
+     * @a p into @a dst. The CPU counterpart of the copies done by SpanningSource.
+     */
+    void stitch(cpu_device& device, cpu_surface& dst, const part& p, const cpu_surface& output,
+                const std::vector<damage::rect>& atlasRects);
+}
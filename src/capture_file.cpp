@@ -0,0 +1,569 @@
+#include "capture_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    static const char     FILE_MAGIC[8] = { 'S', 'V', 'R', 'E', 'C', 'O', 'R', 'D' };
+    static const uint32_t FILE_VERSION  = 1;
+    static const uint32_t FRAME_MAGIC   = 0x52465653; // "SVFR"
+    static const uint32_t INDEX_MAGIC   = 0x58495653; // "SVIX"
+
+    static const uint32_t FRAME_KEY            = 1 << 0;
+    static const uint32_t FRAME_CURSOR_VISIBLE = 1 << 1;
+    static const uint32_t FRAME_CURSOR_MASKED  = 1 << 2;
+
+    // files grow by at least that much at a time, every growth remaps them
+    static const uint64_t GROWTH = 64 * 1024 * 1024;
+
+    // Everything is stored in the byte order of the machine, x86 in practice, and 8 byte aligned
+    struct file_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t tile_size;
+        int32_t  width;
+        int32_t  height;
+        uint64_t frames;      // complete frames
+        uint64_t end;         // bytes used by them, the file may be longer
+        uint64_t first_index; // offset of the first index block, 0 if none
+        uint64_t reserved[2];
+    };
+
+    struct frame_header {
+        uint32_t magic;
+        uint32_t tiles;
+        uint64_t present_us;
+        uint64_t recorded_us;
+        int32_t  cursor_x;
+        int32_t  cursor_y;
+        uint32_t flags;
+        uint32_t reserved;
+    };
+
+    // followed by width * height * 4 bytes of pixels, padded to 8 bytes
+    struct tile_header {
+        uint16_t column;
+        uint16_t row;
+        uint16_t width;
+        uint16_t height;
+    };
+
+    struct index_block {
+        uint32_t magic;
+        uint32_t count;
+        uint64_t next; // offset of the next block, 0 if none
+        uint64_t offsets[capture_file::INDEX_BLOCK_FRAMES];
+    };
+
+    uint64_t padded(uint64_t bytes)
+    {
+        return (bytes + 7) & ~static_cast<uint64_t>(7);
+    }
+
+    uint64_t tileBytes(int32_t width, int32_t height)
+    {
+        return sizeof(tile_header) + padded(4 * static_cast<uint64_t>(width) * static_cast<uint64_t>(height));
+    }
+}
+
+/**
+ * A file mapped into memory, writable and growing or read-only
+ */
+class capture_file::mapping {
+    uint8_t *m_data = nullptr;
+    uint64_t m_size = 0;
+    bool     m_writable;
+
+#ifdef _WIN32
+    HANDLE m_file    = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = NULL;
+#else
+    int    m_fd = -1;
+#endif
+
+    bool map(uint64_t size)
+    {
+        unmap();
+
+#ifdef _WIN32
+        m_mapping = CreateFileMappingW(m_file, nullptr, m_writable ? PAGE_READWRITE : PAGE_READONLY,
+                                       static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+        if (!m_mapping)
+            return false;
+
+        m_data = static_cast<uint8_t*>(MapViewOfFile(m_mapping, m_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+#else
+        if (m_writable && ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+            return false;
+
+        void *data = mmap(nullptr, size, m_writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_fd, 0);
+        m_data = data == MAP_FAILED ? nullptr : static_cast<uint8_t*>(data);
+#endif
+
+        m_size = m_data ? size : 0;
+        return m_data != nullptr;
+    }
+
+    void unmap()
+    {
+#ifdef _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+
+        m_mapping = NULL;
+#else
+        if (m_data)
+            munmap(m_data, m_size);
+#endif
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+public:
+    explicit mapping(bool writable) : m_writable(writable) {}
+
+    ~mapping()
+    {
+        unmap();
+
+#ifdef _WIN32
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+#else
+        if (m_fd >= 0)
+            ::close(m_fd);
+#endif
+    }
+
+    mapping(const mapping&) = delete;
+    mapping& operator=(const mapping&) = delete;
+
+    /**
+     * Opens @a path, creating an empty file if writable, and maps all of an existing one
+     */
+    bool open(const char *path)
+    {
+#ifdef _WIN32
+        int length = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+        if (length <= 0)
+            return false;
+
+        std::vector<wchar_t> wide(static_cast<std::size_t>(length));
+        MultiByteToWideChar(CP_UTF8, 0, path, -1, wide.data(), length);
+
+        m_file = CreateFileW(wide.data(), m_writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                             FILE_SHARE_READ, nullptr, m_writable ? CREATE_ALWAYS : OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, NULL);
+        if (m_file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (m_writable || !GetFileSizeEx(m_file, &size) || !size.QuadPart)
+            return m_writable;
+
+        return map(static_cast<uint64_t>(size.QuadPart));
+#else
+        m_fd = m_writable ? ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(path, O_RDONLY);
+        if (m_fd < 0)
+            return false;
+
+        struct stat st;
+        if (m_writable || fstat(m_fd, &st) != 0 || !st.st_size)
+            return m_writable;
+
+        return map(static_cast<uint64_t>(st.st_size));
+#endif
+    }
+
+    /**
+     * Grows the file and its mapping to @a size bytes. Pointers into the old mapping go stale.
+     */
+    bool grow(uint64_t size)
+    {
+        return size <= m_size || map(size);
+    }
+
+    /**
+     * Unmaps the file and cuts it off after @a size bytes
+     */
+    void truncate(uint64_t size)
+    {
+        unmap();
+
+#ifdef _WIN32
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(size);
+
+        if (SetFilePointerEx(m_file, end, nullptr, FILE_BEGIN))
+            SetEndOfFile(m_file);
+#else
+        if (ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+            return;
+#endif
+    }
+
+    uint8_t *data() const { return m_data; }
+    uint64_t size() const { return m_size; }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// writer
+//////////////////////////////////////////////////////////////////////////////
+capture_file::writer::writer() = default;
+
+capture_file::writer::~writer()
+{
+    close();
+}
+
+bool
+capture_file::writer::open(const char *path, int width, int height)
+{
+    close();
+
+    if (width <= 0 || height <= 0)
+        return false;
+
+    m_map.reset(new mapping(true));
+
+    if (!m_map->open(path) || !m_map->grow(GROWTH)) {
+        m_map.reset();
+        return false;
+    }
+
+    m_width     = width;
+    m_height    = height;
+    m_columns   = (width  + TILE_SIZE - 1) / TILE_SIZE;
+    m_rows      = (height + TILE_SIZE - 1) / TILE_SIZE;
+    m_frames    = 0;
+    m_end       = sizeof(file_header);
+    m_index     = 0;
+    m_sinceKey  = 0;
+    m_tileBytes = 0;
+
+    m_dirty.assign(static_cast<std::size_t>(m_columns) * static_cast<std::size_t>(m_rows), 0);
+
+    file_header *header = reinterpret_cast<file_header*>(m_map->data());
+    std::memset(header, 0, sizeof(*header));
+    std::memcpy(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header->version   = FILE_VERSION;
+    header->tile_size = TILE_SIZE;
+    header->width     = width;
+    header->height    = height;
+    header->end       = m_end;
+
+    return true;
+}
+
+void
+capture_file::writer::close()
+{
+    if (!m_map)
+        return;
+
+    m_map->truncate(m_end);
+    m_map.reset();
+}
+
+bool
+capture_file::writer::reserve(uint64_t bytes)
+{
+    if (m_end + bytes <= m_map->size())
+        return true;
+
+    return m_map->grow(m_end + std::max(bytes, GROWTH));
+}
+
+void
+capture_file::writer::markDirty(const damage::rect& r)
+{
+    damage::rect clipped = damage::intersection(r, { 0, 0, m_width, m_height });
+    if (damage::empty(clipped))
+        return;
+
+    for (int32_t row = clipped.top / TILE_SIZE; row <= (clipped.bottom - 1) / TILE_SIZE; ++row)
+        for (int32_t column = clipped.left / TILE_SIZE; column <= (clipped.right - 1) / TILE_SIZE; ++column)
+            m_dirty[static_cast<std::size_t>(row) * m_columns + column] = 1;
+}
+
+bool
+capture_file::writer::append(const uint8_t *pixels, std::size_t pitch, const std::vector<damage::rect> *damage, frame_info& info)
+{
+    if (!m_map)
+        return false;
+
+    info.key = !damage || m_frames == 0 || m_sinceKey + 1 >= KEY_INTERVAL;
+
+    if (info.key) {
+        std::fill(m_dirty.begin(), m_dirty.end(), 1);
+    } else {
+        std::fill(m_dirty.begin(), m_dirty.end(), 0);
+        for (const damage::rect& r : *damage)
+            markDirty(r);
+    }
+
+    // how much we need, a new index block included
+    uint64_t bytes = sizeof(frame_header) + sizeof(index_block);
+    info.tiles     = 0;
+
+    for (int32_t row = 0; row < m_rows; ++row) {
+        for (int32_t column = 0; column < m_columns; ++column) {
+            if (!m_dirty[static_cast<std::size_t>(row) * m_columns + column])
+                continue;
+
+            bytes += tileBytes(std::min(TILE_SIZE, m_width - column * TILE_SIZE), std::min(TILE_SIZE, m_height - row * TILE_SIZE));
+            ++info.tiles;
+        }
+    }
+
+    if (!reserve(bytes))
+        return false;
+
+    uint8_t *base   = m_map->data();
+    uint64_t offset = m_end;
+    uint64_t at     = m_end;
+
+    frame_header *frame = reinterpret_cast<frame_header*>(base + at);
+    frame->magic       = FRAME_MAGIC;
+    frame->tiles       = info.tiles;
+    frame->present_us  = info.present_us;
+    frame->recorded_us = info.recorded_us;
+    frame->cursor_x    = static_cast<int32_t>(info.cursor.x);
+    frame->cursor_y    = static_cast<int32_t>(info.cursor.y);
+    frame->flags       = (info.key ? FRAME_KEY : 0)
+                       | (info.cursor.visible ? FRAME_CURSOR_VISIBLE : 0)
+                       | (info.cursor.masked ? FRAME_CURSOR_MASKED : 0);
+    frame->reserved    = 0;
+    at += sizeof(frame_header);
+
+    for (int32_t row = 0; row < m_rows; ++row) {
+        for (int32_t column = 0; column < m_columns; ++column) {
+            if (!m_dirty[static_cast<std::size_t>(row) * m_columns + column])
+                continue;
+
+            tile_header *tile = reinterpret_cast<tile_header*>(base + at);
+            tile->column = static_cast<uint16_t>(column);
+            tile->row    = static_cast<uint16_t>(row);
+            tile->width  = static_cast<uint16_t>(std::min(TILE_SIZE, m_width - column * TILE_SIZE));
+            tile->height = static_cast<uint16_t>(std::min(TILE_SIZE, m_height - row * TILE_SIZE));
+
+            uint8_t    *dst   = base + at + sizeof(tile_header);
+            std::size_t bytes = 4 * static_cast<std::size_t>(tile->width);
+
+            for (int32_t y = 0; y < tile->height; ++y)
+                std::memcpy(dst + y * bytes, pixels + static_cast<std::size_t>(row * TILE_SIZE + y) * pitch + 4 * column * TILE_SIZE, bytes);
+
+            at          += tileBytes(tile->width, tile->height);
+            m_tileBytes += bytes * tile->height;
+        }
+    }
+
+    // the frame goes into the current index block, or a new one right after it
+    index_block *block = m_index ? reinterpret_cast<index_block*>(base + m_index) : nullptr;
+    file_header *header = reinterpret_cast<file_header*>(base);
+
+    if (!block || block->count == INDEX_BLOCK_FRAMES) {
+        index_block *next = reinterpret_cast<index_block*>(base + at);
+        std::memset(next, 0, sizeof(*next));
+        next->magic = INDEX_MAGIC;
+
+        if (block)
+            block->next = at;
+        else
+            header->first_index = at;
+
+        block   = next;
+        m_index = at;
+        at     += sizeof(index_block);
+    }
+
+    block->offsets[block->count++] = offset;
+
+    // only now the frame counts
+    m_end      = at;
+    m_sinceKey = info.key ? 0 : m_sinceKey + 1;
+    ++m_frames;
+
+    header->end    = m_end;
+    header->frames = m_frames;
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// reader
+//////////////////////////////////////////////////////////////////////////////
+capture_file::reader::reader() = default;
+
+capture_file::reader::~reader()
+{
+    close();
+}
+
+void
+capture_file::reader::close()
+{
+    m_map.reset();
+
+    m_offsets.clear();
+    m_keys.clear();
+}
+
+bool
+capture_file::reader::open(const char *path)
+{
+    close();
+
+    m_map.reset(new mapping(false));
+
+    const file_header *header = nullptr;
+    if (m_map->open(path) && m_map->size() >= sizeof(file_header))
+        header = reinterpret_cast<const file_header*>(m_map->data());
+
+    if (!header || std::memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header->version != FILE_VERSION
+        || header->tile_size != TILE_SIZE || header->width <= 0 || header->height <= 0 || header->end > m_map->size())
+    {
+        close();
+        return false;
+    }
+
+    m_width  = header->width;
+    m_height = header->height;
+
+    // everything the index points to has to be within the complete part of the file
+    uint64_t end   = header->end;
+    uint64_t block = header->first_index;
+
+    while (block && m_offsets.size() < header->frames && block + sizeof(index_block) <= end) {
+        const index_block *index = reinterpret_cast<const index_block*>(m_map->data() + block);
+        if (index->magic != INDEX_MAGIC)
+            break;
+
+        for (uint32_t i = 0; i < index->count && i < INDEX_BLOCK_FRAMES && m_offsets.size() < header->frames; ++i) {
+            uint64_t offset = index->offsets[i];
+            if (offset + sizeof(frame_header) > end)
+                break;
+
+            const frame_header *frame = reinterpret_cast<const frame_header*>(m_map->data() + offset);
+            if (frame->magic != FRAME_MAGIC)
+                break;
+
+            if (frame->flags & FRAME_KEY)
+                m_keys.push_back(m_offsets.size());
+
+            m_offsets.push_back(offset);
+        }
+
+        block = index->next;
+    }
+
+    // frames before the first key frame can't be shown
+    if (m_keys.empty() || m_keys.front() != 0)
+        m_offsets.clear();
+
+    return true;
+}
+
+const uint8_t *
+capture_file::reader::frame(uint64_t n) const
+{
+    return n < m_offsets.size() ? m_map->data() + m_offsets[n] : nullptr;
+}
+
+bool
+capture_file::reader::info(uint64_t n, frame_info& info) const
+{
+    const frame_header *frame = reinterpret_cast<const frame_header*>(this->frame(n));
+    if (!frame)
+        return false;
+
+    info.present_us     = frame->present_us;
+    info.recorded_us    = frame->recorded_us;
+    info.key            = (frame->flags & FRAME_KEY) != 0;
+    info.tiles          = frame->tiles;
+    info.cursor.x       = frame->cursor_x;
+    info.cursor.y       = frame->cursor_y;
+    info.cursor.visible = (frame->flags & FRAME_CURSOR_VISIBLE) != 0;
+    info.cursor.masked  = (frame->flags & FRAME_CURSOR_MASKED) != 0;
+
+    return true;
+}
+
+uint64_t
+capture_file::reader::key_before(uint64_t n) const
+{
+    auto it = std::upper_bound(m_keys.begin(), m_keys.end(), n);
+
+    return it == m_keys.begin() ? 0 : *(it - 1);
+}
+
+uint64_t
+capture_file::reader::apply(uint64_t n, cpu_surface& dst, std::vector<damage::rect> *changed) const
+{
+    const uint8_t *at = frame(n);
+    if (!at || dst.width != m_width || dst.height != m_height)
+        return 0;
+
+    const frame_header *header = reinterpret_cast<const frame_header*>(at);
+    const uint8_t      *end    = m_map->data() + (n + 1 < m_offsets.size() ? m_offsets[n + 1] : m_map->size());
+    uint64_t            copied = 0;
+
+    at += sizeof(frame_header);
+
+    for (uint32_t i = 0; i < header->tiles; ++i) {
+        if (at + sizeof(tile_header) > end)
+            break;
+
+        const tile_header *tile = reinterpret_cast<const tile_header*>(at);
+        damage::rect       r    = {
+            tile->column * TILE_SIZE,
+            tile->row * TILE_SIZE,
+            tile->column * TILE_SIZE + tile->width,
+            tile->row * TILE_SIZE + tile->height
+        };
+
+        uint64_t size = tileBytes(tile->width, tile->height);
+        if (at + size > end || r.right > m_width || r.bottom > m_height)
+            break;
+
+        const uint8_t *src   = at + sizeof(tile_header);
+        std::size_t    bytes = 4 * static_cast<std::size_t>(tile->width);
+
+        for (int32_t y = 0; y < tile->height; ++y)
+            std::memcpy(dst.row(r.top + y) + 4 * r.left, src + y * bytes, bytes);
+
+        copied += bytes * tile->height;
+        at     += size;
+
+        if (changed && !(header->flags & FRAME_KEY))
+            changed->push_back(r);
+    }
+
+    if (changed && (header->flags & FRAME_KEY))
+        changed->push_back(dst.bounds());
+
+    return copied;
+}
+
+uint64_t
+capture_file::reader::seek(uint64_t n, cpu_surface& dst) const
+{
+    uint64_t copied = 0;
+
+    for (uint64_t i = key_before(n); i <= n && i < m_offsets.size(); ++i)
+        copied += apply(i, dst, nullptr);
+
+    return copied;
+}
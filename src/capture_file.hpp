@@ -0,0 +1,159 @@
+#pragma once
+
+#include "cpu_surface.hpp"
+#include "damage.hpp"
+#include "frame_source.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/** @file capture_file.hpp
+ *
+ * Recordings of what a view showed: an append-only file of frames, each holding the 64x64
+ * tiles of the desktop which changed since the frame before, the cursor state, and when the
+ * frame was presented and recorded.
+ *
+ * Every KEY_INTERVAL frames (and whenever the damage is unknown) a key frame holds all tiles,
+ * so seeking only has to replay the frames since the key frame before. A chain of index blocks
+ * in between the frames points to every frame, and the header says how many frames and bytes
+ * are complete. A recording cut short by a crash is readable up to the last complete frame.
+ *
+ * Files are written and read through memory mappings, which are hidden in capture_file.cpp.
+ */
+namespace capture_file {
+    static const int32_t  TILE_SIZE          = 64;
+    static const uint32_t KEY_INTERVAL       = 300;
+    static const uint32_t INDEX_BLOCK_FRAMES = 1024;
+
+    /**
+     * What is known about a recorded frame besides its tiles
+     */
+    struct frame_info {
+        uint64_t present_us  = 0; // when the source presented it (LastPresentTime), 0 if unknown
+        uint64_t recorded_us = 0; // when it was recorded
+        bool     key         = false;
+        uint32_t tiles       = 0;
+
+        frame_source::cursor_state cursor;
+    };
+
+    class mapping;
+
+    /**
+     * Appends frames to a new file
+     */
+    class writer {
+        std::unique_ptr<mapping> m_map;
+
+        int32_t  m_width   = 0;
+        int32_t  m_height  = 0;
+        int32_t  m_columns = 0;
+        int32_t  m_rows    = 0;
+
+        uint64_t m_frames    = 0;
+        uint64_t m_end       = 0; // bytes used
+        uint64_t m_index     = 0; // offset of the current index block, 0 if none yet
+        uint32_t m_sinceKey  = 0;
+        uint64_t m_tileBytes = 0;
+
+        std::vector<uint8_t> m_dirty; // one per tile
+
+        bool reserve(uint64_t bytes);
+        void markDirty(const damage::rect& r);
+
+    public:
+        writer();
+        ~writer();
+
+        writer(const writer&) = delete;
+        writer& operator=(const writer&) = delete;
+
+        /**
+         * Creates (or truncates) @a path, a UTF-8 path, for frames of width x height pixels
+         */
+        bool open(const char *path, int width, int height);
+
+        /**
+         * Truncates the file to what has been written and closes it
+         */
+        void close();
+
+        bool is_open() const { return m_map != nullptr; }
+
+        /**
+         * Appends a frame: the tiles of the 32bpp image at @a pixels touched by @a damage, or all
+         * of them if it is nullptr. present_us, recorded_us and cursor of @a info are recorded,
+         * the rest is filled in.
+         */
+        bool append(const uint8_t *pixels, std::size_t pitch, const std::vector<damage::rect> *damage, frame_info& info);
+
+        int width() const  { return m_width; }
+        int height() const { return m_height; }
+        uint64_t frames() const { return m_frames; }
+        uint64_t bytes() const { return m_end; }
+
+        /**
+         * Pixel bytes written so far, without headers
+         */
+        uint64_t tile_bytes() const { return m_tileBytes; }
+    };
+
+    /**
+     * Reads frames from a complete file, or one still being written up to where it was when
+     * it was opened
+     */
+    class reader {
+        std::unique_ptr<mapping> m_map;
+
+        int32_t  m_width  = 0;
+        int32_t  m_height = 0;
+
+        std::vector<uint64_t> m_offsets; // of every frame
+        std::vector<uint64_t> m_keys;    // numbers of the key frames
+
+        const uint8_t *frame(uint64_t n) const;
+
+    public:
+        reader();
+        ~reader();
+
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+
+        /**
+         * Opens @a path, a UTF-8 path, and reads the index
+         */
+        bool open(const char *path);
+        void close();
+
+        bool is_open() const { return m_map != nullptr; }
+
+        int width() const  { return m_width; }
+        int height() const { return m_height; }
+        uint64_t frames() const { return m_offsets.size(); }
+
+        bool info(uint64_t n, frame_info& info) const;
+
+        /**
+         * The last key frame at or before frame @a n
+         */
+        uint64_t key_before(uint64_t n) const;
+
+        /**
+         * Copies the tiles of frame @a n into @a dst, which has to be width() x height(), and
+         * appends the rects it changed to @a changed, if given
+         *
+         * @returns The number of bytes copied
+         */
+        uint64_t apply(uint64_t n, cpu_surface& dst, std::vector<damage::rect> *changed) const;
+
+        /**
+         * Makes @a dst show frame @a n, replaying the frames since the key frame before it
+         *
+         * @returns The number of bytes copied
+         */
+        uint64_t seek(uint64_t n, cpu_surface& dst) const;
+    };
+}
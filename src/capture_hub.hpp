@@ -0,0 +1,233 @@
+#pragma once
+
+#include "damage.hpp"
+#include "frame_source.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/** @file capture_hub.hpp
+ *
+ * Bookkeeping for sharing one capture of a monitor between several views.
+ *
+ * A hub captures one output and publishes its frames, the views subscribe to the hub of the
+ * output they show and pick up whatever changed since they looked last. The registry keeps
+ * exactly one hub per output alive for as long as views are attached to it.
+ *
+ * The hubs themselves are a template parameter.
+ */
+namespace capture_hub {
+    /**
+     * An output, in desktop coordinates
+     */
+    struct output {
+        int x;
+        int y;
+        int w;
+        int h;
+    };
+
+    inline bool operator<(const output& a, const output& b)
+    {
+        return std::tie(a.x, a.y, a.w, a.h) < std::tie(b.x, b.y, b.w, b.h);
+    }
+
+    /**
+     * Hands the frames of one hub to its subscribers. Thread safe.
+     */
+    class fanout {
+    public:
+        // Damage piling up for a subscriber beyond this counts as a change of everything
+        static const std::size_t MAX_PENDING_DAMAGE = 256;
+
+        struct subscriber {
+            void    *wakeup       = nullptr; // passed to the wake function on new frames
+            uint64_t desktopSeen  = 0;
+            uint64_t cursorSeen   = 0;
+
+            // desktop regions changed since take_damage() was called last
+            std::vector<damage::rect> damage;
+            bool                      damageUnknown = true;
+        };
+
+    private:
+        mutable std::mutex         m_mutex;
+        std::vector<subscriber*>   m_subscribers;
+
+        uint64_t                   m_desktopFrame = 0;
+        uint64_t                   m_cursorFrame  = 0;
+        frame_source::cursor_state m_cursor;
+
+    public:
+        /**
+         * Starts handing frames to @a sub. It sees the current frame as new.
+         */
+        void subscribe(subscriber& sub)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+
+            sub.desktopSeen   = 0;
+            sub.cursorSeen    = 0;
+            sub.damageUnknown = true;
+            sub.damage.clear();
+            m_subscribers.push_back(&sub);
+        }
+
+        void unsubscribe(subscriber& sub)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+
+            m_subscribers.erase(std::remove(m_subscribers.begin(), m_subscribers.end(), &sub), m_subscribers.end());
+        }
+
+        /**
+         * Publishes a new frame and calls @a wake with the wakeup of every subscriber
+         *
+         * @param damage The regions of the desktop which changed, nullptr if unknown
+         */
+        template<class TWake>
+        void publish(bool desktopChanged, const std::vector<damage::rect> *damage,
+                     bool cursorChanged, const frame_source::cursor_state& cursor, TWake wake)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+
+            if (desktopChanged) {
+                ++m_desktopFrame;
+
+                for (subscriber *sub : m_subscribers) {
+                    if (sub->damageUnknown)
+                        continue;
+
+                    if (!damage || sub->damage.size() + damage->size() > MAX_PENDING_DAMAGE) {
+                        sub->damageUnknown = true;
+                        sub->damage.clear();
+                    } else {
+                        sub->damage.insert(sub->damage.end(), damage->begin(), damage->end());
+                    }
+                }
+            }
+
+            if (cursorChanged) {
+                ++m_cursorFrame;
+                m_cursor = cursor;
+            }
+
+            for (subscriber *sub : m_subscribers)
+                wake(sub->wakeup);
+        }
+
+        /**
+         * Tells @a sub what changed since it looked last, and marks it as seen
+         */
+        void poll(subscriber& sub, bool& desktopChanged, bool& cursorChanged, frame_source::cursor_state& cursor)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+
+            desktopChanged = sub.desktopSeen != m_desktopFrame;
+            cursorChanged  = sub.cursorSeen  != m_cursorFrame;
+
+            if (cursorChanged)
+                cursor = m_cursor;
+
+            sub.desktopSeen = m_desktopFrame;
+            sub.cursorSeen  = m_cursorFrame;
+        }
+
+        /**
+         * Appends the damage collected for @a sub to @a rects and starts collecting anew.
+         * Returns false if the whole desktop has to be considered changed.
+         */
+        bool take_damage(subscriber& sub, std::vector<damage::rect>& rects)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+
+            bool known = !sub.damageUnknown;
+            if (known)
+                rects.insert(rects.end(), sub.damage.begin(), sub.damage.end());
+
+            sub.damage.clear();
+            sub.damageUnknown = false;
+
+            return known;
+        }
+
+        std::size_t subscribers() const
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            return m_subscribers.size();
+        }
+    };
+
+    /**
+     * One hub per output, reference counted by the attached views. Thread safe.
+     *
+     * THub is constructed from an output when the first view attaches, and destroyed when
+     * the last one detaches.
+     */
+    template<class THub>
+    class registry {
+        struct entry {
+            std::unique_ptr<THub> hub;
+            unsigned              refs;
+        };
+
+        mutable std::mutex       m_mutex;
+        std::map<output, entry>  m_hubs;
+
+    public:
+        /**
+         * Returns the hub for @a out, creating it if needed. Every attach() needs a detach().
+         */
+        THub *attach(const output& out)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+
+            auto it = m_hubs.find(out);
+            if (it == m_hubs.end())
+                it = m_hubs.insert(std::make_pair(out, entry{ std::unique_ptr<THub>(new THub(out)), 0 })).first;
+
+            ++it->second.refs;
+            return it->second.hub.get();
+        }
+
+        void detach(const output& out)
+        {
+            std::unique_ptr<THub> last;
+
+            {
+                std::lock_guard<std::mutex> guard(m_mutex);
+
+                auto it = m_hubs.find(out);
+                if (it == m_hubs.end())
+                    return;
+
+                if (--it->second.refs == 0) {
+                    last = std::move(it->second.hub);
+                    m_hubs.erase(it);
+                }
+            }
+
+            // stopping a hub may take a while, don't block the other outputs meanwhile
+        }
+
+        unsigned refs(const output& out) const
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+
+            auto it = m_hubs.find(out);
+            return it == m_hubs.end() ? 0 : it->second.refs;
+        }
+
+        std::size_t size() const
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            return m_hubs.size();
+        }
+    };
+}
@@ -0,0 +1,65 @@
+#include "capture_rate.hpp"
+
+#include <algorithm>
+
+namespace {
+    // weight of a new sample in the moving average
+    static const double SMOOTHING = 1.0 / 8;
+}
+
+void
+capture_rate::controller::set_target(unsigned fps)
+{
+    m_fps = std::min(fps, MAX_FPS);
+}
+
+uint64_t
+capture_rate::controller::interval() const
+{
+    if (!m_fps)
+        return 0;
+
+    uint64_t wanted  = 1000000 / m_fps;
+    uint64_t backoff = std::min(static_cast<uint64_t>(m_cost / MAX_LOAD), MAX_BACKOFF_INTERVAL);
+
+    return std::max(wanted, backoff);
+}
+
+bool
+capture_rate::controller::backing_off() const
+{
+    return m_fps && interval() > 1000000 / m_fps;
+}
+
+double
+capture_rate::controller::load() const
+{
+    uint64_t i = interval();
+
+    return i ? m_cost / static_cast<double>(i) : 0.0;
+}
+
+bool
+capture_rate::controller::present(uint64_t now)
+{
+    uint64_t i = interval();
+    if (!i)
+        return false;
+
+    if (m_captured && now < m_nextCapture)
+        return false;
+
+    // after a pause or a change of the interval, start counting from now
+    bool onTime = m_captured && now - m_nextCapture < i;
+
+    m_nextCapture = (onTime ? m_nextCapture : now) + i;
+    m_captured    = true;
+
+    return true;
+}
+
+void
+capture_rate::controller::captured(uint64_t cost)
+{
+    m_cost = m_cost == 0 ? cost : m_cost + SMOOTHING * (static_cast<double>(cost) - m_cost);
+}
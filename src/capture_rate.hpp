@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+
+/** @file capture_rate.hpp
+ *
+ * Decides in which presents of the DWM the hook copies the back buffer (Windows 7).
+ *
+ * The copy happens inside IDXGISwapChain::Present of the DWM, so every microsecond spent there
+ * delays the composition of the whole desktop. The controller aims at the frame rate the host
+ * asks for, but backs off if the copies take up more than a small share of the time.
+ *
+ * Time is passed in by the caller as microseconds of any monotonic clock, so it can be driven
+ * by a fake clock.
+ */
+namespace capture_rate {
+    /**
+     * The rate until the host asks for another one
+     */
+    static const unsigned DEFAULT_FPS = 20;
+
+    /**
+     * The highest rate the host can ask for, higher rates are clamped
+     */
+    static const unsigned MAX_FPS = 240;
+
+    /**
+     * The share of the time the copies may take up before the controller backs off
+     */
+    static const double MAX_LOAD = 0.05;
+
+    /**
+     * Backing off never goes below this rate, in microseconds between copies
+     */
+    static const uint64_t MAX_BACKOFF_INTERVAL = 1000000;
+
+    class controller {
+        unsigned m_fps;
+
+        uint64_t m_nextCapture = 0;
+        bool     m_captured    = false;
+
+        double   m_cost = 0; // moving average, in microseconds
+
+    public:
+        explicit controller(unsigned fps = DEFAULT_FPS) { set_target(fps); }
+
+        /**
+         * Sets the frame rate the host wants, 0 stops copying altogether
+         */
+        void set_target(unsigned fps);
+        unsigned target() const { return m_fps; }
+
+        /**
+         * Called in every present, returns whether to copy the back buffer in this one.
+         *
+         * Copies are due an interval after the previous one was due, not after it happened,
+         * so that waiting for the next present doesn't add up: 24 fps from presents at 60 Hz
+         * are every second or third present, instead of every third.
+         */
+        bool present(uint64_t now);
+
+        /**
+         * Reports how long the copy decided on by the last present() took
+         */
+        void captured(uint64_t cost);
+
+        /**
+         * The time between two copies, in microseconds. 0 if copying is stopped.
+         */
+        uint64_t interval() const;
+
+        /**
+         * Whether the copies are slowed down below the target because they take too long
+         */
+        bool backing_off() const;
+
+        /**
+         * The share of the time spent copying at the current interval
+         */
+        double load() const;
+
+        /**
+         * Moving average of the time a copy takes, in microseconds
+         */
+        double cost() const { return m_cost; }
+    };
+}
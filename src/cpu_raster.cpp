@@ -0,0 +1,456 @@
+#include "cpu_raster.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__i386__) || defined(__x86_64__)
+#   define CPU_RASTER_X86 1
+#   include <immintrin.h>
+#endif
+
+namespace {
+    // The four source pixels around a sample, with the horizontal weight of the right ones
+    struct footprint {
+        uint32_t p00, p01, p10, p11;
+        unsigned fx;
+    };
+
+    inline footprint fetch(const uint8_t *row0, const uint8_t *row1, unsigned width, int32_t u)
+    {
+        // arithmetic shifts, so positions left of the first pixel work out
+        int32_t  x  = u >> 16;
+        unsigned fx = static_cast<unsigned>(u >> 8) & 0xFF;
+
+        int32_t last = static_cast<int32_t>(width) - 1;
+        int32_t x0   = std::min(std::max(x, 0), last);
+        int32_t x1   = std::min(std::max(x + 1, 0), last);
+
+        const uint32_t *r0 = reinterpret_cast<const uint32_t*>(row0);
+        const uint32_t *r1 = reinterpret_cast<const uint32_t*>(row1);
+
+        footprint f = { r0[x0], r0[x1], r1[x0], r1[x1], fx };
+        return f;
+    }
+
+    inline unsigned lerp8(unsigned a, unsigned b, unsigned f)
+    {
+        return (a * (256 - f) + b * f + 128) >> 8;
+    }
+
+    // a * b / 255, rounded, for 8 bit values
+    inline unsigned mul255(unsigned a, unsigned b)
+    {
+        unsigned x = a * b + 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    inline uint32_t blendPixel(uint32_t s, uint32_t d)
+    {
+        unsigned a      = s >> 24;
+        uint32_t result = d & 0xFF000000u;
+
+        for (unsigned shift = 0; shift < 24; shift += 8) {
+            unsigned x = ((s >> shift) & 0xFF) * a + ((d >> shift) & 0xFF) * (255 - a) + 128;
+            result |= static_cast<uint32_t>((x + (x >> 8)) >> 8) << shift;
+        }
+
+        return result;
+    }
+
+    ///////////////////////////////////////////////
+    // Plain C++, also used for the row remainders
+    ///////////////////////////////////////////////
+    void bilinearScalar(const uint8_t *row0, const uint8_t *row1, unsigned width, unsigned fy,
+                        uint32_t *dst, unsigned count, int32_t u, int32_t du)
+    {
+        for (unsigned i = 0; i < count; ++i, u += du) {
+            footprint f = fetch(row0, row1, width, u);
+            uint32_t  result = 0;
+
+            for (unsigned shift = 0; shift < 32; shift += 8) {
+                unsigned top    = lerp8((f.p00 >> shift) & 0xFF, (f.p01 >> shift) & 0xFF, f.fx);
+                unsigned bottom = lerp8((f.p10 >> shift) & 0xFF, (f.p11 >> shift) & 0xFF, f.fx);
+
+                result |= static_cast<uint32_t>(lerp8(top, bottom, fy)) << shift;
+            }
+
+            dst[i] = result;
+        }
+    }
+
+    void blendScalar(const uint32_t *src, uint32_t *dst, unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            dst[i] = blendPixel(src[i], dst[i]);
+    }
+
+#ifdef CPU_RASTER_X86
+    ///////////////////////////////////////////////
+    // SSE2: one pixel per iteration, both rows and
+    // all channels at once
+    ///////////////////////////////////////////////
+
+    // [256 - f, f] in every pair of 16 bit lanes, for _mm_madd_epi16
+    inline int32_t weightPair(unsigned f)
+    {
+        return static_cast<int32_t>((f << 16) | (256 - f));
+    }
+
+    __attribute__((target("sse2")))
+    void bilinearSse2(const uint8_t *row0, const uint8_t *row1, unsigned width, unsigned fy,
+                      uint32_t *dst, unsigned count, int32_t u, int32_t du)
+    {
+        const __m128i zero  = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi32(128);
+        const __m128i wy    = _mm_set1_epi32(weightPair(fy));
+
+        for (unsigned i = 0; i < count; ++i, u += du) {
+            footprint f = fetch(row0, row1, width, u);
+
+            // b00 b01 g00 g01 r00 r01 a00 a01 | the same for the bottom row
+            __m128i top    = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(f.p00)), _mm_cvtsi32_si128(static_cast<int>(f.p01)));
+            __m128i bottom = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(f.p10)), _mm_cvtsi32_si128(static_cast<int>(f.p11)));
+            __m128i wx     = _mm_set1_epi32(weightPair(f.fx));
+
+            __m128i t = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(top, zero), wx), round), 8);
+            __m128i b = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(bottom, zero), wx), round), 8);
+
+            // t0 b0 t1 b1 t2 b2 t3 b3, then the same once more vertically
+            __m128i tb = _mm_packs_epi32(t, b);
+            __m128i v  = _mm_unpacklo_epi16(tb, _mm_srli_si128(tb, 8));
+            __m128i o  = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(v, wy), round), 8);
+
+            o = _mm_packs_epi32(o, o);
+            o = _mm_packus_epi16(o, o);
+
+            dst[i] = static_cast<uint32_t>(_mm_cvtsi128_si32(o));
+        }
+    }
+
+    ///////////////////////////////////////////////
+    // SSE2: 4 pixels per iteration
+    ///////////////////////////////////////////////
+    __attribute__((target("sse2")))
+    void blendSse2(const uint32_t *src, uint32_t *dst, unsigned count)
+    {
+        const __m128i zero      = _mm_setzero_si128();
+        const __m128i c255      = _mm_set1_epi16(255);
+        const __m128i c128      = _mm_set1_epi16(128);
+        const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF);
+
+        unsigned i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+
+            __m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+            __m128i dlo = _mm_unpacklo_epi8(d, zero), dhi = _mm_unpackhi_epi8(d, zero);
+
+            // the source alpha in every channel
+            __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+            __m128i xlo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(slo, alo), _mm_mullo_epi16(dlo, _mm_sub_epi16(c255, alo))), c128);
+            __m128i xhi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(shi, ahi), _mm_mullo_epi16(dhi, _mm_sub_epi16(c255, ahi))), c128);
+
+            xlo = _mm_srli_epi16(_mm_add_epi16(xlo, _mm_srli_epi16(xlo, 8)), 8);
+            xhi = _mm_srli_epi16(_mm_add_epi16(xhi, _mm_srli_epi16(xhi, 8)), 8);
+
+            __m128i result = _mm_packus_epi16(xlo, xhi);
+            result = _mm_or_si128(_mm_and_si128(result, colorMask), _mm_andnot_si128(colorMask, d));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+        }
+
+        blendScalar(src + i, dst + i, count - i);
+    }
+
+    ///////////////////////////////////////////////
+    // AVX2: two pixels per iteration, one per lane
+    ///////////////////////////////////////////////
+    __attribute__((target("avx2")))
+    inline __m256i lanes(__m128i low, __m128i high)
+    {
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+    }
+
+    __attribute__((target("avx2")))
+    void bilinearAvx2(const uint8_t *row0, const uint8_t *row1, unsigned width, unsigned fy,
+                      uint32_t *dst, unsigned count, int32_t u, int32_t du)
+    {
+        const __m256i zero  = _mm256_setzero_si256();
+        const __m256i round = _mm256_set1_epi32(128);
+        const __m256i wy    = _mm256_set1_epi32(weightPair(fy));
+
+        unsigned i = 0;
+        for (; i + 2 <= count; i += 2, u += 2 * du) {
+            footprint f = fetch(row0, row1, width, u);
+            footprint g = fetch(row0, row1, width, u + du);
+
+            // per lane: the top row pairs in the lower half, the bottom row pairs in the upper one
+            __m128i pf = _mm_unpacklo_epi64(
+                _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(f.p00)), _mm_cvtsi32_si128(static_cast<int>(f.p01))),
+                _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(f.p10)), _mm_cvtsi32_si128(static_cast<int>(f.p11))));
+            __m128i pg = _mm_unpacklo_epi64(
+                _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(g.p00)), _mm_cvtsi32_si128(static_cast<int>(g.p01))),
+                _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(g.p10)), _mm_cvtsi32_si128(static_cast<int>(g.p11))));
+
+            __m256i pixels = lanes(pf, pg);
+            __m256i wx     = lanes(_mm_set1_epi32(weightPair(f.fx)), _mm_set1_epi32(weightPair(g.fx)));
+
+            __m256i t = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), wx), round), 8);
+            __m256i b = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), wx), round), 8);
+
+            __m256i tb = _mm256_packs_epi32(t, b);
+            __m256i v  = _mm256_unpacklo_epi16(tb, _mm256_srli_si256(tb, 8));
+            __m256i o  = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(v, wy), round), 8);
+
+            o = _mm256_packs_epi32(o, o);
+            o = _mm256_packus_epi16(o, o);
+
+            dst[i]     = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_castsi256_si128(o)));
+            dst[i + 1] = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_extracti128_si256(o, 1)));
+        }
+
+        bilinearScalar(row0, row1, width, fy, dst + i, count - i, u, du);
+    }
+
+    ///////////////////////////////////////////////
+    // AVX2: 8 pixels per iteration
+    ///////////////////////////////////////////////
+    __attribute__((target("avx2")))
+    void blendAvx2(const uint32_t *src, uint32_t *dst, unsigned count)
+    {
+        const __m256i zero      = _mm256_setzero_si256();
+        const __m256i c255      = _mm256_set1_epi16(255);
+        const __m256i c128      = _mm256_set1_epi16(128);
+        const __m256i colorMask = _mm256_set1_epi32(0x00FFFFFF);
+
+        unsigned i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+
+            // unpacking and packing within the lanes keeps the pixels in order
+            __m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+            __m256i dlo = _mm256_unpacklo_epi8(d, zero), dhi = _mm256_unpackhi_epi8(d, zero);
+
+            __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+            __m256i xlo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(slo, alo), _mm256_mullo_epi16(dlo, _mm256_sub_epi16(c255, alo))), c128);
+            __m256i xhi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(shi, ahi), _mm256_mullo_epi16(dhi, _mm256_sub_epi16(c255, ahi))), c128);
+
+            xlo = _mm256_srli_epi16(_mm256_add_epi16(xlo, _mm256_srli_epi16(xlo, 8)), 8);
+            xhi = _mm256_srli_epi16(_mm256_add_epi16(xhi, _mm256_srli_epi16(xhi, 8)), 8);
+
+            __m256i result = _mm256_packus_epi16(xlo, xhi);
+            result = _mm256_or_si256(_mm256_and_si256(result, colorMask), _mm256_andnot_si256(colorMask, d));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), result);
+        }
+
+        blendScalar(src + i, dst + i, count - i);
+    }
+#endif
+
+    const cpu_raster::kernels scalarKernels = { cpu_raster::isa::scalar, bilinearScalar, blendScalar };
+
+#ifdef CPU_RASTER_X86
+    const cpu_raster::kernels sse2Kernels = { cpu_raster::isa::sse2, bilinearSse2, blendSse2 };
+    const cpu_raster::kernels avx2Kernels = { cpu_raster::isa::avx2, bilinearAvx2, blendAvx2 };
+#endif
+
+    // Where the samples of a quad are, in 16.16 fixed point texels
+    struct mapping {
+        damage::rect area;
+        double       scaleX;
+        double       scaleY;
+        int32_t      u;
+        int32_t      du;
+    };
+
+    bool mapQuad(const cpu_raster::quad& q, const damage::rect& clip, const cpu_surface& dst, const cpu_surface& src, mapping& m)
+    {
+        m.area = cpu_raster::covered(q, damage::intersection(clip, dst.bounds()));
+        if (damage::empty(m.area) || !src.width || !src.height)
+            return false;
+
+        m.scaleX = static_cast<double>(src.width)  / static_cast<double>(q.right - q.left);
+        m.scaleY = static_cast<double>(src.height) / static_cast<double>(q.bottom - q.top);
+
+        m.u  = static_cast<int32_t>(std::lround(((m.area.left + 0.5 - q.left) * m.scaleX - 0.5) * 65536.0));
+        m.du = static_cast<int32_t>(std::lround(m.scaleX * 65536.0));
+
+        return true;
+    }
+
+    // The source rows around row y of the framebuffer, and the weight of the lower one
+    void sourceRows(const cpu_raster::quad& q, const mapping& m, const cpu_surface& src, int32_t y,
+                    const uint8_t *&row0, const uint8_t *&row1, unsigned& fy)
+    {
+        int32_t v    = static_cast<int32_t>(std::lround(((y + 0.5 - q.top) * m.scaleY - 0.5) * 65536.0));
+        int32_t last = src.height - 1;
+
+        fy   = static_cast<unsigned>(v >> 8) & 0xFF;
+        row0 = src.row(std::min(std::max(v >> 16, 0), last));
+        row1 = src.row(std::min(std::max((v >> 16) + 1, 0), last));
+    }
+}
+
+const cpu_raster::kernels*
+cpu_raster::kernels_for(isa which)
+{
+#ifdef CPU_RASTER_X86
+    __builtin_cpu_init();
+
+    if (which == isa::avx2)
+        return __builtin_cpu_supports("avx2") ? &avx2Kernels : nullptr;
+    if (which == isa::sse2)
+        return __builtin_cpu_supports("sse2") ? &sse2Kernels : nullptr;
+#endif
+
+    return which == isa::scalar ? &scalarKernels : nullptr;
+}
+
+const cpu_raster::kernels&
+cpu_raster::best_kernels()
+{
+    static const kernels& best =
+        kernels_for(isa::avx2) ? *kernels_for(isa::avx2) :
+        kernels_for(isa::sse2) ? *kernels_for(isa::sse2) :
+        scalarKernels;
+
+    return best;
+}
+
+damage::rect
+cpu_raster::covered(const quad& q, const damage::rect& clip)
+{
+    damage::rect r = {
+        static_cast<int32_t>(std::ceil(q.left   - 0.5f)),
+        static_cast<int32_t>(std::ceil(q.top    - 0.5f)),
+        static_cast<int32_t>(std::ceil(q.right  - 0.5f)),
+        static_cast<int32_t>(std::ceil(q.bottom - 0.5f))
+    };
+
+    return damage::intersection(r, clip);
+}
+
+void
+cpu_raster::draw(const kernels& k, cpu_surface& dst, const damage::rect& clip,
+                 const quad& q, const cpu_surface& src, bool blend)
+{
+    mapping m;
+    if (!mapQuad(q, clip, dst, src, m))
+        return;
+
+    unsigned              count = static_cast<unsigned>(damage::width(m.area));
+    std::vector<uint32_t> samples(blend ? count : 0);
+
+    for (int32_t y = m.area.top; y < m.area.bottom; ++y) {
+        const uint8_t *row0, *row1;
+        unsigned       fy;
+        sourceRows(q, m, src, y, row0, row1, fy);
+
+        uint32_t *out = reinterpret_cast<uint32_t*>(dst.row(y)) + m.area.left;
+
+        if (blend) {
+            k.bilinear_row(row0, row1, static_cast<unsigned>(src.width), fy, samples.data(), count, m.u, m.du);
+            k.blend_row(samples.data(), out, count);
+        } else {
+            k.bilinear_row(row0, row1, static_cast<unsigned>(src.width), fy, out, count, m.u, m.du);
+        }
+    }
+}
+
+void
+cpu_raster::draw_nearest(cpu_surface& dst, const damage::rect& clip, const quad& q, const cpu_surface& src)
+{
+    damage::rect area = covered(q, damage::intersection(clip, dst.bounds()));
+    if (damage::empty(area) || !src.width || !src.height)
+        return;
+
+    double scaleX = static_cast<double>(src.width)  / static_cast<double>(q.right - q.left);
+    double scaleY = static_cast<double>(src.height) / static_cast<double>(q.bottom - q.top);
+
+    // the texel each pixel center falls into
+    unsigned             count = static_cast<unsigned>(damage::width(area));
+    std::vector<int32_t> columns(count);
+    bool                 unscaled = true;
+
+    for (unsigned i = 0; i < count; ++i) {
+        int32_t x  = static_cast<int32_t>(std::floor((area.left + i + 0.5 - q.left) * scaleX));
+        columns[i] = std::min(std::max(x, 0), src.width - 1);
+        unscaled   = unscaled && columns[i] == columns[0] + static_cast<int32_t>(i);
+    }
+
+    int32_t        lastRow = -1;
+    const uint8_t *lastOut = nullptr;
+
+    for (int32_t y = area.top; y < area.bottom; ++y) {
+        int32_t row = static_cast<int32_t>(std::floor((y + 0.5 - q.top) * scaleY));
+        row = std::min(std::max(row, 0), src.height - 1);
+
+        uint8_t *out = dst.row(y) + 4 * area.left;
+
+        if (row == lastRow) {
+            std::memcpy(out, lastOut, 4 * count);
+        } else if (unscaled) {
+            std::memcpy(out, src.row(row) + 4 * columns[0], 4 * count);
+        } else {
+            const uint32_t *in     = reinterpret_cast<const uint32_t*>(src.row(row));
+            uint32_t       *pixels = reinterpret_cast<uint32_t*>(out);
+
+            for (unsigned i = 0; i < count; ++i)
+                pixels[i] = in[columns[i]];
+        }
+
+        lastRow = row;
+        lastOut = out;
+    }
+}
+
+void
+cpu_raster::draw_masked(const kernels& k, cpu_surface& dst, const damage::rect& clip,
+                        const quad& q, const cpu_surface& color, const cpu_surface& mask)
+{
+    mapping m;
+    if (!mapQuad(q, clip, dst, color, m) || mask.width != color.width || mask.height != color.height)
+        return;
+
+    unsigned              count = static_cast<unsigned>(damage::width(m.area));
+    std::vector<uint32_t> colors(count), masks(count);
+
+    for (int32_t y = m.area.top; y < m.area.bottom; ++y) {
+        const uint8_t *row0, *row1;
+        unsigned       fy;
+
+        sourceRows(q, m, color, y, row0, row1, fy);
+        k.bilinear_row(row0, row1, static_cast<unsigned>(color.width), fy, colors.data(), count, m.u, m.du);
+
+        sourceRows(q, m, mask, y, row0, row1, fy);
+        k.bilinear_row(row0, row1, static_cast<unsigned>(mask.width), fy, masks.data(), count, m.u, m.du);
+
+        uint32_t *out = reinterpret_cast<uint32_t*>(dst.row(y)) + m.area.left;
+
+        // |framebuffer * mask - color|, with the coverage of the mask as alpha
+        for (unsigned i = 0; i < count; ++i) {
+            uint32_t result = masks[i] & 0xFF000000u;
+
+            for (unsigned shift = 0; shift < 24; shift += 8) {
+                int product = static_cast<int>(mul255((out[i] >> shift) & 0xFF, (masks[i] >> shift) & 0xFF));
+                int c       = static_cast<int>((colors[i] >> shift) & 0xFF);
+
+                result |= static_cast<uint32_t>(std::abs(product - c)) << shift;
+            }
+
+            colors[i] = result;
+        }
+
+        k.blend_row(colors.data(), out, count);
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_surface.hpp"
+#include "damage.hpp"
+
+/** @file cpu_raster.hpp
+ *
+ * Drawing textured quads into a 32bpp framebuffer in system memory, the way the D3D10
+ * renderer draws them: bilinear filtering with clamped edges, and alpha blending for the
+ * cursor (SRC_ALPHA, INV_SRC_ALPHA). The alpha channel of the framebuffer is left alone.
+ *
+ * Filter weights have 8 bits, the horizontal pass is rounded to 8 bits before the vertical
+ * one. There are SSE2 and AVX2 implementations next to the plain C++ one, all of them produce
+ * exactly the same output. Point sampling is plain copying, it doesn't need any of them.
+ */
+namespace cpu_raster {
+    /**
+     * Where a quad ends up in the framebuffer, in pixels. Pixels whose centers are inside
+     * are drawn, like in D3D10.
+     */
+    struct quad {
+        float left;
+        float top;
+        float right;
+        float bottom;
+    };
+
+    enum class isa { scalar, sse2, avx2 };
+
+    struct kernels {
+        isa id;
+
+        /**
+         * Samples @a count pixels between two source rows.
+         *
+         * @param width Pixels in the source rows, positions outside are clamped
+         * @param fy    Weight of @a row1, 0 to 255
+         * @param u     Position of the first sample in texels, 16.16 fixed point, 0 being the
+         *              center of the first source pixel
+         * @param du    Distance between two samples, 16.16 fixed point
+         */
+        void (*bilinear_row)(const uint8_t *row0, const uint8_t *row1, unsigned width, unsigned fy,
+                             uint32_t *dst, unsigned count, int32_t u, int32_t du);
+
+        /**
+         * dst = src * alpha + dst * (1 - alpha), for the color channels
+         */
+        void (*blend_row)(const uint32_t *src, uint32_t *dst, unsigned count);
+    };
+
+    /**
+     * Returns the best set of kernels supported by the running CPU
+     */
+    const kernels& best_kernels();
+
+    /**
+     * Returns the kernels for the given instruction set, or nullptr if the running CPU
+     * (or the compiler) doesn't support it
+     */
+    const kernels* kernels_for(isa which);
+
+    /**
+     * The pixels of the framebuffer covered by @a q, within @a clip
+     */
+    damage::rect covered(const quad& q, const damage::rect& clip);
+
+    /**
+     * Draws @a src stretched over @a q, only within @a clip
+     *
+     * @param blend Alpha blend onto the framebuffer instead of replacing it
+     */
+    void draw(const kernels& k, cpu_surface& dst, const damage::rect& clip,
+              const quad& q, const cpu_surface& src, bool blend);
+
+    /**
+     * Draws @a src stretched over @a q with point sampling, like D3D10_FILTER_MIN_MAG_MIP_POINT.
+     * Meant for whole number magnifications, see view_geometry::integer_scale(): repeated rows
+     * are copied, and unscaled ones too.
+     */
+    void draw_nearest(cpu_surface& dst, const damage::rect& clip, const quad& q, const cpu_surface& src);
+
+    /**
+     * Draws a cursor with an AND mask like PShaderCursor: (framebuffer AND mask) XOR color,
+     * blended with the coverage in the alpha channel of the mask. See cursor_convert.hpp.
+     */
+    void draw_masked(const kernels& k, cpu_surface& dst, const damage::rect& clip,
+                     const quad& q, const cpu_surface& color, const cpu_surface& mask);
+}
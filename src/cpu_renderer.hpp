@@ -0,0 +1,377 @@
+#pragma once
+
+#include "capture_file.hpp"
+#include "cpu_raster.hpp"
+#include "cpu_surface.hpp"
+#include "frame_source.hpp"
+#include "pyramid.hpp"
+#include "stats.hpp"
+#include "view_geometry.hpp"
+#include "view_options.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** @file cpu_renderer.hpp
+ *
+ * Draws the same scene as Renderer, into a framebuffer in system memory: the desktop placed
+ * according to the aspect mode, the cursor on top of it. Presenting the framebuffer is up to the user.
+ *
+ * It serves as a reference for the D3D10 renderer which runs anywhere, and as the fallback for
+ * machines without a usable D3D10 device. Sources have to work on cpu_surfaces.
+ *
+ * TClock provides the timestamps for the statistics:
+ *
+ *     uint64_t now_us();
+ */
+template<class TSource, class TClock>
+class CpuRenderer {
+    static_assert(frame_source::is_frame_source<TSource>::value, "TSource doesn't fulfill the frame source contract, see frame_source.hpp");
+    static_assert(std::is_same<typename TSource::texture_type, cpu_surface>::value, "CpuRenderer needs a source working on cpu_surfaces");
+
+    // what is left of the view when there is no desktop to draw
+    static const uint32_t BACKGROUND = 0xFF808080;
+
+    cpu_device                   m_device;
+    std::unique_ptr<cpu_surface> m_desktopTexture;
+    std::unique_ptr<cpu_surface> m_cursorTexture;
+    std::unique_ptr<cpu_surface> m_cursorMaskTexture;
+    cpu_surface                  m_framebuffer;
+
+    const cpu_raster::kernels *m_kernels = &cpu_raster::best_kernels();
+
+    frame_source::cursor_state m_cursor;
+
+    int m_desktopX      = 0;
+    int m_desktopY      = 0;
+    int m_desktopWidth  = 0;
+    int m_desktopHeight = 0;
+
+    // where the desktop goes, see view_geometry.hpp
+    int          m_aspect = SV_ASPECT_STRETCH;
+    damage::rect m_layout = { 0, 0, 0, 0 };
+
+    // Thumbnail mode, like Renderer: m_pyramid[i] is level i + 1, views draw from level
+    // m_level, 0 being the desktop itself
+    bool                      m_thumbnail    = false;
+    unsigned                  m_level        = 0;
+    std::vector<cpu_surface>  m_pyramid;
+    std::vector<damage::rect> m_pyramidDamage; // of the desktop texture, since the last render()
+    bool                      m_pyramidStale = true;
+
+    bool m_zeroCopy = false;
+
+    // recording what is shown, see capture_file.hpp
+    capture_file::writer      m_recording;
+    std::vector<damage::rect> m_frameDamage;
+
+    TSource m_source;
+    TClock  m_clock;
+
+    // What to draw the desktop from, the source's current frame texture if it has one
+    const cpu_surface& desktopSurface()
+    {
+        const cpu_surface *frame = m_source.frameTexture();
+
+        return frame ? *frame : *m_desktopTexture;
+    }
+
+    void updateLayout()
+    {
+        m_layout = view_geometry::desktop_rect(m_desktopWidth, m_desktopHeight, m_framebuffer.width, m_framebuffer.height, m_aspect);
+
+        updateThumbnailLevel();
+    }
+
+    void updateThumbnailLevel()
+    {
+        unsigned level = 0;
+
+        if (m_thumbnail)
+            level = pyramid::choose_level(m_desktopWidth, m_desktopHeight, damage::width(m_layout), damage::height(m_layout), pyramid::MAX_LEVELS);
+
+        while (m_pyramid.size() < level) {
+            unsigned next = static_cast<unsigned>(m_pyramid.size()) + 1;
+
+            m_pyramid.emplace_back(pyramid::level_extent(m_desktopWidth, next), pyramid::level_extent(m_desktopHeight, next));
+        }
+
+        if (level > m_level)
+            m_pyramidStale = true;
+
+        m_level = level;
+    }
+
+    void updatePyramid(const cpu_surface& desktop)
+    {
+        if (!m_level)
+            return;
+
+        if (m_pyramidStale)
+            m_pyramidDamage.assign(1, desktop.bounds());
+
+        const pyramid::kernels& k      = pyramid::best_kernels();
+        const cpu_surface      *source = &desktop;
+
+        for (unsigned i = 0; i < m_level && !m_pyramidDamage.empty(); ++i) {
+            cpu_surface& level = m_pyramid[i];
+
+            pyramid::next_level_damage(m_pyramidDamage, level.width, level.height);
+
+            for (const damage::rect& r : m_pyramidDamage)
+                pyramid::downsample(k, source->pixels.data(), source->pitch, source->width, source->height,
+                                    level.pixels.data(), level.pitch, r);
+
+            source = &level;
+        }
+
+        m_pyramidDamage.clear();
+        m_pyramidStale = false;
+    }
+
+    // Appends the current desktop to the recording, @a damage is nullptr if unknown
+    void record(const std::vector<damage::rect> *damage)
+    {
+        const cpu_surface& desktop = desktopSurface();
+
+        capture_file::frame_info info;
+        info.present_us  = frame_source::present_time(m_source);
+        info.recorded_us = m_clock.now_us();
+        info.cursor      = m_cursor;
+
+        if (!m_recording.append(desktop.pixels.data(), desktop.pitch, damage, info))
+            m_recording.close();
+    }
+
+    // The cursor texture scaled like the desktop, see Renderer::updateCursorPosition
+    cpu_raster::quad cursorQuad() const
+    {
+        float scaleX = static_cast<float>(damage::width(m_layout))  / static_cast<float>(m_desktopWidth);
+        float scaleY = static_cast<float>(damage::height(m_layout)) / static_cast<float>(m_desktopHeight);
+
+        float left = static_cast<float>(m_layout.left) + static_cast<float>(m_cursor.x) * scaleX;
+        float top  = static_cast<float>(m_layout.top)  + static_cast<float>(m_cursor.y) * scaleY;
+
+        cpu_raster::quad q = {
+            left,
+            top,
+            left + static_cast<float>(m_cursorTexture->width)  * scaleX,
+            top  + static_cast<float>(m_cursorTexture->height) * scaleY
+        };
+        return q;
+    }
+
+public:
+    template<class... TArgs>
+    explicit CpuRenderer(TArgs&&... sourceArgs) :
+        m_source(std::forward<TArgs>(sourceArgs)...)
+    {}
+
+    CpuRenderer(const CpuRenderer&) = delete;
+    CpuRenderer& operator=(const CpuRenderer&) = delete;
+
+    TSource& source() { return m_source; }
+
+    const cpu_surface& framebuffer() const { return m_framebuffer; }
+
+    /**
+     * Bytes the source copied into our textures so far
+     */
+    uint64_t bytesCopied() const { return m_device.bytes_copied; }
+
+    /**
+     * Draws with the given kernels instead of the best ones for the running CPU
+     */
+    void setKernels(const cpu_raster::kernels& k) { m_kernels = &k; }
+
+    void resize(int w, int h)
+    {
+        m_framebuffer = cpu_surface(w > 0 ? w : 0, h > 0 ? h : 0);
+
+        updateLayout();
+    }
+
+    void reset(int x, int y, int w, int h)
+    {
+        m_desktopX      = x;
+        m_desktopY      = y;
+        m_desktopWidth  = w;
+        m_desktopHeight = h;
+
+        m_source.reinit(&m_device, x, y, w, h);
+
+        m_desktopTexture.reset(m_source.createDesktopTexture());
+        m_cursorTexture.reset(m_source.createCursorTexture());
+        m_cursorMaskTexture.reset(m_source.createCursorMaskTexture());
+
+        if (!m_desktopTexture)
+            m_desktopTexture.reset(new cpu_surface());
+
+        // a recording has one size
+        const cpu_surface& desktop = desktopSurface();
+        if (m_recording.is_open() && (desktop.width != m_recording.width() || desktop.height != m_recording.height()))
+            m_recording.close();
+
+        // the desktop size may have changed
+        m_pyramid.clear();
+        m_level = 0;
+        updateLayout();
+    }
+
+    /**
+     * @returns Whether the option is supported
+     */
+    bool setOption(int option, int value)
+    {
+        if (option == SV_OPTION_THUMBNAIL) {
+            m_thumbnail = value != 0;
+            updateThumbnailLevel();
+        } else if (option == SV_OPTION_ZERO_COPY) {
+            bool enable = value != 0;
+            if (enable == m_zeroCopy)
+                return true;
+
+            if (!m_source.setZeroCopy(enable))
+                return false;
+
+            // the desktop texture hasn't been kept up to date, start over
+            m_zeroCopy = enable;
+            reset(m_desktopX, m_desktopY, m_desktopWidth, m_desktopHeight);
+        } else if (option == SV_OPTION_ASPECT) {
+            m_aspect = value;
+            updateLayout();
+        } else if (option == SV_OPTION_CAPTURE_RATE) {
+            return value >= 0 && frame_source::set_capture_rate(m_source, static_cast<unsigned>(value));
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Starts recording the desktop and cursor into a new file at @a path, see capture_file.hpp,
+     * which stops when the desktop size changes
+     *
+     * @returns Whether the file could be created
+     */
+    bool startRecording(const char *path)
+    {
+        const cpu_surface& desktop = desktopSurface();
+
+        return m_recording.open(path, desktop.width, desktop.height);
+    }
+
+    void stopRecording() { m_recording.close(); }
+
+    /**
+     * The recording, or nullptr if there is none
+     */
+    const capture_file::writer *recording() const { return m_recording.is_open() ? &m_recording : nullptr; }
+
+    /**
+     * Like Renderer::wakesUp
+     */
+    bool wakesUp() { return frame_source::wakes_up(m_source); }
+
+    /**
+     * Like Renderer::update
+     */
+    bool update(unsigned timeoutMs)
+    {
+        bool changed = false;
+
+        uint64_t start      = m_clock.now_us();
+        bool     acquired   = m_source.acquireFrame(timeoutMs);
+        uint64_t acquiredAt = m_clock.now_us();
+
+        stats::time(SV_STAGE_ACQUIRE, acquiredAt, acquiredAt - start);
+
+        if (acquired) {
+            stats::count(stats::FRAMES_ACQUIRED);
+
+            bool desktopChanged = m_source.updateDesktop(m_desktopTexture.get());
+            bool pyramid        = m_level && !m_pyramidStale;
+            bool damageKnown    = true;
+
+            // the damage can be taken only once
+            m_frameDamage.clear();
+            if (desktopChanged && (pyramid || m_recording.is_open()))
+                damageKnown = m_source.desktopDamage(m_frameDamage);
+
+            if (desktopChanged && pyramid) {
+                if (damageKnown)
+                    m_pyramidDamage.insert(m_pyramidDamage.end(), m_frameDamage.begin(), m_frameDamage.end());
+                else
+                    m_pyramidStale = true;
+            }
+
+            bool cursorChanged = m_source.updateCursor(m_cursorTexture.get(), m_cursorMaskTexture.get(), m_cursor);
+
+            if (m_recording.is_open() && (desktopChanged || cursorChanged))
+                record(damageKnown ? &m_frameDamage : nullptr);
+
+            changed = desktopChanged || cursorChanged;
+
+            uint64_t copiedAt = m_clock.now_us();
+            stats::time(SV_STAGE_COPY, copiedAt, copiedAt - acquiredAt);
+        }
+
+        m_source.releaseFrame();
+
+        if (!changed)
+            stats::count(stats::FRAMES_SKIPPED);
+
+        return changed;
+    }
+
+    /**
+     * Draws the current textures into the framebuffer
+     */
+    void render()
+    {
+        if (damage::empty(m_framebuffer.bounds()))
+            return;
+
+        uint64_t start = m_clock.now_us();
+
+        const cpu_surface& desktop = desktopSurface();
+
+        updatePyramid(desktop);
+
+        const cpu_surface& view = m_level ? m_pyramid[m_level - 1] : desktop;
+        damage::rect       all  = m_framebuffer.bounds();
+
+        cpu_raster::quad screen = {
+            static_cast<float>(m_layout.left),
+            static_cast<float>(m_layout.top),
+            static_cast<float>(m_layout.right),
+            static_cast<float>(m_layout.bottom)
+        };
+
+        // the bars around a fitted desktop
+        if (damage::empty(view.bounds()) || damage::area(damage::intersection(m_layout, all)) < damage::area(all)) {
+            uint32_t *pixels = reinterpret_cast<uint32_t*>(m_framebuffer.pixels.data());
+            std::fill(pixels, pixels + m_framebuffer.pixels.size() / 4, BACKGROUND);
+        }
+
+        if (view_geometry::integer_scale(view.width, view.height, m_layout))
+            cpu_raster::draw_nearest(m_framebuffer, all, screen, view);
+        else
+            cpu_raster::draw(*m_kernels, m_framebuffer, all, screen, view, false);
+
+        if (m_cursor.visible && m_cursorTexture && m_desktopWidth > 0 && m_desktopHeight > 0) {
+            if (m_cursor.masked && m_cursorMaskTexture)
+                cpu_raster::draw_masked(*m_kernels, m_framebuffer, all, cursorQuad(), *m_cursorTexture, *m_cursorMaskTexture);
+            else
+                cpu_raster::draw(*m_kernels, m_framebuffer, all, cursorQuad(), *m_cursorTexture, true);
+        }
+
+        uint64_t drawn = m_clock.now_us();
+        stats::time(SV_STAGE_DRAW, drawn, drawn - start);
+    }
+};
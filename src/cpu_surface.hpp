@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "damage.hpp"
+
+/** @file cpu_surface.hpp
+ *
+ * Plain memory counterparts of a D3D device and texture, used by frame sources and
+ * renderers which work without a GPU.
+ */
+
+/**
+ * A 32bpp BGRA image in system memory
+ */
+struct cpu_surface {
+    int                  width  = 0;
+    int                  height = 0;
+    std::size_t          pitch  = 0;
+    std::vector<uint8_t> pixels;
+
+    cpu_surface() = default;
+
+    // initially, the surface is black and transparent
+    cpu_surface(int w, int h) :
+        width(w),
+        height(h),
+        pitch(4 * static_cast<std::size_t>(w)),
+        pixels(pitch * static_cast<std::size_t>(h), 0)
+    {}
+
+    uint8_t *row(int y)
+    {
+        return pixels.data() + static_cast<std::size_t>(y) * pitch;
+    }
+
+    const uint8_t *row(int y) const
+    {
+        return pixels.data() + static_cast<std::size_t>(y) * pitch;
+    }
+
+    damage::rect bounds() const
+    {
+        damage::rect r = { 0, 0, width, height };
+        return r;
+    }
+};
+
+/**
+ * Copies between cpu_surfaces, keeping track of the amount of copied memory
+ */
+struct cpu_device {
+    uint64_t bytes_copied = 0;
+
+    /**
+     * Copies @a r of @a src to the same position in @a dst
+     */
+    void copy_rect(cpu_surface& dst, const cpu_surface& src, const damage::rect& r)
+    {
+        damage::rect clipped = damage::intersection(damage::intersection(r, dst.bounds()), src.bounds());
+        if (damage::empty(clipped))
+            return;
+
+        std::size_t bytes = 4 * static_cast<std::size_t>(damage::width(clipped));
+
+        for (int32_t y = clipped.top; y < clipped.bottom; ++y)
+            std::memcpy(dst.row(y) + 4 * clipped.left, src.row(y) + 4 * clipped.left, bytes);
+
+        bytes_copied += bytes * static_cast<uint64_t>(damage::height(clipped));
+    }
+
+    /**
+     * Copies @a r of @a src to (x, y) in @a dst, like CopySubresourceRegion
+     */
+    void copy_region(cpu_surface& dst, int32_t x, int32_t y, const cpu_surface& src, const damage::rect& r)
+    {
+        damage::rect from = damage::intersection(r, src.bounds());
+        damage::rect to   = {
+            x + from.left - r.left,
+            y + from.top  - r.top,
+            x + from.right - r.left,
+            y + from.bottom - r.top
+        };
+
+        to = damage::intersection(to, dst.bounds());
+        if (damage::empty(to))
+            return;
+
+        // where the clipped destination reads from
+        int32_t srcX = from.left + (to.left - x - (from.left - r.left));
+        int32_t srcY = from.top  + (to.top  - y - (from.top  - r.top));
+
+        std::size_t bytes = 4 * static_cast<std::size_t>(damage::width(to));
+
+        for (int32_t row = 0; row < damage::height(to); ++row)
+            std::memcpy(dst.row(to.top + row) + 4 * to.left, src.row(srcY + row) + 4 * srcX, bytes);
+
+        bytes_copied += bytes * static_cast<uint64_t>(damage::height(to));
+    }
+
+    void copy_resource(cpu_surface& dst, const cpu_surface& src)
+    {
+        copy_rect(dst, src, src.bounds());
+    }
+};
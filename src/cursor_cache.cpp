@@ -0,0 +1,119 @@
+#include "cursor_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+    const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+
+    inline uint64_t mix(uint64_t h, uint64_t v)
+    {
+        h ^= v * PRIME2;
+        h  = (h << 31) | (h >> 33);
+        return h * PRIME1;
+    }
+
+    void copyPixels(const uint32_t *pixels, unsigned width, unsigned height,
+                    uint8_t *dst, std::size_t pitch, unsigned texWidth, unsigned texHeight)
+    {
+        unsigned w = std::min(width, texWidth);
+
+        for (unsigned y = 0; y < texHeight; ++y) {
+            uint8_t *row = dst + y * pitch;
+
+            if (y < height) {
+                std::memcpy(row, pixels + static_cast<std::size_t>(y) * width, 4 * w);
+                std::memset(row + 4 * w, 0, 4 * (texWidth - w));
+            } else {
+                std::memset(row, 0, 4 * texWidth);
+            }
+        }
+    }
+}
+
+uint64_t
+cursor::hash_bytes(const void *data, std::size_t length, uint64_t seed)
+{
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    uint64_t h = seed ^ (length * PRIME1);
+
+    // 8 bytes at a time, the rest is zero padded
+    std::size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, bytes + i, 8);
+        h = mix(h, v);
+    }
+
+    if (i < length) {
+        uint64_t v = 0;
+        std::memcpy(&v, bytes + i, length - i);
+        h = mix(h, v);
+    }
+
+    // final avalanche
+    h ^= h >> 29;
+    h *= PRIME2;
+    h ^= h >> 32;
+
+    return h;
+}
+
+void
+cursor::copy_image(const image& img, uint8_t *dst, std::size_t pitch, unsigned texWidth, unsigned texHeight)
+{
+    copyPixels(img.pixels.data(), img.width, img.height, dst, pitch, texWidth, texHeight);
+}
+
+void
+cursor::copy_mask(const image& img, uint8_t *dst, std::size_t pitch, unsigned texWidth, unsigned texHeight)
+{
+    copyPixels(img.mask.data(), img.width, img.masked() ? img.height : 0, dst, pitch, texWidth, texHeight);
+}
+
+const cursor::image *
+cursor::shape_cache::find(uint64_t key)
+{
+    auto it = m_index.find(key);
+    if (it == m_index.end()) {
+        ++m_misses;
+        return nullptr;
+    }
+
+    ++m_hits;
+
+    // mark as most recently used
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+    return &it->second->second;
+}
+
+const cursor::image&
+cursor::shape_cache::insert(uint64_t key, image&& img)
+{
+    auto it = m_index.find(key);
+    if (it != m_index.end()) {
+        it->second->second = std::move(img);
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+        return it->second->second;
+    }
+
+    if (m_entries.size() >= m_capacity) {
+        m_index.erase(m_entries.back().first);
+        m_entries.pop_back();
+    }
+
+    m_entries.emplace_front(key, std::move(img));
+    m_index[key] = m_entries.begin();
+
+    return m_entries.front().second;
+}
+
+void
+cursor::shape_cache::clear()
+{
+    m_entries.clear();
+    m_index.clear();
+}
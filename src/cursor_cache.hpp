@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** @file cursor_cache.hpp
+ *
+ * Cache for converted cursor images, so switching between a handful of cursor shapes
+ * doesn't convert the same shapes over and over again.
+ */
+namespace cursor {
+    /**
+     * A converted cursor image, 32bpp BGRA, top-down, without padding
+     *
+     * Cursors which XOR the desktop have a mask of the same size, see cursor_convert.hpp.
+     */
+    struct image {
+        unsigned              width  = 0;
+        unsigned              height = 0;
+        std::vector<uint32_t> pixels;
+        std::vector<uint32_t> mask;   // empty unless masked
+
+        image() = default;
+        image(unsigned w, unsigned h, bool masked = false)
+          : width(w), height(h),
+            pixels(static_cast<std::size_t>(w) * h, 0),
+            mask(masked ? static_cast<std::size_t>(w) * h : 0, 0) {}
+
+        bool masked() const { return !mask.empty(); }
+
+        uint32_t *row(unsigned y) { return pixels.data() + static_cast<std::size_t>(y) * width; }
+        const uint32_t *row(unsigned y) const { return pixels.data() + static_cast<std::size_t>(y) * width; }
+
+        uint32_t *mask_row(unsigned y) { return mask.data() + static_cast<std::size_t>(y) * width; }
+        const uint32_t *mask_row(unsigned y) const { return mask.data() + static_cast<std::size_t>(y) * width; }
+    };
+
+    /**
+     * Fast non-cryptographic 64bit hash of the given memory
+     *
+     * Chain calls by passing the result of the previous one as @a seed.
+     */
+    uint64_t hash_bytes(const void *data, std::size_t length, uint64_t seed = 0);
+
+    /**
+     * Writes @a img into the top left corner of a mapped texture of the given size.
+     * Everything not covered by the image becomes black and transparent.
+     */
+    void copy_image(const image& img, uint8_t *dst, std::size_t pitch, unsigned texWidth, unsigned texHeight);
+
+    /**
+     * Like copy_image(), but writes the mask of a masked image. Everything else is
+     * left uncovered.
+     */
+    void copy_mask(const image& img, uint8_t *dst, std::size_t pitch, unsigned texWidth, unsigned texHeight);
+
+    /**
+     * A bounded cache of converted cursor images, evicting the least recently used one
+     */
+    class shape_cache {
+        typedef std::pair<uint64_t, image> entry;
+
+        std::size_t                                                m_capacity;
+        std::list<entry>                                           m_entries; // most recently used first
+        std::unordered_map<uint64_t, std::list<entry>::iterator>  m_index;
+
+        uint64_t m_hits   = 0;
+        uint64_t m_misses = 0;
+
+    public:
+        explicit shape_cache(std::size_t capacity = 16) : m_capacity(capacity ? capacity : 1) {}
+
+        /**
+         * Looks up a cached image
+         *
+         * @returns The image, or nullptr if there is none for @a key. The pointer stays valid
+         *          until the next call to insert().
+         */
+        const image *find(uint64_t key);
+
+        /**
+         * Adds an image, possibly evicting the least recently used one
+         */
+        const image& insert(uint64_t key, image&& img);
+
+        void clear();
+
+        uint64_t hits() const   { return m_hits; }
+        uint64_t misses() const { return m_misses; }
+    };
+}
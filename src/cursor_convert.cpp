@@ -0,0 +1,324 @@
+#include "cursor_convert.hpp"
+
+#include <cstring>
+
+#if defined(__i386__) || defined(__x86_64__)
+#   define CURSOR_CONVERT_X86 1
+#   include <immintrin.h>
+#endif
+
+namespace {
+    const uint32_t ALPHA_OPAQUE = 0xFF000000u;
+    const uint32_t RGB_WHITE  = 0x00FFFFFFu;
+
+    ///////////////////////////////////////////////
+    // Plain C++, also used for the row remainders
+    ///////////////////////////////////////////////
+    inline bool bit(const uint8_t *row, unsigned x)
+    {
+        return (row[x / 8] >> (7 - x % 8)) & 1;
+    }
+
+    void monochromeScalar(const uint8_t *andRow, const uint8_t *xorRow, uint32_t *dst, unsigned begin, unsigned end)
+    {
+        for (unsigned x = begin; x < end; ++x)
+            dst[x] = (bit(andRow, x) ? 0 : ALPHA_OPAQUE) | (bit(xorRow, x) ? RGB_WHITE : 0);
+    }
+
+    void maskedColorScalar(const uint8_t *src, uint32_t *dst, unsigned begin, unsigned end)
+    {
+        for (unsigned x = begin; x < end; ++x) {
+            uint32_t pixel;
+            std::memcpy(&pixel, src + 4 * x, 4);
+
+            dst[x] = pixel | ALPHA_OPAQUE;
+        }
+    }
+
+    void colorMaskScalar(const uint8_t *maskRow, uint32_t *dst, unsigned begin, unsigned end)
+    {
+        for (unsigned x = begin; x < end; ++x)
+            dst[x] = (dst[x] & RGB_WHITE) | (static_cast<uint32_t>(255 - maskRow[4 * x]) << 24);
+    }
+
+    void monochromeMaskScalar(const uint8_t *andRow, uint32_t *dst, unsigned begin, unsigned end)
+    {
+        for (unsigned x = begin; x < end; ++x)
+            dst[x] = ALPHA_OPAQUE | (bit(andRow, x) ? RGB_WHITE : 0);
+    }
+
+    void maskedColorMaskScalar(const uint8_t *src, uint32_t *dst, unsigned begin, unsigned end)
+    {
+        for (unsigned x = begin; x < end; ++x)
+            dst[x] = ALPHA_OPAQUE | (static_cast<uint32_t>(src[4 * x + 3]) * 0x010101u);
+    }
+
+    void expandMonochromeScalar(const uint8_t *andRow, const uint8_t *xorRow, uint32_t *dst, unsigned width)
+    {
+        monochromeScalar(andRow, xorRow, dst, 0, width);
+    }
+
+    void expandMaskedColorScalar(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        maskedColorScalar(src, dst, 0, width);
+    }
+
+    void applyColorMaskScalar(const uint8_t *maskRow, uint32_t *dst, unsigned width)
+    {
+        colorMaskScalar(maskRow, dst, 0, width);
+    }
+
+    void expandMonochromeMaskScalar(const uint8_t *andRow, uint32_t *dst, unsigned width)
+    {
+        monochromeMaskScalar(andRow, dst, 0, width);
+    }
+
+    void expandMaskedColorMaskScalar(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        maskedColorMaskScalar(src, dst, 0, width);
+    }
+
+#ifdef CURSOR_CONVERT_X86
+    ///////////////////////////////////////////////
+    // SSE2: 4 pixels per register
+    ///////////////////////////////////////////////
+    __attribute__((target("sse2")))
+    void expandMonochromeSse2(const uint8_t *andRow, const uint8_t *xorRow, uint32_t *dst, unsigned width)
+    {
+        // the leftmost pixel is the most significant bit
+        const __m128i bitsLo = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+        const __m128i bitsHi = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+        const __m128i opaque = _mm_set1_epi32(static_cast<int>(ALPHA_OPAQUE));
+        const __m128i white  = _mm_set1_epi32(static_cast<int>(RGB_WHITE));
+
+        unsigned bytes = width / 8;
+
+        for (unsigned i = 0; i < bytes; ++i) {
+            __m128i a = _mm_set1_epi32(andRow[i]);
+            __m128i x = _mm_set1_epi32(xorRow[i]);
+
+            __m128i andLo = _mm_cmpeq_epi32(_mm_and_si128(a, bitsLo), bitsLo);
+            __m128i andHi = _mm_cmpeq_epi32(_mm_and_si128(a, bitsHi), bitsHi);
+            __m128i xorLo = _mm_cmpeq_epi32(_mm_and_si128(x, bitsLo), bitsLo);
+            __m128i xorHi = _mm_cmpeq_epi32(_mm_and_si128(x, bitsHi), bitsHi);
+
+            __m128i lo = _mm_or_si128(_mm_andnot_si128(andLo, opaque), _mm_and_si128(xorLo, white));
+            __m128i hi = _mm_or_si128(_mm_andnot_si128(andHi, opaque), _mm_and_si128(xorHi, white));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8 * i),     lo);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8 * i + 4), hi);
+        }
+
+        monochromeScalar(andRow, xorRow, dst, bytes * 8, width);
+    }
+
+    __attribute__((target("sse2")))
+    void expandMaskedColorSse2(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        const __m128i opaque = _mm_set1_epi32(static_cast<int>(ALPHA_OPAQUE));
+
+        unsigned x = 0;
+        for (; x + 4 <= width; x += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_or_si128(pixels, opaque));
+        }
+
+        maskedColorScalar(src, dst, x, width);
+    }
+
+    __attribute__((target("sse2")))
+    void applyColorMaskSse2(const uint8_t *maskRow, uint32_t *dst, unsigned width)
+    {
+        const __m128i lowByte = _mm_set1_epi32(0xFF);
+        const __m128i white   = _mm_set1_epi32(static_cast<int>(RGB_WHITE));
+
+        unsigned x = 0;
+        for (; x + 4 <= width; x += 4) {
+            __m128i mask   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(maskRow + 4 * x));
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x));
+
+            // 255 - m == ~m for a byte
+            __m128i alpha = _mm_slli_epi32(_mm_andnot_si128(mask, lowByte), 24);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_or_si128(_mm_and_si128(pixels, white), alpha));
+        }
+
+        colorMaskScalar(maskRow, dst, x, width);
+    }
+
+    __attribute__((target("sse2")))
+    void expandMonochromeMaskSse2(const uint8_t *andRow, uint32_t *dst, unsigned width)
+    {
+        const __m128i bitsLo = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+        const __m128i bitsHi = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+        const __m128i opaque = _mm_set1_epi32(static_cast<int>(ALPHA_OPAQUE));
+        const __m128i white  = _mm_set1_epi32(static_cast<int>(RGB_WHITE));
+
+        unsigned bytes = width / 8;
+
+        for (unsigned i = 0; i < bytes; ++i) {
+            __m128i a = _mm_set1_epi32(andRow[i]);
+
+            __m128i lo = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(a, bitsLo), bitsLo), white);
+            __m128i hi = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(a, bitsHi), bitsHi), white);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8 * i),     _mm_or_si128(lo, opaque));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8 * i + 4), _mm_or_si128(hi, opaque));
+        }
+
+        monochromeMaskScalar(andRow, dst, bytes * 8, width);
+    }
+
+    __attribute__((target("sse2")))
+    void expandMaskedColorMaskSse2(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        const __m128i opaque = _mm_set1_epi32(static_cast<int>(ALPHA_OPAQUE));
+
+        unsigned x = 0;
+        for (; x + 4 <= width; x += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x));
+
+            // replicate the alpha byte into the color channels
+            __m128i a = _mm_srli_epi32(pixels, 24);
+            a = _mm_or_si128(a, _mm_or_si128(_mm_slli_epi32(a, 8), _mm_slli_epi32(a, 16)));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_or_si128(a, opaque));
+        }
+
+        maskedColorMaskScalar(src, dst, x, width);
+    }
+
+    ///////////////////////////////////////////////
+    // AVX2: 8 pixels per register
+    ///////////////////////////////////////////////
+    __attribute__((target("avx2")))
+    void expandMonochromeAvx2(const uint8_t *andRow, const uint8_t *xorRow, uint32_t *dst, unsigned width)
+    {
+        const __m256i bits   = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+        const __m256i opaque = _mm256_set1_epi32(static_cast<int>(ALPHA_OPAQUE));
+        const __m256i white  = _mm256_set1_epi32(static_cast<int>(RGB_WHITE));
+
+        unsigned bytes = width / 8;
+
+        for (unsigned i = 0; i < bytes; ++i) {
+            __m256i a = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(andRow[i]), bits), bits);
+            __m256i x = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(xorRow[i]), bits), bits);
+
+            __m256i pixels = _mm256_or_si256(_mm256_andnot_si256(a, opaque), _mm256_and_si256(x, white));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 8 * i), pixels);
+        }
+
+        monochromeScalar(andRow, xorRow, dst, bytes * 8, width);
+    }
+
+    __attribute__((target("avx2")))
+    void expandMaskedColorAvx2(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        const __m256i opaque = _mm256_set1_epi32(static_cast<int>(ALPHA_OPAQUE));
+
+        unsigned x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_or_si256(pixels, opaque));
+        }
+
+        maskedColorScalar(src, dst, x, width);
+    }
+
+    __attribute__((target("avx2")))
+    void applyColorMaskAvx2(const uint8_t *maskRow, uint32_t *dst, unsigned width)
+    {
+        const __m256i lowByte = _mm256_set1_epi32(0xFF);
+        const __m256i white   = _mm256_set1_epi32(static_cast<int>(RGB_WHITE));
+
+        unsigned x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i mask   = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(maskRow + 4 * x));
+            __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + x));
+
+            __m256i alpha = _mm256_slli_epi32(_mm256_andnot_si256(mask, lowByte), 24);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_or_si256(_mm256_and_si256(pixels, white), alpha));
+        }
+
+        colorMaskScalar(maskRow, dst, x, width);
+    }
+
+    __attribute__((target("avx2")))
+    void expandMonochromeMaskAvx2(const uint8_t *andRow, uint32_t *dst, unsigned width)
+    {
+        const __m256i bits   = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+        const __m256i opaque = _mm256_set1_epi32(static_cast<int>(ALPHA_OPAQUE));
+        const __m256i white  = _mm256_set1_epi32(static_cast<int>(RGB_WHITE));
+
+        unsigned bytes = width / 8;
+
+        for (unsigned i = 0; i < bytes; ++i) {
+            __m256i a = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(andRow[i]), bits), bits);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 8 * i), _mm256_or_si256(_mm256_and_si256(a, white), opaque));
+        }
+
+        monochromeMaskScalar(andRow, dst, bytes * 8, width);
+    }
+
+    __attribute__((target("avx2")))
+    void expandMaskedColorMaskAvx2(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        const __m256i opaque = _mm256_set1_epi32(static_cast<int>(ALPHA_OPAQUE));
+
+        unsigned x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x));
+
+            __m256i a = _mm256_srli_epi32(pixels, 24);
+            a = _mm256_or_si256(a, _mm256_or_si256(_mm256_slli_epi32(a, 8), _mm256_slli_epi32(a, 16)));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_or_si256(a, opaque));
+        }
+
+        maskedColorMaskScalar(src, dst, x, width);
+    }
+#endif
+
+    const cursor::kernels scalarKernels = {
+        cursor::isa::scalar, expandMonochromeScalar, expandMaskedColorScalar, applyColorMaskScalar,
+        expandMonochromeMaskScalar, expandMaskedColorMaskScalar
+    };
+
+#ifdef CURSOR_CONVERT_X86
+    const cursor::kernels sse2Kernels = {
+        cursor::isa::sse2, expandMonochromeSse2, expandMaskedColorSse2, applyColorMaskSse2,
+        expandMonochromeMaskSse2, expandMaskedColorMaskSse2
+    };
+
+    const cursor::kernels avx2Kernels = {
+        cursor::isa::avx2, expandMonochromeAvx2, expandMaskedColorAvx2, applyColorMaskAvx2,
+        expandMonochromeMaskAvx2, expandMaskedColorMaskAvx2
+    };
+#endif
+}
+
+const cursor::kernels*
+cursor::kernels_for(isa which)
+{
+#ifdef CURSOR_CONVERT_X86
+    __builtin_cpu_init();
+
+    if (which == isa::avx2)
+        return __builtin_cpu_supports("avx2") ? &avx2Kernels : nullptr;
+    if (which == isa::sse2)
+        return __builtin_cpu_supports("sse2") ? &sse2Kernels : nullptr;
+#endif
+
+    return which == isa::scalar ? &scalarKernels : nullptr;
+}
+
+const cursor::kernels&
+cursor::best_kernels()
+{
+    static const kernels& best =
+        kernels_for(isa::avx2) ? *kernels_for(isa::avx2) :
+        kernels_for(isa::sse2) ? *kernels_for(isa::sse2) :
+        scalarKernels;
+
+    return best;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+
+/** @file cursor_convert.hpp
+ *
+ * Conversion of cursor images into the 32bpp BGRA layout of our cursor texture, one row
+ * at a time.
+ *
+ * Cursors which combine their image with the desktop using AND and XOR masks are split into
+ * two textures: the color texture holds the XOR color and looks like the cursor drawn onto a
+ * black desktop, the mask texture holds the AND mask in its color channels and whether a pixel
+ * is covered by the cursor image in its alpha channel. The renderer composites them as
+ * (desktop AND mask) XOR color, see PShaderCursor in shaders.hlsl.
+ *
+ * There are SSE2 and AVX2 implementations next to the plain C++ one, the best one supported
+ * by the CPU is chosen at runtime. All of them produce exactly the same output.
+ */
+namespace cursor {
+    enum class isa { scalar, sse2, avx2 };
+
+    struct kernels {
+        isa id;
+
+        /**
+         * Expands a row of a monochrome cursor, given as 1bpp AND and XOR masks (MSB first).
+         *
+         * Pixels with a set AND bit become transparent, pixels with a set XOR bit become white,
+         * everything else is black.
+         */
+        void (*expand_monochrome)(const uint8_t *andRow, const uint8_t *xorRow, uint32_t *dst, unsigned width);
+
+        /**
+         * Copies a row of a masked color cursor (32bpp, the alpha byte holds the mask)
+         * and makes it opaque.
+         */
+        void (*expand_masked_color)(const uint8_t *src, uint32_t *dst, unsigned width);
+
+        /**
+         * Sets the alpha channel of a row of a color cursor from a 32bpp mask bitmap: a white
+         * mask pixel means transparent, a black one opaque.
+         */
+        void (*apply_color_mask)(const uint8_t *maskRow, uint32_t *dst, unsigned width);
+
+        /**
+         * Expands the 1bpp AND mask of a monochrome cursor row into the mask texture layout
+         */
+        void (*expand_monochrome_mask)(const uint8_t *andRow, uint32_t *dst, unsigned width);
+
+        /**
+         * Expands the mask of a masked color cursor row (the alpha byte, either 0 or 0xFF)
+         * into the mask texture layout
+         */
+        void (*expand_masked_color_mask)(const uint8_t *src, uint32_t *dst, unsigned width);
+    };
+
+    /**
+     * Returns the best set of kernels supported by the running CPU
+     */
+    const kernels& best_kernels();
+
+    /**
+     * Returns the kernels for the given instruction set, or nullptr if the running CPU
+     * (or the compiler) doesn't support it
+     */
+    const kernels* kernels_for(isa which);
+
+    inline void expand_monochrome(const uint8_t *andRow, const uint8_t *xorRow, uint32_t *dst, unsigned width)
+    {
+        best_kernels().expand_monochrome(andRow, xorRow, dst, width);
+    }
+
+    inline void expand_masked_color(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        best_kernels().expand_masked_color(src, dst, width);
+    }
+
+    inline void apply_color_mask(const uint8_t *maskRow, uint32_t *dst, unsigned width)
+    {
+        best_kernels().apply_color_mask(maskRow, dst, width);
+    }
+
+    inline void expand_monochrome_mask(const uint8_t *andRow, uint32_t *dst, unsigned width)
+    {
+        best_kernels().expand_monochrome_mask(andRow, dst, width);
+    }
+
+    inline void expand_masked_color_mask(const uint8_t *src, uint32_t *dst, unsigned width)
+    {
+        best_kernels().expand_masked_color_mask(src, dst, width);
+    }
+}
@@ -0,0 +1,217 @@
+#include "damage.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    // Merging more than this would be too expensive, one big bounding box will do instead
+    static const std::size_t MAX_COALESCED_RECTS = 256;
+
+    bool shouldMerge(const damage::rect& a, const damage::rect& b)
+    {
+        if (damage::overlaps(a, b))
+            return true;
+
+        // merge if at most a quarter of the bounding box is wasted
+        int64_t covered = damage::area(a) + damage::area(b);
+        int64_t waste   = damage::area(damage::bounding(a, b)) - covered;
+
+        return waste * 4 <= covered;
+    }
+
+    // Clips a move so that both its source and its destination are inside of bounds
+    damage::move clipMove(const damage::move& m, const damage::rect& bounds)
+    {
+        int32_t dx = m.dst.left - m.src_x;
+        int32_t dy = m.dst.top  - m.src_y;
+
+        damage::rect dst = damage::intersection(m.dst, bounds);
+        damage::rect src = { dst.left - dx, dst.top - dy, dst.right - dx, dst.bottom - dy };
+        src = damage::intersection(src, bounds);
+
+        damage::move clipped = {
+            src.left,
+            src.top,
+            { src.left + dx, src.top + dy, src.right + dx, src.bottom + dy },
+            false
+        };
+        return clipped;
+    }
+
+    void copyRect(uint8_t *dst, std::size_t dstPitch, int32_t dstX, int32_t dstY,
+                  const uint8_t *src, std::size_t srcPitch, int32_t srcX, int32_t srcY,
+                  int32_t w, int32_t h)
+    {
+        // copy bottom-up if we would otherwise overwrite rows we still need to read
+        bool reverse = dst == src && dstY > srcY;
+
+        for (int32_t i = 0; i < h; ++i) {
+            int32_t row = reverse ? h - 1 - i : i;
+
+            std::memmove(dst + (dstY + row) * dstPitch + dstX * 4,
+                         src + (srcY + row) * srcPitch + srcX * 4,
+                         static_cast<std::size_t>(w) * 4);
+        }
+    }
+}
+
+void
+damage::coalesce(std::vector<rect>& rects, const rect& bounds)
+{
+    std::vector<rect> clipped;
+    clipped.reserve(rects.size());
+
+    for (const rect& r : rects) {
+        rect c = intersection(r, bounds);
+        if (!empty(c))
+            clipped.push_back(c);
+    }
+
+    if (clipped.size() > MAX_COALESCED_RECTS) {
+        rect all = clipped[0];
+        for (const rect& r : clipped)
+            all = bounding(all, r);
+
+        clipped.assign(1, all);
+    }
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+
+        for (std::size_t i = 0; i < clipped.size(); ++i) {
+            for (std::size_t j = i + 1; j < clipped.size(); ) {
+                if (shouldMerge(clipped[i], clipped[j])) {
+                    clipped[i] = bounding(clipped[i], clipped[j]);
+                    clipped.erase(clipped.begin() + j);
+                    merged = true;
+                } else {
+                    ++j;
+                }
+            }
+        }
+    }
+
+    int64_t total = 0;
+    for (const rect& r : clipped)
+        total += area(r);
+
+    if (total * 4 >= area(bounds) * 3)
+        clipped.assign(1, bounds);
+
+    rects.swap(clipped);
+}
+
+int64_t
+damage::crop(std::vector<rect>& rects, const rect& region)
+{
+    int64_t removed = 0;
+    std::size_t kept = 0;
+
+    for (const rect& r : rects) {
+        rect clipped = intersection(r, region);
+
+        removed += area(r) - area(clipped);
+        if (empty(clipped))
+            continue;
+
+        rects[kept++] = {
+            clipped.left   - region.left,
+            clipped.top    - region.top,
+            clipped.right  - region.left,
+            clipped.bottom - region.top
+        };
+    }
+
+    rects.resize(kept);
+
+    return removed;
+}
+
+void
+damage::order_moves(std::vector<move>& moves, const rect& bounds)
+{
+    std::vector<move> pending;
+    pending.reserve(moves.size());
+
+    for (const move& m : moves) {
+        move c = clipMove(m, bounds);
+        if (!empty(c.dst))
+            pending.push_back(c);
+    }
+
+    std::vector<move> ordered;
+    ordered.reserve(pending.size());
+    std::vector<bool> done(pending.size(), false);
+
+    while (ordered.size() < pending.size()) {
+        bool progress = false;
+
+        for (std::size_t i = 0; i < pending.size(); ++i) {
+            if (done[i])
+                continue;
+
+            // we may not overwrite what another outstanding move still has to read
+            bool blocked = false;
+            for (std::size_t j = 0; j < pending.size() && !blocked; ++j) {
+                if (j == i || done[j] || pending[j].staged)
+                    continue;
+
+                blocked = overlaps(pending[i].dst, source(pending[j]));
+            }
+
+            if (!blocked) {
+                ordered.push_back(pending[i]);
+                done[i] = true;
+                progress = true;
+            }
+        }
+
+        if (!progress) {
+            // cyclic dependency, save the source of the first outstanding move beforehand
+            for (std::size_t i = 0; i < pending.size(); ++i) {
+                if (!done[i] && !pending[i].staged) {
+                    pending[i].staged = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    moves.swap(ordered);
+}
+
+void
+damage::apply_moves(uint8_t *pixels, std::size_t pitch, const std::vector<move>& moves)
+{
+    // save the sources of staged moves before anything gets overwritten
+    std::vector<std::vector<uint8_t>> staged;
+
+    for (const move& m : moves) {
+        if (!m.staged)
+            continue;
+
+        std::size_t stagedPitch = static_cast<std::size_t>(width(m.dst)) * 4;
+
+        staged.push_back(std::vector<uint8_t>(stagedPitch * height(m.dst)));
+        copyRect(staged.back().data(), stagedPitch, 0, 0,
+                 pixels, pitch, m.src_x, m.src_y,
+                 width(m.dst), height(m.dst));
+    }
+
+    std::size_t nextStaged = 0;
+
+    for (const move& m : moves) {
+        if (m.staged) {
+            const std::vector<uint8_t>& saved = staged[nextStaged++];
+
+            copyRect(pixels, pitch, m.dst.left, m.dst.top,
+                     saved.data(), static_cast<std::size_t>(width(m.dst)) * 4, 0, 0,
+                     width(m.dst), height(m.dst));
+        } else {
+            copyRect(pixels, pitch, m.dst.left, m.dst.top,
+                     pixels, pitch, m.src_x, m.src_y,
+                     width(m.dst), height(m.dst));
+        }
+    }
+}
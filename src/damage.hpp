@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/** @file damage.hpp
+ *
+ * Bookkeeping of changed screen regions (dirty rects and move rects), for the D3D renderers
+ * and for code which works on plain CPU framebuffers alike.
+ */
+namespace damage {
+    /**
+     * A rectangle in pixel coordinates. right and bottom are exclusive, like in a win32 RECT.
+     */
+    struct rect {
+        int32_t left;
+        int32_t top;
+        int32_t right;
+        int32_t bottom;
+    };
+
+    /**
+     * A rectangle which has been moved on the screen, e.g. by scrolling or by dragging a window.
+     *
+     * The contents of the previous frame at (src_x, src_y) have to be moved to dst.
+     */
+    struct move {
+        int32_t src_x;
+        int32_t src_y;
+        rect    dst;
+
+        // Set by order_moves(): the source has to be saved before any move is executed,
+        // because of a cyclic dependency with another move.
+        bool    staged;
+    };
+
+    inline int32_t width(const rect& r)  { return r.right - r.left; }
+    inline int32_t height(const rect& r) { return r.bottom - r.top; }
+
+    inline bool empty(const rect& r)
+    {
+        return r.right <= r.left || r.bottom <= r.top;
+    }
+
+    inline int64_t area(const rect& r)
+    {
+        return empty(r) ? 0 : static_cast<int64_t>(width(r)) * static_cast<int64_t>(height(r));
+    }
+
+    inline rect intersection(const rect& a, const rect& b)
+    {
+        rect r = {
+            a.left   > b.left   ? a.left   : b.left,
+            a.top    > b.top    ? a.top    : b.top,
+            a.right  < b.right  ? a.right  : b.right,
+            a.bottom < b.bottom ? a.bottom : b.bottom
+        };
+        return r;
+    }
+
+    inline rect bounding(const rect& a, const rect& b)
+    {
+        rect r = {
+            a.left   < b.left   ? a.left   : b.left,
+            a.top    < b.top    ? a.top    : b.top,
+            a.right  > b.right  ? a.right  : b.right,
+            a.bottom > b.bottom ? a.bottom : b.bottom
+        };
+        return r;
+    }
+
+    inline bool overlaps(const rect& a, const rect& b)
+    {
+        return !empty(intersection(a, b));
+    }
+
+    /**
+     * The rectangle a move reads from
+     */
+    inline rect source(const move& m)
+    {
+        rect r = { m.src_x, m.src_y, m.src_x + width(m.dst), m.src_y + height(m.dst) };
+        return r;
+    }
+
+    /**
+     * Clips the given rectangles to @a bounds and merges them into fewer, larger rectangles.
+     *
+     * Two rectangles are merged if their bounding box doesn't waste too many pixels which
+     * weren't part of either of them. If the remaining rectangles cover most of @a bounds,
+     * they are collapsed into @a bounds itself, as one big copy is cheaper than many small ones.
+     *
+     * The resulting rectangles don't overlap each other.
+     */
+    void coalesce(std::vector<rect>& rects, const rect& bounds);
+
+    /**
+     * Clips the given rectangles to @a region and moves them into its coordinates, i.e. the
+     * top left corner of @a region becomes (0, 0). Rectangles outside of it are removed.
+     *
+     * @returns The number of pixels removed by clipping
+     */
+    int64_t crop(std::vector<rect>& rects, const rect& region);
+
+    /**
+     * Sorts moves so that they can be executed one after another on a single surface
+     * containing the previous frame: a move is only executed after all moves reading from its
+     * destination. Cyclic dependencies are broken by marking moves as staged, their sources
+     * need to be saved before executing any move.
+     *
+     * Moves are clipped to @a bounds, moves ending up empty are removed.
+     */
+    void order_moves(std::vector<move>& moves, const rect& bounds);
+
+    /**
+     * Executes moves ordered by order_moves() on a 32bpp framebuffer.
+     */
+    void apply_moves(uint8_t *pixels, std::size_t pitch, const std::vector<move>& moves);
+}
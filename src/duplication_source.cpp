@@ -1,11 +1,66 @@
 #include "duplication_source.hpp"
 #include "logger.hpp"
 #include "util.hpp"
+#include "cursor_convert.hpp"
+#include "stats.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 
 namespace {
     static const UINT CURSOR_TEX_SIZE = 256;
+
+    // log the cursor cache statistics every that many shape updates
+    static const uint64_t CURSOR_CACHE_LOG_INTERVAL = 64;
+
+    // log the copies saved by the zero-copy mode every that many desktop updates
+    static const uint64_t ZERO_COPY_LOG_INTERVAL = 1000;
+
+    // log the copies saved by cropping to a region every that many desktop updates
+    static const uint64_t CROP_LOG_INTERVAL = 1000;
+
+    // AcquireNextFrame doesn't wake up for messages, so we wait in slices of this many ms
+    static const unsigned ACQUIRE_SLICE = 8;
+
+    cursor::image convertPointerShape(const uint8_t *buffer, const DXGI_OUTDUPL_POINTER_SHAPE_INFO& pointer)
+    {
+        if (pointer.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR) {
+            cursor::image img(std::min(pointer.Width, CURSOR_TEX_SIZE), std::min(pointer.Height, CURSOR_TEX_SIZE));
+
+            for (UINT row = 0; row < img.height; ++row)
+                memcpy(img.row(row), buffer + row*pointer.Pitch, img.width*4);
+
+            return img;
+        } else if (pointer.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MASKED_COLOR) {
+            //FIXME: I haven't found a way yet to trigger this codepath at runtime.
+            cursor::image img(std::min(pointer.Width, CURSOR_TEX_SIZE), std::min(pointer.Height, CURSOR_TEX_SIZE), true);
+
+            //  mask==0     => Use source RGB values
+            //  mask==0xFF  => Use source RGB XOR target RGB
+            // Without the cursor shader, the mask is applied onto a black background, where the
+            // mask value doesn't matter.
+            for (UINT row = 0; row < img.height; ++row) {
+                cursor::expand_masked_color(buffer + row*pointer.Pitch, img.row(row), img.width);
+                cursor::expand_masked_color_mask(buffer + row*pointer.Pitch, img.mask_row(row), img.width);
+            }
+
+            return img;
+        } else {
+            // Without the cursor shader, we pretend to apply the AND mask onto a black surface.
+            // This is incorrect, but doesn't look too bad.
+            cursor::image img(std::min(pointer.Width, CURSOR_TEX_SIZE), std::min(pointer.Height/2, CURSOR_TEX_SIZE), true);
+
+            const uint8_t *and_map = buffer;
+            const uint8_t *xor_map = and_map + pointer.Pitch*pointer.Height/2;
+
+            for (UINT row = 0; row < img.height; ++row) {
+                cursor::expand_monochrome(&and_map[row * pointer.Pitch], &xor_map[row * pointer.Pitch], img.row(row), img.width);
+                cursor::expand_monochrome_mask(&and_map[row * pointer.Pitch], img.mask_row(row), img.width);
+            }
+
+            return img;
+        }
+    }
 }
 
 void
@@ -15,7 +70,15 @@ DuplicationSource::reinit(ID3D10Device *device, int x, int y, int w, int h)
 
     m_duplication.clear();
     m_duplDesktopImage.clear();
+    m_frameTexture.clear();
+    m_releasedTexture.clear();
+    m_redrawTexture.clear();
+    m_desktopStale  = false;
     m_frameAcquired = false;
+    m_frameHeld     = false;
+    m_needsFullCopy = true;
+    m_region        = { 0, 0, w, h };
+    m_cropped       = false;
 
     m_desktopWidth = w;
     m_desktopHeight = h;
@@ -41,13 +104,26 @@ DuplicationSource::reinit(ID3D10Device *device, int x, int y, int w, int h)
         DXGI_OUTPUT_DESC desc;
         output1->GetDesc(&desc);
 
+        const RECT& screen = desc.DesktopCoordinates;
+
         if (desc.AttachedToDesktop
-            && desc.DesktopCoordinates.left == x
-            && desc.DesktopCoordinates.top  == y
-            && desc.DesktopCoordinates.right == x + w
-            && desc.DesktopCoordinates.bottom == y + h)
+            && w > 0 && h > 0
+            && x >= screen.left && x + w <= screen.right
+            && y >= screen.top  && y + h <= screen.bottom)
         {
-            logger << "Attempting to duplicate display " << i << std::endl;
+            m_region  = { x - screen.left, y - screen.top, x - screen.left + w, y - screen.top + h };
+            m_cropped = w != screen.right - screen.left || h != screen.bottom - screen.top;
+
+            logger << "Attempting to duplicate display " << i;
+            if (m_cropped)
+                logger << ", region x=" << m_region.left << " y=" << m_region.top << " w=" << w << " h=" << h;
+            logger << std::endl;
+
+            // the region has to be copied out of the duplicated surface
+            if (m_cropped && m_zeroCopy) {
+                logger << "Zero-copy isn't possible for a region of a display, copying" << std::endl;
+                setZeroCopy(false);
+            }
 
             HRESULT hr = output1->DuplicateOutput(device, m_duplication.pptr_cleared());
             if FAILED(hr)
@@ -72,9 +148,10 @@ DuplicationSource::createDesktopTexture()
 
     m_duplication->GetDesc(&dpldesc);
 
+    // a region only needs a texture of its own size
     D3D10_TEXTURE2D_DESC texdsc = {
-        .Width = dpldesc.ModeDesc.Width,
-        .Height = dpldesc.ModeDesc.Height,
+        .Width = m_cropped ? static_cast<UINT>(m_desktopWidth) : dpldesc.ModeDesc.Width,
+        .Height = m_cropped ? static_cast<UINT>(m_desktopHeight) : dpldesc.ModeDesc.Height,
         .MipLevels = 1,
         .ArraySize = 1,
         .Format = DXGI_FORMAT_B8G8R8A8_UNORM,
@@ -103,6 +180,9 @@ DuplicationSource::createDesktopTexture()
     if FAILED(hr)
         logger << "Failed:CreateTexture2D: " << util::hresult_to_utf8(hr) << std::endl;
 
+    // a new texture doesn't contain anything we could update incrementally
+    m_needsFullCopy = true;
+
     return texture;
 }
 
@@ -148,139 +228,355 @@ DuplicationSource::createCursorTexture()
     return texture;
 }
 
-void
-DuplicationSource::acquireFrame()
+ID3D10Texture2D *
+DuplicationSource::createCursorMaskTexture()
+{
+    // same size and format as the cursor texture
+    return createCursorTexture();
+}
+
+bool
+DuplicationSource::acquireFrame(unsigned timeoutMs)
 {
     HRESULT hr;
 
-    if (!m_duplication || !m_dev)
-        return;
+    if (!m_duplication || !m_dev) {
+        // nothing to wait for, but don't let the render loop spin
+        MsgWaitForMultipleObjects(0, nullptr, FALSE, timeoutMs, QS_ALLINPUT);
+        return false;
+    }
+
+    // in zero-copy mode, the last frame has been drawn from until now
+    if (m_frameHeld)
+        releaseHeldFrame();
 
-    hr = m_duplication->AcquireNextFrame(100, &m_duplInfo, m_duplDesktopImage.pptr_cleared());
+    // The render loop handles resizes and the like in between, a thread without messages
+    // simply waits for the whole timeout
+    for (unsigned waited = 0;;) {
+        unsigned slice = std::min(timeoutMs - waited, ACQUIRE_SLICE);
 
-    if (hr == DXGI_ERROR_WAIT_TIMEOUT)
-        return; // This can happen if the screen is idle or whatever, it's not really fatal enough to log
+        hr = m_duplication->AcquireNextFrame(slice, &m_duplInfo, m_duplDesktopImage.pptr_cleared());
+        if (hr != DXGI_ERROR_WAIT_TIMEOUT)
+            break;
+
+        // This happens all the time if the screen is idle, it's not really fatal enough to log
+        waited += slice;
+        if (waited >= timeoutMs || HIWORD(GetQueueStatus(QS_ALLINPUT)))
+            return false;
+    }
 
-    if (!(m_frameAcquired = SUCCEEDED(hr)))
+    if (!(m_frameAcquired = m_frameHeld = SUCCEEDED(hr)))
         logger << "Failed: AcquireNextFrame: " << util::hresult_to_utf8(hr) << std::endl;
+    else
+        stats::count(stats::ACCUMULATED_FRAMES, m_duplInfo.AccumulatedFrames);
+
+    // 0 if only the cursor changed
+    if (m_frameAcquired && m_duplInfo.LastPresentTime.QuadPart)
+        m_presentTime = util::qpc_to_microseconds(m_duplInfo.LastPresentTime.QuadPart);
+
+    // the image holds the whole desktop even if only the cursor changed
+    if (m_frameHeld && m_zeroCopy) {
+        m_frameTexture = m_duplDesktopImage.query<ID3D10Texture2D>();
+        m_desktopStale = true;
+    }
 
     // if the access has been lost, we might get away with just recreating it again
     if (FAILED(hr) && hr == DXGI_ERROR_ACCESS_LOST) {
         logger << "Recreating the IDXGIOutputDuplication interface because of DXGI_ERROR_ACCESS_LOST=" << hr << std::endl;
         reinit(m_dev, m_desktopX, m_desktopY, m_desktopWidth, m_desktopHeight);
     }
+
+    return m_frameAcquired;
 }
 
-void
+bool
 DuplicationSource::updateDesktop(ID3D10Texture2D *desktopTex)
 {
     if (!desktopTex || !m_frameAcquired || !m_dev || !m_duplDesktopImage)
-        return;
+        return false;
 
+    // only the cursor has changed
     if (!m_duplInfo.LastPresentTime.QuadPart || !m_duplDesktopImage)
-        return;
+        return false;
 
     auto d3dresource = m_duplDesktopImage.query<ID3D10Texture2D>();
-    m_dev->CopyResource(desktopTex, d3dresource);
+
+    m_fullUpdate = m_needsFullCopy || !collectDamage();
+
+    if (m_zeroCopy) {
+        // The renderer draws from the frame itself, what the copy would have moved is saved.
+        // The desktop texture is only brought up to date for redraws, see frameTexture().
+        m_redrawTexture = com_ptr<ID3D10Texture2D>::ref(desktopTex);
+
+        if (m_fullUpdate) {
+            m_bytesSaved += 4 * static_cast<uint64_t>(m_desktopWidth) * static_cast<uint64_t>(m_desktopHeight);
+        } else {
+            for (const damage::rect& r : m_damage)
+                m_bytesSaved += 4 * static_cast<uint64_t>(damage::area(r));
+        }
+
+        if (++m_framesDrawn % ZERO_COPY_LOG_INTERVAL == 0)
+            logZeroCopy();
+
+        return m_fullUpdate || !m_damage.empty();
+    }
+
+    if (m_fullUpdate && !m_cropped) {
+        m_dev->CopyResource(desktopTex, d3dresource);
+        m_needsFullCopy = false;
+        return true;
+    }
+
+    if (m_fullUpdate) {
+        m_damage.assign(1, { 0, 0, damage::width(m_region), damage::height(m_region) });
+        m_needsFullCopy = false;
+    }
+
+    // The acquired image already contains the moved regions at their destination, so we
+    // can copy them from there just like the dirty regions. m_damage is relative to the
+    // region, the duplicated surface isn't.
+    for (const damage::rect& r : m_damage) {
+        D3D10_BOX box = {
+            .left   = static_cast<UINT>(r.left + m_region.left),
+            .top    = static_cast<UINT>(r.top + m_region.top),
+            .front  = 0,
+            .right  = static_cast<UINT>(r.right + m_region.left),
+            .bottom = static_cast<UINT>(r.bottom + m_region.top),
+            .back   = 1
+        };
+
+        m_dev->CopySubresourceRegion(desktopTex, 0, static_cast<UINT>(r.left), static_cast<UINT>(r.top), 0, d3dresource, 0, &box);
+    }
+
+    return !m_damage.empty();
 }
 
-void
-DuplicationSource::updateCursor(ID3D10Texture2D *cursorTex, LONG& cursorX, LONG& cursorY, bool& cursorVisible)
+bool
+DuplicationSource::desktopDamage(std::vector<damage::rect>& rects)
+{
+    if (m_fullUpdate)
+        return false;
+
+    rects.insert(rects.end(), m_damage.begin(), m_damage.end());
+
+    return true;
+}
+
+bool
+DuplicationSource::collectDamage()
+{
+    HRESULT hr;
+
+    m_damage.clear();
+
+    if (!m_duplInfo.TotalMetadataBufferSize)
+        return true; // nothing changed
+
+    if (m_metadata.size() < m_duplInfo.TotalMetadataBufferSize)
+        m_metadata.resize(m_duplInfo.TotalMetadataBufferSize);
+
+    // move rects come first in the buffer, dirty rects are appended after them
+    UINT moveBytes = 0;
+    hr = m_duplication->GetFrameMoveRects(static_cast<UINT>(m_metadata.size()),
+                                          reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(m_metadata.data()),
+                                          &moveBytes);
+    if FAILED(hr) {
+        logger << "Failed: GetFrameMoveRects: " << util::hresult_to_utf8(hr) << std::endl;
+        return false;
+    }
+
+    UINT dirtyBytes = 0;
+    hr = m_duplication->GetFrameDirtyRects(static_cast<UINT>(m_metadata.size() - moveBytes),
+                                           reinterpret_cast<RECT*>(m_metadata.data() + moveBytes),
+                                           &dirtyBytes);
+    if FAILED(hr) {
+        logger << "Failed: GetFrameDirtyRects: " << util::hresult_to_utf8(hr) << std::endl;
+        return false;
+    }
+
+    const DXGI_OUTDUPL_MOVE_RECT *moves = reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(m_metadata.data());
+    const RECT                   *dirty = reinterpret_cast<RECT*>(m_metadata.data() + moveBytes);
+
+    for (UINT i = 0; i < moveBytes / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++i) {
+        const RECT& dst = moves[i].DestinationRect;
+        m_damage.push_back({ dst.left, dst.top, dst.right, dst.bottom });
+    }
+
+    for (UINT i = 0; i < dirtyBytes / sizeof(RECT); ++i)
+        m_damage.push_back({ dirty[i].left, dirty[i].top, dirty[i].right, dirty[i].bottom });
+
+    D3D10_TEXTURE2D_DESC desc;
+    m_duplDesktopImage.query<ID3D10Texture2D>()->GetDesc(&desc);
+
+    damage::rect bounds = { 0, 0, static_cast<int32_t>(desc.Width), static_cast<int32_t>(desc.Height) };
+    damage::coalesce(m_damage, bounds);
+
+    if (m_cropped) {
+        m_bytesCropped += 4 * static_cast<uint64_t>(damage::crop(m_damage, m_region));
+
+        if (++m_cropUpdates % CROP_LOG_INTERVAL == 0)
+            logger << "Region: skipped " << m_bytesCropped / (1024 * 1024) << " MB of copies outside of it in "
+                   << m_cropUpdates << " frames" << std::endl;
+    }
+
+    return true;
+}
+
+bool
+DuplicationSource::updateCursor(ID3D10Texture2D *cursorTex, ID3D10Texture2D *cursorMaskTex, frame_source::cursor_state& cursorState)
 {
     HRESULT hr;
 
     if (!cursorTex || !m_frameAcquired)
-        return;
+        return false;
 
     if (!m_duplInfo.LastMouseUpdateTime.QuadPart)
-        return;
+        return false;
+
+    bool visible = m_duplInfo.PointerPosition.Visible;
+    bool changed = visible != cursorState.visible;
 
-    if ((cursorVisible = m_duplInfo.PointerPosition.Visible)) {
-        cursorX = m_duplInfo.PointerPosition.Position.x;
-        cursorY = m_duplInfo.PointerPosition.Position.y;
+    if ((cursorState.visible = visible)) {
+        changed = changed
+            || cursorState.x != m_duplInfo.PointerPosition.Position.x - m_region.left
+            || cursorState.y != m_duplInfo.PointerPosition.Position.y - m_region.top;
+
+        cursorState.x = m_duplInfo.PointerPosition.Position.x - m_region.left;
+        cursorState.y = m_duplInfo.PointerPosition.Position.y - m_region.top;
     }
 
     if (!m_duplInfo.PointerShapeBufferSize)
-        return;
+        return changed;
 
-    std::unique_ptr<uint8_t[]> buffer(new uint8_t[m_duplInfo.PointerShapeBufferSize]);
+    if (m_pointerShape.size() < m_duplInfo.PointerShapeBufferSize)
+        m_pointerShape.resize(m_duplInfo.PointerShapeBufferSize);
 
     DXGI_OUTDUPL_POINTER_SHAPE_INFO pointer;
-    UINT dummy;
-    hr = m_duplication->GetFramePointerShape(m_duplInfo.PointerShapeBufferSize, reinterpret_cast<void*>(buffer.get()), &dummy, &pointer);
+    UINT shapeSize = 0;
+    hr = m_duplication->GetFramePointerShape(m_duplInfo.PointerShapeBufferSize, reinterpret_cast<void*>(m_pointerShape.data()), &shapeSize, &pointer);
     if FAILED(hr) {
         logger << "Failed: GetFramePointerShape: " << util::hresult_to_utf8(hr) << std::endl;
-        return;
+        return changed;
     }
 
+    // the same shape will show up again and again, no need to convert it every time
+    uint64_t key = cursor::hash_bytes(m_pointerShape.data(), shapeSize, cursor::hash_bytes(&pointer, sizeof(pointer)));
+
+    const cursor::image *shape = m_cursorCache.find(key);
+    if (!shape)
+        shape = &m_cursorCache.insert(key, convertPointerShape(m_pointerShape.data(), pointer));
+
+    if ((m_cursorCache.hits() + m_cursorCache.misses()) % CURSOR_CACHE_LOG_INTERVAL == 0)
+        logger << "Cursor shape cache: hits=" << m_cursorCache.hits() << " misses=" << m_cursorCache.misses() << std::endl;
+
     // we can now update the pointer shape
     D3D10_MAPPED_TEXTURE2D info;
     hr = cursorTex->Map(0, D3D10_MAP_WRITE_DISCARD, 0, &info);
     if FAILED(hr) {
         logger << "Failed: ID3D10Texture2D::Map: " << util::hresult_to_utf8(hr) << std::endl;
-        return;
+        return changed;
     }
 
-    // first, make it black and transparent
-    memset(info.pData, 0, 4 * CURSOR_TEX_SIZE * CURSOR_TEX_SIZE);
-
-    // then, fill it with the new cursor
-    if (pointer.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_COLOR) {
-        for (UINT row = 0; row < std::min(pointer.Height, CURSOR_TEX_SIZE); ++row) {
-            memcpy((char*)info.pData + row*info.RowPitch, buffer.get() + row*pointer.Pitch, std::min(pointer.Width, CURSOR_TEX_SIZE)*4);
-        }
-    } else if (pointer.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MASKED_COLOR) {
-        //FIXME: We don't want to read the desktop image back into the CPU, so we apply the mask
-        // onto a black background. This is not correct.
-        //FIXME: I haven't found a way yet to trigger this codepath at runtime.
-        for (UINT row = 0; row < std::min(pointer.Height, CURSOR_TEX_SIZE); ++row) {
-            for (UINT col = 0; col < std::min(pointer.Width, CURSOR_TEX_SIZE); ++col) {
-                uint8_t *target = &reinterpret_cast<uint8_t*>(info.pData)[row*info.RowPitch + col*4];
-                uint8_t *source = &buffer[row*pointer.Pitch + col*4];
-
-                // the mask value doesn't matter because
-                //  mask==0     => Use source RGB values
-                //  mask==0xFF  => Use source RGB XOR target RGB = source RGB if the target is black
-                target[0] = source[0];
-                target[1] = source[1];
-                target[2] = source[2];
-                target[3] = 0xFF;
-            }
-        }
-    } else {
-        //FIXME: We don't want to read the desktop image back into the CPU, so we pretend to
-        //       apply the AND mask onto a black surface. This is incorrect, but doesn't look too bad.
+    cursor::copy_image(*shape, reinterpret_cast<uint8_t*>(info.pData), info.RowPitch, CURSOR_TEX_SIZE, CURSOR_TEX_SIZE);
 
-        uint8_t *and_map = buffer.get();
-        uint8_t *xor_map = and_map + pointer.Pitch*pointer.Height/2;
+    cursorTex->Unmap(0);
 
-        for (UINT row = 0; row < std::min(pointer.Height/2, CURSOR_TEX_SIZE); ++row)
-        {
-            uint8_t *and_row = &and_map[row * pointer.Pitch];
-            uint8_t *xor_row = &xor_map[row * pointer.Pitch];
+    cursorState.masked = shape->masked() && cursorMaskTex;
+    if (!cursorState.masked)
+        return true;
 
-            for (UINT col = 0; col < std::min(pointer.Width, CURSOR_TEX_SIZE); ++col) {
-                uint8_t *target = &reinterpret_cast<uint8_t*>(info.pData)[row*info.RowPitch + col*4];
+    hr = cursorMaskTex->Map(0, D3D10_MAP_WRITE_DISCARD, 0, &info);
+    if FAILED(hr) {
+        logger << "Failed: ID3D10Texture2D::Map (mask): " << util::hresult_to_utf8(hr) << std::endl;
+        cursorState.masked = false;
+        return true;
+    }
 
-                uint8_t alpha = util::get_pixel_from_row<1>(and_row, col) ? 0 : 0xFF;
-                uint8_t rgb   = util::get_pixel_from_row<1>(xor_row, col) ? 0xFF : 0;
+    cursor::copy_mask(*shape, reinterpret_cast<uint8_t*>(info.pData), info.RowPitch, CURSOR_TEX_SIZE, CURSOR_TEX_SIZE);
 
-                target[0] = rgb;
-                target[1] = rgb;
-                target[2] = rgb;
-                target[3] = alpha;
-            }
-        }
-    }
+    cursorMaskTex->Unmap(0);
 
-    cursorTex->Unmap(0);
+    return true;
 }
 
 void
 DuplicationSource::releaseFrame()
 {
-    if (m_frameAcquired && m_duplication)
+    m_frameAcquired = false;
+
+    // zero-copy: the frame is given back right before acquiring the next one
+    if (m_zeroCopy || !m_frameHeld)
+        return;
+
+    if (m_duplication)
         m_duplication->ReleaseFrame();
 
-    m_frameAcquired = false;
-}
\ No newline at end of file
+    m_frameHeld = false;
+}
+
+bool
+DuplicationSource::setZeroCopy(bool enable)
+{
+    if (enable == m_zeroCopy)
+        return true;
+
+    // the renderer would draw the whole display
+    if (enable && m_cropped)
+        return false;
+
+    if (!enable && m_frameHeld)
+        releaseHeldFrame();
+
+    if (!enable) {
+        logZeroCopy();
+
+        m_releasedTexture.clear();
+        m_redrawTexture.clear();
+        m_desktopStale = false;
+    }
+
+    m_zeroCopy      = enable;
+    m_needsFullCopy = true;
+
+    return true;
+}
+
+ID3D10Texture2D *
+DuplicationSource::frameTexture()
+{
+    if (!m_zeroCopy)
+        return nullptr;
+
+    if (m_frameHeld)
+        return m_frameTexture;
+
+    // A redraw after the frame went back to DXGI, after a resize or the like while the
+    // desktop is idle. DXGI keeps the desktop in the surface it handed out, so it is copied
+    // from there into the desktop texture, which is drawn from until the next frame.
+    if (m_desktopStale && m_releasedTexture && m_redrawTexture) {
+        m_dev->CopyResource(m_redrawTexture, m_releasedTexture);
+        m_bytesCopied += 4 * static_cast<uint64_t>(m_desktopWidth) * static_cast<uint64_t>(m_desktopHeight);
+        m_desktopStale = false;
+    }
+
+    return nullptr;
+}
+
+void
+DuplicationSource::releaseHeldFrame()
+{
+    // no copy, the surface is only kept for a redraw before the next frame
+    m_releasedTexture = m_frameTexture;
+
+    m_frameTexture.clear();
+    m_duplication->ReleaseFrame();
+    m_frameHeld = false;
+}
+
+void
+DuplicationSource::logZeroCopy()
+{
+    logger << "Zero-copy: drew " << m_framesDrawn << " frames from the duplicated surface, saved "
+           << m_bytesSaved / (1024 * 1024) << " MB of copies, copied " << m_bytesCopied / (1024 * 1024)
+           << " MB for redraws" << std::endl;
+}
@@ -4,9 +4,24 @@
 #include <dxgi1_2.h>
 
 #include "com_ptr.hpp"
+#include "damage.hpp"
+#include "cursor_cache.hpp"
+#include "frame_source.hpp"
 
+#include <vector>
+
+/**
+ * Captures a rectangle of the desktop with the desktop duplication API. The rectangle has to be
+ * inside one output. If it doesn't cover the whole output, only the changed parts inside of it
+ * are copied, into a texture of its own size.
+ */
 class DuplicationSource {
-    ID3D10Device   *m_dev;
+public:
+    typedef ID3D10Device    device_type;
+    typedef ID3D10Texture2D texture_type;
+
+private:
+    ID3D10Device   *m_dev = nullptr;
 
     int m_desktopWidth;
     int m_desktopHeight;
@@ -15,16 +30,59 @@ class DuplicationSource {
 
     com_ptr<IDXGIOutputDuplication> m_duplication;
 
-    bool                    m_frameAcquired = false;
+    // the captured rectangle in the coordinates of the duplicated output
+    damage::rect m_region  = { 0, 0, 0, 0 };
+    bool         m_cropped = false;  // m_region doesn't cover the whole output
+    uint64_t     m_bytesCropped = 0; // not copied thanks to cropping
+    uint64_t     m_cropUpdates  = 0;
+
+    bool                    m_frameAcquired = false; // acquired in this pass through the render loop
+    bool                    m_frameHeld     = false; // not given back to DXGI yet
     DXGI_OUTDUPL_FRAME_INFO m_duplInfo;
+    uint64_t                m_presentTime = 0;   // of the last frame which changed the desktop, in us
     com_ptr<IDXGIResource>  m_duplDesktopImage;
 
+    // Zero-copy mode: frames are held until the next acquireFrame, and drawn from directly.
+    // Only a redraw after the frame went back to DXGI copies the surface into the desktop
+    // texture, see frameTexture().
+    bool                     m_zeroCopy = false;
+    com_ptr<ID3D10Texture2D> m_frameTexture;
+    com_ptr<ID3D10Texture2D> m_releasedTexture;      // the surface of the last frame given back
+    com_ptr<ID3D10Texture2D> m_redrawTexture;        // the desktop texture of the renderer
+    bool                     m_desktopStale = false; // frames were drawn without a copy since
+    uint64_t                 m_bytesSaved   = 0;
+    uint64_t                 m_bytesCopied  = 0;
+    uint64_t                 m_framesDrawn  = 0;
+
+    void releaseHeldFrame();
+    void logZeroCopy();
+
+    // The desktop texture only receives the regions which changed, unless a full copy is due
+    bool                        m_needsFullCopy = true;
+    bool                        m_fullUpdate    = true;
+    std::vector<uint8_t>        m_metadata;
+    std::vector<damage::rect>   m_damage;
+
+    bool collectDamage();
+
+    // converted cursor shapes, and a reusable buffer for the raw ones
+    cursor::shape_cache         m_cursorCache;
+    std::vector<uint8_t>        m_pointerShape;
+
 public:
     void reinit(ID3D10Device *device, int x, int y, int w, int h);
     ID3D10Texture2D *createDesktopTexture();
     ID3D10Texture2D *createCursorTexture();
-    void acquireFrame();
-    void updateDesktop(ID3D10Texture2D *desktopTex);
-    void updateCursor(ID3D10Texture2D *cursorTex, LONG& cursorX, LONG& cursorY, bool& cursorVisible);
+    ID3D10Texture2D *createCursorMaskTexture();
+    bool acquireFrame(unsigned timeoutMs);
+    bool updateDesktop(ID3D10Texture2D *desktopTex);
+    bool desktopDamage(std::vector<damage::rect>& rects);
+    bool updateCursor(ID3D10Texture2D *cursorTex, ID3D10Texture2D *cursorMaskTex, frame_source::cursor_state& cursorState);
     void releaseFrame();
+    bool setZeroCopy(bool enable);
+    ID3D10Texture2D *frameTexture();
+    uint64_t presentTime() const { return m_presentTime; }
+
+    // AcquireNextFrame returns for cursor changes as well, and messages end the wait slices
+    bool wakesUp() const { return m_duplication && m_dev; }
 };
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "frame_ring.hpp"
+
+frame_ring::ring::ring(unsigned slots)
+{
+    m_count = slots < 2 ? 2 : slots > MAX_SLOTS ? MAX_SLOTS : slots;
+}
+
+void
+frame_ring::ring::add_damage(const std::vector<damage::rect> *rects)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    for (unsigned i = 0; i < m_count; ++i) {
+        slot& s = m_slots[i];
+
+        if (s.damageUnknown)
+            continue;
+
+        if (!rects || s.damage.size() + rects->size() > MAX_SLOT_DAMAGE) {
+            s.damageUnknown = true;
+            s.damage.clear();
+        } else {
+            s.damage.insert(s.damage.end(), rects->begin(), rects->end());
+        }
+    }
+}
+
+int
+frame_ring::ring::begin_write(std::vector<damage::rect>& rects, bool& full)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    // the most recent frame nobody looks at has the least to catch up on
+    int best = -1;
+
+    for (unsigned i = 0; i < m_count; ++i) {
+        const slot& s = m_slots[i];
+
+        if (static_cast<int>(i) == m_latest || s.readers || s.writing)
+            continue;
+
+        if (best < 0 || s.frame > m_slots[best].frame)
+            best = static_cast<int>(i);
+    }
+
+    if (best < 0) {
+        ++m_busy;
+        return -1;
+    }
+
+    slot& s = m_slots[best];
+
+    full = s.damageUnknown;
+    if (!full)
+        rects.insert(rects.end(), s.damage.begin(), s.damage.end());
+
+    s.writing       = true;
+    s.damage.clear();
+    s.damageUnknown = false;
+
+    return best;
+}
+
+uint64_t
+frame_ring::ring::commit(int index)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    slot& s = m_slots[index];
+
+    s.writing = false;
+    s.frame   = ++m_frame;
+    m_latest  = index;
+
+    return s.frame;
+}
+
+void
+frame_ring::ring::abort(int index)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    slot& s = m_slots[index];
+
+    s.writing       = false;
+    s.damageUnknown = true;
+    s.damage.clear();
+}
+
+int
+frame_ring::ring::acquire(uint64_t& frame)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_latest < 0)
+        return -1;
+
+    slot& s = m_slots[m_latest];
+
+    ++s.readers;
+    frame = s.frame;
+
+    return m_latest;
+}
+
+void
+frame_ring::ring::release(int index)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_slots[index].readers)
+        --m_slots[index].readers;
+}
+
+uint64_t
+frame_ring::ring::latest_frame() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    return m_frame;
+}
+
+uint64_t
+frame_ring::ring::busy() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    return m_busy;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "damage.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/** @file frame_ring.hpp
+ *
+ * Hands captured frames from a capture thread to the views through a small ring of textures,
+ * so capturing the next frame overlaps with drawing and presenting the current one.
+ *
+ * The producer writes one slot at a time. A slot it writes to is neither the latest frame nor
+ * held by any reader. Once the GPU is done writing (the producer waits for a fence), it commits
+ * the slot, which makes it the latest frame. Readers hold the latest frame while they draw
+ * from it and release it once their own fence says the GPU is done reading.
+ *
+ * Every slot remembers which regions of the desktop changed since it was written last, so
+ * the producer only has to refresh those. Only the bookkeeping is in here, the textures and
+ * fences belong to the users.
+ */
+namespace frame_ring {
+    static const unsigned MAX_SLOTS     = 4;
+    static const unsigned DEFAULT_SLOTS = 3;
+
+    /**
+     * More changed regions of a slot than this are refreshed as a whole
+     */
+    static const std::size_t MAX_SLOT_DAMAGE = 256;
+
+    /**
+     * Thread safe, for one producer and any number of readers
+     */
+    class ring {
+        struct slot {
+            uint64_t frame   = 0; // 0 if it has never been committed
+            unsigned readers = 0;
+            bool     writing = false;
+
+            // changed since the slot was written last
+            std::vector<damage::rect> damage;
+            bool                      damageUnknown = true;
+        };
+
+        mutable std::mutex m_mutex;
+        slot               m_slots[MAX_SLOTS];
+        unsigned           m_count;
+        int                m_latest = -1;
+        uint64_t           m_frame  = 0;
+        uint64_t           m_busy   = 0;
+
+    public:
+        /**
+         * @param slots Number of slots, 2 to MAX_SLOTS
+         */
+        explicit ring(unsigned slots = DEFAULT_SLOTS);
+
+        ring(const ring&) = delete;
+        ring& operator=(const ring&) = delete;
+
+        unsigned size() const { return m_count; }
+
+        /**
+         * Producer: the captured desktop changed in @a rects, nullptr if unknown
+         */
+        void add_damage(const std::vector<damage::rect> *rects);
+
+        /**
+         * Producer: picks a slot to write the current desktop to, and clears its damage.
+         *
+         * @param rects Receives the regions to refresh, unless @a full is set
+         * @param full  Set if the whole slot has to be written
+         * @returns The slot, or -1 if all of them are in use
+         */
+        int begin_write(std::vector<damage::rect>& rects, bool& full);
+
+        /**
+         * Producer: the slot holds the current desktop now, it becomes the latest frame.
+         * Returns its frame number.
+         */
+        uint64_t commit(int slot);
+
+        /**
+         * Producer: gives up writing to the slot, it needs a full refresh next time
+         */
+        void abort(int slot);
+
+        /**
+         * Reader: holds the latest frame until release()
+         *
+         * @returns The slot, or -1 if nothing has been committed yet
+         */
+        int acquire(uint64_t& frame);
+
+        void release(int slot);
+
+        /**
+         * Frame number of the latest frame, 0 if there is none
+         */
+        uint64_t latest_frame() const;
+
+        /**
+         * How often begin_write() found every slot in use
+         */
+        uint64_t busy() const;
+    };
+}
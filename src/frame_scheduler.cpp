@@ -0,0 +1,27 @@
+#include "frame_scheduler.hpp"
+
+unsigned
+frame_scheduler::scheduler::delay(uint64_t now) const
+{
+    if (!m_presented || now >= m_lastPresent + m_minInterval)
+        return 0;
+
+    return static_cast<unsigned>(m_lastPresent + m_minInterval - now);
+}
+
+bool
+frame_scheduler::scheduler::frame(uint64_t now, bool changed)
+{
+    if (!changed && !m_redraw) {
+        ++m_stats.idle;
+        return false;
+    }
+
+    ++m_stats.active;
+
+    m_redraw      = false;
+    m_presented   = true;
+    m_lastPresent = now;
+
+    return true;
+}
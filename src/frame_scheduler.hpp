@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+
+/** @file frame_scheduler.hpp
+ *
+ * Decides when the render loop waits, draws and presents.
+ *
+ * The render loop blocks in the frame source until a new frame arrives or the wait times out,
+ * and only draws and presents if the desktop or the cursor changed, or if the view itself
+ * needs to be drawn again. A frame rate cap protects against broken vsync.
+ *
+ * Time is passed in by the caller as milliseconds of any monotonic clock, so the scheduling
+ * can be driven by a fake clock and a fake source.
+ */
+namespace frame_scheduler {
+    /**
+     * Passes through the render loop, by outcome
+     */
+    struct stats {
+        uint64_t active = 0; // drawn and presented
+        uint64_t idle   = 0; // nothing changed, or the wait timed out
+    };
+
+    class scheduler {
+        unsigned m_minInterval;
+        unsigned m_maxWait;
+        unsigned m_wakingWait;
+
+        uint64_t m_lastPresent = 0;
+        bool     m_presented   = false;
+        bool     m_redraw      = true;
+
+        stats    m_stats;
+
+    public:
+        /**
+         * @param minInterval Minimum time between two presents, in ms
+         * @param maxWait     Longest time the source may block waiting for a frame, in ms. This
+         *                    bounds the latency of whatever the source polls rather than wakes
+         *                    up for.
+         * @param wakingWait  The same for sources which wake up for everything, see
+         *                    frame_source::wakes_up()
+         */
+        explicit scheduler(unsigned minInterval = 10, unsigned maxWait = 16, unsigned wakingWait = 1000)
+          : m_minInterval(minInterval), m_maxWait(maxWait), m_wakingWait(wakingWait) {}
+
+        /**
+         * The view has to be drawn again even if the source doesn't change, e.g. after a resize
+         */
+        void invalidate() { m_redraw = true; }
+
+        /**
+         * How long to hold off before waiting for the next frame, to keep the frame rate cap
+         */
+        unsigned delay(uint64_t now) const;
+
+        /**
+         * How long the source may block waiting for the next frame
+         *
+         * @param wakesUp Whether the source wakes up for new frames and messages by itself
+         */
+        unsigned wait_timeout(bool wakesUp = false) const { return wakesUp ? m_wakingWait : m_maxWait; }
+
+        /**
+         * Accounts for one pass through the render loop
+         *
+         * @param changed Whether the source changed the desktop or the cursor
+         * @returns Whether to draw and present
+         */
+        bool frame(uint64_t now, bool changed);
+
+        const stats& counts() const { return m_stats; }
+    };
+
+    template<class TRenderer>
+    auto wakes_up(TRenderer& renderer, int) -> decltype(static_cast<bool>(renderer.wakesUp()))
+    {
+        return renderer.wakesUp();
+    }
+
+    template<class TRenderer>
+    bool wakes_up(TRenderer&, long)
+    {
+        return false;
+    }
+
+    /**
+     * Whether the source of @a renderer wakes up for new frames and messages by itself, so the
+     * render loop may block in it for longer. False for renderers which can't tell.
+     */
+    template<class TRenderer>
+    bool wakes_up(TRenderer& renderer)
+    {
+        return wakes_up(renderer, 0);
+    }
+
+    /**
+     * One pass through the render loop: waits for the next frame, and draws it if needed
+     *
+     * TRenderer needs `bool update(unsigned timeoutMs)`, which blocks in the source and returns
+     * whether anything changed, and `void render()`, which draws and presents. It may provide
+     * `bool wakesUp()`, see wakes_up().
+     * TClock needs `uint64_t now()` and `void sleep(unsigned ms)`, which may return early.
+     *
+     * @returns Whether a frame has been presented
+     */
+    template<class TRenderer, class TClock>
+    bool run_once(scheduler& sched, TRenderer& renderer, TClock& clock)
+    {
+        unsigned delay = sched.delay(clock.now());
+        if (delay) {
+            clock.sleep(delay);
+            return false;
+        }
+
+        bool changed = renderer.update(sched.wait_timeout(wakes_up(renderer)));
+
+        if (!sched.frame(clock.now(), changed))
+            return false;
+
+        renderer.render();
+        return true;
+    }
+}
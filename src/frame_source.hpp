@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "damage.hpp"
+
+/** @file frame_source.hpp
+ *
+ * The contract between a renderer and the source of the frames it displays.
+ *
+ * A frame source names the device and texture types it works with:
+ *
+ *     typedef ... device_type;
+ *     typedef ... texture_type;
+ *
+ * and provides the following methods, which the renderer calls in this order:
+ *
+ *     // (Re)starts capturing the screen at the given desktop coordinates
+ *     void reinit(device_type *device, int x, int y, int w, int h);
+ *
+ *     // Creates textures suitable for the update methods. The caller takes ownership.
+ *     texture_type *createDesktopTexture();
+ *     texture_type *createCursorTexture();
+ *     texture_type *createCursorMaskTexture();
+ *
+ *     // Once per pass through the render loop:
+ *     bool acquireFrame(unsigned timeoutMs);
+ *     bool updateDesktop(texture_type *desktopTex);
+ *     bool desktopDamage(std::vector<damage::rect>& rects);
+ *     bool updateCursor(texture_type *cursorTex, texture_type *cursorMaskTex, frame_source::cursor_state& cursor);
+ *     void releaseFrame();
+ *
+ *     // Drawing from the source's own textures, see below
+ *     bool setZeroCopy(bool enable);
+ *     texture_type *frameTexture();
+ *
+ * acquireFrame blocks for at most timeoutMs until there is a new frame, and returns whether
+ * there is one. Only then the update methods are called, which return whether they changed
+ * anything, so the renderer can skip drawing frames which look exactly like the last one.
+ * releaseFrame is always called.
+ *
+ * After updateDesktop changed the desktop texture, desktopDamage appends the regions it changed
+ * to rects. If it can't tell, it returns false and the whole texture counts as changed.
+ *
+ * If frameTexture() returns a texture, the renderer draws the desktop from that one instead of
+ * the desktop texture. It stays valid until the next acquireFrame, nullptr means there is no
+ * such frame. Sources which can hand out the captured frame itself support a zero-copy mode,
+ * setZeroCopy returns whether they do. In that mode updateDesktop doesn't touch the desktop
+ * texture, a frameTexture() returning nullptr brings it up to date for a redraw if needed.
+ * Other sources return false.
+ *
+ * updateCursor only touches the fields of the cursor state which changed. The mask texture is
+ * only written (and used by the renderer) for shapes which need it, see cursor_convert.hpp.
+ *
+ * Sources which know when the frame they acquired was presented may provide
+ *
+ *     uint64_t presentTime();
+ *
+ * in microseconds of util::microseconds_now(), 0 if unknown. See present_time().
+ *
+ * Sources which capture at a rate of their own, rather than whenever the desktop changes, may
+ * provide
+ *
+ *     bool setCaptureRate(unsigned fps);
+ *
+ * returning whether they could change it, 0 stopping capture. See set_capture_rate().
+ *
+ * Sources whose acquireFrame wakes up by itself for new frames, cursor changes and window
+ * messages, rather than polling any of them, may provide
+ *
+ *     bool wakesUp();
+ *
+ * returning true while that holds. The render loop then blocks in them for longer. See wakes_up().
+ */
+namespace frame_source {
+    /**
+     * Where and how to draw the cursor
+     */
+    struct cursor_state {
+        long x       = 0;
+        long y       = 0;
+        bool visible = true;
+        bool masked  = false; // composite with the mask texture instead of alpha blending
+    };
+
+    /**
+     * Checks whether TSource fulfills the frame source contract
+     *
+     * static_assert(frame_source::is_frame_source<MySource>::value, "...");
+     */
+    template<class TSource>
+    class is_frame_source {
+        template<class T,
+                 class TDevice  = typename T::device_type,
+                 class TTexture = typename T::texture_type>
+        static auto test(int) -> decltype(
+            std::declval<T&>().reinit(std::declval<TDevice*>(), 0, 0, 0, 0),
+            std::declval<T&>().releaseFrame(),
+            std::declval<T&>().setZeroCopy(true),
+            std::integral_constant<bool,
+                std::is_same<decltype(std::declval<T&>().acquireFrame(0u)), bool>::value &&
+                std::is_same<decltype(std::declval<T&>().updateDesktop(std::declval<TTexture*>())), bool>::value &&
+                std::is_same<decltype(std::declval<T&>().desktopDamage(std::declval<std::vector<damage::rect>&>())), bool>::value &&
+                std::is_same<decltype(std::declval<T&>().updateCursor(std::declval<TTexture*>(), std::declval<TTexture*>(), std::declval<cursor_state&>())), bool>::value &&
+                std::is_same<decltype(std::declval<T&>().createDesktopTexture()), TTexture*>::value &&
+                std::is_same<decltype(std::declval<T&>().frameTexture()), TTexture*>::value &&
+                std::is_same<decltype(std::declval<T&>().createCursorTexture()), TTexture*>::value &&
+                std::is_same<decltype(std::declval<T&>().createCursorMaskTexture()), TTexture*>::value>());
+
+        template<class T>
+        static std::false_type test(...);
+
+    public:
+        static const bool value = decltype(test<TSource>(0))::value;
+    };
+
+    template<class TSource>
+    auto present_time(TSource& source, int) -> decltype(static_cast<uint64_t>(source.presentTime()))
+    {
+        return source.presentTime();
+    }
+
+    template<class TSource>
+    uint64_t present_time(TSource&, long)
+    {
+        return 0;
+    }
+
+    /**
+     * When the frame @a source acquired last was presented, 0 if the source can't tell
+     */
+    template<class TSource>
+    uint64_t present_time(TSource& source)
+    {
+        return present_time(source, 0);
+    }
+
+    template<class TSource>
+    auto set_capture_rate(TSource& source, unsigned fps, int) -> decltype(static_cast<bool>(source.setCaptureRate(fps)))
+    {
+        return source.setCaptureRate(fps);
+    }
+
+    template<class TSource>
+    bool set_capture_rate(TSource&, unsigned, long)
+    {
+        return false;
+    }
+
+    /**
+     * Asks @a source to capture @a fps frames per second, returns false if it has no such rate
+     */
+    template<class TSource>
+    bool set_capture_rate(TSource& source, unsigned fps)
+    {
+        return set_capture_rate(source, fps, 0);
+    }
+
+    template<class TSource>
+    auto wakes_up(TSource& source, int) -> decltype(static_cast<bool>(source.wakesUp()))
+    {
+        return source.wakesUp();
+    }
+
+    template<class TSource>
+    bool wakes_up(TSource&, long)
+    {
+        return false;
+    }
+
+    /**
+     * Whether @a source wakes up for everything by itself, false if it may poll something
+     */
+    template<class TSource>
+    bool wakes_up(TSource& source)
+    {
+        return wakes_up(source, 0);
+    }
+}
@@ -0,0 +1,131 @@
+#define NOMINMAX
+
+#include "gdi_cursor.hpp"
+
+#include "logger.hpp"
+#include "cursor_convert.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace {
+    // log the cursor cache statistics every that many shape updates
+    static const uint64_t CURSOR_CACHE_LOG_INTERVAL = 64;
+
+    // Reads a cursor via GDI and converts it, unless we have already seen these exact bitmaps
+    const cursor::image *lookupCursorShape(HDC hdc, const ICONINFO& info, cursor::shape_cache& cache, UINT maxSize)
+    {
+        struct {
+            BITMAPINFOHEADER bi;
+            RGBQUAD colors[2];
+        } bmi;
+
+        util::zero_out(bmi);
+        bmi.bi.biSize = sizeof(bmi.bi);
+
+        if (!info.hbmColor) {
+            // monochrome cursor
+            if (!GetDIBits(hdc, info.hbmMask, 0, 0, nullptr, (BITMAPINFO*)&bmi, DIB_RGB_COLORS))
+                return nullptr;
+
+            UINT w = static_cast<UINT>(bmi.bi.biWidth);
+            UINT h = static_cast<UINT>(std::abs(bmi.bi.biHeight)/2);
+            bmi.bi.biHeight = -1*std::abs(bmi.bi.biHeight); // force top-down bitmap
+
+            std::unique_ptr<uint8_t[]> bits(new uint8_t[4 * w * h]);
+
+            if (!GetDIBits(hdc, info.hbmMask, 0, h*2, bits.get(), (BITMAPINFO*)&bmi, DIB_RGB_COLORS))
+                return nullptr;
+
+            LONG bpl = ((w-1)/32 + 1)*4; // bytes per line
+
+            uint64_t key = cursor::hash_bytes(bits.get(), bpl*h*2, cursor::hash_bytes(&bmi.bi, sizeof(bmi.bi)));
+            const cursor::image *cached = cache.find(key);
+            if (cached)
+                return cached;
+
+            // Without the cursor shader, we pretend to apply the AND mask onto a black surface.
+            // This is incorrect, but doesn't look too bad.
+            cursor::image img(std::min(w, maxSize), std::min(h, maxSize), true);
+
+            uint8_t *and_map = bits.get();
+            uint8_t *xor_map = bits.get() + bpl*h;
+
+            for (UINT row = 0; row < img.height; ++row) {
+                cursor::expand_monochrome(&and_map[row * bpl], &xor_map[row * bpl], img.row(row), img.width);
+                cursor::expand_monochrome_mask(&and_map[row * bpl], img.mask_row(row), img.width);
+            }
+
+            return &cache.insert(key, std::move(img));
+        } else {
+            if (!GetDIBits(hdc, info.hbmColor, 0, 1, nullptr, (BITMAPINFO *)&bmi, DIB_RGB_COLORS))
+                return nullptr;
+
+            UINT w = static_cast<UINT>(bmi.bi.biWidth);
+            UINT h = static_cast<UINT>(std::abs(bmi.bi.biHeight));
+
+            bmi.bi.biBitCount = 32;
+            bmi.bi.biCompression = BI_RGB;
+            bmi.bi.biHeight = -std::abs(bmi.bi.biHeight); // force top-down bitmap
+
+            std::unique_ptr<uint8_t[]> bits(new uint8_t[4*w*h]);
+            std::unique_ptr<uint8_t[]> mask(new uint8_t[4*w*h]);
+
+            // read the color data
+            if (!GetDIBits(hdc, info.hbmColor, 0, h, bits.get(), (BITMAPINFO *)&bmi, DIB_RGB_COLORS)) {
+                logger << "Failed: GetDIBits: " << GetLastError() << std::endl;
+                return nullptr;
+            }
+
+            // and the mask
+            bool hasMask = GetDIBits(hdc, info.hbmMask, 0, h, mask.get(), (BITMAPINFO *)&bmi, DIB_RGB_COLORS);
+
+            uint64_t key = cursor::hash_bytes(bits.get(), 4*w*h, cursor::hash_bytes(&bmi.bi, sizeof(bmi.bi)));
+            if (hasMask)
+                key = cursor::hash_bytes(mask.get(), 4*w*h, key);
+
+            const cursor::image *cached = cache.find(key);
+            if (cached)
+                return cached;
+
+            cursor::image img(std::min(w, maxSize), std::min(h, maxSize));
+
+            for (UINT y = 0; y < img.height; y++) {
+                memcpy(img.row(y), bits.get() + y*w*4, img.width*4);
+
+                if (hasMask)
+                    cursor::apply_color_mask(mask.get() + y*w*4, img.row(y), img.width);
+            }
+
+            return &cache.insert(key, std::move(img));
+        }
+    }
+}
+
+const cursor::image *
+gdi_cursor::read_shape(HCURSOR hcursor, DWORD& xHotspot, DWORD& yHotspot,
+                       cursor::shape_cache& cache, unsigned maxSize)
+{
+    util::raii<ICONINFO> info;
+    util::raii<HDC>      hdc;
+
+    if (!GetIconInfo(hcursor, info))
+        return nullptr;
+
+    xHotspot = info->xHotspot;
+    yHotspot = info->yHotspot;
+
+    if (!(*hdc = CreateCompatibleDC(NULL)))
+        return nullptr;
+
+    const cursor::image *shape = lookupCursorShape(*hdc, *info, cache, maxSize);
+    if (!shape)
+        return nullptr;
+
+    if ((cache.hits() + cache.misses()) % CURSOR_CACHE_LOG_INTERVAL == 0)
+        logger << "Cursor shape cache: hits=" << cache.hits() << " misses=" << cache.misses() << std::endl;
+
+    return shape;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <windows.h>
+
+#include "util.hpp"
+#include "cursor_cache.hpp"
+
+namespace util {
+    template<>
+    inline void raii_free(ICONINFO &ii)
+    {
+        DeleteObject(ii.hbmColor);
+        DeleteObject(ii.hbmMask);
+    }
+
+    template<>
+    inline void raii_free(HDC &hdc)
+    {
+        DeleteDC(hdc);
+    }
+}
+
+/** @file gdi_cursor.hpp
+ *
+ * Reading cursor shapes via GDI, for the sources which can't get them from DXGI
+ */
+namespace gdi_cursor {
+    /**
+     * Reads the shape and hotspot of @a hcursor and converts the shape, unless @a cache has
+     * already seen these exact bitmaps. Shapes are cut off at maxSize x maxSize.
+     *
+     * @returns The converted shape, owned by @a cache, or nullptr on failure. The hotspot is
+     *          set whenever the cursor could be read.
+     */
+    const cursor::image *read_shape(HCURSOR hcursor, DWORD& xHotspot, DWORD& yHotspot,
+                                    cursor::shape_cache& cache, unsigned maxSize);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <windows.h>
+
+#include "logger.hpp"
+#include "util.hpp"
+#include "cpu_renderer.hpp"
+#include "stats.hpp"
+
+/**
+ * The fallback for machines where Renderer can't get a D3D10 device: draws on the CPU, see
+ * cpu_renderer.hpp, and presents with SetDIBitsToDevice. Same interface as Renderer.
+ */
+template<class TSource>
+class GdiRenderer {
+    struct clock {
+        uint64_t now_us() { return util::microseconds_now(); }
+    };
+
+    HWND                        m_hwnd;
+    CpuRenderer<TSource, clock> m_renderer;
+
+public:
+    GdiRenderer(HWND hwnd, int x, int y, int w, int h) :
+        m_hwnd(hwnd)
+    {
+        logger << "Drawing on the CPU, presenting with GDI" << std::endl;
+
+        RECT cr;
+        GetClientRect(hwnd, &cr);
+        this->resize(cr);
+
+        this->reset(x, y, w, h);
+    }
+
+    GdiRenderer(const GdiRenderer&) = delete;
+    GdiRenderer& operator=(const GdiRenderer&) = delete;
+
+    void resize(const RECT& cr)
+    {
+        m_renderer.resize(cr.right - cr.left, cr.bottom - cr.top);
+    }
+
+    void reset(int x, int y, int w, int h)
+    {
+        logger << "Resetting CPU renderer to screen x="<<x<<" y="<<y<<" w="<<w<<" h="<<h << std::endl;
+
+        m_renderer.reset(x, y, w, h);
+    }
+
+    void setOption(int option, int value)
+    {
+        if (!m_renderer.setOption(option, value))
+            logger << "View option " << option << " isn't supported by the CPU renderer" << std::endl;
+    }
+
+    void startRecording(const char *path)
+    {
+        if (m_renderer.startRecording(path))
+            logger << "Recording to " << path << std::endl;
+        else
+            logger << "Failed to create recording " << path << std::endl;
+    }
+
+    void stopRecording()
+    {
+        if (const capture_file::writer *recording = m_renderer.recording())
+            logger << "Recorded " << recording->frames() << " frames, " << recording->bytes() / (1024 * 1024) << " MB" << std::endl;
+
+        m_renderer.stopRecording();
+    }
+
+    bool update(unsigned timeoutMs)
+    {
+        return m_renderer.update(timeoutMs);
+    }
+
+    void render()
+    {
+        m_renderer.render();
+
+        const cpu_surface& fb = m_renderer.framebuffer();
+        if (damage::empty(fb.bounds()))
+            return;
+
+        uint64_t drawn = util::microseconds_now();
+
+        BITMAPINFO bmi;
+        util::zero_out(bmi);
+        bmi.bmiHeader.biSize        = sizeof(bmi.bmiHeader);
+        bmi.bmiHeader.biWidth       = fb.width;
+        bmi.bmiHeader.biHeight      = -fb.height; // top-down
+        bmi.bmiHeader.biPlanes      = 1;
+        bmi.bmiHeader.biBitCount    = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        HDC dc = GetDC(m_hwnd);
+        SetDIBitsToDevice(dc, 0, 0, fb.width, fb.height, 0, 0, 0, fb.height, fb.pixels.data(), &bmi, DIB_RGB_COLORS);
+        ReleaseDC(m_hwnd, dc);
+
+        uint64_t presented = util::microseconds_now();
+        stats::time(SV_STAGE_PRESENT, presented, presented - drawn);
+        stats::count(stats::FRAMES_PRESENTED);
+    }
+};
@@ -0,0 +1,229 @@
+#define NOMINMAX
+
+#include "gdi_source.hpp"
+
+#include "util.hpp"
+#include "logger.hpp"
+#include "cursor_convert.hpp"
+#include "gdi_cursor.hpp"
+
+#include <algorithm>
+
+namespace {
+    static const int CURSOR_TEX_SIZE = 256;
+
+    // BitBlt from the screen takes a while, don't capture more often than this, in ms
+    static const uint64_t GDI_CAPTURE_INTERVAL_MS = 50;
+}
+
+GdiSource::~GdiSource()
+{
+    releaseCapture();
+}
+
+void
+GdiSource::releaseCapture()
+{
+    if (m_memDC) {
+        SelectObject(m_memDC, m_oldBitmap);
+        DeleteDC(m_memDC);
+    }
+
+    if (m_bitmap)
+        DeleteObject(m_bitmap);
+
+    m_memDC     = NULL;
+    m_bitmap    = NULL;
+    m_oldBitmap = NULL;
+    m_bits      = nullptr;
+}
+
+void
+GdiSource::reinit(cpu_device *device, int x, int y, int w, int h)
+{
+    logger << "(Re)initializing GDI source x="<<x<<" y="<<y<<" w="<<w<<" h="<<h << std::endl;
+
+    m_dev = device;
+
+    m_desktopWidth  = w;
+    m_desktopHeight = h;
+    m_desktopX      = x;
+    m_desktopY      = y;
+
+    m_lastCursorSeen = NULL;
+    m_xHotspot = 0;
+    m_yHotspot = 0;
+
+    m_lastCapture = 0;
+    m_fullUpdate  = true;
+
+    releaseCapture();
+
+    BITMAPINFO bmi;
+    util::zero_out(bmi);
+    bmi.bmiHeader.biSize        = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth       = w;
+    bmi.bmiHeader.biHeight      = -h; // top-down
+    bmi.bmiHeader.biPlanes      = 1;
+    bmi.bmiHeader.biBitCount    = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void *bits = nullptr;
+    m_bitmap = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (!m_bitmap) {
+        logger << "Failed: CreateDIBSection: " << GetLastError() << std::endl;
+        return;
+    }
+
+    m_memDC = CreateCompatibleDC(NULL);
+    if (!m_memDC) {
+        logger << "Failed: CreateCompatibleDC: " << GetLastError() << std::endl;
+        releaseCapture();
+        return;
+    }
+
+    m_oldBitmap = SelectObject(m_memDC, m_bitmap);
+    m_bits      = static_cast<uint8_t*>(bits);
+}
+
+cpu_surface *
+GdiSource::createDesktopTexture()
+{
+    m_fullUpdate = true;
+
+    return new cpu_surface(m_desktopWidth, m_desktopHeight);
+}
+
+cpu_surface *
+GdiSource::createCursorTexture()
+{
+    return new cpu_surface(CURSOR_TEX_SIZE, CURSOR_TEX_SIZE);
+}
+
+cpu_surface *
+GdiSource::createCursorMaskTexture()
+{
+    // same size and format as the cursor texture
+    return createCursorTexture();
+}
+
+bool
+GdiSource::acquireFrame(unsigned timeoutMs)
+{
+    // Like the DWM source, there is nothing to wait for but the next capture and messages.
+    // The cursor is polled on every pass.
+    uint64_t sinceCapture = util::milliseconds_now() - m_lastCapture;
+    if (sinceCapture < GDI_CAPTURE_INTERVAL_MS)
+        timeoutMs = std::min(timeoutMs, static_cast<unsigned>(GDI_CAPTURE_INTERVAL_MS - sinceCapture));
+
+    MsgWaitForMultipleObjects(0, nullptr, FALSE, timeoutMs, QS_ALLINPUT);
+
+    return true;
+}
+
+bool
+GdiSource::updateDesktop(cpu_surface *desktopTex)
+{
+    m_damage.clear();
+
+    uint64_t now = util::milliseconds_now();
+    if (!m_bits || !desktopTex || now - m_lastCapture < GDI_CAPTURE_INTERVAL_MS)
+        return false;
+
+    m_lastCapture = now;
+
+    HDC screen = GetDC(NULL);
+    BOOL ok    = BitBlt(m_memDC, 0, 0, m_desktopWidth, m_desktopHeight, screen, m_desktopX, m_desktopY, SRCCOPY | CAPTUREBLT);
+    ReleaseDC(NULL, screen);
+
+    if (!ok) {
+        logger << "Failed: BitBlt: " << GetLastError() << std::endl;
+        return false;
+    }
+
+    GdiFlush();
+
+    // GDI leaves the alpha channel undefined, the desktop is opaque
+    int width  = std::min(m_desktopWidth,  desktopTex->width);
+    int height = std::min(m_desktopHeight, desktopTex->height);
+    int band   = -1; // first row of the current run of changed rows
+
+    for (int y = 0; y < height; ++y) {
+        const uint32_t *src = reinterpret_cast<const uint32_t*>(m_bits) + static_cast<std::size_t>(y) * m_desktopWidth;
+        uint32_t       *dst = reinterpret_cast<uint32_t*>(desktopTex->row(y));
+
+        bool changed = m_fullUpdate;
+        for (int x = 0; x < width; ++x) {
+            uint32_t pixel = src[x] | 0xFF000000u;
+
+            changed = changed || pixel != dst[x];
+            dst[x]  = pixel;
+        }
+
+        if (changed && band < 0) {
+            band = y;
+        } else if (!changed && band >= 0) {
+            m_damage.push_back({ 0, band, width, y });
+            band = -1;
+        }
+    }
+
+    if (band >= 0)
+        m_damage.push_back({ 0, band, width, height });
+
+    m_fullUpdate = false;
+
+    for (const damage::rect& r : m_damage)
+        m_dev->bytes_copied += 4 * static_cast<uint64_t>(damage::area(r));
+
+    return !m_damage.empty();
+}
+
+bool
+GdiSource::desktopDamage(std::vector<damage::rect>& rects)
+{
+    rects.insert(rects.end(), m_damage.begin(), m_damage.end());
+
+    return true;
+}
+
+bool
+GdiSource::updateCursor(cpu_surface *cursorTex, cpu_surface *cursorMaskTex, frame_source::cursor_state& cursorState)
+{
+    CURSORINFO cursorinfo;
+    POINT      position;
+
+    cursorinfo.cbSize = sizeof(cursorinfo);
+
+    if (!GetCursorPos(&position) || !GetCursorInfo(&cursorinfo))
+        return false;
+
+    bool changed = false;
+
+    if (cursorinfo.hCursor != m_lastCursorSeen) {
+        m_lastCursorSeen = cursorinfo.hCursor;
+
+        const cursor::image *shape = gdi_cursor::read_shape(cursorinfo.hCursor, m_xHotspot, m_yHotspot, m_cursorCache, CURSOR_TEX_SIZE);
+        if (shape && cursorTex) {
+            cursor::copy_image(*shape, cursorTex->pixels.data(), cursorTex->pitch, cursorTex->width, cursorTex->height);
+
+            cursorState.masked = shape->masked() && cursorMaskTex;
+            if (cursorState.masked)
+                cursor::copy_mask(*shape, cursorMaskTex->pixels.data(), cursorMaskTex->pitch, cursorMaskTex->width, cursorMaskTex->height);
+        }
+
+        changed = true;
+    }
+
+    bool visible = cursorinfo.flags == CURSOR_SHOWING;
+    long x       = position.x - m_desktopX - m_xHotspot;
+    long y       = position.y - m_desktopY - m_yHotspot;
+
+    changed = changed || visible != cursorState.visible || x != cursorState.x || y != cursorState.y;
+
+    cursorState.visible = visible;
+    cursorState.x       = x;
+    cursorState.y       = y;
+
+    return changed;
+}
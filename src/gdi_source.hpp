@@ -0,0 +1,68 @@
+#pragma once
+
+#include <windows.h>
+
+#include "cpu_surface.hpp"
+#include "cursor_cache.hpp"
+#include "frame_source.hpp"
+
+#include <vector>
+
+/**
+ * Captures the screen with BitBlt, for the CPU renderer on machines without a usable D3D10
+ * device. Slow, so the desktop is only captured every so often.
+ *
+ * Changed rows are found by comparing the capture with the desktop texture, only those are
+ * copied and reported as damage.
+ */
+class GdiSource {
+public:
+    typedef cpu_device  device_type;
+    typedef cpu_surface texture_type;
+
+private:
+    cpu_device *m_dev = nullptr;
+
+    int m_desktopWidth  = 0;
+    int m_desktopHeight = 0;
+    int m_desktopX      = 0;
+    int m_desktopY      = 0;
+
+    // the capture, a top-down 32bpp DIB section
+    HDC      m_memDC     = NULL;
+    HBITMAP  m_bitmap    = NULL;
+    HGDIOBJ  m_oldBitmap = NULL;
+    uint8_t *m_bits      = nullptr;
+
+    uint64_t m_lastCapture = 0;
+    bool     m_fullUpdate  = true;
+
+    std::vector<damage::rect> m_damage;
+
+    HCURSOR m_lastCursorSeen = NULL;
+    DWORD   m_xHotspot = 0;
+    DWORD   m_yHotspot = 0;
+
+    cursor::shape_cache m_cursorCache;
+
+    void releaseCapture();
+
+public:
+    GdiSource() = default;
+    ~GdiSource();
+
+    GdiSource(const GdiSource&) = delete;
+    GdiSource& operator=(const GdiSource&) = delete;
+
+    void reinit(cpu_device *device, int x, int y, int w, int h);
+    cpu_surface *createDesktopTexture();
+    cpu_surface *createCursorTexture();
+    cpu_surface *createCursorMaskTexture();
+    bool acquireFrame(unsigned timeoutMs);
+    bool updateDesktop(cpu_surface *desktopTex);
+    bool desktopDamage(std::vector<damage::rect>& rects);
+    bool updateCursor(cpu_surface *cursorTex, cpu_surface *cursorMaskTex, frame_source::cursor_state& cursorState);
+    void releaseFrame() {}
+    bool setZeroCopy(bool) { return false; }
+    cpu_surface *frameTexture() { return nullptr; }
+};
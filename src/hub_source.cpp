@@ -0,0 +1,540 @@
+#include "hub_source.hpp"
+#include "logger.hpp"
+#include "stats.hpp"
+
+namespace {
+    // how long the capture thread waits for a frame before checking whether to quit
+    static const unsigned HUB_ACQUIRE_TIMEOUT = 100;
+
+    // how long it waits while a slot still has to be published
+    static const unsigned HUB_RING_POLL_TIMEOUT = 2;
+
+    // Whether the GPU has passed @a fence, without flushing
+    bool fencePassed(ID3D10Query *fence)
+    {
+        BOOL done = FALSE;
+
+        return fence->GetData(&done, sizeof(done), D3D10_ASYNC_GETDATA_DONOTFLUSH) == S_OK && done;
+    }
+
+    void appendDamage(std::vector<damage::rect>& rects, bool& unknown, const std::vector<damage::rect> *damage)
+    {
+        if (unknown)
+            return;
+
+        if (!damage || rects.size() + damage->size() > capture_hub::fanout::MAX_PENDING_DAMAGE) {
+            unknown = true;
+            rects.clear();
+        } else {
+            rects.insert(rects.end(), damage->begin(), damage->end());
+        }
+    }
+
+    capture_hub::registry<OutputHub>& hubs()
+    {
+        static capture_hub::registry<OutputHub> registry;
+        return registry;
+    }
+
+    // Creates a copy target like @a tex, which can be opened by other devices
+    com_ptr<ID3D10Texture2D> createSharedLike(ID3D10Device *device, ID3D10Texture2D *tex, HANDLE& handle)
+    {
+        HRESULT hr;
+        com_ptr<ID3D10Texture2D> shared;
+
+        handle = NULL;
+
+        D3D10_TEXTURE2D_DESC texdsc;
+        tex->GetDesc(&texdsc);
+
+        texdsc.Usage          = D3D10_USAGE_DEFAULT;
+        texdsc.BindFlags      = D3D10_BIND_SHADER_RESOURCE;
+        texdsc.CPUAccessFlags = 0;
+        texdsc.MiscFlags      = D3D10_RESOURCE_MISC_SHARED;
+
+        hr = device->CreateTexture2D(&texdsc, nullptr, shared.pptr_cleared());
+        if FAILED(hr) {
+            logger << "Failed: CreateTexture2D (shared): " << util::hresult_to_utf8(hr) << std::endl;
+            return com_ptr<ID3D10Texture2D>();
+        }
+
+        // start out like the original, i.e. black and transparent
+        device->CopyResource(shared, tex);
+
+        auto res = shared.query<IDXGIResource>();
+        if (!res) {
+            logger << "Failed: QueryInterface<IDXGIResource>" << std::endl;
+            return com_ptr<ID3D10Texture2D>();
+        }
+
+        hr = res->GetSharedHandle(&handle);
+        if FAILED(hr) {
+            logger << "Failed: GetSharedHandle: " << util::hresult_to_utf8(hr) << std::endl;
+            return com_ptr<ID3D10Texture2D>();
+        }
+
+        return shared;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// OutputHub
+//////////////////////////////////////////////////////////////////////////////
+OutputHub::OutputHub(const capture_hub::output& out) : m_output(out)
+{
+    logger << "Starting capture hub x="<<out.x<<" y="<<out.y<<" w="<<out.w<<" h="<<out.h << std::endl;
+
+    if (!setupDevice())
+        return;
+
+    m_source.reinit(m_device, out.x, out.y, out.w, out.h);
+
+    if (!setupTextures())
+        return;
+
+    m_threadHandle = CreateThread(nullptr, 0, &OutputHub::threadProc, reinterpret_cast<void*>(this), 0, nullptr);
+    if (!m_threadHandle) {
+        logger << "FAILED: CreateThread: " << GetLastError() << std::endl;
+    }
+}
+
+OutputHub::~OutputHub()
+{
+    logger << "Stopping capture hub x="<<m_output.x<<" y="<<m_output.y<<" w="<<m_output.w<<" h="<<m_output.h << std::endl;
+
+    if (m_threadHandle) {
+        InterlockedExchange(&m_quit, 1);
+
+        WaitForSingleObject(m_threadHandle, INFINITE);
+        CloseHandle(m_threadHandle);
+    }
+}
+
+bool
+OutputHub::setupDevice()
+{
+    HRESULT hr;
+
+    if (!m_dxgiCreator || !m_d3dCreator)
+        return false;
+
+    // The views render with adapter #0, so we capture with it, too
+    IDXGIFactory1 *fac = nullptr;
+    hr = m_dxgiCreator(com_ptr<IDXGIFactory1>::uuid(), &fac);
+    com_ptr<IDXGIFactory1> factory = com_ptr<IDXGIFactory1>::take(fac);
+    if FAILED(hr) {
+        logger << "Failed to create IDXGIFactory1: " << util::hresult_to_utf8(hr) << std::endl;
+        return false;
+    }
+
+    com_ptr<IDXGIAdapter> adapter;
+    hr = factory->EnumAdapters(0, adapter.pptr_cleared());
+    if FAILED(hr) {
+        logger << "Failed to get Adapter #0: " << util::hresult_to_utf8(hr) << std::endl;
+        return false;
+    }
+
+    hr = m_d3dCreator(adapter,
+                      D3D10_DRIVER_TYPE_HARDWARE,
+                      nullptr,
+                      D3D10_CREATE_DEVICE_BGRA_SUPPORT,
+                      D3D10_FEATURE_LEVEL_9_1,
+                      D3D10_1_SDK_VERSION,
+                      m_device.pptr_cleared());
+    if FAILED(hr) {
+        logger << "Failed to create the capture device: " << util::hresult_to_utf8(hr) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+OutputHub::setupTextures()
+{
+    // The source writes the desktop into a texture of our own, the changed regions are copied
+    // to the ring slots from there. The cursor textures have to be mapped by the source, so
+    // they are copied over whenever the cursor changes.
+    m_desktopTexture    = com_ptr<ID3D10Texture2D>::take(m_source.createDesktopTexture());
+    m_cursorTexture     = com_ptr<ID3D10Texture2D>::take(m_source.createCursorTexture());
+    m_cursorMaskTexture = com_ptr<ID3D10Texture2D>::take(m_source.createCursorMaskTexture());
+
+    if (!m_desktopTexture || !m_cursorTexture || !m_cursorMaskTexture)
+        return false;
+
+    for (unsigned i = 0; i < m_ring.size(); ++i) {
+        m_slots[i] = createSharedLike(m_device, m_desktopTexture, m_slotHandles[i]);
+        if (!m_slots[i])
+            return false;
+    }
+
+    m_sharedCursorTexture     = createSharedLike(m_device, m_cursorTexture, m_cursorHandle);
+    m_sharedCursorMaskTexture = createSharedLike(m_device, m_cursorMaskTexture, m_cursorMaskHandle);
+
+    // Without a fence, slots are published right after flushing their copies
+    D3D10_QUERY_DESC fenceDesc = { .Query = D3D10_QUERY_EVENT, .MiscFlags = 0 };
+    HRESULT hr = m_device->CreateQuery(&fenceDesc, m_fence.pptr_cleared());
+    if FAILED(hr)
+        logger << "Failed: CreateQuery (capture fence): " << util::hresult_to_utf8(hr) << std::endl;
+
+    // the views wait for the initial copies
+    m_device->Flush();
+
+    return m_sharedCursorTexture && m_sharedCursorMaskTexture;
+}
+
+void
+OutputHub::addCaptureDamage(const std::vector<damage::rect> *damage)
+{
+    m_ring.add_damage(damage);
+    appendDamage(m_captureDamage, m_captureDamageUnknown, damage);
+
+    m_dirty = true;
+}
+
+void
+OutputHub::beginWrite()
+{
+    std::vector<damage::rect> rects;
+    bool                      full = true;
+
+    int slot = m_ring.begin_write(rects, full);
+    if (slot < 0)
+        return; // the views hold every slot, try again later
+
+    if (full) {
+        m_device->CopyResource(m_slots[slot], m_desktopTexture);
+    } else {
+        for (const damage::rect& r : rects) {
+            D3D10_BOX box = {
+                .left   = static_cast<UINT>(r.left),
+                .top    = static_cast<UINT>(r.top),
+                .front  = 0,
+                .right  = static_cast<UINT>(r.right),
+                .bottom = static_cast<UINT>(r.bottom),
+                .back   = 1
+            };
+
+            m_device->CopySubresourceRegion(m_slots[slot], 0, box.left, box.top, 0, m_desktopTexture, 0, &box);
+        }
+    }
+
+    // what the views have to redraw once the slot is published
+    m_writeDamage.swap(m_captureDamage);
+    m_writeDamageUnknown = m_captureDamageUnknown;
+    m_captureDamage.clear();
+    m_captureDamageUnknown = false;
+    m_writePresentTime     = m_capturePresentTime;
+
+    if (m_fence)
+        m_fence->End();
+
+    m_device->Flush();
+
+    m_pendingSlot = slot;
+    m_dirty       = false;
+}
+
+bool
+OutputHub::writeDone()
+{
+    return m_pendingSlot >= 0 && (!m_fence || fencePassed(m_fence));
+}
+
+CALLBACK DWORD
+OutputHub::threadProc(void *param)
+{
+    static_cast<OutputHub*>(param)->captureLoop();
+
+    return 0;
+}
+
+void
+OutputHub::captureLoop()
+{
+    frame_source::cursor_state cursor;
+    std::vector<damage::rect>  damage;
+
+    stats::recorder recorder;
+    stats::recorder::set_current(&recorder);
+
+    while (!InterlockedExchangeAdd(&m_quit, 0)) {
+        bool desktopChanged = false;
+        bool cursorChanged  = false;
+
+        // don't sleep on a slot which is about to be published
+        unsigned timeout = m_pendingSlot >= 0 || m_dirty ? HUB_RING_POLL_TIMEOUT : HUB_ACQUIRE_TIMEOUT;
+
+        uint64_t start      = util::microseconds_now();
+        bool     acquired   = m_source.acquireFrame(timeout);
+        uint64_t acquiredAt = util::microseconds_now();
+
+        stats::time(SV_STAGE_ACQUIRE, acquiredAt, acquiredAt - start);
+
+        if (acquired) {
+            desktopChanged = m_source.updateDesktop(m_desktopTexture);
+
+            if (desktopChanged) {
+                damage.clear();
+                addCaptureDamage(m_source.desktopDamage(damage) ? &damage : nullptr);
+
+                m_capturePresentTime = m_source.presentTime();
+            }
+
+            cursorChanged  = m_source.updateCursor(m_cursorTexture, m_cursorMaskTexture, cursor);
+
+            if (cursorChanged) {
+                m_device->CopyResource(m_sharedCursorTexture, m_cursorTexture);
+                m_device->CopyResource(m_sharedCursorMaskTexture, m_cursorMaskTexture);
+            }
+
+            uint64_t copiedAt = util::microseconds_now();
+            stats::time(SV_STAGE_COPY, copiedAt, copiedAt - acquiredAt);
+        }
+
+        m_source.releaseFrame();
+
+        // publish the slot written before, and start on the next one
+        bool published = writeDone();
+        if (published) {
+            m_presentTime.store(m_writePresentTime);
+            m_ring.commit(m_pendingSlot);
+            m_pendingSlot = -1;
+        }
+
+        if (published || cursorChanged) {
+            // the cursor copies have to be on their way before the views look at the textures
+            if (cursorChanged)
+                m_device->Flush();
+
+            m_fanout.publish(published, m_writeDamageUnknown ? nullptr : &m_writeDamage, cursorChanged, cursor, [](void *wakeup) {
+                SetEvent(reinterpret_cast<HANDLE>(wakeup));
+            });
+        }
+
+        if (m_pendingSlot < 0 && m_dirty)
+            beginWrite();
+    }
+
+    if (m_pendingSlot >= 0)
+        m_ring.abort(m_pendingSlot);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// HubSource
+//////////////////////////////////////////////////////////////////////////////
+HubSource::HubSource()
+{
+    m_wakeup = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    m_subscriber.wakeup = reinterpret_cast<void*>(m_wakeup);
+}
+
+HubSource::~HubSource()
+{
+    detach();
+
+    CloseHandle(m_wakeup);
+}
+
+void
+HubSource::detach()
+{
+    if (!m_hub)
+        return;
+
+    // the slots go back before the hub may go away
+    retire(m_slot);
+    m_slot = -1;
+    releaseRetired(true);
+
+    m_slots.clear();
+
+    m_hub->fanout().unsubscribe(m_subscriber);
+    m_hub = nullptr;
+
+    hubs().detach(m_output);
+}
+
+void
+HubSource::reinit(ID3D10Device *device, int x, int y, int w, int h)
+{
+    logger << "(Re)initializing hub source dev="<<device<<" x="<<x<<" y="<<y<<" w="<<w<<" h="<<h << std::endl;
+
+    detach();
+
+    m_dev    = device;
+    m_output = { x, y, w, h };
+
+    m_desktopChanged = false;
+    m_cursorChanged  = false;
+
+    m_hub = hubs().attach(m_output);
+    m_hub->fanout().subscribe(m_subscriber);
+
+    for (unsigned i = 0; i < m_hub->ring().size(); ++i)
+        m_slots.push_back(com_ptr<ID3D10Texture2D>::take(openShared(m_hub->slotHandle(i))));
+}
+
+void
+HubSource::retire(int slot)
+{
+    if (slot < 0)
+        return;
+
+    // everything drawn from the slot so far has been submitted, the fence passes after it
+    RetiredSlot retired = { slot, com_ptr<ID3D10Query>() };
+
+    if (!m_fences.empty()) {
+        retired.fence = m_fences.back();
+        m_fences.pop_back();
+    } else {
+        D3D10_QUERY_DESC fenceDesc = { .Query = D3D10_QUERY_EVENT, .MiscFlags = 0 };
+        HRESULT hr = m_dev->CreateQuery(&fenceDesc, retired.fence.pptr_cleared());
+        if FAILED(hr)
+            logger << "Failed: CreateQuery (view fence): " << util::hresult_to_utf8(hr) << std::endl;
+    }
+
+    if (retired.fence)
+        retired.fence->End();
+
+    m_retired.push_back(retired);
+}
+
+void
+HubSource::releaseRetired(bool wait)
+{
+    if (wait && !m_retired.empty())
+        m_dev->Flush();
+
+    for (auto it = m_retired.begin(); it != m_retired.end();) {
+        if (it->fence && !fencePassed(it->fence)) {
+            if (!wait) {
+                ++it;
+                continue;
+            }
+
+            while (!fencePassed(it->fence))
+                SwitchToThread();
+        }
+
+        m_hub->ring().release(it->slot);
+
+        if (it->fence)
+            m_fences.push_back(it->fence);
+
+        it = m_retired.erase(it);
+    }
+}
+
+ID3D10Texture2D *
+HubSource::openShared(HANDLE handle)
+{
+    if (!m_dev || !handle)
+        return nullptr;
+
+    ID3D10Texture2D *texture = nullptr;
+
+    HRESULT hr = m_dev->OpenSharedResource(handle, com_ptr<ID3D10Texture2D>::uuid(), reinterpret_cast<void**>(&texture));
+    if FAILED(hr)
+        logger << "Failed: OpenSharedResource: " << util::hresult_to_utf8(hr) << std::endl;
+
+    return texture;
+}
+
+ID3D10Texture2D *
+HubSource::createDesktopTexture()
+{
+    // drawn from until the first frame has been published
+    return m_hub ? openShared(m_hub->slotHandle(0)) : nullptr;
+}
+
+ID3D10Texture2D *
+HubSource::createCursorTexture()
+{
+    return m_hub ? openShared(m_hub->cursorHandle()) : nullptr;
+}
+
+ID3D10Texture2D *
+HubSource::createCursorMaskTexture()
+{
+    return m_hub ? openShared(m_hub->cursorMaskHandle()) : nullptr;
+}
+
+bool
+HubSource::acquireFrame(unsigned timeoutMs)
+{
+    // the hub wakes us up on new frames, and so do messages
+    MsgWaitForMultipleObjects(1, &m_wakeup, FALSE, timeoutMs, QS_ALLINPUT);
+
+    if (!m_hub)
+        return false;
+
+    m_hub->fanout().poll(m_subscriber, m_desktopChanged, m_cursorChanged, m_cursor);
+
+    releaseRetired(false);
+
+    if (m_desktopChanged) {
+        m_presentTime = m_hub->presentTime();
+
+        uint64_t frame;
+        int      slot = m_hub->ring().acquire(frame);
+
+        if (slot == m_slot) {
+            m_hub->ring().release(slot);
+        } else {
+            retire(m_slot);
+            m_slot = slot;
+        }
+    }
+
+    return m_desktopChanged || m_cursorChanged;
+}
+
+bool
+HubSource::updateDesktop(ID3D10Texture2D *desktopTex)
+{
+    // We draw from the hub's slots, see frameTexture(), there is nothing to copy
+    return m_desktopChanged;
+}
+
+bool
+HubSource::desktopDamage(std::vector<damage::rect>& rects)
+{
+    return m_hub && m_hub->fanout().take_damage(m_subscriber, rects);
+}
+
+bool
+HubSource::updateCursor(ID3D10Texture2D *cursorTex, ID3D10Texture2D *cursorMaskTex, frame_source::cursor_state& cursorState)
+{
+    if (m_cursorChanged)
+        cursorState = m_cursor;
+
+    return m_cursorChanged;
+}
+
+void
+HubSource::releaseFrame()
+{
+}
+
+bool
+HubSource::setZeroCopy(bool)
+{
+    // We draw from the hub's slots anyway, see frameTexture(), there is no copy to save
+    return true;
+}
+
+ID3D10Texture2D *
+HubSource::frameTexture()
+{
+    if (m_slot < 0 || static_cast<std::size_t>(m_slot) >= m_slots.size())
+        return nullptr;
+
+    return m_slots[m_slot];
+}
+
+uint64_t
+HubSource::presentTime() const
+{
+    return m_presentTime;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <d3d10_1.h>
+#include <dxgi1_2.h>
+
+#include "com_ptr.hpp"
+#include "util.hpp"
+#include "capture_hub.hpp"
+#include "duplication_source.hpp"
+#include "frame_ring.hpp"
+
+#include <atomic>
+#include <vector>
+
+/**
+ * Captures one output with its own device and thread, for any number of views.
+ *
+ * The desktop and cursor end up in shared textures, which the views open on their own devices,
+ * so an output is duplicated and copied once no matter how many views show it.
+ *
+ * The desktop is captured into a private texture, and handed to the views through a ring of
+ * shared ones, see frame_ring.hpp. A slot is published once the fence behind its copy has
+ * passed, while the thread already waits for the next frame.
+ */
+class OutputHub {
+    util::dll_func<HRESULT (REFIID, IDXGIFactory1 **)> m_dxgiCreator { L"dxgi.dll", "CreateDXGIFactory1" };
+    util::dll_func<HRESULT (IDXGIAdapter *,
+                            D3D10_DRIVER_TYPE,
+                            HMODULE,
+                            UINT,
+                            D3D10_FEATURE_LEVEL1,
+                            UINT,
+                            ID3D10Device1 **)> m_d3dCreator { L"d3d10_1.dll", "D3D10CreateDevice1" };
+
+    capture_hub::output m_output;
+
+    com_ptr<ID3D10Device1>   m_device;
+    DuplicationSource        m_source;
+
+    // written by the capture thread only, the views see the shared copies
+    com_ptr<ID3D10Texture2D> m_desktopTexture;
+    com_ptr<ID3D10Texture2D> m_cursorTexture;
+    com_ptr<ID3D10Texture2D> m_cursorMaskTexture;
+    com_ptr<ID3D10Texture2D> m_sharedCursorTexture;
+    com_ptr<ID3D10Texture2D> m_sharedCursorMaskTexture;
+
+    HANDLE m_cursorHandle     = NULL;
+    HANDLE m_cursorMaskHandle = NULL;
+
+    frame_ring::ring         m_ring;
+    com_ptr<ID3D10Texture2D> m_slots[frame_ring::MAX_SLOTS];
+    HANDLE                   m_slotHandles[frame_ring::MAX_SLOTS] = {};
+
+    // The slot being written, it is committed once m_fence has passed. The damage published
+    // with it is what the capture saw up to the start of the write.
+    com_ptr<ID3D10Query>      m_fence;
+    int                       m_pendingSlot = -1;
+    bool                      m_dirty       = false; // the capture is ahead of the latest slot
+    std::vector<damage::rect> m_captureDamage;
+    bool                      m_captureDamageUnknown = true;
+    std::vector<damage::rect> m_writeDamage;
+    bool                      m_writeDamageUnknown   = true;
+
+    // when the captured, written and latest published frames were presented, in us
+    uint64_t              m_capturePresentTime = 0;
+    uint64_t              m_writePresentTime   = 0;
+    std::atomic<uint64_t> m_presentTime { 0 };
+
+    capture_hub::fanout m_fanout;
+
+    HANDLE        m_threadHandle = NULL;
+    volatile LONG m_quit         = 0;
+
+    bool setupDevice();
+    bool setupTextures();
+    void addCaptureDamage(const std::vector<damage::rect> *damage);
+    void beginWrite();
+    bool writeDone();
+
+    static CALLBACK DWORD threadProc(void *param);
+    void captureLoop();
+
+public:
+    explicit OutputHub(const capture_hub::output& out);
+    ~OutputHub();
+
+    OutputHub(const OutputHub&) = delete;
+    OutputHub& operator=(const OutputHub&) = delete;
+
+    capture_hub::fanout& fanout() { return m_fanout; }
+    frame_ring::ring& ring() { return m_ring; }
+
+    // Shared handles of the textures, NULL if capturing couldn't be set up
+    HANDLE slotHandle(unsigned slot) const { return m_slotHandles[slot]; }
+    HANDLE cursorHandle() const     { return m_cursorHandle; }
+    HANDLE cursorMaskHandle() const { return m_cursorMaskHandle; }
+
+    // when the desktop in the latest slot was presented
+    uint64_t presentTime() const { return m_presentTime.load(); }
+};
+
+/**
+ * A frame source showing the frames of the OutputHub of its output
+ *
+ * The view draws from the hub's ring slots opened on its device, so it never copies the
+ * desktop and is in zero-copy mode all the time.
+ */
+class HubSource {
+public:
+    typedef ID3D10Device    device_type;
+    typedef ID3D10Texture2D texture_type;
+
+private:
+    ID3D10Device        *m_dev = nullptr;
+    OutputHub           *m_hub = nullptr;
+    capture_hub::output  m_output;
+
+    capture_hub::fanout::subscriber m_subscriber;
+    HANDLE                          m_wakeup;
+
+    // The ring slots opened on our device, the one we draw from, and those we drew from
+    // before, which go back to the hub once the GPU is done with them
+    struct RetiredSlot {
+        int                  slot;
+        com_ptr<ID3D10Query> fence;
+    };
+
+    std::vector<com_ptr<ID3D10Texture2D>> m_slots;
+    int                                   m_slot = -1;
+    std::vector<RetiredSlot>              m_retired;
+    std::vector<com_ptr<ID3D10Query>>     m_fences;
+
+    // what the last poll of the hub found
+    bool                       m_desktopChanged = false;
+    bool                       m_cursorChanged  = false;
+    frame_source::cursor_state m_cursor;
+    uint64_t                   m_presentTime    = 0;
+
+    ID3D10Texture2D *openShared(HANDLE handle);
+    void detach();
+    void retire(int slot);
+    void releaseRetired(bool wait);
+
+public:
+    HubSource();
+    ~HubSource();
+
+    HubSource(const HubSource&) = delete;
+    HubSource& operator=(const HubSource&) = delete;
+
+    void reinit(ID3D10Device *device, int x, int y, int w, int h);
+    ID3D10Texture2D *createDesktopTexture();
+    ID3D10Texture2D *createCursorTexture();
+    ID3D10Texture2D *createCursorMaskTexture();
+    bool acquireFrame(unsigned timeoutMs);
+    bool updateDesktop(ID3D10Texture2D *desktopTex);
+    bool desktopDamage(std::vector<damage::rect>& rects);
+    bool updateCursor(ID3D10Texture2D *cursorTex, ID3D10Texture2D *cursorMaskTex, frame_source::cursor_state& cursorState);
+    void releaseFrame();
+    bool setZeroCopy(bool enable);
+    ID3D10Texture2D *frameTexture();
+    uint64_t presentTime() const;
+
+    // the hub wakes us up for the desktop and the cursor
+    bool wakesUp() const { return m_hub != nullptr; }
+
+    /**
+     * Signalled whenever the hub has something new, for waiting on several sources at once
+     */
+    HANDLE wakeup() const { return m_wakeup; }
+};
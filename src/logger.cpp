@@ -1,63 +1,155 @@
-#include <iostream>
-#include <sstream>
-#include <thread>
+#include <atomic>
+#include <cctype>
+#include <memory>
 #include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
 
 #include "logger.hpp"
+#include "async_log.hpp"
 #include "util.hpp"
 
 namespace {
-    // trim from start
-    inline std::string ltrim(std::string s) {
-        s.erase(s.begin(), std::find_if(s.begin(), s.end(), std::not1(std::ptr_fun<int, int>(std::isspace))));
-        return s;
-    }
+    // Records in the ring of the asynchronous mode. A burst beyond that gets dropped.
+    static const unsigned ASYNC_LOG_RECORDS = 256;
+
+    static std::mutex      g_mutex;
+    static SV_LogHandler_t g_handler  = nullptr;
+    static void           *g_userdata = nullptr;
+
+    static std::mutex        g_modeMutex;
+    static std::atomic<bool> g_async(false);
+    static unsigned          g_views = 0; // the drain thread is stopped when the last one goes
+
+    // Calls the installed handler, in synchronous mode on the logging thread itself
+    void deliver(const char *message, void *)
+    {
+        std::lock_guard<std::mutex> guard(g_mutex);
 
-    // trim from end
-    inline std::string rtrim(std::string s) {
-        s.erase(std::find_if(s.rbegin(), s.rend(), std::not1(std::ptr_fun<int, int>(std::isspace))).base(), s.end());
-        return s;
+        if (g_handler)
+            g_handler(message, g_userdata);
     }
 
-    // trim from both ends
-    inline std::string trim(std::string s) {
-        return ltrim(rtrim(s));
+    async_log::drain& asyncDrain()
+    {
+        static async_log::drain drain(deliver, nullptr, ASYNC_LOG_RECORDS);
+        return drain;
     }
 
-    static std::mutex      g_mutex;
-    static SV_LogHandler_t g_handler  = nullptr;
-    static void           *g_userdata = nullptr;
+    // Collects one message of one thread. Messages longer than the fixed buffer spill over into
+    // a string, the asynchronous mode cuts them to a record.
+    class MyLogger : public std::streambuf {
+        char        m_buffer[async_log::RECORD_SIZE];
+        std::string m_spill;
 
-    class MyLogger : public std::stringbuf {
     public:
+        MyLogger()
+        {
+            reset();
+        }
+
+        // drops whatever hasn't been flushed
+        void reset()
+        {
+            // keep room for the terminating NUL
+            setp(m_buffer, m_buffer + sizeof(m_buffer) - 1);
+            m_spill.clear();
+        }
+
+    protected:
+        virtual int_type overflow(int_type ch)
+        {
+            if (traits_type::eq_int_type(ch, traits_type::eof()))
+                return traits_type::not_eof(ch);
+
+            // the buffer is full, move it out of the way
+            m_spill.append(pbase(), pptr());
+            m_spill.push_back(traits_type::to_char_type(ch));
+
+            setp(m_buffer, m_buffer + sizeof(m_buffer) - 1);
+
+            return ch;
+        }
+
         virtual int sync()
         {
-            std::lock_guard<std::mutex> guard(g_mutex);
+            char *begin = pbase();
+            char *end   = pptr();
+
+            if (!m_spill.empty()) {
+                m_spill.append(begin, end);
 
-            if (g_handler) {
-                std::string msg = trim(this->str());
+                begin = &m_spill[0];
+                end   = begin + m_spill.size();
+            }
 
-                g_handler(msg.c_str(), g_userdata);
+            // trim from both ends
+            while (begin != end && std::isspace(static_cast<unsigned char>(*begin)))
+                ++begin;
+            while (end != begin && std::isspace(static_cast<unsigned char>(end[-1])))
+                --end;
+
+            if (g_async.load(std::memory_order_acquire)) {
+                // delivered right away, if SV_SetLogMode stopped the drain in the meantime
+                asyncDrain().post(begin, static_cast<std::size_t>(end - begin));
+            } else {
+                *end = '\0';
+                deliver(begin, nullptr);
             }
 
-            this->str(std::string());
+            reset();
 
             return 0;
         }
     };
+
+    struct ThreadLogger {
+        MyLogger     buf;
+        std::ostream stream { &buf };
+        HANDLE       owner = NULL; // the thread using it, signalled once that has exited
+    };
+
+    // Loggers of all threads which log. They aren't owned by a thread_local, so that no
+    // destructor has to run on the threads of the DWM exiting after the dll has been unloaded.
+    // A thread without one takes over that of a thread which has exited, so there are only as
+    // many as threads logged at the same time. They go away with g_loggers when the dll is
+    // unloaded, nothing of the dll may log after that.
+    static std::mutex                                 g_loggersMutex;
+    static std::vector<std::unique_ptr<ThreadLogger>> g_loggers;
+
+    thread_local ThreadLogger *g_threadLogger = nullptr;
 }
 
 std::ostream* get_logger()
 {
-    static MyLogger     *my_buf = nullptr;
-    static std::ostream *my_stream = nullptr;
+    if (!g_threadLogger) {
+        HANDLE self = OpenThread(SYNCHRONIZE, FALSE, GetCurrentThreadId());
+
+        std::lock_guard<std::mutex> guard(g_loggersMutex);
+
+        for (std::unique_ptr<ThreadLogger>& exited : g_loggers) {
+            if (!exited->owner || WaitForSingleObject(exited->owner, 0) != WAIT_OBJECT_0)
+                continue;
 
-    if (!my_buf)
-        my_buf = new MyLogger;
-    if (!my_stream)
-        my_stream = new std::ostream(my_buf);
+            // the thread may have left half a message behind
+            CloseHandle(exited->owner);
+            exited->buf.reset();
+            exited->stream.clear();
 
-    return my_stream;
+            g_threadLogger = exited.get();
+            break;
+        }
+
+        if (!g_threadLogger) {
+            g_loggers.emplace_back(new ThreadLogger);
+            g_threadLogger = g_loggers.back().get();
+        }
+
+        g_threadLogger->owner = self;
+    }
+
+    return &g_threadLogger->stream;
 }
 
 void SV_SetLogHandler(SV_LogHandler_t handler, void* userdata)
@@ -68,3 +160,40 @@ void SV_SetLogHandler(SV_LogHandler_t handler, void* userdata)
     g_userdata = userdata;
 }
 
+void SV_SetLogMode(int mode)
+{
+    std::lock_guard<std::mutex> guard(g_modeMutex);
+
+    bool async = mode == SV_LOG_ASYNC;
+
+    if (async == g_async.load(std::memory_order_relaxed))
+        return;
+
+    if (async) {
+        asyncDrain().start();
+        g_async.store(true, std::memory_order_release);
+    } else {
+        g_async.store(false, std::memory_order_release);
+        asyncDrain().stop();
+    }
+}
+
+void log_view_created()
+{
+    std::lock_guard<std::mutex> guard(g_modeMutex);
+
+    ++g_views;
+
+    if (g_async.load(std::memory_order_relaxed))
+        asyncDrain().start();
+}
+
+void log_view_destroyed()
+{
+    std::lock_guard<std::mutex> guard(g_modeMutex);
+
+    // Joined here rather than when the dll is unloaded, see async_log::drain::~drain. Until
+    // the next view starts it again, messages go to the handler on the thread logging.
+    if (--g_views == 0)
+        asyncDrain().stop();
+}
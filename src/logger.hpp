@@ -22,6 +22,24 @@ typedef void (__cdecl *SV_LogHandler_t)(const char *message, void *userdata);
  */
 __cdecl __declspec(dllexport) void SV_SetLogHandler(SV_LogHandler_t handler, void *userdata);
 
+/**
+ * How log messages get to the handler
+ */
+enum SV_LogMode {
+    SV_LOG_SYNC  = 0, // on the thread logging, the default
+    SV_LOG_ASYNC = 1, // queued for a background thread, dropped if the queue is full
+};
+
+/**
+ * Switches between synchronous and asynchronous logging.
+ *
+ * Switching back to synchronous logging delivers the queued messages and stops the background
+ * thread, so this must not be called while holding the loader lock. The thread also stops when
+ * the last view is destroyed, and starts again with the next one. Without views, switch back
+ * to synchronous logging before unloading the dll.
+ */
+__cdecl __declspec(dllexport) void SV_SetLogMode(int mode);
+
 } // extern "C"
 
 #ifdef __cplusplus
@@ -34,6 +52,10 @@ __cdecl __declspec(dllexport) void SV_SetLogHandler(SV_LogHandler_t handler, voi
 
 std::ostream *get_logger();
 
+// The background thread of the asynchronous mode runs while there are views, see SV_SetLogMode
+void log_view_created();
+void log_view_destroyed();
+
 #define logger (*get_logger())
 
 #endif /* __cplusplus */
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "pyramid.hpp"
+
+#include <algorithm>
+
+#if defined(__i386__) || defined(__x86_64__)
+#   define PYRAMID_X86 1
+#   include <immintrin.h>
+#endif
+
+namespace {
+    ///////////////////////////////////////////////
+    // Plain C++, also used for the row remainders
+    ///////////////////////////////////////////////
+    void downsampleScalar(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                          unsigned srcWidth, unsigned begin, unsigned end)
+    {
+        for (unsigned x = begin; x < end; ++x) {
+            unsigned left  = 2 * x;
+            unsigned right = std::min(left + 1, srcWidth - 1);
+
+            for (unsigned c = 0; c < 4; ++c) {
+                unsigned sum = row0[4 * left + c] + row0[4 * right + c] +
+                               row1[4 * left + c] + row1[4 * right + c];
+
+                dst[4 * x + c] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+        }
+    }
+
+#ifdef PYRAMID_X86
+    ///////////////////////////////////////////////
+    // SSE2: 4 destination pixels per iteration
+    ///////////////////////////////////////////////
+    __attribute__((target("sse2")))
+    void downsampleSse2(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                        unsigned srcWidth, unsigned begin, unsigned end)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i two  = _mm_set1_epi16(2);
+
+        // the right pixel of the last pair has to exist in the source
+        unsigned full = std::min(end, srcWidth / 2);
+
+        unsigned x = begin;
+        for (; x + 4 <= full; x += 4) {
+            const uint8_t *s0 = row0 + 8 * x;
+            const uint8_t *s1 = row1 + 8 * x;
+
+            // split 8 source pixels into the left and the right ones of each pair
+            __m128 a0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s0)));
+            __m128 b0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + 16)));
+            __m128 a1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s1)));
+            __m128 b1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + 16)));
+
+            __m128i left0  = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i right0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+            __m128i left1  = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i right1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+            // sum up in 16 bits
+            __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(left0, zero), _mm_unpacklo_epi8(right0, zero)),
+                                       _mm_add_epi16(_mm_unpacklo_epi8(left1, zero), _mm_unpacklo_epi8(right1, zero)));
+            __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(left0, zero), _mm_unpackhi_epi8(right0, zero)),
+                                       _mm_add_epi16(_mm_unpackhi_epi8(left1, zero), _mm_unpackhi_epi8(right1, zero)));
+
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), _mm_packus_epi16(lo, hi));
+        }
+
+        downsampleScalar(row0, row1, dst, srcWidth, x, end);
+    }
+
+    ///////////////////////////////////////////////
+    // AVX2: 8 destination pixels per iteration
+    ///////////////////////////////////////////////
+    __attribute__((target("avx2")))
+    void downsampleAvx2(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                        unsigned srcWidth, unsigned begin, unsigned end)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i two  = _mm256_set1_epi16(2);
+
+        unsigned full = std::min(end, srcWidth / 2);
+
+        unsigned x = begin;
+        for (; x + 8 <= full; x += 8) {
+            const uint8_t *s0 = row0 + 8 * x;
+            const uint8_t *s1 = row1 + 8 * x;
+
+            __m256 a0 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s0)));
+            __m256 b0 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s0 + 32)));
+            __m256 a1 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s1)));
+            __m256 b1 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s1 + 32)));
+
+            // like SSE2 within each lane, the permute after packing puts the lanes in order
+            __m256i left0  = _mm256_castps_si256(_mm256_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m256i right0 = _mm256_castps_si256(_mm256_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+            __m256i left1  = _mm256_castps_si256(_mm256_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m256i right1 = _mm256_castps_si256(_mm256_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+            __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(left0, zero), _mm256_unpacklo_epi8(right0, zero)),
+                                          _mm256_add_epi16(_mm256_unpacklo_epi8(left1, zero), _mm256_unpacklo_epi8(right1, zero)));
+            __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(left0, zero), _mm256_unpackhi_epi8(right0, zero)),
+                                          _mm256_add_epi16(_mm256_unpackhi_epi8(left1, zero), _mm256_unpackhi_epi8(right1, zero)));
+
+            lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+            hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+            // lane 0 holds a0[0,2] b0[0,2] = pixels 0, 1, 4, 5, lane 1 pixels 2, 3, 6, 7
+            __m256i packed = _mm256_packus_epi16(lo, hi);
+            packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * x), packed);
+        }
+
+        downsampleScalar(row0, row1, dst, srcWidth, x, end);
+    }
+#endif
+
+    const pyramid::kernels scalarKernels = { pyramid::isa::scalar, downsampleScalar };
+
+#ifdef PYRAMID_X86
+    const pyramid::kernels sse2Kernels = { pyramid::isa::sse2, downsampleSse2 };
+    const pyramid::kernels avx2Kernels = { pyramid::isa::avx2, downsampleAvx2 };
+#endif
+}
+
+unsigned
+pyramid::choose_level(int width, int height, int viewWidth, int viewHeight, unsigned maxLevel)
+{
+    unsigned level = 0;
+
+    while (level < maxLevel &&
+           level_extent(width,  level + 1) >= viewWidth &&
+           level_extent(height, level + 1) >= viewHeight)
+        ++level;
+
+    return level;
+}
+
+damage::rect
+pyramid::next_level_rect(const damage::rect& r, int nextWidth, int nextHeight)
+{
+    // every pixel touching the region, rounded outwards
+    damage::rect next = { r.left / 2, r.top / 2, (r.right + 1) / 2, (r.bottom + 1) / 2 };
+    damage::rect bounds = { 0, 0, nextWidth, nextHeight };
+
+    return damage::intersection(next, bounds);
+}
+
+void
+pyramid::next_level_damage(std::vector<damage::rect>& rects, int nextWidth, int nextHeight)
+{
+    damage::rect bounds = { 0, 0, nextWidth, nextHeight };
+
+    for (damage::rect& r : rects)
+        r = next_level_rect(r, nextWidth, nextHeight);
+
+    rects.erase(std::remove_if(rects.begin(), rects.end(), [](const damage::rect& r) { return damage::empty(r); }),
+                rects.end());
+
+    // halving makes neighbours overlap
+    damage::coalesce(rects, bounds);
+
+    if (rects.size() > MAX_LEVEL_RECTS)
+        rects.assign(1, bounds);
+}
+
+void
+pyramid::downsample(const kernels& k,
+                    const uint8_t *src, std::size_t srcPitch, int width, int height,
+                    uint8_t *dst, std::size_t dstPitch, const damage::rect& r)
+{
+    damage::rect bounds  = { 0, 0, level_extent(width, 1), level_extent(height, 1) };
+    damage::rect clipped = damage::intersection(r, bounds);
+    if (damage::empty(clipped))
+        return;
+
+    for (int32_t y = clipped.top; y < clipped.bottom; ++y) {
+        const uint8_t *row0 = src + static_cast<std::size_t>(2 * y) * srcPitch;
+        const uint8_t *row1 = src + static_cast<std::size_t>(std::min(2 * y + 1, height - 1)) * srcPitch;
+
+        k.downsample_row(row0, row1, dst + static_cast<std::size_t>(y) * dstPitch, static_cast<unsigned>(width),
+                         static_cast<unsigned>(clipped.left), static_cast<unsigned>(clipped.right));
+    }
+}
+
+const pyramid::kernels*
+pyramid::kernels_for(isa which)
+{
+#ifdef PYRAMID_X86
+    __builtin_cpu_init();
+
+    if (which == isa::avx2)
+        return __builtin_cpu_supports("avx2") ? &avx2Kernels : nullptr;
+    if (which == isa::sse2)
+        return __builtin_cpu_supports("sse2") ? &sse2Kernels : nullptr;
+#endif
+
+    return which == isa::scalar ? &scalarKernels : nullptr;
+}
+
+const pyramid::kernels&
+pyramid::best_kernels()
+{
+    static const kernels& best =
+        kernels_for(isa::avx2) ? *kernels_for(isa::avx2) :
+        kernels_for(isa::sse2) ? *kernels_for(isa::sse2) :
+        scalarKernels;
+
+    return best;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "damage.hpp"
+
+/** @file pyramid.hpp
+ *
+ * A pyramid of box filtered half resolution copies of the desktop, for views showing it
+ * at a fraction of its size.
+ *
+ * Level 0 is the desktop itself, every further level has half the width and height of the
+ * previous one (rounded up), and each of its pixels is the average of a 2x2 block of the
+ * previous level. Odd edges are clamped, i.e. the last column or row counts twice. A view
+ * samples the smallest level which is still at least as large as itself, so bilinear
+ * filtering never minifies by more than 2 and doesn't alias.
+ *
+ * The renderer builds the levels on the GPU, only over the regions which changed. The CPU
+ * kernels in here compute exactly the same thing, as a reference and for benchmarking.
+ */
+namespace pyramid {
+    /**
+     * Levels beyond the desktop itself, i.e. views down to 1/16 of the desktop size
+     */
+    static const unsigned MAX_LEVELS = 4;
+
+    /**
+     * More changed regions of a level than this are rebuilt as a whole, see next_level_damage()
+     */
+    static const std::size_t MAX_LEVEL_RECTS = 64;
+
+    inline int level_extent(int extent, unsigned level)
+    {
+        for (unsigned i = 0; i < level; ++i)
+            extent = (extent + 1) / 2;
+
+        return extent;
+    }
+
+    /**
+     * The level a view of viewWidth x viewHeight showing a desktop of width x height
+     * should sample, at most maxLevel
+     */
+    unsigned choose_level(int width, int height, int viewWidth, int viewHeight, unsigned maxLevel);
+
+    /**
+     * The region of the next level which depends on @a r, clipped to the next level's size
+     */
+    damage::rect next_level_rect(const damage::rect& r, int nextWidth, int nextHeight);
+
+    /**
+     * Turns the changed regions of one level into those of the next one. Returns at most
+     * MAX_LEVEL_RECTS rectangles.
+     */
+    void next_level_damage(std::vector<damage::rect>& rects, int nextWidth, int nextHeight);
+
+    enum class isa { scalar, sse2, avx2 };
+
+    struct kernels {
+        isa id;
+
+        /**
+         * Averages 2x2 blocks of two 32bpp rows into one row of half the width.
+         *
+         * @param srcWidth Pixels in the source rows. If it is odd, the last source pixel is used twice.
+         * @param begin    First destination pixel to compute
+         * @param end      One past the last destination pixel to compute, at most (srcWidth + 1) / 2
+         */
+        void (*downsample_row)(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                               unsigned srcWidth, unsigned begin, unsigned end);
+    };
+
+    /**
+     * Returns the best set of kernels supported by the running CPU
+     */
+    const kernels& best_kernels();
+
+    /**
+     * Returns the kernels for the given instruction set, or nullptr if the running CPU
+     * (or the compiler) doesn't support it
+     */
+    const kernels* kernels_for(isa which);
+
+    /**
+     * Computes @a r of the next level from a 32bpp image of width x height
+     *
+     * @param r Region of the destination, see next_level_rect()
+     */
+    void downsample(const kernels& k,
+                    const uint8_t *src, std::size_t srcPitch, int width, int height,
+                    uint8_t *dst, std::size_t dstPitch, const damage::rect& r);
+
+    inline void downsample(const uint8_t *src, std::size_t srcPitch, int width, int height,
+                           uint8_t *dst, std::size_t dstPitch, const damage::rect& r)
+    {
+        downsample(best_kernels(), src, srcPitch, width, height, dst, dstPitch, r);
+    }
+}
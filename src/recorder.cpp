@@ -0,0 +1,125 @@
+#include "recorder.hpp"
+#include "logger.hpp"
+#include "util.hpp"
+
+Recorder::~Recorder()
+{
+    stop();
+}
+
+bool
+Recorder::start(ID3D10Device *device, ID3D10Texture2D *desktop, const char *path)
+{
+    stop();
+
+    if (!device || !desktop || !path)
+        return false;
+
+    D3D10_TEXTURE2D_DESC texdsc;
+    desktop->GetDesc(&texdsc);
+
+    texdsc.MipLevels      = 1;
+    texdsc.ArraySize      = 1;
+    texdsc.Usage          = D3D10_USAGE_STAGING;
+    texdsc.BindFlags      = 0;
+    texdsc.CPUAccessFlags = D3D10_CPU_ACCESS_READ;
+    texdsc.MiscFlags      = 0;
+
+    HRESULT hr = device->CreateTexture2D(&texdsc, nullptr, m_staging.pptr_cleared());
+    if FAILED(hr) {
+        logger << "Failed: CreateTexture2D (recording): " << util::hresult_to_utf8(hr) << std::endl;
+        return false;
+    }
+
+    if (!m_writer.open(path, static_cast<int>(texdsc.Width), static_cast<int>(texdsc.Height))) {
+        logger << "Failed to create recording " << path << std::endl;
+        m_staging.clear();
+        return false;
+    }
+
+    m_dev  = device;
+    m_path = path;
+
+    logger << "Recording " << texdsc.Width << "x" << texdsc.Height << " to " << m_path << std::endl;
+
+    return true;
+}
+
+void
+Recorder::stop()
+{
+    if (!m_writer.is_open())
+        return;
+
+    logger << "Recorded " << m_writer.frames() << " frames, " << m_writer.bytes() / (1024 * 1024)
+           << " MB to " << m_path << std::endl;
+
+    m_writer.close();
+    m_staging.clear();
+    m_dev = nullptr;
+}
+
+bool
+Recorder::fits(ID3D10Texture2D *desktop) const
+{
+    if (!desktop)
+        return false;
+
+    D3D10_TEXTURE2D_DESC texdsc;
+    desktop->GetDesc(&texdsc);
+
+    return static_cast<int>(texdsc.Width) == m_writer.width() && static_cast<int>(texdsc.Height) == m_writer.height();
+}
+
+void
+Recorder::record(ID3D10Texture2D *desktop, const std::vector<damage::rect> *damage,
+                 const frame_source::cursor_state& cursor, uint64_t presentTime)
+{
+    if (!m_writer.is_open() || !desktop)
+        return;
+
+    // the staging texture keeps everything else from before, the first frame is a key frame
+    if (!damage || !m_writer.frames()) {
+        m_dev->CopyResource(m_staging, desktop);
+    } else {
+        damage::rect bounds = { 0, 0, m_writer.width(), m_writer.height() };
+
+        for (const damage::rect& r : *damage) {
+            damage::rect clipped = damage::intersection(r, bounds);
+            if (damage::empty(clipped))
+                continue;
+
+            D3D10_BOX box = {
+                .left   = static_cast<UINT>(clipped.left),
+                .top    = static_cast<UINT>(clipped.top),
+                .front  = 0,
+                .right  = static_cast<UINT>(clipped.right),
+                .bottom = static_cast<UINT>(clipped.bottom),
+                .back   = 1
+            };
+
+            m_dev->CopySubresourceRegion(m_staging, 0, box.left, box.top, 0, desktop, 0, &box);
+        }
+    }
+
+    D3D10_MAPPED_TEXTURE2D mapped;
+    HRESULT hr = m_staging->Map(0, D3D10_MAP_READ, 0, &mapped);
+    if FAILED(hr) {
+        logger << "Failed: Map (recording): " << util::hresult_to_utf8(hr) << std::endl;
+        return;
+    }
+
+    capture_file::frame_info info;
+    info.present_us  = presentTime;
+    info.recorded_us = util::microseconds_now();
+    info.cursor      = cursor;
+
+    bool written = m_writer.append(static_cast<const uint8_t*>(mapped.pData), mapped.RowPitch, damage, info);
+
+    m_staging->Unmap(0);
+
+    if (!written) {
+        logger << "Failed to write to recording " << m_path << ", stopping" << std::endl;
+        stop();
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <d3d10_1.h>
+
+#include "com_ptr.hpp"
+#include "capture_file.hpp"
+#include "frame_source.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * Records what a Renderer shows into a capture file, see capture_file.hpp.
+ *
+ * The changed regions of the desktop texture are copied into a staging texture, which keeps
+ * the whole desktop, and read back from there. Mapping it waits for the copies, so every
+ * recorded frame costs a round trip to the GPU.
+ */
+class Recorder {
+    ID3D10Device            *m_dev = nullptr;
+    com_ptr<ID3D10Texture2D> m_staging;
+    capture_file::writer     m_writer;
+    std::string              m_path;
+
+public:
+    Recorder() = default;
+    ~Recorder();
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    /**
+     * Starts recording desktops like @a desktop into a new file at @a path, a UTF-8 path
+     */
+    bool start(ID3D10Device *device, ID3D10Texture2D *desktop, const char *path);
+    void stop();
+
+    bool recording() const { return m_writer.is_open(); }
+
+    /**
+     * Whether @a desktop can be recorded into the current file
+     */
+    bool fits(ID3D10Texture2D *desktop) const;
+
+    /**
+     * Appends a frame showing @a desktop, which changed in @a damage (nullptr if unknown)
+     */
+    void record(ID3D10Texture2D *desktop, const std::vector<damage::rect> *damage,
+                const frame_source::cursor_state& cursor, uint64_t presentTime);
+};
@@ -7,10 +7,22 @@
 #include "util.hpp"
 #include "shaders.h"
 #include "com_ptr.hpp"
+#include "frame_source.hpp"
+#include "pyramid.hpp"
+#include "recorder.hpp"
+#include "stats.hpp"
+#include "view_geometry.hpp"
+#include "view_options.hpp"
+
+#include <algorithm>
+#include <vector>
 
 // Renders our desktop view scene
 template<class TSource>
 class Renderer {
+    static_assert(frame_source::is_frame_source<TSource>::value, "TSource doesn't fulfill the frame source contract, see frame_source.hpp");
+    static_assert(std::is_same<typename TSource::texture_type, ID3D10Texture2D>::value, "Renderer needs a source working on D3D10 textures");
+
     util::dll_func<HRESULT (REFIID, IDXGIFactory1 **)> m_dxgiCreator { L"dxgi.dll", "CreateDXGIFactory1" };
     util::dll_func<HRESULT (IDXGIAdapter *,
                             D3D10_DRIVER_TYPE,
@@ -30,27 +42,84 @@ class Renderer {
     com_ptr<ID3D10VertexShader>     m_vshader;
     com_ptr<ID3D10InputLayout>      m_ilayout;
     com_ptr<ID3D10SamplerState>     m_sampler;
+    com_ptr<ID3D10SamplerState>     m_pointSampler;
     com_ptr<ID3D10BlendState>       m_blendState;
+    com_ptr<ID3D10PixelShader>      m_cursorPShader;
+    com_ptr<ID3D10Buffer>           m_cursorRectBuffer;
 
     com_ptr<ID3D10Texture2D>          m_desktopTexture;
     com_ptr<ID3D10ShaderResourceView> m_desktopSrv;
     com_ptr<ID3D10Texture2D>          m_cursorTexture;
     com_ptr<ID3D10ShaderResourceView> m_cursorSrv;
+    com_ptr<ID3D10Texture2D>          m_cursorMaskTexture;
+    com_ptr<ID3D10ShaderResourceView> m_cursorMaskSrv;
     com_ptr<ID3D10Buffer>             m_desktopVBuffer;
     com_ptr<ID3D10Buffer>             m_cursorVBuffer;
 
-    bool m_cursorVisible = true;
+    frame_source::cursor_state m_cursor;
+
     UINT m_cursorWidth   = 0;
     UINT m_cursorHeight  = 0;
-    LONG m_cursorX       = 0;
-    LONG m_cursorY       = 0;
+    int  m_desktopX      = 0;
+    int  m_desktopY      = 0;
     int  m_desktopWidth  = 0;
     int  m_desktopHeight = 0;
+    int  m_viewWidth     = 0;
+    int  m_viewHeight    = 0;
+
+    // where the desktop goes, see view_geometry.hpp
+    int          m_aspect = SV_ASPECT_STRETCH;
+    damage::rect m_layout = { 0, 0, 0, 0 };
 
     struct VERTEX { float x; float y; float z; float u; float v; };
 
+    // Thumbnail mode: downscaled copies of the desktop, see pyramid.hpp. m_pyramid[i] is
+    // level i + 1, views draw from level m_level, 0 being the desktop texture itself.
+    struct PyramidLevel {
+        com_ptr<ID3D10Texture2D>          texture;
+        com_ptr<ID3D10RenderTargetView>   renderTarget;
+        com_ptr<ID3D10ShaderResourceView> srv;
+        int                               width;
+        int                               height;
+    };
+
+    bool                      m_thumbnail    = false;
+    unsigned                  m_level        = 0;
+    std::vector<PyramidLevel> m_pyramid;
+    com_ptr<ID3D10Buffer>     m_pyramidVBuffer;
+    std::vector<damage::rect> m_pyramidDamage; // of the desktop texture, since the last render()
+    bool                      m_pyramidStale = true;
+
+    // Sources handing out frame textures (zero-copy mode, capture hub rings) are drawn from
+    // those. The views of the last few are kept, which also keeps the textures from being
+    // released and their addresses reused.
+    static const std::size_t MAX_FRAME_VIEWS = 4;
+
+    struct FrameView {
+        com_ptr<ID3D10Texture2D>          texture;
+        com_ptr<ID3D10ShaderResourceView> srv;
+    };
+
+    bool                   m_zeroCopy = false;
+    std::vector<FrameView> m_frameViews; // most recently used last
+
+    // recording what is shown, see SV_StartRecording
+    Recorder                  m_recorder;
+    std::vector<damage::rect> m_frameDamage;
+
+    // the texture holding the current desktop
+    ID3D10Texture2D *desktopTexture()
+    {
+        ID3D10Texture2D *frame = m_source.frameTexture();
+
+        return frame ? frame : static_cast<ID3D10Texture2D*>(m_desktopTexture);
+    }
+
     TSource m_source;
 
+    // whether the device and everything drawing needs could be set up
+    bool m_ok = false;
+
     bool setupDxgiAndD3DDevice(HWND hwnd)
     {
         HRESULT hr;
@@ -130,6 +199,43 @@ class Renderer {
         return true;
     }
 
+    // PShaderCursor has no level 9 version. Without it, cursors with an XOR mask are alpha
+    // blended like all the others.
+    bool setupCursorShader()
+    {
+        HRESULT hr;
+
+        if (m_device->GetFeatureLevel() < D3D10_FEATURE_LEVEL_10_0) {
+            logger << "Feature level 9, drawing XOR cursors without the desktop" << std::endl;
+            return false;
+        }
+
+        hr = m_device->CreatePixelShader(shader_compiled_PShaderCursor, sizeof(shader_compiled_PShaderCursor), m_cursorPShader.pptr_cleared());
+        if FAILED(hr) {
+            logger << "Failed to create cursor pixel shader: " << util::hresult_to_utf8(hr) << std::endl;
+            return false;
+        }
+
+        // the position of the cursor on the desktop texture, filled by updateCursorPosition()
+        D3D10_BUFFER_DESC cbufferDesc = {
+            .ByteWidth = 4 * sizeof(float),
+            .Usage = D3D10_USAGE_DYNAMIC,
+            .BindFlags = D3D10_BIND_CONSTANT_BUFFER,
+            .CPUAccessFlags = D3D10_CPU_ACCESS_WRITE,
+            .MiscFlags = 0
+        };
+        hr = m_device->CreateBuffer(&cbufferDesc, nullptr, m_cursorRectBuffer.pptr_cleared());
+        if FAILED(hr) {
+            logger << "FAILED: CreateBuffer (cursorRectBuffer): " << util::hresult_to_utf8(hr) << std::endl;
+            m_cursorPShader.clear();
+            return false;
+        }
+
+        m_device->PSSetConstantBuffers(0, 1, m_cursorRectBuffer.pptr());
+
+        return true;
+    }
+
     bool setupInputLayout()
     {
         HRESULT hr;
@@ -176,6 +282,12 @@ class Renderer {
         }
         m_device->PSSetSamplers(0, 1, m_sampler.pptr());
 
+        // for desktops magnified by whole numbers
+        samplerdsc.Filter = D3D10_FILTER_MIN_MAG_MIP_POINT;
+        hr = m_device->CreateSamplerState(&samplerdsc, m_pointSampler.pptr_cleared());
+        if FAILED(hr)
+            logger << "Failed to create point sampler state: " << util::hresult_to_utf8(hr) << std::endl;
+
         return true;
     }
 
@@ -219,7 +331,7 @@ class Renderer {
             return false;
         }
 
-        // create vertex buffers
+        // create vertex buffers, updateDesktopPosition() moves the quad according to the aspect mode
         VERTEX desktopVertices[] = {
             //  X  |   Y  |  Z  |  U  |  V   |
             { -1.0f,  1.0f, 0.0f, 0.0f, 0.0f }, // LEFT TOP
@@ -231,9 +343,9 @@ class Renderer {
         };
         D3D10_BUFFER_DESC desktopVBufferDesc = {
             .ByteWidth = sizeof(desktopVertices),
-            .Usage = D3D10_USAGE_IMMUTABLE,
+            .Usage = D3D10_USAGE_DYNAMIC,
             .BindFlags = D3D10_BIND_VERTEX_BUFFER,
-            .CPUAccessFlags = 0,
+            .CPUAccessFlags = D3D10_CPU_ACCESS_WRITE,
             .MiscFlags = 0
         };
         D3D10_SUBRESOURCE_DATA desktopVBufferData = {
@@ -270,6 +382,19 @@ class Renderer {
         m_cursorHeight = texdsc.Height;
         logger << "Cursor size: width=" << m_cursorWidth << " height=" << m_cursorHeight << std::endl;
 
+        // the AND mask of XOR cursors, only needed if we can composite them
+        m_cursorMaskSrv.clear();
+        m_cursorMaskTexture.clear();
+        if (m_cursorPShader) {
+            m_cursorMaskTexture = com_ptr<ID3D10Texture2D>::take(m_source.createCursorMaskTexture());
+
+            if (m_cursorMaskTexture) {
+                hr = m_device->CreateShaderResourceView(m_cursorMaskTexture, nullptr, m_cursorMaskSrv.pptr_cleared());
+                if FAILED(hr)
+                    logger << "Fail: CreateShaderResourceView (cursor mask): " << util::hresult_to_utf8(hr) << std::endl;
+            }
+        }
+
         // the cursor needs a vertex buffer, too!
         VERTEX vertices[6] = {
             //  X  |   Y  |  Z  |  U  |  V   |
@@ -301,15 +426,289 @@ class Renderer {
         return true;
     }
 
+    bool setupPyramid(unsigned levels)
+    {
+        HRESULT hr;
+
+        if (!m_desktopTexture)
+            return false;
+
+        D3D10_TEXTURE2D_DESC texdsc;
+        m_desktopTexture->GetDesc(&texdsc);
+
+        texdsc.MipLevels      = 1;
+        texdsc.ArraySize      = 1;
+        texdsc.Usage          = D3D10_USAGE_DEFAULT;
+        texdsc.BindFlags      = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+        texdsc.CPUAccessFlags = 0;
+        texdsc.MiscFlags      = 0;
+
+        while (m_pyramid.size() < levels) {
+            PyramidLevel level;
+            level.width  = pyramid::level_extent(m_desktopWidth,  static_cast<unsigned>(m_pyramid.size()) + 1);
+            level.height = pyramid::level_extent(m_desktopHeight, static_cast<unsigned>(m_pyramid.size()) + 1);
+
+            texdsc.Width  = static_cast<UINT>(level.width);
+            texdsc.Height = static_cast<UINT>(level.height);
+
+            hr = m_device->CreateTexture2D(&texdsc, nullptr, level.texture.pptr_cleared());
+            if FAILED(hr) {
+                logger << "FAILED: CreateTexture2D (pyramid): " << util::hresult_to_utf8(hr) << std::endl;
+                return false;
+            }
+
+            hr = m_device->CreateRenderTargetView(level.texture, nullptr, level.renderTarget.pptr_cleared());
+            if FAILED(hr) {
+                logger << "FAILED: CreateRenderTargetView (pyramid): " << util::hresult_to_utf8(hr) << std::endl;
+                return false;
+            }
+
+            hr = m_device->CreateShaderResourceView(level.texture, nullptr, level.srv.pptr_cleared());
+            if FAILED(hr) {
+                logger << "FAILED: CreateShaderResourceView (pyramid): " << util::hresult_to_utf8(hr) << std::endl;
+                return false;
+            }
+
+            m_pyramid.push_back(level);
+        }
+
+        if (!m_pyramidVBuffer) {
+            D3D10_BUFFER_DESC vbufferDesc = {
+                .ByteWidth = static_cast<UINT>(6 * pyramid::MAX_LEVEL_RECTS * sizeof(VERTEX)),
+                .Usage = D3D10_USAGE_DYNAMIC,
+                .BindFlags = D3D10_BIND_VERTEX_BUFFER,
+                .CPUAccessFlags = D3D10_CPU_ACCESS_WRITE,
+                .MiscFlags = 0
+            };
+            hr = m_device->CreateBuffer(&vbufferDesc, nullptr, m_pyramidVBuffer.pptr_cleared());
+            if FAILED(hr) {
+                logger << "FAILED: CreateBuffer (pyramidVBuffer): " << util::hresult_to_utf8(hr) << std::endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // What to draw the desktop from, the source's current frame texture if it has one
+    ID3D10ShaderResourceView *desktopSrv()
+    {
+        ID3D10Texture2D *frame = m_source.frameTexture();
+        if (!frame)
+            return m_desktopSrv;
+
+        for (std::size_t i = 0; i < m_frameViews.size(); ++i) {
+            if (m_frameViews[i].texture != frame)
+                continue;
+
+            std::rotate(m_frameViews.begin() + i, m_frameViews.begin() + i + 1, m_frameViews.end());
+            return m_frameViews.back().srv;
+        }
+
+        D3D10_TEXTURE2D_DESC texdsc;
+        frame->GetDesc(&texdsc);
+
+        FrameView view;
+        HRESULT   hr = E_INVALIDARG;
+
+        if (texdsc.BindFlags & D3D10_BIND_SHADER_RESOURCE)
+            hr = m_device->CreateShaderResourceView(frame, nullptr, view.srv.pptr_cleared());
+
+        if FAILED(hr) {
+            logger << "Can't sample the frame texture: " << util::hresult_to_utf8(hr) << std::endl;
+
+            if (m_zeroCopy) {
+                logger << "Zero-copy: going back to copies" << std::endl;
+                setOption(SV_OPTION_ZERO_COPY, 0);
+            }
+
+            return m_desktopSrv;
+        }
+
+        view.texture = com_ptr<ID3D10Texture2D>::ref(frame);
+
+        if (m_frameViews.size() >= MAX_FRAME_VIEWS)
+            m_frameViews.erase(m_frameViews.begin());
+
+        m_frameViews.push_back(view);
+
+        return m_frameViews.back().srv;
+    }
+
+    // Picks the pyramid level for the current view and desktop size, creating it if needed
+    void updateThumbnailLevel()
+    {
+        unsigned level = 0;
+
+        if (m_thumbnail && m_device)
+            level = pyramid::choose_level(m_desktopWidth, m_desktopHeight, damage::width(m_layout), damage::height(m_layout), pyramid::MAX_LEVELS);
+
+        if (level > m_pyramid.size() && !setupPyramid(level))
+            level = 0;
+
+        // only the levels in use are kept up to date
+        if (level > m_level)
+            m_pyramidStale = true;
+
+        if (level != m_level)
+            logger << "Thumbnail level " << level << " for a view of " << m_viewWidth << "x" << m_viewHeight << std::endl;
+
+        m_level = level;
+    }
+
+    // Brings the pyramid levels in use up to date with the desktop texture. Each level is drawn
+    // from the previous one, a bilinear sample in the middle of each 2x2 block is their average.
+    void updatePyramid(ID3D10ShaderResourceView *desktop)
+    {
+        if (!m_level)
+            return;
+
+        if (m_pyramidStale)
+            m_pyramidDamage.assign(1, { 0, 0, m_desktopWidth, m_desktopHeight });
+
+        if (m_pyramidDamage.empty())
+            return;
+
+        UINT stride = sizeof(VERTEX);
+        UINT offset = 0;
+
+        ID3D10ShaderResourceView *noSrv = nullptr;
+        m_device->PSSetShaderResources(0, 1, &noSrv);
+        m_device->PSSetSamplers(0, 1, m_sampler.pptr());
+        m_device->OMSetBlendState(nullptr, nullptr, 0xFFFFFFFF);
+        m_device->IASetVertexBuffers(0, 1, m_pyramidVBuffer.pptr(), &stride, &offset);
+        m_device->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+        ID3D10ShaderResourceView *source = desktop;
+        float sourceWidth  = static_cast<float>(m_desktopWidth);
+        float sourceHeight = static_cast<float>(m_desktopHeight);
+
+        for (unsigned i = 0; i < m_level; ++i) {
+            PyramidLevel& level = m_pyramid[i];
+
+            pyramid::next_level_damage(m_pyramidDamage, level.width, level.height);
+            if (m_pyramidDamage.empty())
+                break;
+
+            VERTEX *vertices = nullptr;
+
+            HRESULT hr = m_pyramidVBuffer->Map(D3D10_MAP_WRITE_DISCARD, 0, reinterpret_cast<void**>(&vertices));
+            if FAILED(hr) {
+                logger << "FAILED: ID3D10Buffer::Map (pyramidVBuffer): " << util::hresult_to_utf8(hr) << std::endl;
+                break;
+            }
+
+            float w = static_cast<float>(level.width);
+            float h = static_cast<float>(level.height);
+
+            for (const damage::rect& r : m_pyramidDamage) {
+                float left   = -1.0f + 2.0f * static_cast<float>(r.left)   / w;
+                float top    =  1.0f - 2.0f * static_cast<float>(r.top)    / h;
+                float right  = -1.0f + 2.0f * static_cast<float>(r.right)  / w;
+                float bottom =  1.0f - 2.0f * static_cast<float>(r.bottom) / h;
+                float uleft   = 2.0f * static_cast<float>(r.left)   / sourceWidth;
+                float vtop    = 2.0f * static_cast<float>(r.top)    / sourceHeight;
+                float uright  = 2.0f * static_cast<float>(r.right)  / sourceWidth;
+                float vbottom = 2.0f * static_cast<float>(r.bottom) / sourceHeight;
+
+                *vertices++ = { left,  top,    0.0f, uleft,  vtop    }; // LEFT TOP
+                *vertices++ = { right, bottom, 0.0f, uright, vbottom }; // RIGHT BOTTOM
+                *vertices++ = { left,  bottom, 0.0f, uleft,  vbottom }; // LEFT BOTTOM
+                *vertices++ = { left,  top,    0.0f, uleft,  vtop    }; // LEFT TOP
+                *vertices++ = { right, top,    0.0f, uright, vtop    }; // RIGHT TOP
+                *vertices++ = { right, bottom, 0.0f, uright, vbottom }; // RIGHT BOTTOM
+            }
+
+            m_pyramidVBuffer->Unmap();
+
+            D3D10_VIEWPORT viewport = {
+                .TopLeftX = 0,
+                .TopLeftY = 0,
+                .Width    = static_cast<UINT>(level.width),
+                .Height   = static_cast<UINT>(level.height),
+                .MinDepth = 0,
+                .MaxDepth = 0
+            };
+
+            m_device->OMSetRenderTargets(1, level.renderTarget.pptr(), nullptr);
+            m_device->RSSetViewports(1, &viewport);
+            m_device->PSSetShaderResources(0, 1, &source);
+            m_device->Draw(static_cast<UINT>(6 * m_pyramidDamage.size()), 0);
+
+            source       = level.srv;
+            sourceWidth  = w;
+            sourceHeight = h;
+        }
+
+        m_pyramidDamage.clear();
+        m_pyramidStale = false;
+
+        // back to drawing the view
+        D3D10_VIEWPORT viewport = {
+            .TopLeftX = 0,
+            .TopLeftY = 0,
+            .Width    = static_cast<UINT>(m_viewWidth),
+            .Height   = static_cast<UINT>(m_viewHeight),
+            .MinDepth = 0,
+            .MaxDepth = 0
+        };
+
+        m_device->PSSetShaderResources(0, 1, &noSrv);
+        m_device->OMSetRenderTargets(1, m_renderTarget.pptr(), nullptr);
+        m_device->RSSetViewports(1, &viewport);
+        m_device->OMSetBlendState(m_blendState, nullptr, 0xFFFFFFFF);
+    }
+
+    // Places the desktop quad according to the aspect mode and the view size
+    void updateDesktopPosition()
+    {
+        m_layout = view_geometry::desktop_rect(m_desktopWidth, m_desktopHeight, m_viewWidth, m_viewHeight, m_aspect);
+
+        updateThumbnailLevel();
+        updateCursorPosition();
+
+        if (!m_desktopVBuffer || damage::empty(m_layout))
+            return;
+
+        float left   = -1.0f + 2.0f*static_cast<float>(m_layout.left)/static_cast<float>(m_viewWidth);
+        float top    =  1.0f - 2.0f*static_cast<float>(m_layout.top)/static_cast<float>(m_viewHeight);
+        float right  = -1.0f + 2.0f*static_cast<float>(m_layout.right)/static_cast<float>(m_viewWidth);
+        float bottom =  1.0f - 2.0f*static_cast<float>(m_layout.bottom)/static_cast<float>(m_viewHeight);
+
+        VERTEX *vertices = nullptr;
+
+        HRESULT hr = m_desktopVBuffer->Map(D3D10_MAP_WRITE_DISCARD, 0, reinterpret_cast<void**>(&vertices));
+        if FAILED(hr) {
+            logger << "FAILED: ID3D10Buffer::Map (desktopVBuffer): " << util::hresult_to_utf8(hr) << std::endl;
+            return;
+        }
+
+        //  X   |   Y   |  Z  |  U  |  V   |
+        vertices[0] = { left,  top,    0.0f, 0.0f, 0.0f }; // LEFT TOP
+        vertices[1] = { right, bottom, 0.0f, 1.0f, 1.0f }; // RIGHT BOTTOM
+        vertices[2] = { left,  bottom, 0.0f, 0.0f, 1.0f }; // LEFT BOTTOM
+        vertices[3] = { left,  top,    0.0f, 0.0f, 0.0f }; // LEFT TOP
+        vertices[4] = { right, top,    0.0f, 1.0f, 0.0f }; // RIGHT TOP
+        vertices[5] = { right, bottom, 0.0f, 1.0f, 1.0f }; // RIGHT BOTTOM
+
+        m_desktopVBuffer->Unmap();
+    }
+
     void updateCursorPosition()
     {
-        if (!m_cursorVBuffer)
+        if (!m_cursorVBuffer || damage::empty(m_layout) || m_desktopWidth <= 0 || m_desktopHeight <= 0)
             return;
 
-        float left   = -1.0f + 2.0f*static_cast<float>(m_cursorX)/static_cast<float>(m_desktopWidth);
-        float top    =  1.0f - 2.0f*static_cast<float>(m_cursorY)/static_cast<float>(m_desktopHeight);
-        float right  =  left + 2.0f*static_cast<float>(m_cursorWidth)/static_cast<float>(m_desktopWidth);
-        float bottom =  top  - 2.0f*static_cast<float>(m_cursorHeight)/static_cast<float>(m_desktopHeight);
+        // the cursor is scaled like the desktop
+        float scaleX = static_cast<float>(damage::width(m_layout))  / static_cast<float>(m_desktopWidth);
+        float scaleY = static_cast<float>(damage::height(m_layout)) / static_cast<float>(m_desktopHeight);
+        float x      = static_cast<float>(m_layout.left) + static_cast<float>(m_cursor.x) * scaleX;
+        float y      = static_cast<float>(m_layout.top)  + static_cast<float>(m_cursor.y) * scaleY;
+
+        float left   = -1.0f + 2.0f*x/static_cast<float>(m_viewWidth);
+        float top    =  1.0f - 2.0f*y/static_cast<float>(m_viewHeight);
+        float right  =  left + 2.0f*static_cast<float>(m_cursorWidth)*scaleX/static_cast<float>(m_viewWidth);
+        float bottom =  top  - 2.0f*static_cast<float>(m_cursorHeight)*scaleY/static_cast<float>(m_viewHeight);
         float uleft   = 0.0f;
         float vtop    = 0.0f;
         float uright  = 1.0f;
@@ -333,6 +732,25 @@ class Renderer {
         vertices[5] = { right, bottom, 0.0f, uright, vbottom }; // RIGHT BOTTOM
 
         m_cursorVBuffer->Unmap();
+
+        if (!m_cursor.masked || !m_cursorRectBuffer)
+            return;
+
+        // the same quad in desktop texture coordinates, for PShaderCursor
+        float *rect = nullptr;
+
+        hr = m_cursorRectBuffer->Map(D3D10_MAP_WRITE_DISCARD, 0, reinterpret_cast<void**>(&rect));
+        if FAILED(hr) {
+            logger << "FAILED: ID3D10Buffer::Map (cursorRectBuffer): " << util::hresult_to_utf8(hr) << std::endl;
+            return;
+        }
+
+        rect[0] = static_cast<float>(m_cursor.x) / static_cast<float>(m_desktopWidth);
+        rect[1] = static_cast<float>(m_cursor.y) / static_cast<float>(m_desktopHeight);
+        rect[2] = static_cast<float>(m_cursor.x + static_cast<long>(m_cursorWidth))  / static_cast<float>(m_desktopWidth);
+        rect[3] = static_cast<float>(m_cursor.y + static_cast<long>(m_cursorHeight)) / static_cast<float>(m_desktopHeight);
+
+        m_cursorRectBuffer->Unmap();
     }
 
 public:
@@ -347,6 +765,8 @@ public:
         if (!setupShaders())
             return;
 
+        setupCursorShader();
+
         if (!setupInputLayout())
             return;
 
@@ -356,6 +776,8 @@ public:
         if (!setupBlendState())
             return;
 
+        m_ok = true;
+
         // sets render target and viewport
         RECT cr;
         GetClientRect(hwnd, &cr);
@@ -364,6 +786,11 @@ public:
         this->reset(x, y, w, h);
     }
 
+    /**
+     * Whether drawing works at all. If it doesn't, the view has to fall back to GdiRenderer.
+     */
+    bool ok() const { return m_ok; }
+
     void resize(const RECT& cr)
     {
         HRESULT hr;
@@ -394,68 +821,224 @@ public:
 
         m_device->OMSetRenderTargets(1, m_renderTarget.pptr(), nullptr);
 
+        m_viewWidth  = cr.right - cr.left;
+        m_viewHeight = cr.bottom - cr.top;
+
         // Create and set a viewport
         D3D10_VIEWPORT viewport = {
             .TopLeftX = 0,
             .TopLeftY = 0,
-            .Width    = static_cast<UINT>(cr.right - cr.left),
-            .Height   = static_cast<UINT>(cr.bottom - cr.top),
+            .Width    = static_cast<UINT>(m_viewWidth),
+            .Height   = static_cast<UINT>(m_viewHeight),
             .MinDepth = 0,
             .MaxDepth = 0
         };
         m_device->RSSetViewports(1, &viewport);
+
+        updateDesktopPosition();
     }
 
     void reset(int x, int y, int w, int h)
     {
+        m_desktopX      = x;
+        m_desktopY      = y;
         m_desktopWidth  = w;
         m_desktopHeight = h;
 
         logger << "Resetting renderer to screen x="<<x<<" y="<<y<<" w="<<w<<" h="<<h << std::endl;
 
+        m_frameViews.clear();
+
         m_source.reinit(m_device, x, y, w, h);
 
         setupDesktopTextureAndVertices();
         setupCursorTextureAndVertices();
+
+        // the desktop size may have changed
+        m_pyramid.clear();
+        m_level = 0;
+        updateDesktopPosition();
+
+        if (m_recorder.recording() && !m_recorder.fits(desktopTexture())) {
+            logger << "The desktop size changed, stopping the recording" << std::endl;
+            m_recorder.stop();
+        }
     }
 
-    void render() {
-        if (!m_device || !m_renderTarget)
-            return;
+    /**
+     * Starts recording the desktop and cursor into a new file at @a path, see capture_file.hpp
+     */
+    void startRecording(const char *path)
+    {
+        if (m_device)
+            m_recorder.start(m_device, desktopTexture(), path);
+    }
+
+    void stopRecording()
+    {
+        m_recorder.stop();
+    }
+
+    void setOption(int option, int value)
+    {
+        if (option == SV_OPTION_THUMBNAIL) {
+            m_thumbnail = value != 0;
+            updateThumbnailLevel();
+        } else if (option == SV_OPTION_ZERO_COPY) {
+            bool enable = value != 0;
+            if (enable == m_zeroCopy)
+                return;
+
+            if (!m_source.setZeroCopy(enable)) {
+                logger << "Zero-copy isn't supported by this frame source" << std::endl;
+                return;
+            }
+
+            logger << "Zero-copy " << (enable ? "on" : "off") << std::endl;
+            m_zeroCopy = enable;
+
+            // the desktop texture hasn't been kept up to date, start over
+            if (m_device)
+                reset(m_desktopX, m_desktopY, m_desktopWidth, m_desktopHeight);
+        } else if (option == SV_OPTION_ASPECT) {
+            m_aspect = value;
+            updateDesktopPosition();
+        } else if (option == SV_OPTION_CAPTURE_RATE) {
+            if (value < 0 || !frame_source::set_capture_rate(m_source, static_cast<unsigned>(value)))
+                logger << "The capture rate can't be set for this frame source" << std::endl;
+        } else {
+            logger << "Unknown view option " << option << std::endl;
+        }
+    }
+
+    /**
+     * Whether update() wakes up for new frames and messages without a timeout, see
+     * frame_source::wakes_up()
+     */
+    bool wakesUp() { return m_device && m_renderTarget && frame_source::wakes_up(m_source); }
+
+    /**
+     * Waits for at most @a timeoutMs for a new frame and copies it into our textures
+     *
+     * @returns Whether the desktop or the cursor changed, i.e. whether render() would draw
+     *          anything new
+     */
+    bool update(unsigned timeoutMs) {
+        if (!m_device || !m_renderTarget) {
+            // nothing will ever change, but the render loop shouldn't spin
+            MsgWaitForMultipleObjects(0, nullptr, FALSE, timeoutMs, QS_ALLINPUT);
+            return false;
+        }
+
+        bool changed = false;
 
         // acquire and copy desktop texture
-        m_source.acquireFrame();
+        uint64_t start      = util::microseconds_now();
+        bool     acquired   = m_source.acquireFrame(timeoutMs);
+        uint64_t acquiredAt = util::microseconds_now();
 
-        m_source.updateDesktop(m_desktopTexture);
-        m_source.updateCursor(m_cursorTexture, m_cursorX, m_cursorY, m_cursorVisible);
+        stats::time(SV_STAGE_ACQUIRE, acquiredAt, acquiredAt - start);
 
-        updateCursorPosition();
+        if (acquired) {
+            stats::count(stats::FRAMES_ACQUIRED);
+
+            bool desktopChanged = m_source.updateDesktop(m_desktopTexture);
+            bool pyramid        = m_level && !m_pyramidStale;
+            bool damageKnown    = true;
+
+            // the damage can be taken only once
+            m_frameDamage.clear();
+            if (desktopChanged && (pyramid || m_recorder.recording()))
+                damageKnown = m_source.desktopDamage(m_frameDamage);
+
+            if (desktopChanged && pyramid) {
+                if (damageKnown)
+                    m_pyramidDamage.insert(m_pyramidDamage.end(), m_frameDamage.begin(), m_frameDamage.end());
+                else
+                    m_pyramidStale = true;
+            }
+
+            bool cursorChanged = m_source.updateCursor(m_cursorTexture, m_cursorMaskTexture, m_cursor);
+            if (cursorChanged)
+                updateCursorPosition();
+
+            if (m_recorder.recording() && (desktopChanged || cursorChanged))
+                m_recorder.record(desktopTexture(), damageKnown ? &m_frameDamage : nullptr, m_cursor,
+                                  frame_source::present_time(m_source));
+
+            changed = desktopChanged || cursorChanged;
+
+            uint64_t copiedAt = util::microseconds_now();
+            stats::time(SV_STAGE_COPY, copiedAt, copiedAt - acquiredAt);
+        }
 
         m_source.releaseFrame();
 
+        if (!changed)
+            stats::count(stats::FRAMES_SKIPPED);
+
+        return changed;
+    }
+
+    // Draws and presents the current textures
+    void render() {
+        if (!m_device || !m_renderTarget)
+            return;
+
+        uint64_t start = util::microseconds_now();
+
+        ID3D10ShaderResourceView *desktop = desktopSrv();
+
+        updatePyramid(desktop);
+
         // draw the scene
         float gray[4] = { 0.5, 0.5, 0.5, 1.0 };
         m_device->ClearRenderTargetView(m_renderTarget, gray);
 
+        // texels magnified by whole numbers (or not at all) are drawn sharp
+        int  viewWidth  = m_level ? m_pyramid[m_level - 1].width  : m_desktopWidth;
+        int  viewHeight = m_level ? m_pyramid[m_level - 1].height : m_desktopHeight;
+        bool point      = m_pointSampler && view_geometry::integer_scale(viewWidth, viewHeight, m_layout);
+
         UINT stride = sizeof(VERTEX);
         UINT offset = 0;
         m_device->IASetVertexBuffers(0, 1, m_desktopVBuffer.pptr(), &stride, &offset);
         m_device->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-        m_device->PSSetShaderResources(0, 1, m_desktopSrv.pptr());
+        m_device->PSSetShaderResources(0, 1, m_level ? m_pyramid[m_level - 1].srv.pptr() : &desktop);
+        m_device->PSSetSamplers(0, 1, point ? m_pointSampler.pptr() : m_sampler.pptr());
         m_device->Draw(6, 0);
+        m_device->PSSetSamplers(0, 1, m_sampler.pptr());
+
+        if (m_cursor.visible && m_cursor.masked && m_cursorMaskSrv) {
+            // (desktop AND mask) XOR color, which needs the desktop underneath the cursor
+            ID3D10ShaderResourceView *srvs[] = { m_cursorSrv, m_cursorMaskSrv, desktop };
 
-        if (m_cursorVisible) {
+            m_device->IASetVertexBuffers(0, 1, m_cursorVBuffer.pptr(), &stride, &offset);
+            m_device->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+            m_device->PSSetShader(m_cursorPShader);
+            m_device->PSSetShaderResources(0, 3, srvs);
+            m_device->Draw(6, 0);
+            m_device->PSSetShader(m_pshader);
+        } else if (m_cursor.visible) {
             m_device->IASetVertexBuffers(0, 1, m_cursorVBuffer.pptr(), &stride, &offset);
             m_device->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
             m_device->PSSetShaderResources(0, 1, m_cursorSrv.pptr());
             m_device->Draw(6, 0);
         }
 
+        uint64_t drawn = util::microseconds_now();
+        stats::time(SV_STAGE_DRAW, drawn, drawn - start);
+
         m_swap->Present(1, 0);
+
+        uint64_t presented = util::microseconds_now();
+        stats::time(SV_STAGE_PRESENT, presented, presented - drawn);
+        stats::count(stats::FRAMES_PRESENTED);
     }
 
     ~Renderer()
     {
-        m_device->ClearState();
+        if (m_device)
+            m_device->ClearState();
     }
 };
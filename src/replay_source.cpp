@@ -0,0 +1,146 @@
+#include "replay_source.hpp"
+
+#include <algorithm>
+
+namespace {
+    static const int CURSOR_TEX_SIZE = 256;
+
+    // the marker standing in for the cursor, white with a black outline
+    static const int MARKER_SIZE = 12;
+}
+
+ReplaySource::ReplaySource(const char *path)
+{
+    m_reader.open(path);
+}
+
+void
+ReplaySource::seek(uint64_t n)
+{
+    m_next          = std::min(n, m_reader.frames());
+    m_needsFullCopy = true;
+}
+
+void
+ReplaySource::reinit(cpu_device *device, int, int, int, int)
+{
+    // the recording has a size of its own, playback goes on where it was
+    m_dev = device;
+
+    m_frameAcquired      = false;
+    m_needsFullCopy      = true;
+    m_cursorShapeChanged = true;
+}
+
+cpu_surface *
+ReplaySource::createDesktopTexture()
+{
+    // a new texture doesn't contain anything we could update incrementally
+    m_needsFullCopy = true;
+
+    return new cpu_surface(m_reader.width(), m_reader.height());
+}
+
+cpu_surface *
+ReplaySource::createCursorTexture()
+{
+    m_cursorShapeChanged = true;
+
+    return new cpu_surface(CURSOR_TEX_SIZE, CURSOR_TEX_SIZE);
+}
+
+cpu_surface *
+ReplaySource::createCursorMaskTexture()
+{
+    // same size and format as the cursor texture
+    return createCursorTexture();
+}
+
+bool
+ReplaySource::acquireFrame(unsigned)
+{
+    m_frameAcquired = m_reader.info(m_next, m_info);
+
+    return m_frameAcquired;
+}
+
+bool
+ReplaySource::updateDesktop(cpu_surface *desktopTex)
+{
+    m_damage.clear();
+
+    if (!m_frameAcquired || !desktopTex)
+        return false;
+
+    uint64_t copied;
+
+    m_fullUpdate = m_needsFullCopy;
+
+    if (m_needsFullCopy) {
+        copied = m_reader.seek(m_next, *desktopTex);
+        m_needsFullCopy = false;
+    } else {
+        copied = m_reader.apply(m_next, *desktopTex, &m_damage);
+    }
+
+    if (m_dev)
+        m_dev->bytes_copied += copied;
+
+    return m_fullUpdate || !m_damage.empty();
+}
+
+bool
+ReplaySource::desktopDamage(std::vector<damage::rect>& rects)
+{
+    if (m_fullUpdate)
+        return false;
+
+    rects.insert(rects.end(), m_damage.begin(), m_damage.end());
+
+    return true;
+}
+
+bool
+ReplaySource::updateCursor(cpu_surface *cursorTex, cpu_surface *, frame_source::cursor_state& cursor)
+{
+    if (!m_frameAcquired)
+        return false;
+
+    bool changed = m_cursorShapeChanged;
+
+    if (m_cursorShapeChanged && cursorTex) {
+        std::fill(cursorTex->pixels.begin(), cursorTex->pixels.end(), 0);
+
+        for (int y = 0; y < std::min(MARKER_SIZE, cursorTex->height); ++y) {
+            uint32_t *row = reinterpret_cast<uint32_t*>(cursorTex->row(y));
+
+            for (int x = 0; x < std::min(MARKER_SIZE, cursorTex->width); ++x) {
+                bool edge = x == 0 || y == 0 || x == MARKER_SIZE - 1 || y == MARKER_SIZE - 1;
+                row[x] = edge ? 0xFF000000u : 0xFFFFFFFFu;
+            }
+        }
+
+        m_cursorShapeChanged = false;
+    }
+
+    // there is no mask to go with the marker
+    const frame_source::cursor_state& recorded = m_info.cursor;
+
+    changed = changed || recorded.x != cursor.x || recorded.y != cursor.y || recorded.visible != cursor.visible;
+
+    cursor.x       = recorded.x;
+    cursor.y       = recorded.y;
+    cursor.visible = recorded.visible;
+    cursor.masked  = false;
+
+    return changed;
+}
+
+void
+ReplaySource::releaseFrame()
+{
+    if (m_frameAcquired)
+        ++m_next;
+
+    m_frameAcquired = false;
+}
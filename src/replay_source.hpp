@@ -0,0 +1,75 @@
+#pragma once
+
+#include "capture_file.hpp"
+#include "cpu_surface.hpp"
+#include "damage.hpp"
+#include "frame_source.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A frame source playing back a recording, see capture_file.hpp.
+ *
+ * Every acquired frame is the next recorded one, as fast as the renderer asks for them. Pacing
+ * the playback, e.g. by the recorded timestamps in frameInfo(), is up to the user. Only the
+ * changed tiles are copied, unless the desktop texture is new or playback jumped.
+ *
+ * Cursor shapes aren't recorded, the cursor is drawn as a marker at the recorded position.
+ */
+class ReplaySource {
+public:
+    typedef cpu_device  device_type;
+    typedef cpu_surface texture_type;
+
+private:
+    cpu_device           *m_dev = nullptr;
+    capture_file::reader  m_reader;
+
+    uint64_t m_next          = 0; // the frame acquireFrame hands out
+    bool     m_frameAcquired = false;
+    bool     m_needsFullCopy = true;
+    bool     m_fullUpdate    = true;
+    bool     m_cursorShapeChanged = true;
+
+    capture_file::frame_info  m_info;
+    std::vector<damage::rect> m_damage;
+
+public:
+    explicit ReplaySource(const char *path);
+
+    /**
+     * Whether the recording could be opened
+     */
+    bool ok() const { return m_reader.is_open(); }
+
+    uint64_t frames() const { return m_reader.frames(); }
+
+    /**
+     * The frame the next acquireFrame hands out, frames() once everything has been played
+     */
+    uint64_t position() const { return m_next; }
+
+    /**
+     * Continues playback at frame @a n
+     */
+    void seek(uint64_t n);
+
+    /**
+     * The timestamps and cursor of the acquired frame
+     */
+    const capture_file::frame_info& frameInfo() const { return m_info; }
+
+    void reinit(cpu_device *device, int x, int y, int w, int h);
+    cpu_surface *createDesktopTexture();
+    cpu_surface *createCursorTexture();
+    cpu_surface *createCursorMaskTexture();
+    bool acquireFrame(unsigned timeoutMs); // false once everything has been played
+    bool updateDesktop(cpu_surface *desktopTex);
+    bool desktopDamage(std::vector<damage::rect>& rects);
+    bool updateCursor(cpu_surface *cursorTex, cpu_surface *cursorMaskTex, frame_source::cursor_state& cursor);
+    void releaseFrame();
+    bool setZeroCopy(bool) { return false; }
+    cpu_surface *frameTexture() { return nullptr; }
+    uint64_t presentTime() const { return m_info.present_us; }
+};
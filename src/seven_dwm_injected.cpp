@@ -3,6 +3,8 @@
 #define INITGUID
 
 #include "seven_dwm_injected.hpp"
+#include "capture_rate.hpp"
+#include "shared_slots.hpp"
 #include "util.hpp"
 #include "com_ptr.hpp"
 #include "logger.hpp"
@@ -15,22 +17,28 @@
 
 #include "mhook.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cstring>
+#include <string>
 
 namespace {
     //////////////////////////////////////
     // Global variables for communication
     //////////////////////////////////////
-    std::atomic<HWND>   g_host                { 0 };
     std::atomic<LONG>   g_monitorLeft         { 0 };
     std::atomic<LONG>   g_monitorTop          { 0 };
     std::atomic<LONG>   g_monitorRight        { 0 };
     std::atomic<LONG>   g_monitorBottom       { 0 };
-    std::atomic<HANDLE> g_sharedTextureHandle { INVALID_HANDLE_VALUE };
+    std::atomic<unsigned> g_captureFps        { capture_rate::DEFAULT_FPS };
 
     // The capturing thread will check these in every iteration
-    std::atomic<IDXGISwapChain*> g_capturedSwapChain { nullptr };
-    std::atomic<ID3D10Resource*> g_captureTarget     { nullptr };
+    std::atomic<IDXGISwapChain*>         g_capturedSwapChain { nullptr };
+    std::atomic<shared_slots::control*>  g_slotControl       { nullptr };
+
+    // Set up by the entry point before hooking, see seven_dwm_injected.hpp
+    seven_dwm::channel *g_channel      = nullptr;
+    HANDLE              g_hostEvent    = NULL;
 
     //////////////////////////////////////////////////
     // D3D Stuff
@@ -39,30 +47,77 @@ namespace {
     // will contain the original IDXGISwapChain::Present function, or a trampoline to call it
     HRESULT (STDCALL *g_truePresent)(IDXGISwapChain* swap, UINT sync_interval, UINT flags);
 
-    // Opens the shared capture target texture
-    ID3D10Resource* openCaptureTarget(IDXGISwapChain *swap)
+    // The textures the frames are copied to, only touched by the DWM's render thread while
+    // Present is hooked
+    struct SlotTargets {
+        shared_slots::control  *control = nullptr;
+        shared_slots::producer  producer;
+        ID3D10Resource         *textures[shared_slots::SLOTS] = {};
+        IDXGIKeyedMutex        *mutexes[shared_slots::SLOTS]  = {};
+
+        bool ready() const { return textures[shared_slots::SLOTS - 1] != nullptr; }
+
+        void release()
+        {
+            for (uint32_t i = 0; i < shared_slots::SLOTS; ++i) {
+                if (mutexes[i])
+                    IDXGIKeyedMutex_Release(mutexes[i]);
+                if (textures[i])
+                    ID3D10Resource_Release(textures[i]);
+
+                mutexes[i]  = nullptr;
+                textures[i] = nullptr;
+            }
+        }
+    } g_slots;
+
+    // Opens the slot textures the host published last, returns whether they are usable
+    bool syncSlots(IDXGISwapChain *swap)
     {
         HRESULT hr;
-        com_ptr<ID3D10Device> device;
-        ID3D10Resource *target = nullptr;
 
-        HANDLE sharedHandle = g_sharedTextureHandle.load();
-        if (sharedHandle == INVALID_HANDLE_VALUE)
-            return nullptr;
+        shared_slots::control *control = g_slotControl.load();
+        if (!control)
+            return false;
 
+        if (control != g_slots.control) {
+            g_slots.release();
+            g_slots.control  = control;
+            g_slots.producer = shared_slots::producer(control);
+        }
+
+        uint32_t handles[shared_slots::SLOTS];
+        int32_t  width, height;
+
+        if (!g_slots.producer.sync(handles, width, height))
+            return g_slots.ready();
+
+        g_slots.release();
+
+        com_ptr<ID3D10Device> device;
         hr = IDXGISwapChain_GetDevice(swap, IID_ID3D10Device, device.pptr_as_void_cleared());
         if FAILED(hr) {
             logger << "Failed to retrieve device from swap chain: " << util::hresult_to_utf8(hr) << std::endl;
-            return nullptr;
+            return false;
         }
 
-        hr = ID3D10Device_OpenSharedResource(device, sharedHandle, IID_ID3D10Resource, (void**)&target);
-        if FAILED(hr) {
-            logger << "Failed to open shared texture: " << util::hresult_to_utf8(hr) << std::endl;
-            return nullptr;
+        for (uint32_t i = 0; i < shared_slots::SLOTS; ++i) {
+            HANDLE shared = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(handles[i]));
+
+            hr = ID3D10Device_OpenSharedResource(device, shared, IID_ID3D10Resource, (void**)&g_slots.textures[i]);
+            if SUCCEEDED(hr)
+                hr = ID3D10Resource_QueryInterface(g_slots.textures[i], IID_IDXGIKeyedMutex, (void**)&g_slots.mutexes[i]);
+
+            if FAILED(hr) {
+                logger << "Failed to open shared texture: " << util::hresult_to_utf8(hr) << std::endl;
+                g_slots.release();
+                return false;
+            }
         }
 
-        return target;
+        logger << "Copying into new " << width << "x" << height << " textures" << std::endl;
+
+        return true;
     }
 
     // Copies the back buffer into the given target
@@ -136,23 +191,44 @@ namespace {
     {
         IDXGISwapChain *capturedChain = g_capturedSwapChain.load();
 
-        // We limit the number of screenshots to 20fps
-        static DWORD lastShot = 0;
+        // Only ever touched by the DWM's render thread
+        static capture_rate::controller rate;
+        static bool                     backingOff = false;
 
         if (capturedChain == swap) {
-            // We're supposed to record this one.
-            ID3D10Resource *captureTarget = g_captureTarget.load();
-
-            if (!captureTarget) {
-                captureTarget = openCaptureTarget(swap);
-                g_captureTarget.store(captureTarget);
+            // We're supposed to record this one, as often as the host wants and we can afford.
+            unsigned fps = g_captureFps.load();
+            if (fps != rate.target()) {
+                rate.set_target(fps);
+                logger << "Copying " << rate.target() << " frames per second" << std::endl;
             }
 
-            if (captureTarget) {
-                DWORD currentTicks = GetTickCount();
-                if (currentTicks - lastShot > 50) {
-                    lastShot = currentTicks;
-                    copyBackBuffer(swap, captureTarget);
+            if (syncSlots(swap) && rate.present(util::microseconds_now())) {
+                uint32_t         slot  = g_slots.producer.slot();
+                IDXGIKeyedMutex *mutex = g_slots.mutexes[slot];
+
+                // The slot never is the one the view copies from, but it might have been until
+                // just now. The mutex orders the copies on the GPU, it's never worth waiting for.
+                if (IDXGIKeyedMutex_AcquireSync(mutex, 0, 0) != S_OK) {
+                    g_slots.producer.drop();
+                } else {
+                    uint64_t start = util::microseconds_now();
+                    copyBackBuffer(swap, g_slots.textures[slot]);
+                    rate.captured(util::microseconds_now() - start);
+
+                    IDXGIKeyedMutex_ReleaseSync(mutex, 0);
+                    if (g_slots.producer.commit())
+                        SetEvent(g_hostEvent);
+                }
+
+                if (rate.backing_off() != backingOff) {
+                    backingOff = rate.backing_off();
+
+                    if (backingOff)
+                        logger << "Copies take " << static_cast<unsigned>(rate.cost()) << "us, backing off to one every "
+                               << rate.interval() / 1000 << "ms" << std::endl;
+                    else
+                        logger << "Copying at " << rate.target() << " frames per second again" << std::endl;
                 }
             }
         } else if (!capturedChain) {
@@ -164,102 +240,67 @@ namespace {
     }
 
     //////////////////////////////////////////////////
-    // Communication window to the host
+    // Commands from the host
     //////////////////////////////////////////////////
-    class Communicator : win32::window
+    void runCommand(uint32_t type, const std::string& payload)
     {
-        static const UINT_PTR CHECK_KEEPALIVE_TIMER_ID = 42;
+        if (type == seven_dwm::COMMAND_SCREEN && payload.size() == sizeof(seven_dwm::screen_command)) {
+            seven_dwm::screen_command screen;
+            std::memcpy(&screen, payload.data(), sizeof(screen));
 
-        DWORD m_lastKeepAlive;
+            g_monitorLeft.store(screen.left);
+            g_monitorTop.store(screen.top);
+            g_monitorRight.store(screen.right);
+            g_monitorBottom.store(screen.bottom);
 
-    public:
-        DwmCommunicator(const Communicator* window) = delete;
+            g_capturedSwapChain.store(nullptr);
+        } else if (type == seven_dwm::COMMAND_CAPTURE_RATE && payload.size() == sizeof(uint32_t)) {
+            uint32_t fps;
+            std::memcpy(&fps, payload.data(), sizeof(fps));
 
-        Communicator() : win32::window(0, 0, 0, HWND_MESSAGE), m_lastKeepAlive(GetTickCount())
-        {
-            SetTimer(hwnd(), CHECK_KEEPALIVE_TIMER_ID, 1000, nullptr);
-
-            PostMessage(g_host.load(), WM_APP_INJECTED, 0, (LPARAM)hwnd());
-        }
-
-        ~Communicator()
-        {}
-
-    private:
-        LRESULT onCopydata(COPYDATASTRUCT *data)
-        {
-            if (data->dwData == COPYDATA_ID_NEWSCREEN) {
-                RECT *screen = reinterpret_cast<RECT*>(data->lpData);
-
-                g_monitorLeft.store(screen->left);
-                g_monitorTop.store(screen->top);
-                g_monitorRight.store(screen->right);
-                g_monitorBottom.store(screen->bottom);
-
-                g_capturedSwapChain.store(nullptr);
-            }
-
-            return TRUE;
-        }
-
-        LRESULT onKeepAlive()
-        {
-            m_lastKeepAlive = GetTickCount();
-
-            return TRUE;
+            g_captureFps.store(fps);
         }
+    }
 
-        LRESULT onCheckKeepAlive()
-        {
-            if ((GetTickCount() - m_lastKeepAlive) > 2000)
-                PostQuitMessage(-1);
+    // Runs the commands until the host stops bumping the keepalive
+    void serve(HANDLE commandEvent)
+    {
+        uint32_t    type;
+        std::string payload;
 
-            return TRUE;
-        }
+        uint32_t keepalive  = g_channel->keepalive.load();
+        DWORD    lastChange = GetTickCount();
 
-        LRESULT onNewTexture(HANDLE tex)
-        {
-            g_sharedTextureHandle.store(tex);
-            ID3D10Resource *res = g_captureTarget.exchange(nullptr);
-            if (res)
-                ID3D10Resource_Release(res);
+        for (;;) {
+            WaitForSingleObject(commandEvent, seven_dwm::KEEPALIVE_INTERVAL_MS);
 
-            return TRUE;
-        }
+            while (spsc_ring::pop(g_channel->commands, type, payload))
+                runCommand(type, payload);
 
-    protected:
-        LRESULT handleMessage(UINT msgid, WPARAM wp, LPARAM lp)
-        {
-            if (msgid == WM_COPYDATA) {
-                COPYDATASTRUCT *data = reinterpret_cast<COPYDATASTRUCT*>(lp);
-
-                return onCopydata(data);
-            } else if (msgid == WM_APP_NEWTEXTURE) {
-                return onNewTexture((HANDLE)lp);
-            } else if (msgid == WM_APP_KEEPALIVE) {
-                return onKeepAlive();
-            } else if (msgid == WM_TIMER && wp == (WPARAM)CHECK_KEEPALIVE_TIMER_ID) {
-                return onCheckKeepAlive();
+            if (g_channel->keepalive.load() != keepalive) {
+                keepalive  = g_channel->keepalive.load();
+                lastChange = GetTickCount();
+            } else if (GetTickCount() - lastChange > seven_dwm::KEEPALIVE_TIMEOUT_MS) {
+                return;
             }
-
-            return win32::window::handleMessage(msgid, wp, lp);
         }
-    };
+    }
 
     //////////////////////////////////////
     // Logger function
     //////////////////////////////////////
-    static void __cdecl SendMessageLogHandler(const char *message, void *userdata)
+    static void __cdecl ChannelLogHandler(const char *message, void *userdata)
     {
-        HWND host = (HWND)userdata;
+        seven_dwm::channel *channel = static_cast<seven_dwm::channel*>(userdata);
 
-        COPYDATASTRUCT copy = {
-            .dwData = COPYDATA_ID_LOG,
-            .cbData = static_cast<DWORD>(std::strlen(message)),
-            .lpData = reinterpret_cast<void*>(const_cast<char*>(message))
-        };
+        // the logger calls one handler at a time, so this is the only writer of the ring
+        uint32_t size = std::min(static_cast<uint32_t>(std::strlen(message)),
+                                 spsc_ring::max_payload(sizeof(channel->messages.data)));
 
-        SendMessageTimeout(host, WM_COPYDATA, 0, (LPARAM)&copy, SMTO_ABORTIFHUNG, 500, nullptr);
+        if (spsc_ring::push(channel->messages, seven_dwm::MESSAGE_LOG, message, size))
+            SetEvent(g_hostEvent);
+        else
+            channel->messages.head.lost.fetch_add(1, std::memory_order_relaxed);
     }
 
     ///////////////////////////////////////////
@@ -334,40 +375,76 @@ namespace {
 extern "C" __stdcall __declspec(dllexport)
 DWORD _SV_DWM_EntryPoint(void *param)
 {
-    HWND host = (HWND)param;
-    g_host.store(host);
+    // Everything is named after the host's communication window
+    unsigned long host = static_cast<unsigned long>(reinterpret_cast<uintptr_t>(param));
+    wchar_t       name[seven_dwm::NAME_SIZE];
+
+    swprintf(name, seven_dwm::NAME_SIZE, seven_dwm::CHANNEL_NAME_FORMAT, host);
+    HANDLE mapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name);
+    if (!mapping)
+        return -1;
+
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(seven_dwm::channel));
+    if (!view) {
+        CloseHandle(mapping);
+        return -1;
+    }
+
+    g_channel = static_cast<seven_dwm::channel*>(view);
+
+    swprintf(name, seven_dwm::NAME_SIZE, seven_dwm::COMMAND_EVENT_NAME_FORMAT, host);
+    HANDLE commandEvent = OpenEventW(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, name);
+
+    swprintf(name, seven_dwm::NAME_SIZE, seven_dwm::HOST_EVENT_NAME_FORMAT, host);
+    g_hostEvent = OpenEventW(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, name);
+
+    if (g_channel->magic.load() != seven_dwm::CHANNEL_MAGIC || !commandEvent || !g_hostEvent) {
+        if (commandEvent)
+            CloseHandle(commandEvent);
+        if (g_hostEvent)
+            CloseHandle(g_hostEvent);
 
-    SV_SetLogHandler(SendMessageLogHandler, param);
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        return -1;
+    }
+
+    SV_SetLogHandler(ChannelLogHandler, g_channel);
+
+    // Logging happens inside of Present, it must not wait for the host
+    SV_SetLogMode(SV_LOG_ASYNC);
 
     logger << "Thread has been injected!" << std::endl;
 
-    // Setup the communication window
-    Communicator comm;
+    g_slotControl.store(&g_channel->slots);
 
     // Hook IDXGISwapChain::Present
     if (!DoTheHook())
         return -1;
 
-    // Run our message loop
-    BOOL ret;
-    MSG  msg;
-    while ((ret = GetMessage(&msg, NULL, 0, 0)) != 0) {
-        if (ret < 0)
-            break;
+    // the host sends its settings again
+    g_channel->attachments.fetch_add(1);
+    SetEvent(g_hostEvent);
 
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
-    }
+    serve(commandEvent);
 
     logger << "Bye Bye DWM!" << std::endl;
 
+    // get the remaining messages out and stop the log thread before we unload ourselves
+    SV_SetLogMode(SV_LOG_SYNC);
+
     // Unhook IDXGISwapChain::Present
     if (UndoTheHook()) {
-        // Freeing the allocated shared texture object is in order
-        ID3D10Resource *res = g_captureTarget.load();
+        // Present can't touch the slots or the events anymore
+        g_slots.release();
+        g_slotControl.store(nullptr);
 
-        if (res)
-            ID3D10Resource_Release(res);
+        SV_SetLogHandler(nullptr, nullptr);
+
+        CloseHandle(commandEvent);
+        CloseHandle(g_hostEvent);
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
 
         FreeLibraryAndExitThread(win32::get_running_instance(), 0);
     }
@@ -376,4 +453,4 @@ DWORD _SV_DWM_EntryPoint(void *param)
     Sleep(INFINITE);
 
     return 0;
-}
\ No newline at end of file
+}
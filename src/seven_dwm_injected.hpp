@@ -1,29 +1,81 @@
 #pragma once
 
-// The view will send this to the DWM periodically
-// Sent by the view
-// WPARAM: 0
-// LPARAM: 0
-#define WM_APP_KEEPALIVE    0x8002
+#include "shared_slots.hpp"
+#include "spsc_ring.hpp"
 
-// Informs the injected code of a new shared texture to use as a copy target
-// Sent by the view
-// WPARAM: 0
-// LPARAM: (HANDLE) the shared d3d handle for the texture
-#define WM_APP_NEWTEXTURE   0x8003
+#include <atomic>
+#include <cstdint>
 
-// Informs the view about a successful injection
-// WPARAM: 0
-// LPARAM: (HWND) communication window inside the DWM
-#define WM_APP_INJECTED     0x8004
+/** @file seven_dwm_injected.hpp
+ *
+ * The protocol between SevenDwmSource and the code it injects into the DWM (Windows 7).
+ *
+ * Both sides share a channel block in a file mapping the view creates. Commands go from the
+ * view to the DWM in one ring, log lines come back in another, see spsc_ring.hpp. After
+ * writing to a ring, the writer sets the event of the reader, so nobody ever waits for the other
+ * side or for a message loop. The injected code also sets the view's event whenever it
+ * committed a frame to the slots, which live in the channel as well.
+ *
+ * The mapping and the events are named after the view's communication window, whose handle is
+ * passed to the injected entry point.
+ */
+namespace seven_dwm {
+    static const uint32_t CHANNEL_MAGIC = 0x43445653; // "SVDC"
 
-// Larger messages are being sent via WM_COPYDATA
-// dwData is used as an ID to discriminate specific messages
+    // %08lx is the handle of the view's communication window
+    static const wchar_t CHANNEL_NAME_FORMAT[]       = L"Local\\ScreenView-Channel-%08lx";
+    static const wchar_t COMMAND_EVENT_NAME_FORMAT[] = L"Local\\ScreenView-Commands-%08lx";
+    static const wchar_t HOST_EVENT_NAME_FORMAT[]    = L"Local\\ScreenView-Host-%08lx";
+    static const int     NAME_SIZE                   = 64;
 
-// lpData contains an UTF8 character string, not necessarily NULL terminated
-#define COPYDATA_ID_LOG     1
+    // the view bumps the keepalive that often, the injected code leaves after missing two
+    static const uint32_t KEEPALIVE_INTERVAL_MS = 1000;
+    static const uint32_t KEEPALIVE_TIMEOUT_MS  = 2000;
 
-// lpData contains a RECT structure specifying the desktop coordinates of the screen
-#define COPYDATA_ID_NEWSCREEN 2
+    /**
+     * From the view to the DWM
+     */
+    enum command_type : uint32_t {
+        // payload: screen_command, the desktop coordinates of the screen to capture
+        COMMAND_SCREEN       = 1,
 
+        // payload: uint32_t, the number of desktop images per second the injected code should
+        // copy, see capture_rate.hpp. 0 stops copying.
+        COMMAND_CAPTURE_RATE = 2
+    };
 
+    struct screen_command {
+        int32_t left;
+        int32_t top;
+        int32_t right;
+        int32_t bottom;
+    };
+
+    /**
+     * From the DWM to the view
+     */
+    enum message_type : uint32_t {
+        // payload: UTF-8 characters, not NULL terminated
+        MESSAGE_LOG = 1
+    };
+
+    /**
+     * Lives in the file mapping, all zeroes until the view sets it up
+     */
+    struct channel {
+        std::atomic<uint32_t> magic;
+
+        // bumped by the view every KEEPALIVE_INTERVAL_MS
+        std::atomic<uint32_t> keepalive;
+
+        // bumped by the injected code whenever it hooked Present, the view sends its settings
+        // again then
+        std::atomic<uint32_t> attachments;
+        std::atomic<uint32_t> reserved;
+
+        shared_slots::control slots;
+
+        spsc_ring::ring<4096>  commands;
+        spsc_ring::ring<65536> messages;
+    };
+}
@@ -7,160 +7,57 @@
 #include "seven_dwm_injected.hpp"
 #include "injection.hpp"
 #include "win32.hpp"
+#include "cursor_convert.hpp"
+#include "gdi_cursor.hpp"
 
 #include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <windows.h>
 
-namespace util {
-    template<>
-    inline void raii_free(ICONINFO &ii)
-    {
-        DeleteObject(ii.hbmColor);
-        DeleteObject(ii.hbmMask);
-    }
-
-    template<>
-    inline void raii_free(HDC &hdc)
-    {
-        DeleteDC(hdc);
-    }
-}
-
 namespace {
     static const UINT CURSOR_TEX_SIZE = 256;
 
-    void updateCursorShape(ID3D10Texture2D *tex, HCURSOR cursor, DWORD &xHotspot, DWORD &yHotspot)
-    {
-        util::raii<ICONINFO>   info;
-        util::raii<HDC>        hdc;
-
-        struct {
-            BITMAPINFOHEADER bi;
-            RGBQUAD colors[2];
-        } bmi;
+    // the DWM holds the mutex of a slot only while copying into it, this is a safety net
+    static const DWORD SLOT_SYNC_TIMEOUT_MS = 100;
 
+    // log the frame counts that often, in received frames
+    static const uint32_t FRAME_LOG_INTERVAL = 1000;
 
+    void updateCursorShape(ID3D10Texture2D *tex, ID3D10Texture2D *maskTex, HCURSOR hcursor,
+                           DWORD &xHotspot, DWORD &yHotspot, bool &masked, cursor::shape_cache& cache)
+    {
         HRESULT hr;
 
-        if (!GetIconInfo(cursor, info))
+        const cursor::image *shape = gdi_cursor::read_shape(hcursor, xHotspot, yHotspot, cache, CURSOR_TEX_SIZE);
+        if (!tex || !shape)
             return;
 
-        if (!(*hdc = CreateCompatibleDC(NULL)))
-            return;
-
-        xHotspot = info->xHotspot;
-        yHotspot = info->yHotspot;
-
-        if (!tex)
+        D3D10_MAPPED_TEXTURE2D map;
+        hr = tex->Map(0, D3D10_MAP_WRITE_DISCARD, 0, &map);
+        if FAILED(hr) {
+            logger << "Failed: ID3D10Texture2D::Map: " << util::hresult_to_utf8(hr) << std::endl;
             return;
+        }
 
-        util::zero_out(bmi);
-        bmi.bi.biSize = sizeof(bmi.bi);
-
-        if (!info->hbmColor) {
-            // monochrome cursor
-            if (!GetDIBits(*hdc, info->hbmMask, 0, 0, nullptr, (BITMAPINFO*)&bmi, DIB_RGB_COLORS))
-                return;
-
-            UINT w = static_cast<UINT>(bmi.bi.biWidth);
-            UINT h = static_cast<UINT>(std::abs(bmi.bi.biHeight)/2);
-            bmi.bi.biHeight = -1*std::abs(bmi.bi.biHeight); // force top-down bitmap
-
-            std::unique_ptr<uint8_t[]> bits(new uint8_t[4 * w * h]);
-
-            if (!GetDIBits(*hdc, info->hbmMask, 0, h*2, bits.get(), (BITMAPINFO*)&bmi, DIB_RGB_COLORS))
-                return;
-
-            LONG bpl = ((w-1)/32 + 1)*4; // bytes per line
-
-            D3D10_MAPPED_TEXTURE2D map;
-            hr = tex->Map(0, D3D10_MAP_WRITE_DISCARD, 0, &map);
-            if FAILED(hr) {
-                logger << "Failed: ID3D10Texture2D::Map: " << util::hresult_to_utf8(hr) << std::endl;
-                return;
-            }
-
-            std::memset(map.pData, 0x00, map.RowPitch * CURSOR_TEX_SIZE);
-
-            //FIXME: We don't want to read the desktop image back into the CPU, so we pretend to
-            //       apply the AND mask onto a black surface. This is incorrect, but doesn't look too bad.
-            uint8_t *and_map = bits.get();
-            uint8_t *xor_map = bits.get() + bpl*h;
-
-            for (UINT row = 0; row < std::min(h, CURSOR_TEX_SIZE); ++row)
-            {
-                uint8_t *and_row = &and_map[row * bpl];
-                uint8_t *xor_row = &xor_map[row * bpl];
-
-                for (UINT col = 0; col < std::min(w, CURSOR_TEX_SIZE); ++col) {
-                    uint8_t *target = &reinterpret_cast<uint8_t*>(map.pData)[row*map.RowPitch + col*4];
-
-                    uint8_t alpha = util::get_pixel_from_row<1>(and_row, col) ? 0 : 0xFF;
-                    uint8_t rgb   = util::get_pixel_from_row<1>(xor_row, col) ? 0xFF : 0;
-
-                    target[0] = rgb;
-                    target[1] = rgb;
-                    target[2] = rgb;
-                    target[3] = alpha;
-                }
-            }
-
-            tex->Unmap(0);
-        } else {
-            if (!GetDIBits(*hdc, info->hbmColor, 0, 1, nullptr, (BITMAPINFO *)&bmi, DIB_RGB_COLORS))
-                return;
-
-            UINT w = static_cast<UINT>(bmi.bi.biWidth);
-            UINT h = static_cast<UINT>(std::abs(bmi.bi.biHeight));
-
-            bmi.bi.biBitCount = 32;
-            bmi.bi.biCompression = BI_RGB;
-            bmi.bi.biHeight = -std::abs(bmi.bi.biHeight); // force top-down bitmap
-
-            std::unique_ptr<uint8_t[]> bits(new uint8_t[4*w*h]);
-
-            // read the color data
-            if (!GetDIBits(*hdc, info->hbmColor, 0, h, bits.get(), (BITMAPINFO *)&bmi, DIB_RGB_COLORS)) {
-                logger << "Failed: GetDIBits: " << GetLastError() << std::endl;
-                return;
-            }
-
-            D3D10_MAPPED_TEXTURE2D map;
-            hr = tex->Map(0, D3D10_MAP_WRITE_DISCARD, 0, &map);
-            if FAILED(hr) {
-                logger << "Failed: ID3D10Texture2D::Map: " << util::hresult_to_utf8(hr) << std::endl;
-                return;
-            }
+        cursor::copy_image(*shape, reinterpret_cast<uint8_t*>(map.pData), map.RowPitch, CURSOR_TEX_SIZE, CURSOR_TEX_SIZE);
 
-            // make everything black and transparent
-            memset(map.pData, 0x00, map.RowPitch * CURSOR_TEX_SIZE);
+        tex->Unmap(0);
 
-            for (UINT y = 0; y < std::min(h, CURSOR_TEX_SIZE); y++) {
-                uint8_t *src_row = bits.get() + y*w*4;
-                uint8_t *dst_row = reinterpret_cast<uint8_t*>(map.pData) + y*map.RowPitch;
+        masked = shape->masked() && maskTex;
+        if (!masked)
+            return;
 
-                memcpy(dst_row, src_row, std::min(w, CURSOR_TEX_SIZE)*4);
-            }
+        hr = maskTex->Map(0, D3D10_MAP_WRITE_DISCARD, 0, &map);
+        if FAILED(hr) {
+            logger << "Failed: ID3D10Texture2D::Map (mask): " << util::hresult_to_utf8(hr) << std::endl;
+            masked = false;
+            return;
+        }
 
-            // mask
-            if (GetDIBits(*hdc, info->hbmMask, 0, h, bits.get(), (BITMAPINFO *)&bmi, DIB_RGB_COLORS))
-            {
-                for (UINT y = 0; y < std::min(h, CURSOR_TEX_SIZE); y++)
-                {
-                    for (UINT x = 0; x < std::min(w, CURSOR_TEX_SIZE); x++)
-                    {
-                        uint8_t *target = reinterpret_cast<uint8_t*>(map.pData) + y*map.RowPitch + x*4;
-                        uint8_t *source = bits.get() + (x + y * w)*4;
-
-                        target[3] = 255 - source[0];
-                    }
-                }
-            }
+        cursor::copy_mask(*shape, reinterpret_cast<uint8_t*>(map.pData), map.RowPitch, CURSOR_TEX_SIZE, CURSOR_TEX_SIZE);
 
-            tex->Unmap(0);
-        }
+        maskTex->Unmap(0);
     }
 }
 
@@ -168,13 +65,18 @@ class SevenDwmSource_DwmCommunicator : public win32::window
 {
     static const UINT_PTR KEEPALIVE_TIMER_ID = 42;
 
-    HWND m_dwmWindow = NULL;
-
-    HANDLE          m_textureForDwm = INVALID_HANDLE_VALUE;
     RECT            m_screenForDwm  { 0,0,0,0 };
+    uint32_t        m_fpsForDwm     = capture_rate::DEFAULT_FPS;
     wchar_t         m_ownDllPath[MAX_PATH] = {};
     wchar_t        *m_ownDllBaseName = nullptr;
 
+    // shared with the injected code, see seven_dwm_injected.hpp
+    HANDLE              m_mapping      = NULL;
+    HANDLE              m_commandEvent = NULL;
+    HANDLE              m_hostEvent    = NULL;
+    seven_dwm::channel *m_channel      = nullptr;
+    uint32_t            m_attachments  = 0;
+
 public:
     SevenDwmSource_DwmCommunicator(const SevenDwmSource_DwmCommunicator* window) = delete;
 
@@ -186,17 +88,54 @@ public:
             m_ownDllBaseName = wcsrchr(m_ownDllPath, L'\\') + 1; // acutally recommended by MSDN somewhere
         }
 
+        // The injected code finds everything by the handle of this window
+        unsigned long id = static_cast<unsigned long>(reinterpret_cast<uintptr_t>(hwnd()));
+        wchar_t       name[seven_dwm::NAME_SIZE];
+
+        swprintf(name, seven_dwm::NAME_SIZE, seven_dwm::CHANNEL_NAME_FORMAT, id);
+        m_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                       sizeof(seven_dwm::channel), name);
+        if (m_mapping)
+            m_channel = static_cast<seven_dwm::channel*>(
+                MapViewOfFile(m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(seven_dwm::channel)));
+
+        swprintf(name, seven_dwm::NAME_SIZE, seven_dwm::COMMAND_EVENT_NAME_FORMAT, id);
+        m_commandEvent = CreateEventW(nullptr, FALSE, FALSE, name);
+
+        swprintf(name, seven_dwm::NAME_SIZE, seven_dwm::HOST_EVENT_NAME_FORMAT, id);
+        m_hostEvent = CreateEventW(nullptr, FALSE, FALSE, name);
+
+        if (m_channel && m_commandEvent && m_hostEvent)
+            m_channel->magic.store(seven_dwm::CHANNEL_MAGIC);
+        else
+            logger << "Failed to create the channel to the DWM: " << GetLastError() << std::endl;
+
         // Install the keepalive timer
-        SetTimer(hwnd(), KEEPALIVE_TIMER_ID, 1000, nullptr);
+        SetTimer(hwnd(), KEEPALIVE_TIMER_ID, seven_dwm::KEEPALIVE_INTERVAL_MS, nullptr);
     }
 
-    void sendNewTexture(HANDLE sharedTexture)
+    ~SevenDwmSource_DwmCommunicator()
     {
-        m_textureForDwm = sharedTexture;
-
-        sendTexture();
+        if (m_channel)
+            UnmapViewOfFile(m_channel);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_commandEvent)
+            CloseHandle(m_commandEvent);
+        if (m_hostEvent)
+            CloseHandle(m_hostEvent);
     }
 
+    /**
+     * The control block shared with the DWM, zeroed initially, nullptr if it couldn't be created
+     */
+    shared_slots::control *slotControl() const { return m_channel ? &m_channel->slots : nullptr; }
+
+    /**
+     * Set by the DWM whenever there is a new frame or something to drain()
+     */
+    HANDLE wakeup() const { return m_hostEvent; }
+
     void sendNewScreen(int x, int y, int w, int h)
     {
         m_screenForDwm.left   = x;
@@ -207,85 +146,103 @@ public:
         sendScreen();
     }
 
-private:
-    void sendTexture()
+    void sendNewCaptureRate(unsigned fps)
     {
-        if (m_dwmWindow)
-            PostMessage(m_dwmWindow, WM_APP_NEWTEXTURE, 0, (LPARAM)m_textureForDwm);
+        m_fpsForDwm = fps;
+
+        sendCaptureRate();
     }
 
-    void sendScreen()
+    /**
+     * Logs what the DWM sent, and sends the settings again once it (re)attached
+     */
+    void drain()
     {
-        if (!m_dwmWindow)
+        if (!m_channel)
             return;
 
-        COPYDATASTRUCT copy = {
-            .dwData = COPYDATA_ID_NEWSCREEN,
-            .cbData = sizeof(m_screenForDwm),
-            .lpData = reinterpret_cast<void*>(&m_screenForDwm)
-        };
+        uint32_t    type;
+        std::string payload;
 
-        SendMessage(m_dwmWindow, WM_COPYDATA, (WPARAM)hwnd(), (LPARAM)&copy);
-    }
+        while (spsc_ring::pop(m_channel->messages, type, payload)) {
+            if (type == seven_dwm::MESSAGE_LOG)
+                logger << "FROM DWM: " << payload << std::endl;
+        }
 
-    LRESULT onCopydata(COPYDATASTRUCT *data)
-    {
-        if (data->dwData != COPYDATA_ID_LOG)
-            return FALSE;
+        uint32_t lost = m_channel->messages.head.lost.exchange(0);
+        if (lost)
+            logger << "Lost " << lost << " log messages from the DWM" << std::endl;
 
-        // Ensure null termination by copying the string first
-        std::string str(reinterpret_cast<char*>(data->lpData), static_cast<std::string::size_type>(data->cbData));
+        uint32_t attachments = m_channel->attachments.load();
+        if (attachments != m_attachments) {
+            m_attachments = attachments;
 
-        logger << "FROM DWM: " << str << std::endl;
+            sendScreen();
+            sendCaptureRate();
+        }
+    }
 
-        return TRUE;
+private:
+    // never waits for the DWM, a full ring means it isn't listening anyway
+    void sendCommand(uint32_t type, const void *payload, uint32_t size)
+    {
+        if (!m_channel)
+            return;
+
+        if (spsc_ring::push(m_channel->commands, type, payload, size))
+            SetEvent(m_commandEvent);
+        else
+            m_channel->commands.head.lost.fetch_add(1);
     }
 
-    LRESULT onInjected(HWND dwmWindow)
+    void sendScreen()
     {
-        m_dwmWindow = (HWND)dwmWindow;
+        seven_dwm::screen_command screen = {
+            .left   = m_screenForDwm.left,
+            .top    = m_screenForDwm.top,
+            .right  = m_screenForDwm.right,
+            .bottom = m_screenForDwm.bottom
+        };
 
-        sendTexture();
-        sendScreen();
+        sendCommand(seven_dwm::COMMAND_SCREEN, &screen, sizeof(screen));
+    }
 
-        return TRUE;
+    void sendCaptureRate()
+    {
+        sendCommand(seven_dwm::COMMAND_CAPTURE_RATE, &m_fpsForDwm, sizeof(m_fpsForDwm));
     }
 
     LRESULT onKeepAlive()
     {
+        if (m_channel)
+            m_channel->keepalive.fetch_add(1);
+
+        drain();
+
         // Check whether we are (still) injected into the dwm
         uint32_t dwm = injection::process_id_for_name(L"dwm.exe");
 
-        if (!dwm) { // uups, no dwm present!?
-            m_dwmWindow = NULL;
-        } else {
-            if (!injection::is_dll_loaded(dwm, m_ownDllBaseName)) {
-                logger << "Now injecting into DWM" << std::endl;
-                m_dwmWindow = NULL;
-
-                // inject ourselves into the dwm
-                std::ptrdiff_t load_library_offset = injection::get_function_offset(L"kernel32.dll", "LoadLibraryW");
-                std::ptrdiff_t our_entry_point_offset = injection::get_function_offset(m_ownDllBaseName, "_SV_DWM_EntryPoint@4");
-
-                if (!load_library_offset || !our_entry_point_offset) {
-                    logger << "FATAL: Entry point not found, can't inject :(" << std::endl;
-                    return TRUE;
-                }
-
-                // load the dll
-                if (!injection::call_remote_func(dwm, L"kernel32.dll", load_library_offset, (void*)m_ownDllPath, MAX_PATH*sizeof(wchar_t))) {
-                    logger << "FATAL: LoadLibraryW could not be executed :(" << std::endl;
-                    return TRUE;
-                }
-
-                // and kickoff our own function
-                injection::call_remote_func(dwm, m_ownDllBaseName, our_entry_point_offset, (void*)hwnd(), 0, nullptr, 0);
+        if (dwm && m_channel && !injection::is_dll_loaded(dwm, m_ownDllBaseName)) {
+            logger << "Now injecting into DWM" << std::endl;
+
+            // inject ourselves into the dwm
+            std::ptrdiff_t load_library_offset = injection::get_function_offset(L"kernel32.dll", "LoadLibraryW");
+            std::ptrdiff_t our_entry_point_offset = injection::get_function_offset(m_ownDllBaseName, "_SV_DWM_EntryPoint@4");
+
+            if (!load_library_offset || !our_entry_point_offset) {
+                logger << "FATAL: Entry point not found, can't inject :(" << std::endl;
+                return TRUE;
+            }
+
+            // load the dll
+            if (!injection::call_remote_func(dwm, L"kernel32.dll", load_library_offset, (void*)m_ownDllPath, MAX_PATH*sizeof(wchar_t))) {
+                logger << "FATAL: LoadLibraryW could not be executed :(" << std::endl;
+                return TRUE;
             }
-        }
 
-        // If we are connected to the DWM, we message it
-        if (m_dwmWindow)
-            PostMessage(m_dwmWindow, WM_APP_KEEPALIVE, 0, 0);
+            // and kickoff our own function, which opens the channel named after us
+            injection::call_remote_func(dwm, m_ownDllBaseName, our_entry_point_offset, (void*)hwnd(), 0, nullptr, 0);
+        }
 
         return TRUE;
     }
@@ -293,15 +250,8 @@ private:
 protected:
     virtual LRESULT handleMessage(UINT msgid, WPARAM wp, LPARAM lp) override
     {
-        if (msgid == WM_COPYDATA) {
-            COPYDATASTRUCT *data = reinterpret_cast<COPYDATASTRUCT*>(lp);
-
-            return onCopydata(data);
-        } else if (msgid == WM_APP_INJECTED) {
-            return onInjected((HWND)lp);
-        } else if (msgid == WM_TIMER && wp == (WPARAM)KEEPALIVE_TIMER_ID) {
+        if (msgid == WM_TIMER && wp == (WPARAM)KEEPALIVE_TIMER_ID)
             return onKeepAlive();
-        }
 
         return win32::window::handleMessage(msgid, wp, lp);
     }
@@ -309,13 +259,29 @@ protected:
 
 SevenDwmSource::SevenDwmSource() : m_communicator(new SevenDwmSource_DwmCommunicator)
 {
+    // it owns the control block of the slots
+    m_slots = shared_slots::consumer(m_communicator->slotControl());
 }
 
 SevenDwmSource::~SevenDwmSource()
 {
+    // nobody is watching anymore, the DWM would go on copying until it misses the keepalive
+    m_communicator->sendNewCaptureRate(0);
+
     delete m_communicator;
 }
 
+bool
+SevenDwmSource::setCaptureRate(unsigned fps)
+{
+    m_captureFps = std::min(fps, capture_rate::MAX_FPS);
+    m_communicator->sendNewCaptureRate(m_captureFps);
+
+    logger << "Asking the DWM for " << m_captureFps << " frames per second" << std::endl;
+
+    return true;
+}
+
 void
 SevenDwmSource::reinit(ID3D10Device *device, int x, int y, int w, int h)
 {
@@ -332,6 +298,12 @@ SevenDwmSource::reinit(ID3D10Device *device, int x, int y, int w, int h)
     m_xHotspot = 0;
     m_yHotspot = 0;
 
+    for (com_ptr<ID3D10Texture2D>& staging : m_staging)
+        staging.clear();
+
+    m_pendingReadbacks = 0;
+    m_tiles.reset(w, h);
+
     m_communicator->sendNewScreen(x, y, w, h);
 }
 
@@ -354,7 +326,7 @@ SevenDwmSource::createDesktopTexture()
         .Usage = D3D10_USAGE_DEFAULT,
         .BindFlags = D3D10_BIND_RENDER_TARGET|D3D10_BIND_SHADER_RESOURCE,
         .CPUAccessFlags = 0,
-        .MiscFlags = D3D10_RESOURCE_MISC_SHARED
+        .MiscFlags = 0
     };
 
     // initially, the texture is black and transparent
@@ -372,26 +344,62 @@ SevenDwmSource::createDesktopTexture()
     if FAILED(hr)
         logger << "Failed:CreateTexture2D: " << util::hresult_to_utf8(hr) << std::endl;
 
-    // Pass texture handle to the injected side
-    com_ptr<IDXGIResource> res;
-    hr = texture->QueryInterface(res.uuid(), res.pptr_as_void_cleared());
-    if FAILED(hr) {
-        logger << "Failed: QueryInterface<IDXGIResource>: " << util::hresult_to_utf8(hr) << std::endl;
-        return texture;
-    }
-
-    HANDLE hshared;
-    hr = res->GetSharedHandle(&hshared);
-    if FAILED(hr) {
-        logger << "Failed: GetSharedHandle: " << util::hresult_to_utf8(hr) << std::endl;
-        return texture;
-    }
+    // the DWM copies into slots of the same size
+    createSlots(texdsc);
 
-    m_communicator->sendNewTexture(hshared);
+    // nothing to compare the first capture into the new texture with
+    dropReadbacks();
 
     return texture;
 }
 
+void
+SevenDwmSource::createSlots(D3D10_TEXTURE2D_DESC texdsc)
+{
+    HRESULT hr;
+
+    texdsc.MiscFlags = D3D10_RESOURCE_MISC_SHARED_KEYEDMUTEX;
+
+    uint32_t handles[shared_slots::SLOTS];
+
+    for (uint32_t i = 0; i < shared_slots::SLOTS; ++i) {
+        m_slotMutexes[i].clear();
+
+        hr = m_dev->CreateTexture2D(&texdsc, nullptr, m_slotTextures[i].pptr_cleared());
+        if FAILED(hr) {
+            logger << "Failed: CreateTexture2D (slot): " << util::hresult_to_utf8(hr) << std::endl;
+            return;
+        }
+
+        hr = m_slotTextures[i]->QueryInterface(m_slotMutexes[i].uuid(), m_slotMutexes[i].pptr_as_void_cleared());
+        if FAILED(hr) {
+            logger << "Failed: QueryInterface<IDXGIKeyedMutex>: " << util::hresult_to_utf8(hr) << std::endl;
+            return;
+        }
+
+        com_ptr<IDXGIResource> res;
+        hr = m_slotTextures[i]->QueryInterface(res.uuid(), res.pptr_as_void_cleared());
+        if FAILED(hr) {
+            logger << "Failed: QueryInterface<IDXGIResource>: " << util::hresult_to_utf8(hr) << std::endl;
+            return;
+        }
+
+        HANDLE hshared;
+        hr = res->GetSharedHandle(&hshared);
+        if FAILED(hr) {
+            logger << "Failed: GetSharedHandle: " << util::hresult_to_utf8(hr) << std::endl;
+            return;
+        }
+
+        // shared handles are 32 bits wide, even for 64 bit processes
+        handles[i] = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(hshared));
+    }
+
+    // the DWM picks them up before it copies the next frame
+    m_slots.publish(handles, static_cast<int32_t>(texdsc.Width), static_cast<int32_t>(texdsc.Height));
+    m_acquiredSlot = -1;
+}
+
 ID3D10Texture2D *
 SevenDwmSource::createCursorTexture()
 {
@@ -431,8 +439,192 @@ SevenDwmSource::createCursorTexture()
     return texture;
 }
 
+ID3D10Texture2D *
+SevenDwmSource::createCursorMaskTexture()
+{
+    // same size and format as the cursor texture
+    return createCursorTexture();
+}
+
+bool
+SevenDwmSource::acquireFrame(unsigned timeoutMs)
+{
+    // The injected code sets the wakeup event whenever it committed a frame or logged
+    // something. The cursor is polled once we return.
+    uint32_t frame = 0;
+
+    m_acquiredSlot = m_slots.acquire(frame);
+    if (m_acquiredSlot < 0) {
+        HANDLE wakeup = m_communicator->wakeup();
+
+        MsgWaitForMultipleObjects(wakeup ? 1 : 0, &wakeup, FALSE, timeoutMs, QS_ALLINPUT);
+        m_communicator->drain();
+
+        m_acquiredSlot = m_slots.acquire(frame);
+    }
+
+    if (m_acquiredSlot >= 0) {
+        // the frame numbers count the frames the DWM committed, the gaps are the ones we missed
+        m_framesMissed += m_lastFrame && frame > m_lastFrame + 1 ? frame - m_lastFrame - 1 : 0;
+        m_lastFrame     = frame;
+
+        if (++m_framesReceived % FRAME_LOG_INTERVAL == 0) {
+            const shared_slots::control *ctl = m_communicator->slotControl();
+
+            logger << "DWM frames: received=" << m_framesReceived << " missed=" << m_framesMissed
+                   << " dropped=" << (ctl ? ctl->dropped.load() : 0) << std::endl;
+        }
+    }
+
+    return true;
+}
+
 void
-SevenDwmSource::updateCursor(ID3D10Texture2D *cursorTex, LONG& cursorX, LONG& cursorY, bool& cursorVisible)
+SevenDwmSource::dropReadbacks()
+{
+    m_pendingReadbacks = 0;
+    m_tiles.invalidate();
+}
+
+bool
+SevenDwmSource::mapReadbacks(bool full)
+{
+    HRESULT hr;
+
+    // oldest first, as the detector compares every capture with the one before
+    while (m_pendingReadbacks) {
+        unsigned oldest = (m_nextReadback + READBACK_FRAMES - m_pendingReadbacks) % READBACK_FRAMES;
+
+        // Only waits if all staging textures are in use, for a copy three captures ago
+        UINT flags = full && m_pendingReadbacks == READBACK_FRAMES ? 0 : D3D10_MAP_FLAG_DO_NOT_WAIT;
+
+        D3D10_MAPPED_TEXTURE2D mapped;
+        hr = m_staging[oldest]->Map(0, D3D10_MAP_READ, flags, &mapped);
+        if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+            return true;
+        if FAILED(hr) {
+            logger << "Failed: Map (change detection): " << util::hresult_to_utf8(hr) << std::endl;
+            return false;
+        }
+
+        if (!m_tiles.update(static_cast<const uint8_t*>(mapped.pData), mapped.RowPitch, m_damage))
+            m_damageKnown = false;
+
+        m_staging[oldest]->Unmap(0);
+        --m_pendingReadbacks;
+    }
+
+    return true;
+}
+
+bool
+SevenDwmSource::readBack(ID3D10Texture2D *desktopTex)
+{
+    HRESULT hr;
+
+    com_ptr<ID3D10Texture2D>& staging = m_staging[m_nextReadback];
+
+    if (!staging) {
+        D3D10_TEXTURE2D_DESC texdsc;
+        desktopTex->GetDesc(&texdsc);
+
+        texdsc.Usage          = D3D10_USAGE_STAGING;
+        texdsc.BindFlags      = 0;
+        texdsc.CPUAccessFlags = D3D10_CPU_ACCESS_READ;
+        texdsc.MiscFlags      = 0;
+
+        hr = m_dev->CreateTexture2D(&texdsc, nullptr, staging.pptr_cleared());
+        if FAILED(hr) {
+            logger << "Failed: CreateTexture2D (change detection): " << util::hresult_to_utf8(hr) << std::endl;
+            return false;
+        }
+
+        if (m_tiles.width() != static_cast<int>(texdsc.Width) || m_tiles.height() != static_cast<int>(texdsc.Height))
+            m_tiles.reset(static_cast<int>(texdsc.Width), static_cast<int>(texdsc.Height));
+    }
+
+    // mapped by a later pass, once the GPU is done with it
+    m_dev->CopyResource(staging, desktopTex);
+
+    m_nextReadback = (m_nextReadback + 1) % READBACK_FRAMES;
+    ++m_pendingReadbacks;
+
+    return true;
+}
+
+bool
+SevenDwmSource::updateDesktop(ID3D10Texture2D *desktopTex)
+{
+    m_damage.clear();
+    m_damageKnown = true;
+
+    // Nobody took the damage of the last change, e.g. without a thumbnail level or a
+    // recording, so there is no need to read back until someone asks again
+    if (m_changeReported) {
+        m_damageWanted   = m_damageAsked;
+        m_damageAsked    = false;
+        m_changeReported = false;
+    }
+
+    if (!desktopTex)
+        return false;
+
+    bool captured = false;
+
+    if (m_acquiredSlot >= 0) {
+        // the DWM holds the mutex only while it copies into the slot, which isn't this one
+        IDXGIKeyedMutex *mutex = m_slotMutexes[m_acquiredSlot];
+
+        HRESULT hr = mutex->AcquireSync(0, SLOT_SYNC_TIMEOUT_MS);
+        if (hr != S_OK) {
+            logger << "Failed: AcquireSync (slot " << m_acquiredSlot << "): " << util::hresult_to_utf8(hr) << std::endl;
+        } else {
+            m_dev->CopyResource(desktopTex, m_slotTextures[m_acquiredSlot]);
+            mutex->ReleaseSync(0);
+
+            captured = true;
+        }
+    }
+
+    if (!m_damageWanted) {
+        if (m_pendingReadbacks || captured)
+            dropReadbacks();
+
+        m_damageKnown = false;
+        return m_changeReported = captured;
+    }
+
+    // Whatever the GPU has finished, the staging texture of this capture is made room for
+    if (!mapReadbacks(captured) || (captured && !readBack(desktopTex))) {
+        dropReadbacks();
+        m_damageKnown = false;
+    }
+
+    // without a capture, this passes on the damage of the last ones
+    return m_changeReported = captured || !m_damageKnown || !m_damage.empty();
+}
+
+bool
+SevenDwmSource::desktopDamage(std::vector<damage::rect>& rects)
+{
+    m_damageAsked = true;
+
+    // the first time after a while, there is nothing to compare with
+    if (!m_damageWanted) {
+        m_damageWanted = true;
+        return false;
+    }
+
+    if (!m_damageKnown)
+        return false;
+
+    rects.insert(rects.end(), m_damage.begin(), m_damage.end());
+
+    return true;
+}
+
+bool
+SevenDwmSource::updateCursor(ID3D10Texture2D *cursorTex, ID3D10Texture2D *cursorMaskTex, frame_source::cursor_state& cursorState)
 {
     CURSORINFO cursorinfo;
     POINT      position;
@@ -440,14 +632,26 @@ SevenDwmSource::updateCursor(ID3D10Texture2D *cursorTex, LONG& cursorX, LONG& cu
     cursorinfo.cbSize = sizeof(cursorinfo);
 
     if (!GetCursorPos(&position) || !GetCursorInfo(&cursorinfo))
-        return;
+        return false;
+
+    bool changed = false;
 
     if (cursorinfo.hCursor != m_lastCursorSeen) {
-        updateCursorShape(cursorTex, (m_lastCursorSeen = cursorinfo.hCursor), m_xHotspot, m_yHotspot);
+        updateCursorShape(cursorTex, cursorMaskTex, (m_lastCursorSeen = cursorinfo.hCursor),
+                          m_xHotspot, m_yHotspot, cursorState.masked, m_cursorCache);
+        changed = true;
     }
 
-    cursorVisible = cursorinfo.flags == CURSOR_SHOWING;
-    cursorX       = position.x - m_desktopX - m_xHotspot;
-    cursorY       = position.y - m_desktopY - m_yHotspot;
+    bool visible = cursorinfo.flags == CURSOR_SHOWING;
+    long x       = position.x - m_desktopX - m_xHotspot;
+    long y       = position.y - m_desktopY - m_yHotspot;
+
+    changed = changed || visible != cursorState.visible || x != cursorState.x || y != cursorState.y;
+
+    cursorState.visible = visible;
+    cursorState.x       = x;
+    cursorState.y       = y;
     //FIXME: do we need to release info.hCursor?
+
+    return changed;
 }
\ No newline at end of file
@@ -2,10 +2,38 @@
 
 #include <d3d10_1.h>
 
+#include "capture_rate.hpp"
 #include "com_ptr.hpp"
+#include "cursor_cache.hpp"
+#include "frame_source.hpp"
+#include "shared_slots.hpp"
+#include "tile_hash.hpp"
+
+#include <vector>
 
 class SevenDwmSource_DwmCommunicator;
+
+/**
+ * Captures the desktop by hooking IDXGISwapChain::Present inside the DWM (Windows 7), which
+ * copies whole back buffers into a ring of three shared textures, see shared_slots.hpp. A frame
+ * is copied from there into the desktop texture once the DWM committed it, so it is never torn.
+ * Settings and log lines are exchanged through rings in shared memory, see
+ * seven_dwm_injected.hpp.
+ *
+ * The hook copies as often as setCaptureRate() asked for, or less if copying takes too long,
+ * see capture_rate.hpp. It knows nothing about dirty rects, so while the renderer asks for
+ * desktopDamage(), the desktop texture is read back and compared tile by tile with the previous
+ * capture to find out what changed, see tile_hash.hpp. The read backs go through a few staging
+ * textures, each is mapped once the GPU is done with it, so the damage of a capture is reported
+ * a frame or two late. The regions are taken from the desktop texture then, which still has
+ * what changed in them.
+ */
 class SevenDwmSource {
+public:
+    typedef ID3D10Device    device_type;
+    typedef ID3D10Texture2D texture_type;
+
+private:
     ID3D10Device   *m_dev = nullptr;
 
     int m_desktopWidth  = 0;
@@ -17,6 +45,40 @@ class SevenDwmSource {
     DWORD   m_xHotspot = 0;
     DWORD   m_yHotspot = 0;
 
+    unsigned m_captureFps = capture_rate::DEFAULT_FPS;
+
+    // the textures the DWM copies to, see shared_slots.hpp
+    com_ptr<ID3D10Texture2D> m_slotTextures[shared_slots::SLOTS];
+    com_ptr<IDXGIKeyedMutex> m_slotMutexes[shared_slots::SLOTS];
+    shared_slots::consumer   m_slots;
+    int                      m_acquiredSlot   = -1;
+    uint32_t                 m_lastFrame      = 0;
+    uint32_t                 m_framesReceived = 0;
+    uint32_t                 m_framesMissed   = 0;
+
+    // The desktop texture read back for change detection, the oldest pending read back is
+    // m_pendingReadbacks before m_nextReadback
+    static const unsigned READBACK_FRAMES = 3;
+
+    com_ptr<ID3D10Texture2D>  m_staging[READBACK_FRAMES];
+    unsigned                  m_nextReadback     = 0;
+    unsigned                  m_pendingReadbacks = 0;
+    tile_hash::detector       m_tiles;
+    std::vector<damage::rect> m_damage;
+    bool                      m_damageKnown = false;
+
+    // whether the renderer took the damage of the last change we reported
+    bool m_changeReported = false;
+    bool m_damageAsked    = false;
+    bool m_damageWanted   = false;
+
+    void createSlots(D3D10_TEXTURE2D_DESC texdsc);
+    bool readBack(ID3D10Texture2D *desktopTex);
+    bool mapReadbacks(bool full);
+    void dropReadbacks();
+
+    cursor::shape_cache m_cursorCache;
+
     SevenDwmSource_DwmCommunicator *m_communicator;
 
 public:
@@ -26,8 +88,17 @@ public:
     void reinit(ID3D10Device *device, int x, int y, int w, int h);
     ID3D10Texture2D *createDesktopTexture();
     ID3D10Texture2D *createCursorTexture();
-    void acquireFrame() { /* FIXME: Should we lock the desktop texture? */ }
-    void updateDesktop(ID3D10Texture2D *) { /* The injected code will always write the desktop image for us */ }
-    void updateCursor(ID3D10Texture2D *cursorTex, LONG& cursorX, LONG& cursorY, bool& cursorVisible);
-    void releaseFrame() { /* FIXME: Unlock desktop texture? */ }
+    ID3D10Texture2D *createCursorMaskTexture();
+    bool acquireFrame(unsigned timeoutMs);
+    bool updateDesktop(ID3D10Texture2D *);
+    bool desktopDamage(std::vector<damage::rect>& rects);
+    bool updateCursor(ID3D10Texture2D *cursorTex, ID3D10Texture2D *cursorMaskTex, frame_source::cursor_state& cursorState);
+    void releaseFrame() {} // the slot is held until the next frame is acquired
+    bool setZeroCopy(bool) { return false; } // the DWM hook has to copy anyway
+    ID3D10Texture2D *frameTexture() { return nullptr; }
+
+    /**
+     * Asks the DWM hook to copy @a fps desktop images per second, 0 stops copying
+     */
+    bool setCaptureRate(unsigned fps);
 };
\ No newline at end of file
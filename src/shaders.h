@@ -182,3 +182,107 @@ unsigned char shader_compiled_VShader[676] = {
     0x54, 0x45, 0x58, 0x43, 0x4F, 0x4F, 0x52, 0x44,
     0x00, 0xAB, 0xAB, 0xAB
 };
+/* Assembled by hand from the listing below, without reflection data. There is no level 9 */
+/* version, so level 9 devices can't create it. Compiling PShaderCursor with */
+/* d3dcompiler-cli.exe -tps_4_0 -ePShaderCursor -O3 shaders.hlsl -pshader_compiled_ */
+/* replaces it with the output of the compiler. */
+/*
+    ps_4_0
+    dcl_constantbuffer cb0[1], immediateIndexed
+    dcl_sampler s0, mode_default
+    dcl_resource_texture2d (float,float,float,float) t0
+    dcl_resource_texture2d (float,float,float,float) t1
+    dcl_resource_texture2d (float,float,float,float) t2
+    dcl_input_ps linear v1.xy
+    dcl_output o0.xyzw
+    dcl_temps 2
+    add r0.xy, -cb0[0].xyxx, cb0[0].zwzz
+    mad r0.xy, v1.xyxx, r0.xyxx, cb0[0].xyxx
+    sample r0.xyzw, r0.xyxx, t2.xyzw, s0
+    sample r1.xyzw, v1.xyxx, t1.xyzw, s0
+    mul r0.xyz, r0.xyzx, r1.xyzx
+    mov o0.w, r1.w
+    sample r1.xyzw, v1.xyxx, t0.xyzw, s0
+    add r0.xyz, r0.xyzx, -r1.xyzx
+    mov o0.xyz, |r0.xyzx|
+    ret
+*/
+
+unsigned char shader_compiled_PShaderCursor[604] = {
+    0x44, 0x58, 0x42, 0x43, 0xDD, 0xB2, 0x51, 0xBC,
+    0xB2, 0x9A, 0xDF, 0x7A, 0xA7, 0xF2, 0xCB, 0x44,
+    0xD4, 0x35, 0xF2, 0x12, 0x01, 0x00, 0x00, 0x00,
+    0x5C, 0x02, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+    0x2C, 0x00, 0x00, 0x00, 0xD0, 0x01, 0x00, 0x00,
+    0x28, 0x02, 0x00, 0x00, 0x53, 0x48, 0x44, 0x52,
+    0x9C, 0x01, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00,
+    0x67, 0x00, 0x00, 0x00, 0x59, 0x00, 0x00, 0x04,
+    0x46, 0x8E, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x5A, 0x00, 0x00, 0x03,
+    0x00, 0x60, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x58, 0x18, 0x00, 0x04, 0x00, 0x70, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x55, 0x55, 0x00, 0x00,
+    0x58, 0x18, 0x00, 0x04, 0x00, 0x70, 0x10, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x55, 0x55, 0x00, 0x00,
+    0x58, 0x18, 0x00, 0x04, 0x00, 0x70, 0x10, 0x00,
+    0x02, 0x00, 0x00, 0x00, 0x55, 0x55, 0x00, 0x00,
+    0x62, 0x10, 0x00, 0x03, 0x32, 0x10, 0x10, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x65, 0x00, 0x00, 0x03,
+    0xF2, 0x20, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x68, 0x00, 0x00, 0x02, 0x02, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x0A, 0x32, 0x00, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x46, 0x80, 0x20, 0x80,
+    0x41, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xE6, 0x8A, 0x20, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x32, 0x00, 0x00, 0x0A, 0x32, 0x00, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x46, 0x10, 0x10, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x46, 0x00, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x46, 0x80, 0x20, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x45, 0x00, 0x00, 0x09, 0xF2, 0x00, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x46, 0x00, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x46, 0x7E, 0x10, 0x00,
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x60, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x45, 0x00, 0x00, 0x09,
+    0xF2, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0x46, 0x10, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0x46, 0x7E, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x60, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x38, 0x00, 0x00, 0x07, 0x72, 0x00, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x46, 0x02, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x46, 0x02, 0x10, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x36, 0x00, 0x00, 0x05,
+    0x82, 0x20, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xF6, 0x0F, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0x45, 0x00, 0x00, 0x09, 0xF2, 0x00, 0x10, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x46, 0x10, 0x10, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x46, 0x7E, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x10, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
+    0x72, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x46, 0x02, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x46, 0x02, 0x10, 0x80, 0x41, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x36, 0x00, 0x00, 0x06,
+    0x72, 0x20, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x46, 0x02, 0x10, 0x80, 0x81, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x3E, 0x00, 0x00, 0x01,
+    0x49, 0x53, 0x47, 0x4E, 0x50, 0x00, 0x00, 0x00,
+    0x02, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00,
+    0x38, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x0F, 0x00, 0x00, 0x00,
+    0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x03, 0x03, 0x00, 0x00,
+    0x53, 0x56, 0x5F, 0x50, 0x4F, 0x53, 0x49, 0x54,
+    0x49, 0x4F, 0x4E, 0x00, 0x54, 0x45, 0x58, 0x43,
+    0x4F, 0x4F, 0x52, 0x44, 0x00, 0xAB, 0xAB, 0xAB,
+    0x4F, 0x53, 0x47, 0x4E, 0x2C, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00,
+    0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x0F, 0x00, 0x00, 0x00,
+    0x53, 0x56, 0x5F, 0x54, 0x41, 0x52, 0x47, 0x45,
+    0x54, 0x00, 0xAB, 0xAB
+};
@@ -1,6 +1,16 @@
 SamplerState SampleType;
 Texture2D shaderTexture;
 
+// Only used by PShaderCursor
+Texture2D cursorMask : register(t1);
+Texture2D desktopTexture : register(t2);
+
+cbuffer CursorRect : register(b0)
+{
+    // left, top, right, bottom of the cursor quad in desktop texture coordinates
+    float4 cursorRect;
+};
+
 struct VOut
 {
     float4 position : SV_POSITION;
@@ -23,3 +33,15 @@ float4 PShader(float4 position : SV_POSITION, float2 texcoord : TEXCOORD0) : SV_
     return shaderTexture.Sample(SampleType, texcoord);
 }
 
+// Draws cursors with an AND and an XOR mask: (desktop AND mask) XOR color.
+// shaderTexture holds the XOR color, cursorMask the AND mask in rgb and the coverage in alpha.
+float4 PShaderCursor(float4 position : SV_POSITION, float2 texcoord : TEXCOORD0) : SV_TARGET
+{
+    float4 color   = shaderTexture.Sample(SampleType, texcoord);
+    float4 mask    = cursorMask.Sample(SampleType, texcoord);
+    float4 desktop = desktopTexture.Sample(SampleType, lerp(cursorRect.xy, cursorRect.zw, texcoord));
+
+    // for black and white masks and colors this is exactly XOR, and for other colors it's close
+    // enough
+    return float4(abs(desktop.rgb * mask.rgb - color.rgb), mask.a);
+}
@@ -0,0 +1,142 @@
+#include "shared_slots.hpp"
+
+namespace {
+    // the state word: the latest slot, whether it is fresh, and the generation
+    static const uint32_t SLOT_MASK        = 0x3;
+    static const uint32_t FRESH            = 0x4;
+    static const uint32_t GENERATION_SHIFT = 3;
+
+    // at the start of every generation
+    static const uint32_t FIRST_LATEST   = 0;
+    static const uint32_t FIRST_PRODUCER = 1;
+    static const uint32_t FIRST_CONSUMER = 2;
+
+    inline uint32_t makeState(uint32_t generation, uint32_t latest, bool fresh)
+    {
+        return generation << GENERATION_SHIFT | (fresh ? FRESH : 0) | latest;
+    }
+
+    inline bool sameGeneration(uint32_t state, uint32_t generation)
+    {
+        return state >> GENERATION_SHIFT == ((generation << GENERATION_SHIFT) >> GENERATION_SHIFT);
+    }
+}
+
+uint32_t
+shared_slots::generation(const control& ctl)
+{
+    return ctl.sequence.load(std::memory_order_acquire) / 2;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Producer
+//////////////////////////////////////////////////////////////////////////////
+bool
+shared_slots::producer::sync(uint32_t *textures, int32_t& width, int32_t& height)
+{
+    if (!m_ctl || m_ctl->magic.load(std::memory_order_acquire) != MAGIC)
+        return false;
+
+    // a seqlock, the host may be publishing right now
+    uint32_t before = m_ctl->sequence.load(std::memory_order_acquire);
+    if (before % 2 || before / 2 == m_generation)
+        return false;
+
+    for (uint32_t i = 0; i < SLOTS; ++i)
+        textures[i] = m_ctl->textures[i].load(std::memory_order_relaxed);
+
+    width  = m_ctl->width.load(std::memory_order_relaxed);
+    height = m_ctl->height.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_ctl->sequence.load(std::memory_order_relaxed) != before)
+        return false;
+
+    m_generation = before / 2;
+    m_back       = FIRST_PRODUCER;
+
+    return true;
+}
+
+uint32_t
+shared_slots::producer::commit()
+{
+    if (!m_ctl || !m_generation)
+        return 0;
+
+    // only the producer counts frames
+    uint32_t frame = m_ctl->frame.load(std::memory_order_relaxed) + 1;
+    m_ctl->slot_frame[m_back].store(frame, std::memory_order_relaxed);
+
+    uint32_t state = m_ctl->state.load(std::memory_order_acquire);
+
+    do {
+        if (!sameGeneration(state, m_generation))
+            return 0;
+    } while (!m_ctl->state.compare_exchange_weak(state, makeState(m_generation, m_back, true),
+                                                 std::memory_order_acq_rel, std::memory_order_acquire));
+
+    m_back = state & SLOT_MASK;
+    m_ctl->frame.store(frame, std::memory_order_release);
+
+    return frame;
+}
+
+void
+shared_slots::producer::drop()
+{
+    if (m_ctl)
+        m_ctl->dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Consumer
+//////////////////////////////////////////////////////////////////////////////
+void
+shared_slots::consumer::publish(const uint32_t *textures, int32_t width, int32_t height)
+{
+    if (!m_ctl)
+        return;
+
+    uint32_t sequence = m_ctl->sequence.load(std::memory_order_relaxed);
+
+    m_ctl->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (uint32_t i = 0; i < SLOTS; ++i) {
+        m_ctl->textures[i].store(textures[i], std::memory_order_relaxed);
+        m_ctl->slot_frame[i].store(0, std::memory_order_relaxed);
+    }
+
+    m_ctl->width.store(width, std::memory_order_relaxed);
+    m_ctl->height.store(height, std::memory_order_relaxed);
+
+    m_generation = (sequence + 2) / 2;
+    m_front      = FIRST_CONSUMER;
+
+    // a producer still committing to the old textures fails from now on
+    m_ctl->state.store(makeState(m_generation, FIRST_LATEST, false), std::memory_order_release);
+
+    m_ctl->magic.store(MAGIC, std::memory_order_relaxed);
+    m_ctl->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+int
+shared_slots::consumer::acquire(uint32_t& frame)
+{
+    if (!m_ctl || !m_generation)
+        return -1;
+
+    uint32_t state = m_ctl->state.load(std::memory_order_acquire);
+
+    do {
+        if (!(state & FRESH) || !sameGeneration(state, m_generation))
+            return -1;
+    } while (!m_ctl->state.compare_exchange_weak(state, makeState(m_generation, m_front, false),
+                                                 std::memory_order_acq_rel, std::memory_order_acquire));
+
+    m_front = state & SLOT_MASK;
+    frame   = m_ctl->slot_frame[m_front].load(std::memory_order_relaxed);
+
+    return static_cast<int>(m_front);
+}
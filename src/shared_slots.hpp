@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/** @file shared_slots.hpp
+ *
+ * Hands frames from the DWM hook (Windows 7) to the view through three shared textures, without
+ * either side ever waiting for the other.
+ *
+ * At any time, one slot belongs to the producer, which copies the next frame into it, one to
+ * the consumer, which copies the frame it holds into its desktop texture, and the third one
+ * holds the latest complete frame. Committing swaps the producer's slot with the latest one,
+ * acquiring swaps the consumer's slot with the latest one if that is newer than its own. Both
+ * are a single compare-and-swap on the state word in the control block, which lives in memory
+ * shared by both processes, so the consumer never sees a frame which is still being written.
+ *
+ * The host publishes the slot textures in the control block. Every publication starts a new
+ * generation, and the producer picks up the new textures before it copies its next frame.
+ * Frames committed to textures of an older generation are dropped.
+ *
+ * The textures themselves are synchronized on the GPU by the users, see SevenDwmSource.
+ */
+namespace shared_slots {
+    static const uint32_t SLOTS = 3;
+    static const uint32_t MAGIC = 0x4c535653; // "SVSL"
+
+    /**
+     * Lives in shared memory, all zeroes until the host publishes the first textures
+     */
+    struct control {
+        std::atomic<uint32_t> magic;
+
+        // odd while the host changes the textures, see publish()
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> textures[SLOTS]; // shared handles
+        std::atomic<int32_t>  width;
+        std::atomic<int32_t>  height;
+
+        // the latest slot, whether it is newer than the consumer's, and the generation
+        std::atomic<uint32_t> state;
+
+        // frames committed since the process started and the frame number of every slot,
+        // 32 bits are enough for two years at 60 fps
+        std::atomic<uint32_t> frame;
+        std::atomic<uint32_t> slot_frame[SLOTS];
+
+        // presents in which the producer didn't copy, because it couldn't get hold of its slot
+        std::atomic<uint32_t> dropped;
+    };
+
+    /**
+     * The generation of the textures, 0 until the first publication
+     */
+    uint32_t generation(const control& ctl);
+
+    /**
+     * The writing side, in the DWM hook
+     */
+    class producer {
+        control *m_ctl        = nullptr;
+        uint32_t m_generation = 0;
+        uint32_t m_back       = 0;
+
+    public:
+        explicit producer(control *ctl = nullptr) : m_ctl(ctl) {}
+
+        /**
+         * Checks for newly published textures
+         *
+         * @returns true if there are new ones, which have been stored in @a textures, @a width
+         *          and @a height. The slots of the old ones must not be written anymore.
+         */
+        bool sync(uint32_t *textures, int32_t& width, int32_t& height);
+
+        /**
+         * Whether there are textures to write to
+         */
+        bool ready() const { return m_generation != 0; }
+
+        /**
+         * The slot to write the next frame to
+         */
+        uint32_t slot() const { return m_back; }
+
+        /**
+         * The slot holds a complete frame now, it becomes the latest one and the producer gets
+         * another slot.
+         *
+         * @returns The frame number, 0 if the textures have been replaced in the meantime
+         */
+        uint32_t commit();
+
+        /**
+         * Counts a present in which no frame was copied, because the slot was busy
+         */
+        void drop();
+    };
+
+    /**
+     * The reading side, in the view
+     */
+    class consumer {
+        control *m_ctl        = nullptr;
+        uint32_t m_generation = 0;
+        uint32_t m_front      = 0;
+
+    public:
+        explicit consumer(control *ctl = nullptr) : m_ctl(ctl) {}
+
+        /**
+         * Publishes new textures of the given size, the slots start over empty
+         */
+        void publish(const uint32_t *textures, int32_t width, int32_t height);
+
+        /**
+         * Takes the latest frame if there is a newer one than the one held
+         *
+         * @returns The slot holding it until the next acquire(), or -1 if there is no newer
+         *          frame. @a frame receives its number.
+         */
+        int acquire(uint32_t& frame);
+
+        /**
+         * The slot held, which may not contain any frame yet
+         */
+        uint32_t slot() const { return m_front; }
+    };
+}
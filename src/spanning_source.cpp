@@ -0,0 +1,286 @@
+#include "spanning_source.hpp"
+#include "logger.hpp"
+#include "util.hpp"
+
+#include <cstdlib>
+
+namespace {
+    // log the stitched copies every that many desktop updates
+    static const uint64_t STITCH_LOG_INTERVAL = 1000;
+}
+
+void
+SpanningSource::reinit(ID3D10Device *device, int x, int y, int w, int h)
+{
+    logger << "(Re)initializing spanning source dev="<<device<<" x="<<x<<" y="<<y<<" w="<<w<<" h="<<h << std::endl;
+
+    m_outputs.clear();
+    m_wakeups.clear();
+    m_damage.clear();
+    m_cursorOutput = -1;
+
+    m_dev = device;
+
+    m_desktopWidth  = w;
+    m_desktopHeight = h;
+
+    // every output of the adapter we render with which is part of the desktop
+    com_ptr<IDXGIDevice>  dev;
+    com_ptr<IDXGIAdapter> adp;
+
+    device->QueryInterface(dev.uuid(), dev.pptr_as_void_cleared());
+    dev->GetAdapter(adp.pptr_cleared());
+
+    std::vector<damage::rect> screens;
+
+    com_ptr<IDXGIOutput> output;
+    for (UINT i = 0; SUCCEEDED(adp->EnumOutputs(i, output.pptr_cleared())); ++i) {
+        DXGI_OUTPUT_DESC desc;
+        output->GetDesc(&desc);
+
+        const RECT& screen = desc.DesktopCoordinates;
+
+        if (desc.AttachedToDesktop)
+            screens.push_back({ screen.left, screen.top, screen.right, screen.bottom });
+    }
+
+    damage::rect view = { x, y, x + w, y + h };
+
+    for (const atlas::part& part : atlas::layout(view, screens)) {
+        const damage::rect& out = part.output;
+
+        logger << "Spanning display x="<<out.left<<" y="<<out.top<<" w="<<damage::width(out)<<" h="<<damage::height(out)
+               << " at x="<<part.x<<" y="<<part.y << std::endl;
+
+        std::unique_ptr<Output> o(new Output);
+        o->part = part;
+        o->hub.reinit(device, out.left, out.top, damage::width(out), damage::height(out));
+        o->cursorTexture     = com_ptr<ID3D10Texture2D>::take(o->hub.createCursorTexture());
+        o->cursorMaskTexture = com_ptr<ID3D10Texture2D>::take(o->hub.createCursorMaskTexture());
+
+        m_wakeups.push_back(o->hub.wakeup());
+        m_outputs.push_back(std::move(o));
+    }
+
+    if (m_outputs.empty())
+        logger << "WARNING: Couldn't find any display: x="<<x<<" y="<<y<<" w="<<w<<" h="<<h<<std::endl;
+}
+
+ID3D10Texture2D *
+SpanningSource::createTexture(UINT width, UINT height)
+{
+    HRESULT hr;
+    ID3D10Texture2D *texture = nullptr;
+
+    // written by copies only
+    D3D10_TEXTURE2D_DESC texdsc = {
+        .Width = width,
+        .Height = height,
+        .MipLevels = 1,
+        .ArraySize = 1,
+        .Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+        .SampleDesc = {
+            .Count = 1,
+            .Quality = 0
+        },
+        .Usage = D3D10_USAGE_DEFAULT,
+        .BindFlags = D3D10_BIND_SHADER_RESOURCE,
+        .CPUAccessFlags = 0,
+        .MiscFlags = 0
+    };
+
+    // initially, the texture is black and transparent
+    D3D10_SUBRESOURCE_DATA texdata = {
+        .pSysMem = std::calloc(texdsc.Width * texdsc.Height, 4),
+        .SysMemPitch = 4*texdsc.Width,
+        .SysMemSlicePitch = 0
+    };
+
+    hr = m_dev->CreateTexture2D(&texdsc, &texdata, &texture);
+
+    std::free(const_cast<void*>(texdata.pSysMem));
+
+    if FAILED(hr)
+        logger << "Failed:CreateTexture2D: " << util::hresult_to_utf8(hr) << std::endl;
+
+    return texture;
+}
+
+ID3D10Texture2D *
+SpanningSource::createDesktopTexture()
+{
+    if (!m_dev || m_outputs.empty())
+        return nullptr;
+
+    // the parts of the outputs are copied as soon as their hubs have frames
+    for (auto& out : m_outputs)
+        out->fullCopy = true;
+
+    // the atlas has the size of the view, large views may exceed what the GPU can do
+    return createTexture(static_cast<UINT>(m_desktopWidth), static_cast<UINT>(m_desktopHeight));
+}
+
+ID3D10Texture2D *
+SpanningSource::createCursorTexture()
+{
+    if (!m_dev || m_outputs.empty() || !m_outputs.front()->cursorTexture)
+        return nullptr;
+
+    // a copy target for the cursors of all hubs, which are all alike
+    D3D10_TEXTURE2D_DESC desc;
+    m_outputs.front()->cursorTexture->GetDesc(&desc);
+
+    m_cursorOutput = -1;
+
+    return createTexture(desc.Width, desc.Height);
+}
+
+ID3D10Texture2D *
+SpanningSource::createCursorMaskTexture()
+{
+    // same size and format as the cursor texture
+    return createCursorTexture();
+}
+
+bool
+SpanningSource::wakesUp() const
+{
+    // every hub has to, we only wait on all of them together
+    for (const auto& out : m_outputs) {
+        if (!out->hub.wakesUp())
+            return false;
+    }
+
+    return !m_outputs.empty();
+}
+
+bool
+SpanningSource::acquireFrame(unsigned timeoutMs)
+{
+    // any hub waking us up will do, then we look at all of them
+    MsgWaitForMultipleObjects(static_cast<DWORD>(m_wakeups.size()), m_wakeups.data(), FALSE, timeoutMs, QS_ALLINPUT);
+
+    bool acquired = false;
+
+    for (auto& out : m_outputs) {
+        out->acquired = out->hub.acquireFrame(0);
+        acquired      = acquired || out->acquired;
+    }
+
+    return acquired;
+}
+
+bool
+SpanningSource::updateDesktop(ID3D10Texture2D *desktopTex)
+{
+    m_damage.clear();
+
+    if (!desktopTex || !m_dev)
+        return false;
+
+    for (auto& out : m_outputs) {
+        // the hub's frames are drawn from directly, the hub source has nothing to copy
+        bool changed = out->acquired && out->hub.updateDesktop(nullptr);
+
+        m_outputDamage.clear();
+        if (changed && !out->hub.desktopDamage(m_outputDamage))
+            out->fullCopy = true;
+
+        if (!changed && !out->fullCopy)
+            continue;
+
+        ID3D10Texture2D *frame = out->hub.frameTexture();
+        if (!frame) {
+            // nothing published yet, copy everything once there is
+            out->fullCopy = true;
+            continue;
+        }
+
+        if (out->fullCopy)
+            m_outputDamage.assign(1, out->part.source);
+
+        std::size_t first = m_damage.size();
+        atlas::to_atlas(out->part, m_outputDamage, m_damage);
+
+        for (std::size_t i = first; i < m_damage.size(); ++i) {
+            const damage::rect& r   = m_damage[i];
+            damage::rect        src = atlas::to_output(out->part, r);
+
+            D3D10_BOX box = {
+                .left   = static_cast<UINT>(src.left),
+                .top    = static_cast<UINT>(src.top),
+                .front  = 0,
+                .right  = static_cast<UINT>(src.right),
+                .bottom = static_cast<UINT>(src.bottom),
+                .back   = 1
+            };
+
+            m_dev->CopySubresourceRegion(desktopTex, 0, static_cast<UINT>(r.left), static_cast<UINT>(r.top), 0, frame, 0, &box);
+
+            m_bytesStitched += 4 * static_cast<uint64_t>(damage::area(r));
+        }
+
+        out->fullCopy = false;
+    }
+
+    if (m_damage.empty())
+        return false;
+
+    if (++m_updates % STITCH_LOG_INTERVAL == 0)
+        logger << "Spanning: stitched " << m_bytesStitched / (1024 * 1024) << " MB from "
+               << m_outputs.size() << " displays in " << m_updates << " frames" << std::endl;
+
+    return true;
+}
+
+bool
+SpanningSource::desktopDamage(std::vector<damage::rect>& rects)
+{
+    rects.insert(rects.end(), m_damage.begin(), m_damage.end());
+
+    return true;
+}
+
+bool
+SpanningSource::updateCursor(ID3D10Texture2D *cursorTex, ID3D10Texture2D *cursorMaskTex, frame_source::cursor_state& cursorState)
+{
+    bool changed = false;
+
+    // The cursor is on the output which reported it visible last. The shape is copied from its
+    // hub whenever that one reports a change, the textures are tiny.
+    for (std::size_t i = 0; i < m_outputs.size(); ++i) {
+        Output& out = *m_outputs[i];
+
+        if (!out.acquired || !out.hub.updateCursor(nullptr, nullptr, out.cursor))
+            continue;
+
+        if (out.cursor.visible || static_cast<int>(i) == m_cursorOutput) {
+            m_cursorOutput = static_cast<int>(i);
+
+            if (cursorTex && out.cursorTexture)
+                m_dev->CopyResource(cursorTex, out.cursorTexture);
+            if (cursorMaskTex && out.cursorMaskTexture)
+                m_dev->CopyResource(cursorMaskTex, out.cursorMaskTexture);
+
+            changed = true;
+        }
+    }
+
+    if (!changed)
+        return false;
+
+    const Output& out = *m_outputs[m_cursorOutput];
+
+    cursorState   = out.cursor;
+    cursorState.x = out.cursor.x - out.part.source.left + out.part.x;
+    cursorState.y = out.cursor.y - out.part.source.top  + out.part.y;
+
+    return true;
+}
+
+void
+SpanningSource::releaseFrame()
+{
+    for (auto& out : m_outputs)
+        out->hub.releaseFrame();
+}
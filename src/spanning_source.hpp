@@ -0,0 +1,71 @@
+#pragma once
+
+#include <d3d10_1.h>
+#include <dxgi1_2.h>
+
+#include "com_ptr.hpp"
+#include "atlas.hpp"
+#include "frame_source.hpp"
+#include "hub_source.hpp"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Captures a rectangle of the desktop spanning any number of outputs.
+ *
+ * Every output under the rectangle is captured by its own OutputHub, i.e. on its own thread
+ * and at its own rate, shared with the other views of that output. Whatever a hub changed is
+ * stitched into the desktop texture, an atlas of the size of the rectangle, see atlas.hpp.
+ * Outputs which didn't change aren't touched.
+ */
+class SpanningSource {
+public:
+    typedef ID3D10Device    device_type;
+    typedef ID3D10Texture2D texture_type;
+
+private:
+    struct Output {
+        atlas::part                part;
+        HubSource                  hub;
+        com_ptr<ID3D10Texture2D>   cursorTexture;     // the hub's shared ones
+        com_ptr<ID3D10Texture2D>   cursorMaskTexture;
+        bool                       acquired       = false;
+        bool                       fullCopy       = true; // the atlas doesn't contain the part yet
+        frame_source::cursor_state cursor;
+    };
+
+    ID3D10Device *m_dev = nullptr;
+
+    int m_desktopWidth  = 0;
+    int m_desktopHeight = 0;
+
+    std::vector<std::unique_ptr<Output>> m_outputs;
+    std::vector<HANDLE>                  m_wakeups;
+
+    // what updateDesktop changed, in atlas coordinates
+    std::vector<damage::rect> m_damage;
+    std::vector<damage::rect> m_outputDamage;
+
+    uint64_t m_bytesStitched = 0;
+    uint64_t m_updates       = 0;
+
+    // the output whose cursor shape is in our cursor textures, -1 for none
+    int m_cursorOutput = -1;
+
+    ID3D10Texture2D *createTexture(UINT width, UINT height);
+
+public:
+    void reinit(ID3D10Device *device, int x, int y, int w, int h);
+    ID3D10Texture2D *createDesktopTexture();
+    ID3D10Texture2D *createCursorTexture();
+    ID3D10Texture2D *createCursorMaskTexture();
+    bool acquireFrame(unsigned timeoutMs);
+    bool updateDesktop(ID3D10Texture2D *desktopTex);
+    bool desktopDamage(std::vector<damage::rect>& rects);
+    bool updateCursor(ID3D10Texture2D *cursorTex, ID3D10Texture2D *cursorMaskTex, frame_source::cursor_state& cursorState);
+    void releaseFrame();
+    bool setZeroCopy(bool) { return false; }
+    ID3D10Texture2D *frameTexture() { return nullptr; }
+    bool wakesUp() const;
+};
@@ -0,0 +1,93 @@
+#include "spsc_ring.hpp"
+
+#include <cstring>
+
+namespace {
+    // in front of every message, messages start at multiples of this
+    struct record {
+        uint32_t size;
+        uint32_t type;
+    };
+
+    inline uint32_t recordSize(uint32_t payload)
+    {
+        return (sizeof(record) + payload + sizeof(record) - 1) & ~static_cast<uint32_t>(sizeof(record) - 1);
+    }
+
+    // copies into the ring at @a position, wrapping around at its end
+    void copyIn(uint8_t *data, uint32_t capacity, uint32_t position, const void *src, uint32_t size)
+    {
+        uint32_t offset = position & (capacity - 1);
+        uint32_t first  = capacity - offset < size ? capacity - offset : size;
+
+        std::memcpy(data + offset, src, first);
+        std::memcpy(data, static_cast<const uint8_t*>(src) + first, size - first);
+    }
+
+    void copyOut(const uint8_t *data, uint32_t capacity, uint32_t position, void *dst, uint32_t size)
+    {
+        uint32_t offset = position & (capacity - 1);
+        uint32_t first  = capacity - offset < size ? capacity - offset : size;
+
+        std::memcpy(dst, data + offset, first);
+        std::memcpy(static_cast<uint8_t*>(dst) + first, data, size - first);
+    }
+}
+
+bool
+spsc_ring::push(header& head, uint8_t *data, uint32_t capacity, uint32_t type, const void *payload, uint32_t size)
+{
+    if (size > max_payload(capacity))
+        return false;
+
+    uint32_t write = head.write.load(std::memory_order_relaxed);
+    uint32_t read  = head.read.load(std::memory_order_acquire);
+    uint32_t need  = recordSize(size);
+
+    if (need > capacity - (write - read))
+        return false;
+
+    record r = { size, type };
+    copyIn(data, capacity, write, &r, sizeof(r));
+    if (size)
+        copyIn(data, capacity, write + sizeof(r), payload, size);
+
+    head.write.store(write + need, std::memory_order_release);
+
+    return true;
+}
+
+bool
+spsc_ring::pop(header& head, const uint8_t *data, uint32_t capacity, uint32_t& type, std::string& payload)
+{
+    uint32_t read  = head.read.load(std::memory_order_relaxed);
+    uint32_t write = head.write.load(std::memory_order_acquire);
+
+    if (read == write)
+        return false;
+
+    record r;
+    copyOut(data, capacity, read, &r, sizeof(r));
+
+    uint32_t need = recordSize(r.size);
+    if (r.size > max_payload(capacity) || need > write - read) {
+        // nothing sensible can be read anymore, start over where the writer is
+        head.read.store(write, std::memory_order_release);
+        return false;
+    }
+
+    payload.resize(r.size);
+    if (r.size)
+        copyOut(data, capacity, read + sizeof(r), &payload[0], r.size);
+
+    type = r.type;
+    head.read.store(read + need, std::memory_order_release);
+
+    return true;
+}
+
+bool
+spsc_ring::empty(const header& head)
+{
+    return head.read.load(std::memory_order_acquire) == head.write.load(std::memory_order_acquire);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/** @file spsc_ring.hpp
+ *
+ * A ring of messages for exactly one writer and one reader, which may live in different
+ * processes: the ring only consists of plain bytes and lock free atomics, so it can be put into
+ * shared memory. Neither side ever blocks, a full ring refuses new messages. Waking up the
+ * reader is up to the users.
+ *
+ * Every message has a type and a payload of up to max_payload() bytes. A ring which is all
+ * zeroes is empty.
+ */
+namespace spsc_ring {
+    struct header {
+        std::atomic<uint32_t> write; // bytes ever written, wrapping around
+        std::atomic<uint32_t> read;  // bytes ever read
+        std::atomic<uint32_t> lost;  // messages refused because the ring was full, counted by the users
+        uint32_t              reserved;
+    };
+
+    /**
+     * @tparam CAPACITY Size of the ring in bytes, a power of two
+     */
+    template<uint32_t CAPACITY>
+    struct ring {
+        static_assert(CAPACITY >= 64 && (CAPACITY & (CAPACITY - 1)) == 0, "the capacity has to be a power of two");
+
+        header  head;
+        uint8_t data[CAPACITY];
+    };
+
+    /**
+     * The largest payload a ring of @a capacity bytes takes
+     */
+    inline uint32_t max_payload(uint32_t capacity) { return capacity / 2; }
+
+    /**
+     * Writer: appends a message, returns false if the ring is too full
+     */
+    bool push(header& head, uint8_t *data, uint32_t capacity, uint32_t type, const void *payload, uint32_t size);
+
+    /**
+     * Reader: takes the oldest message, returns false if there is none.
+     *
+     * A corrupt ring is emptied.
+     */
+    bool pop(header& head, const uint8_t *data, uint32_t capacity, uint32_t& type, std::string& payload);
+
+    /**
+     * Whether there is any message
+     */
+    bool empty(const header& head);
+
+    template<uint32_t CAPACITY>
+    bool push(ring<CAPACITY>& r, uint32_t type, const void *payload, uint32_t size)
+    {
+        return push(r.head, r.data, CAPACITY, type, payload, size);
+    }
+
+    template<uint32_t CAPACITY>
+    bool pop(ring<CAPACITY>& r, uint32_t& type, std::string& payload)
+    {
+        return pop(r.head, r.data, CAPACITY, type, payload);
+    }
+
+    template<uint32_t CAPACITY>
+    bool empty(const ring<CAPACITY>& r)
+    {
+        return empty(r.head);
+    }
+}
@@ -0,0 +1,171 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace {
+    const uint64_t SLOT_US      = stats::SLOT_MS * 1000;
+    const uint64_t NO_EPOCH     = ~0ull;
+
+    // all living recorders, and what the dead ones have counted
+    std::mutex                     g_mutex;
+    std::vector<stats::recorder*>  g_recorders;
+    uint64_t                       g_retired[stats::COUNTER_COUNT] = {};
+
+    thread_local stats::recorder  *g_current = nullptr;
+
+    inline void addRelaxed(std::atomic<uint64_t>& value, uint64_t n)
+    {
+        // there is only one writer, so this doesn't need to be an atomic read-modify-write
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+}
+
+unsigned
+stats::bucket_for(uint64_t us)
+{
+    unsigned bucket = 0;
+
+    while (us && bucket < BUCKETS - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+stats::rolling_histogram::rolling_histogram()
+{
+    for (slot& s : m_slots) {
+        s.epoch.store(NO_EPOCH, std::memory_order_relaxed);
+
+        for (auto& b : s.buckets)
+            b.store(0, std::memory_order_relaxed);
+
+        s.count.store(0, std::memory_order_relaxed);
+        s.total.store(0, std::memory_order_relaxed);
+        s.max.store(0, std::memory_order_relaxed);
+    }
+}
+
+void
+stats::rolling_histogram::record(uint64_t nowUs, uint64_t durationUs)
+{
+    uint64_t epoch = nowUs / SLOT_US;
+    slot& s = m_slots[epoch % WINDOW_SLOTS];
+
+    if (s.epoch.load(std::memory_order_relaxed) != epoch) {
+        // the slot is from a previous round, start over
+        s.epoch.store(NO_EPOCH, std::memory_order_relaxed);
+
+        for (auto& b : s.buckets)
+            b.store(0, std::memory_order_relaxed);
+
+        s.count.store(0, std::memory_order_relaxed);
+        s.total.store(0, std::memory_order_relaxed);
+        s.max.store(0, std::memory_order_relaxed);
+
+        s.epoch.store(epoch, std::memory_order_release);
+    }
+
+    addRelaxed(s.buckets[bucket_for(durationUs)], 1);
+    addRelaxed(s.count, 1);
+    addRelaxed(s.total, durationUs);
+
+    if (durationUs > s.max.load(std::memory_order_relaxed))
+        s.max.store(durationUs, std::memory_order_relaxed);
+}
+
+void
+stats::rolling_histogram::add_to(SV_Histogram& out, uint64_t nowUs) const
+{
+    uint64_t current = nowUs / SLOT_US;
+
+    for (const slot& s : m_slots) {
+        uint64_t epoch = s.epoch.load(std::memory_order_acquire);
+
+        if (epoch == NO_EPOCH || epoch > current || current - epoch >= WINDOW_SLOTS)
+            continue;
+
+        for (unsigned i = 0; i < BUCKETS; ++i)
+            out.buckets[i] += s.buckets[i].load(std::memory_order_relaxed);
+
+        out.count    += s.count.load(std::memory_order_relaxed);
+        out.total_us += s.total.load(std::memory_order_relaxed);
+        out.max_us    = std::max(out.max_us, s.max.load(std::memory_order_relaxed));
+    }
+}
+
+stats::recorder::recorder()
+{
+    for (auto& c : m_counters)
+        c.store(0, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(g_mutex);
+    g_recorders.push_back(this);
+}
+
+stats::recorder::~recorder()
+{
+    if (g_current == this)
+        g_current = nullptr;
+
+    std::lock_guard<std::mutex> guard(g_mutex);
+
+    for (unsigned i = 0; i < COUNTER_COUNT; ++i)
+        g_retired[i] += m_counters[i].load(std::memory_order_relaxed);
+
+    g_recorders.erase(std::remove(g_recorders.begin(), g_recorders.end(), this), g_recorders.end());
+}
+
+void
+stats::recorder::count(counter c, uint64_t n)
+{
+    addRelaxed(m_counters[c], n);
+}
+
+void
+stats::recorder::add_to(SV_Stats& out, uint64_t nowUs) const
+{
+    out.frames_acquired    += m_counters[FRAMES_ACQUIRED].load(std::memory_order_relaxed);
+    out.frames_skipped     += m_counters[FRAMES_SKIPPED].load(std::memory_order_relaxed);
+    out.frames_presented   += m_counters[FRAMES_PRESENTED].load(std::memory_order_relaxed);
+    out.accumulated_frames += m_counters[ACCUMULATED_FRAMES].load(std::memory_order_relaxed);
+
+    for (unsigned i = 0; i < SV_STAGE_COUNT; ++i)
+        m_stages[i].add_to(out.stages[i], nowUs);
+}
+
+void
+stats::recorder::set_current(recorder *r)
+{
+    g_current = r;
+}
+
+stats::recorder *
+stats::recorder::current()
+{
+    return g_current;
+}
+
+void
+stats::collect(SV_Stats& out, uint64_t nowUs)
+{
+    uint32_t size = out.size;
+
+    std::memset(&out, 0, sizeof(out));
+    out.size      = size;
+    out.window_ms = static_cast<uint32_t>(WINDOW_SLOTS * SLOT_MS);
+
+    std::lock_guard<std::mutex> guard(g_mutex);
+
+    out.frames_acquired    = g_retired[FRAMES_ACQUIRED];
+    out.frames_skipped     = g_retired[FRAMES_SKIPPED];
+    out.frames_presented   = g_retired[FRAMES_PRESENTED];
+    out.accumulated_frames = g_retired[ACCUMULATED_FRAMES];
+
+    for (const recorder *r : g_recorders)
+        r->add_to(out, nowUs);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////
+// Reading the statistics - C API, keep in sync with dllapi.h
+// SV_GetStats itself is exported by view.cpp
+//////////////////////////////////////////////////////////////////////
+extern "C" {
+
+#define SV_STATS_BUCKETS 20
+
+enum SV_Stage {
+    SV_STAGE_ACQUIRE = 0, // waiting for a new frame
+    SV_STAGE_COPY,        // copying the frame into our textures
+    SV_STAGE_DRAW,        // drawing the view
+    SV_STAGE_PRESENT,     // presenting the view
+    SV_STAGE_COUNT
+};
+
+struct SV_Histogram {
+    uint64_t buckets[SV_STATS_BUCKETS]; // bucket 0: < 1us, bucket i: [2^(i-1), 2^i) us, the last one is open ended
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+};
+
+struct SV_Stats {
+    uint32_t     size;                  // to be set to sizeof(SV_Stats) by the caller
+    uint32_t     window_ms;             // the time span covered by the histograms
+    uint64_t     frames_acquired;       // new frames the views got from their sources
+    uint64_t     frames_skipped;        // passes of the render loops with nothing new to present
+    uint64_t     frames_presented;
+    uint64_t     accumulated_frames;    // sum of DXGI_OUTDUPL_FRAME_INFO::AccumulatedFrames
+    SV_Histogram stages[SV_STAGE_COUNT];
+};
+
+} // extern "C"
+
+/////////////////////////////////////////////////////////////////////
+// Recording - C++ API
+/////////////////////////////////////////////////////////////////////
+
+/** @file stats.hpp
+ *
+ * Frame counters and latency histograms of the capture and render threads.
+ *
+ * Every thread records into its own recorder without any locking, reading the statistics
+ * sums up all recorders. The histograms cover the last WINDOW_SLOTS * SLOT_MS milliseconds.
+ * Times are passed in by the caller.
+ */
+namespace stats {
+    enum counter {
+        FRAMES_ACQUIRED = 0,
+        FRAMES_SKIPPED,
+        FRAMES_PRESENTED,
+        ACCUMULATED_FRAMES,
+        COUNTER_COUNT
+    };
+
+    static const unsigned BUCKETS      = SV_STATS_BUCKETS;
+    static const unsigned WINDOW_SLOTS = 10;
+    static const uint64_t SLOT_MS      = 1000;
+
+    /**
+     * The histogram bucket a duration falls into
+     */
+    unsigned bucket_for(uint64_t us);
+
+    /**
+     * A log2 histogram over the last WINDOW_SLOTS slots of time
+     *
+     * Only one thread may record, any thread may read. A reader racing with the writer
+     * starting a new slot may see that slot partially cleared.
+     */
+    class rolling_histogram {
+        struct slot {
+            std::atomic<uint64_t> epoch;
+            std::atomic<uint64_t> buckets[BUCKETS];
+            std::atomic<uint64_t> count;
+            std::atomic<uint64_t> total;
+            std::atomic<uint64_t> max;
+        };
+
+        slot m_slots[WINDOW_SLOTS];
+
+    public:
+        rolling_histogram();
+
+        void record(uint64_t nowUs, uint64_t durationUs);
+        void add_to(SV_Histogram& out, uint64_t nowUs) const;
+    };
+
+    /**
+     * The statistics of one thread. Registers itself for collect() while it exists.
+     */
+    class recorder {
+        std::atomic<uint64_t> m_counters[COUNTER_COUNT];
+        rolling_histogram     m_stages[SV_STAGE_COUNT];
+
+    public:
+        recorder();
+        ~recorder();
+
+        recorder(const recorder&) = delete;
+        recorder& operator=(const recorder&) = delete;
+
+        void count(counter c, uint64_t n);
+
+        void time(SV_Stage s, uint64_t nowUs, uint64_t durationUs)
+        {
+            m_stages[s].record(nowUs, durationUs);
+        }
+
+        uint64_t counter_value(counter c) const { return m_counters[c].load(std::memory_order_relaxed); }
+
+        void add_to(SV_Stats& out, uint64_t nowUs) const;
+
+        /**
+         * Makes @a r the recorder used by count() and time() on the calling thread
+         */
+        static void set_current(recorder *r);
+        static recorder *current();
+    };
+
+    /**
+     * Record on the calling thread's recorder, if there is one
+     */
+    inline void count(counter c, uint64_t n = 1)
+    {
+        if (recorder *r = recorder::current())
+            r->count(c, n);
+    }
+
+    inline void time(SV_Stage s, uint64_t nowUs, uint64_t durationUs)
+    {
+        if (recorder *r = recorder::current())
+            r->time(s, nowUs, durationUs);
+    }
+
+    /**
+     * Sums up all recorders, including the counters of the ones which are gone
+     */
+    void collect(SV_Stats& out, uint64_t nowUs);
+}
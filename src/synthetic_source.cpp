@@ -0,0 +1,255 @@
+#include "synthetic_source.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    static const int CURSOR_TEX_SIZE = 256;
+    static const int LINE_HEIGHT     = 16;
+    static const int GLYPH_WIDTH     = 8;
+
+    // cheap deterministic noise, good enough to defeat any compression
+    inline uint32_t pattern(int x, int y, uint64_t seed)
+    {
+        uint32_t v = static_cast<uint32_t>(x) * 0x9E3779B1u ^ static_cast<uint32_t>(y) * 0x85EBCA77u ^ static_cast<uint32_t>(seed) * 0xC2B2AE3Du;
+        v ^= v >> 15;
+        v *= 0x2C1B3C6Du;
+        v ^= v >> 12;
+
+        return v | 0xFF000000u;
+    }
+
+    void fill(cpu_surface& surface, const damage::rect& r, uint64_t seed)
+    {
+        damage::rect clipped = damage::intersection(r, surface.bounds());
+
+        for (int32_t y = clipped.top; y < clipped.bottom; ++y) {
+            uint32_t *row = reinterpret_cast<uint32_t*>(surface.row(y));
+
+            for (int32_t x = clipped.left; x < clipped.right; ++x)
+                row[x] = pattern(x, y, seed);
+        }
+    }
+
+    void fillSolid(cpu_surface& surface, const damage::rect& r, uint32_t bgra)
+    {
+        damage::rect clipped = damage::intersection(r, surface.bounds());
+
+        for (int32_t y = clipped.top; y < clipped.bottom; ++y) {
+            uint32_t *row = reinterpret_cast<uint32_t*>(surface.row(y));
+
+            std::fill(row + clipped.left, row + clipped.right, bgra);
+        }
+    }
+
+    damage::rect terminalArea(int w, int h) { return { 0, 0, w / 2, (h * 2) / 3 }; }
+    damage::rect typingArea(int w, int h)   { return { w / 2, 0, w, h / 3 }; }
+    damage::rect videoArea(int w, int h)    { return { w / 2, h / 3, w / 2 + std::min(640, w / 2), h / 3 + std::min(360, h - h / 3) }; }
+}
+
+SyntheticSource::SyntheticSource(unsigned activities) : m_activities(activities)
+{
+}
+
+void
+SyntheticSource::reinit(cpu_device *device, int, int, int w, int h)
+{
+    m_dev = device;
+
+    m_desktopWidth  = w;
+    m_desktopHeight = h;
+
+    m_screen = cpu_surface(w, h);
+    fill(m_screen, m_screen.bounds(), 0);
+
+    m_frame         = 0;
+    m_frameAcquired = false;
+    m_needsFullCopy = true;
+    m_cursorShapeChanged = true;
+
+    m_typingX = 0;
+    m_typingY = 0;
+}
+
+cpu_surface *
+SyntheticSource::createDesktopTexture()
+{
+    // a new texture doesn't contain anything we could update incrementally
+    m_needsFullCopy = true;
+
+    return new cpu_surface(m_desktopWidth, m_desktopHeight);
+}
+
+cpu_surface *
+SyntheticSource::createCursorTexture()
+{
+    m_cursorShapeChanged = true;
+
+    return new cpu_surface(CURSOR_TEX_SIZE, CURSOR_TEX_SIZE);
+}
+
+cpu_surface *
+SyntheticSource::createCursorMaskTexture()
+{
+    return new cpu_surface(CURSOR_TEX_SIZE, CURSOR_TEX_SIZE);
+}
+
+void
+SyntheticSource::scroll()
+{
+    damage::rect area = terminalArea(m_desktopWidth, m_desktopHeight);
+    if (damage::height(area) <= LINE_HEIGHT)
+        return;
+
+    // move everything up by one line, and print a new line at the bottom
+    m_moves.push_back({ area.left, area.top + LINE_HEIGHT, { area.left, area.top, area.right, area.bottom - LINE_HEIGHT }, false });
+
+    damage::order_moves(m_moves, m_screen.bounds());
+    damage::apply_moves(m_screen.pixels.data(), m_screen.pitch, m_moves);
+
+    for (const damage::move& m : m_moves)
+        m_damage.push_back(m.dst);
+
+    damage::rect line = { area.left, area.bottom - LINE_HEIGHT, area.right, area.bottom };
+    fill(m_screen, line, m_frame);
+    m_damage.push_back(line);
+}
+
+void
+SyntheticSource::type()
+{
+    damage::rect area = typingArea(m_desktopWidth, m_desktopHeight);
+    if (damage::width(area) < GLYPH_WIDTH || damage::height(area) < LINE_HEIGHT)
+        return;
+
+    if (area.left + m_typingX + GLYPH_WIDTH > area.right) {
+        m_typingX  = 0;
+        m_typingY += LINE_HEIGHT;
+    }
+
+    if (area.top + m_typingY + LINE_HEIGHT > area.bottom) {
+        // page is full, start over on a blank one
+        m_typingY = 0;
+
+        fillSolid(m_screen, area, 0xFFFFFFFFu);
+        m_damage.push_back(area);
+    }
+
+    damage::rect glyph = { area.left + m_typingX, area.top + m_typingY, area.left + m_typingX + GLYPH_WIDTH, area.top + m_typingY + LINE_HEIGHT };
+    fill(m_screen, glyph, m_frame);
+    m_damage.push_back(glyph);
+
+    m_typingX += GLYPH_WIDTH;
+}
+
+void
+SyntheticSource::playVideo()
+{
+    damage::rect area = videoArea(m_desktopWidth, m_desktopHeight);
+
+    fill(m_screen, area, m_frame);
+    m_damage.push_back(area);
+}
+
+bool
+SyntheticSource::acquireFrame(unsigned)
+{
+    m_moves.clear();
+    m_damage.clear();
+
+    ++m_frame;
+
+    if (m_activities & ACTIVITY_SCROLLING)
+        scroll();
+
+    if (m_activities & ACTIVITY_TYPING)
+        type();
+
+    if (m_activities & ACTIVITY_VIDEO)
+        playVideo();
+
+    damage::coalesce(m_damage, m_screen.bounds());
+
+    m_frameAcquired = true;
+
+    return true;
+}
+
+bool
+SyntheticSource::updateDesktop(cpu_surface *desktopTex)
+{
+    if (!desktopTex || !m_frameAcquired || !m_dev)
+        return false;
+
+    m_fullUpdate = m_needsFullCopy;
+
+    if (m_needsFullCopy) {
+        m_dev->copy_resource(*desktopTex, m_screen);
+        m_needsFullCopy = false;
+        return true;
+    }
+
+    for (const damage::rect& r : m_damage)
+        m_dev->copy_rect(*desktopTex, m_screen, r);
+
+    return !m_damage.empty();
+}
+
+bool
+SyntheticSource::desktopDamage(std::vector<damage::rect>& rects)
+{
+    if (m_fullUpdate)
+        return false;
+
+    rects.insert(rects.end(), m_damage.begin(), m_damage.end());
+
+    return true;
+}
+
+bool
+SyntheticSource::updateCursor(cpu_surface *cursorTex, cpu_surface *, frame_source::cursor_state& cursor)
+{
+    if (!cursorTex || !m_frameAcquired)
+        return false;
+
+    bool visible = (m_activities & ACTIVITY_CURSOR) != 0;
+    bool changed = visible != cursor.visible;
+
+    if (!(cursor.visible = visible))
+        return changed;
+
+    // wander around on a lissajous figure
+    double t = static_cast<double>(m_frame) * 0.02;
+    long x = static_cast<long>((0.5 + 0.45 * std::sin(3.0 * t)) * m_desktopWidth);
+    long y = static_cast<long>((0.5 + 0.45 * std::sin(2.0 * t)) * m_desktopHeight);
+
+    changed = changed || x != cursor.x || y != cursor.y;
+    cursor.x = x;
+    cursor.y = y;
+
+    if (!m_cursorShapeChanged)
+        return changed;
+
+    // the arrow is opaque, so it doesn't need a mask
+    cursor.masked = false;
+
+    // a plain arrow: white with a black outline, transparent elsewhere
+    fillSolid(*cursorTex, cursorTex->bounds(), 0);
+
+    for (int y = 0; y < 20; ++y) {
+        uint32_t *row = reinterpret_cast<uint32_t*>(cursorTex->row(y));
+
+        for (int x = 0; x <= y / 2 + 1 && x < cursorTex->width; ++x)
+            row[x] = (x == 0 || x == y / 2 + 1 || y == 19) ? 0xFF000000u : 0xFFFFFFFFu;
+    }
+
+    m_cursorShapeChanged = false;
+
+    return true;
+}
+
+void
+SyntheticSource::releaseFrame()
+{
+    m_frameAcquired = false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "cpu_surface.hpp"
+#include "damage.hpp"
+#include "frame_source.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A frame source generating scripted desktop activity in system memory.
+ *
+ * Every acquired frame advances the script by one step, independent of the wall clock, so
+ * runs are reproducible. Like the DXGI duplication, it reports move and dirty rects and only
+ * copies the changed regions into the desktop texture.
+ */
+class SyntheticSource {
+public:
+    typedef cpu_device  device_type;
+    typedef cpu_surface texture_type;
+
+    enum activity : unsigned {
+        ACTIVITY_SCROLLING = 1 << 0, // a terminal scrolling up by one line per frame
+        ACTIVITY_TYPING    = 1 << 1, // one character typed per frame
+        ACTIVITY_VIDEO     = 1 << 2, // a region repainted completely in every frame
+        ACTIVITY_CURSOR    = 1 << 3, // the cursor moving across the screen
+        ACTIVITY_ALL       = 0xF
+    };
+
+private:
+    cpu_device *m_dev = nullptr;
+    unsigned    m_activities;
+
+    int m_desktopWidth  = 0;
+    int m_desktopHeight = 0;
+
+    // what the screen would look like right now
+    cpu_surface m_screen;
+
+    uint64_t m_frame         = 0;
+    bool     m_frameAcquired = false;
+    bool     m_needsFullCopy = true;
+    bool     m_fullUpdate    = true;
+    bool     m_cursorShapeChanged = true;
+
+    int m_typingX = 0;
+    int m_typingY = 0;
+
+    std::vector<damage::move> m_moves;
+    std::vector<damage::rect> m_damage;
+
+    void scroll();
+    void type();
+    void playVideo();
+
+public:
+    explicit SyntheticSource(unsigned activities = ACTIVITY_ALL);
+
+    void reinit(cpu_device *device, int x, int y, int w, int h);
+    cpu_surface *createDesktopTexture();
+    cpu_surface *createCursorTexture();
+    cpu_surface *createCursorMaskTexture();
+    bool acquireFrame(unsigned timeoutMs); // there is a new frame immediately, every time
+    bool updateDesktop(cpu_surface *desktopTex);
+    bool desktopDamage(std::vector<damage::rect>& rects);
+    bool updateCursor(cpu_surface *cursorTex, cpu_surface *cursorMaskTex, frame_source::cursor_state& cursor);
+    void releaseFrame();
+    bool setZeroCopy(bool) { return false; }
+    cpu_surface *frameTexture() { return nullptr; }
+
+    /**
+     * As if the frames were presented at 60 Hz
+     */
+    uint64_t presentTime() const { return m_frame * 16667; }
+
+    /**
+     * The regions changed by the currently acquired frame, move destinations included
+     */
+    const std::vector<damage::rect>& frameDamage() const { return m_damage; }
+};
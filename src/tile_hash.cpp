@@ -0,0 +1,305 @@
+#include "tile_hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#define TILE_HASH_SSE2 1
+#endif
+
+// The hash follows the accumulate and scramble steps of XXH3: every 16 bytes of a row are
+// mixed with a key depending on their position, multiplied 32x32->64 bit and added to one of
+// two pairs of 64 bit accumulators, which are scrambled after every row. Only 64 bit adds and
+// xors and 32 bit multiplications are needed, all of which SSE2 has.
+
+namespace {
+    static const int CHUNK      = 16; // bytes mixed in one step
+    static const int CHUNK_KEYS = 16; // one key per chunk of a 64 pixel row
+
+    static const uint32_t PRIME32 = 0x9E3779B1u;
+    static const uint64_t PRIME64 = 0x9E3779B97F4A7C15ULL;
+
+    alignas(16) static const uint64_t KEYS[2 * CHUNK_KEYS] = {
+        0x41bd83a73a35cc15ULL, 0xf93f5832077bc610ULL, 0xcfbdd7a08d847ef3ULL, 0x878d7110d4cd5763ULL,
+        0x96cbec35ffe88e19ULL, 0xda2d914a39744b29ULL, 0x4dd2f255a85960a1ULL, 0x693936f138f3aa7bULL,
+        0x21d82577a59a90b3ULL, 0x8dcac5956bdb4fc9ULL, 0x3992c092c59b2c85ULL, 0xa2c2104c90dbae7aULL,
+        0x48e4c9567f3e913aULL, 0x99320b30b1135bd9ULL, 0x0426ece0f1a387b0ULL, 0xc30bd4d5670d9e1bULL,
+        0x1cb9890753cb75a7ULL, 0x1744ee9173a44afaULL, 0x55383bc2694b4897ULL, 0x9a094ccf1ea53b37ULL,
+        0xcc1d4056d0713f71ULL, 0x923c7ec7b104c9e4ULL, 0x9f3ad4e156b548b5ULL, 0x62da9816b9492ca0ULL,
+        0x02c8633bf021eb41ULL, 0x09a33347dd147530ULL, 0x65f4a0e8896cfc9cULL, 0xc1beb63c9babebaaULL,
+        0xeba09b0cc702dd8eULL, 0x1ba045f2aabaf231ULL, 0xbb97a61bf19a5644ULL, 0x90c2f02c6586a681ULL,
+    };
+
+    // the accumulators before the first row, and the keys for scrambling them
+    static const uint64_t *SEEDS         = KEYS + 4;
+    static const uint64_t *SCRAMBLE_KEYS = KEYS + 8;
+
+    inline uint64_t load64(const uint8_t *p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline void accumulate(uint64_t *acc, const uint8_t *chunk, int index)
+    {
+        const uint64_t *key = KEYS + 2 * (index % CHUNK_KEYS);
+
+        uint64_t d0 = load64(chunk), d1 = load64(chunk + 8);
+        uint64_t k0 = d0 ^ key[0],   k1 = d1 ^ key[1];
+
+        acc[0] += d1 + (k0 & 0xFFFFFFFFu) * (k0 >> 32);
+        acc[1] += d0 + (k1 & 0xFFFFFFFFu) * (k1 >> 32);
+    }
+
+    inline void scramble(uint64_t *acc)
+    {
+        for (int i = 0; i < 4; ++i) {
+            uint64_t a = acc[i];
+            a ^= a >> 47;
+            a ^= SCRAMBLE_KEYS[i];
+            acc[i] = a * PRIME32;
+        }
+    }
+
+    uint64_t finish(const uint64_t *acc, int width, int height)
+    {
+        uint64_t h = PRIME64 * (static_cast<uint64_t>(width) << 32 | static_cast<uint32_t>(height));
+
+        for (int i = 0; i < 4; ++i) {
+            h = (h ^ acc[i]) * PRIME64;
+            h ^= h >> 29;
+        }
+
+        // splitmix64 finalizer
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 31);
+    }
+
+    // the last bytes of a row, which don't fill a whole chunk, padded with zeroes
+    inline const uint8_t *tail(const uint8_t *row, int bytes, uint8_t *buffer)
+    {
+        int whole = bytes - bytes % CHUNK;
+
+        std::memset(buffer, 0, CHUNK);
+        std::memcpy(buffer, row + whole, bytes - whole);
+
+        return buffer;
+    }
+
+#ifdef TILE_HASH_SSE2
+    __attribute__((target("sse2")))
+    inline __m128i accumulateSse2(__m128i acc, __m128i data, int index)
+    {
+        __m128i key   = _mm_load_si128(reinterpret_cast<const __m128i*>(KEYS + 2 * (index % CHUNK_KEYS)));
+        __m128i mixed = _mm_xor_si128(data, key);
+
+        // the low halves of both 64 bit lanes times their high halves
+        __m128i product = _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1)));
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+
+        return _mm_add_epi64(acc, _mm_add_epi64(swapped, product));
+    }
+
+    __attribute__((target("sse2")))
+    inline __m128i scrambleSse2(__m128i acc, const uint64_t *key)
+    {
+        acc = _mm_xor_si128(acc, _mm_srli_epi64(acc, 47));
+        acc = _mm_xor_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key)));
+
+        // 64 bit times 32 bit, from the two 32x32->64 bit products of both halves
+        __m128i prime = _mm_set1_epi32(static_cast<int>(PRIME32));
+        __m128i low   = _mm_mul_epu32(acc, prime);
+        __m128i high  = _mm_mul_epu32(_mm_shuffle_epi32(acc, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+
+        return _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+    }
+
+    __attribute__((target("sse2")))
+    uint64_t hashSse2(const uint8_t *pixels, std::size_t pitch, int width, int height)
+    {
+        __m128i even = _mm_loadu_si128(reinterpret_cast<const __m128i*>(SEEDS));
+        __m128i odd  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(SEEDS + 2));
+
+        int bytes  = 4 * width;
+        int chunks = bytes / CHUNK;
+
+        alignas(16) uint8_t buffer[CHUNK];
+
+        for (int y = 0; y < height; ++y) {
+            const uint8_t *row = pixels + static_cast<std::size_t>(y) * pitch;
+
+            int c = 0;
+            for (; c + 1 < chunks; c += 2) {
+                even = accumulateSse2(even, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + c * CHUNK)), c);
+                odd  = accumulateSse2(odd,  _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + (c + 1) * CHUNK)), c + 1);
+            }
+
+            if (c < chunks) {
+                even = accumulateSse2(even, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + c * CHUNK)), c);
+                ++c;
+            }
+
+            if (bytes % CHUNK) {
+                __m128i data = _mm_load_si128(reinterpret_cast<const __m128i*>(tail(row, bytes, buffer)));
+
+                if (c % 2)
+                    odd = accumulateSse2(odd, data, c);
+                else
+                    even = accumulateSse2(even, data, c);
+            }
+
+            even = scrambleSse2(even, SCRAMBLE_KEYS);
+            odd  = scrambleSse2(odd,  SCRAMBLE_KEYS + 2);
+        }
+
+        alignas(16) uint64_t acc[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc),     even);
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc + 2), odd);
+
+        return finish(acc, width, height);
+    }
+
+    bool haveSse2()
+    {
+#ifdef __x86_64__
+        return true;
+#else
+        static const bool supported = __builtin_cpu_supports("sse2");
+        return supported;
+#endif
+    }
+#endif
+}
+
+uint64_t
+tile_hash::hash_portable(const uint8_t *pixels, std::size_t pitch, int width, int height)
+{
+    uint64_t acc[4] = { SEEDS[0], SEEDS[1], SEEDS[2], SEEDS[3] };
+
+    int bytes  = 4 * width;
+    int chunks = bytes / CHUNK;
+
+    uint8_t buffer[CHUNK];
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row = pixels + static_cast<std::size_t>(y) * pitch;
+
+        // even chunks go to the first pair of accumulators, odd ones to the second
+        int c = 0;
+        for (; c < chunks; ++c)
+            accumulate(acc + 2 * (c % 2), row + c * CHUNK, c);
+
+        if (bytes % CHUNK)
+            accumulate(acc + 2 * (c % 2), tail(row, bytes, buffer), c);
+
+        scramble(acc);
+    }
+
+    return finish(acc, width, height);
+}
+
+uint64_t
+tile_hash::hash(const uint8_t *pixels, std::size_t pitch, int width, int height)
+{
+#ifdef TILE_HASH_SSE2
+    if (haveSse2())
+        return hashSse2(pixels, pitch, width, height);
+#endif
+
+    return hash_portable(pixels, pitch, width, height);
+}
+
+bool
+tile_hash::simd()
+{
+#ifdef TILE_HASH_SSE2
+    return haveSse2();
+#else
+    return false;
+#endif
+}
+
+void
+tile_hash::detector::reset(int width, int height)
+{
+    m_width   = std::max(width, 0);
+    m_height  = std::max(height, 0);
+    m_columns = (m_width  + TILE_SIZE - 1) / TILE_SIZE;
+    m_rows    = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+    m_valid   = false;
+
+    m_hashes.assign(static_cast<std::size_t>(m_columns) * m_rows, 0);
+    m_changed.assign(m_hashes.size(), 0);
+}
+
+bool
+tile_hash::detector::update(const uint8_t *pixels, std::size_t pitch, std::vector<damage::rect>& rects)
+{
+    for (int row = 0; row < m_rows; ++row) {
+        int top    = row * TILE_SIZE;
+        int height = std::min(TILE_SIZE, m_height - top);
+
+        for (int column = 0; column < m_columns; ++column) {
+            int left  = column * TILE_SIZE;
+            int width = std::min(TILE_SIZE, m_width - left);
+
+            std::size_t tile = static_cast<std::size_t>(row) * m_columns + column;
+            uint64_t    h    = hash(pixels + static_cast<std::size_t>(top) * pitch + 4 * static_cast<std::size_t>(left),
+                                    pitch, width, height);
+
+            m_changed[tile] = h != m_hashes[tile];
+            m_hashes[tile]  = h;
+        }
+    }
+
+    if (!m_valid) {
+        m_valid = true;
+        return false;
+    }
+
+    // Runs of changed tiles in a row become rectangles, which are extended downwards as long
+    // as the next row has a run with the same columns.
+    std::vector<std::size_t> above, current; // indices of the rectangles ending in the previous and this row
+
+    for (int row = 0; row < m_rows; ++row) {
+        int top    = row * TILE_SIZE;
+        int bottom = std::min(top + TILE_SIZE, m_height);
+
+        current.clear();
+
+        for (int column = 0; column < m_columns;) {
+            const uint8_t *changed = m_changed.data() + static_cast<std::size_t>(row) * m_columns;
+
+            if (!changed[column]) {
+                ++column;
+                continue;
+            }
+
+            int first = column;
+            while (column < m_columns && changed[column])
+                ++column;
+
+            int32_t left  = first * TILE_SIZE;
+            int32_t right = std::min(column * TILE_SIZE, m_width);
+
+            std::vector<std::size_t>::const_iterator match = std::find_if(above.begin(), above.end(),
+                [&](std::size_t i) { return rects[i].left == left && rects[i].right == right; });
+
+            if (match != above.end()) {
+                rects[*match].bottom = bottom;
+                current.push_back(*match);
+            } else {
+                damage::rect r = { left, top, right, bottom };
+                current.push_back(rects.size());
+                rects.push_back(r);
+            }
+        }
+
+        above.swap(current);
+    }
+
+    return true;
+}
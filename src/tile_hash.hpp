@@ -0,0 +1,75 @@
+#pragma once
+
+#include "damage.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/** @file tile_hash.hpp
+ *
+ * Finds the changed parts of frames which come without dirty rects, e.g. the whole back
+ * buffer copies of the DWM hook. Frames are split into tiles which are hashed and compared
+ * with the hashes of the previous frame.
+ */
+namespace tile_hash {
+    /**
+     * Width and height of a tile in pixels, the tiles at the right and bottom edge may be smaller
+     */
+    static const int TILE_SIZE = 64;
+
+    /**
+     * Hashes a block of 32bpp pixels, using SSE2 if the CPU has it.
+     *
+     * Changing a pixel, swapping two pixels or two rows changes the hash, except by chance.
+     */
+    uint64_t hash(const uint8_t *pixels, std::size_t pitch, int width, int height);
+
+    /**
+     * Same as hash(), without SSE2. Both return the same hashes.
+     */
+    uint64_t hash_portable(const uint8_t *pixels, std::size_t pitch, int width, int height);
+
+    /**
+     * Whether hash() uses SSE2
+     */
+    bool simd();
+
+    /**
+     * Compares every frame with the previous one, tile by tile.
+     */
+    class detector {
+        int m_width   = 0;
+        int m_height  = 0;
+        int m_columns = 0;
+        int m_rows    = 0;
+        bool m_valid  = false; // whether m_hashes belong to a previous frame
+
+        std::vector<uint64_t> m_hashes;  // of the previous frame, row by row
+        std::vector<uint8_t>  m_changed; // of the current frame
+
+    public:
+        /**
+         * Starts over with frames of the given size, the next frame counts as changed entirely
+         */
+        void reset(int width, int height);
+
+        /**
+         * Forgets the previous frame, e.g. because the consumer lost track of it
+         */
+        void invalidate() { m_valid = false; }
+
+        /**
+         * Hashes a frame and appends the tiles which changed since the previous one to
+         * @a rects, tiles next to each other merged into rectangles like DXGI dirty rects.
+         *
+         * @returns false if there was no previous frame to compare with, the whole frame
+         *          has to be treated as changed then, nothing is appended
+         */
+        bool update(const uint8_t *pixels, std::size_t pitch, std::vector<damage::rect>& rects);
+
+        int width() const  { return m_width; }
+        int height() const { return m_height; }
+        int tiles() const  { return m_columns * m_rows; }
+    };
+}
@@ -145,6 +145,37 @@ namespace util {
         }
     }
 
+    inline uint64_t microseconds_now() {
+        static LARGE_INTEGER frequency;
+        static BOOL qpcAvailable = QueryPerformanceFrequency(&frequency);
+        if (qpcAvailable) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+
+            // split up, 1000000*QuadPart overflows after a few days
+            uint64_t seconds = now.QuadPart / frequency.QuadPart;
+            uint64_t rest    = now.QuadPart % frequency.QuadPart;
+            return seconds * 1000000ULL + (rest * 1000000ULL) / frequency.QuadPart;
+        } else {
+            return 1000ULL * GetTickCount();
+        }
+    }
+
+    /**
+     * Converts a QueryPerformanceCounter value, e.g. a DXGI present time, to the timebase of
+     * microseconds_now()
+     */
+    inline uint64_t qpc_to_microseconds(LONGLONG ticks) {
+        static LARGE_INTEGER frequency;
+        static BOOL qpcAvailable = QueryPerformanceFrequency(&frequency);
+        if (!qpcAvailable || ticks <= 0)
+            return 0;
+
+        uint64_t seconds = ticks / frequency.QuadPart;
+        uint64_t rest    = ticks % frequency.QuadPart;
+        return seconds * 1000000ULL + (rest * 1000000ULL) / frequency.QuadPart;
+    }
+
     /**
      * return the next multiple of @param n being >= @param arg
      */
@@ -1,13 +1,35 @@
 #include "util.hpp"
 #include "renderer.hpp"
+#include "gdi_renderer.hpp"
+#include "gdi_source.hpp"
+#include "hub_source.hpp"
 #include "duplication_source.hpp"
+#include "spanning_source.hpp"
 #include "seven_dwm_source.hpp"
 #include "logger.hpp"
 #include "win32.hpp"
+#include "frame_scheduler.hpp"
+#include "stats.hpp"
+#include "view_options.hpp"
+
+#include <string>
 
 #define WM_APP_RESIZE    (WM_APP + 1)
 #define WM_APP_QUIT      (WM_APP + 2)
 #define WM_APP_SETSCREEN (WM_APP + 3)
+#define WM_APP_SETOPTION (WM_APP + 4)
+#define WM_APP_RECORD    (WM_APP + 5)
+
+namespace {
+    // log the active/idle frame counts that often, in ms
+    static const uint64_t RENDER_STATS_LOG_INTERVAL = 10000;
+
+    // The clock of the render loop. Sleeping wakes up early for messages.
+    struct render_clock {
+        uint64_t now() { return util::milliseconds_now(); }
+        void sleep(unsigned ms) { MsgWaitForMultipleObjects(0, nullptr, FALSE, ms, QS_ALLINPUT); }
+    };
+}
 
 template <class TSource>
 class RenderThread {
@@ -30,6 +52,8 @@ public:
         InterlockedExchange(&m_w, w);
         InterlockedExchange(&m_h, h);
 
+        log_view_created();
+
         m_threadHandle = CreateThread(nullptr, 0, &RenderThread::threadProc, reinterpret_cast<void*>(this), 0, &m_threadId);
         if (!m_threadHandle) {
             logger << "FAILED: CreateThread: " << GetLastError() << std::endl;
@@ -42,6 +66,8 @@ public:
 
         WaitForSingleObject(m_threadHandle, INFINITE);
         CloseHandle(m_threadHandle);
+
+        log_view_destroyed();
     }
 
     void sendResize()
@@ -61,22 +87,66 @@ public:
         logger << "Posted WM_APP_SETSCREEN x="<<x<<" y="<<y<<" w="<<w<<" h="<<h << std::endl;
     }
 
+    void sendOption(int option, int value)
+    {
+        PostThreadMessage(m_threadId, WM_APP_SETOPTION, static_cast<WPARAM>(option), static_cast<LPARAM>(value));
+    }
+
+    // Starts recording to @a path, or stops if it is nullptr
+    void sendRecord(const char *path)
+    {
+        // the render thread deletes the copy
+        std::string *copy = path ? new std::string(path) : nullptr;
+
+        if (!PostThreadMessage(m_threadId, WM_APP_RECORD, reinterpret_cast<WPARAM>(copy), 0))
+            delete copy;
+    }
+
 private:
     static CALLBACK DWORD threadProc(void *param)
     {
         RenderThread *owner = static_cast<RenderThread*>(param);
 
-        Renderer<TSource> renderer(
-            reinterpret_cast<HWND>(InterlockedExchangeAdd(&owner->m_hwnd, 0)),
-            static_cast<int>(InterlockedExchangeAdd(&owner->m_x, 0)),
-            static_cast<int>(InterlockedExchangeAdd(&owner->m_y, 0)),
-            static_cast<int>(InterlockedExchangeAdd(&owner->m_w, 0)),
-            static_cast<int>(InterlockedExchangeAdd(&owner->m_h, 0)));
+        stats::recorder recorder;
+        stats::recorder::set_current(&recorder);
+
+        HWND hwnd = reinterpret_cast<HWND>(InterlockedExchangeAdd(&owner->m_hwnd, 0));
+        int  x    = static_cast<int>(InterlockedExchangeAdd(&owner->m_x, 0));
+        int  y    = static_cast<int>(InterlockedExchangeAdd(&owner->m_y, 0));
+        int  w    = static_cast<int>(InterlockedExchangeAdd(&owner->m_w, 0));
+        int  h    = static_cast<int>(InterlockedExchangeAdd(&owner->m_h, 0));
+
+        bool fallback;
+        {
+            Renderer<TSource> renderer(hwnd, x, y, w, h);
+
+            fallback = !renderer.ok();
+            if (!fallback)
+                runLoop(owner, renderer);
+        }
+
+        // no usable D3D10 device, GDI works everywhere
+        if (fallback) {
+            logger << "Falling back to the CPU renderer" << std::endl;
+
+            GdiRenderer<GdiSource> renderer(hwnd, x, y, w, h);
+            runLoop(owner, renderer);
+        }
 
+        return 0;
+    }
+
+    template<class TRenderer>
+    static void runLoop(RenderThread *owner, TRenderer& renderer)
+    {
         MSG msg;
         memset(&msg, 0, sizeof(msg));
 
-        uint64_t last = util::milliseconds_now();
+        // As a safety net against broken vsync, we cap the FPS at 100
+        frame_scheduler::scheduler scheduler(10);
+        render_clock clock;
+
+        uint64_t lastStats = clock.now();
 
         while (msg.message != WM_QUIT) {
             if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
@@ -87,6 +157,7 @@ private:
                     GetClientRect(reinterpret_cast<HWND>(InterlockedExchangeAdd(&owner->m_hwnd, 0)), &cr);
 
                     renderer.resize(cr);
+                    scheduler.invalidate();
                 } else if (msg.message == WM_APP_SETSCREEN) {
                     renderer.reset(
                         static_cast<int>(InterlockedExchangeAdd(&owner->m_x, 0)),
@@ -94,25 +165,37 @@ private:
                         static_cast<int>(InterlockedExchangeAdd(&owner->m_w, 0)),
                         static_cast<int>(InterlockedExchangeAdd(&owner->m_h, 0))
                     );
+                    scheduler.invalidate();
+                } else if (msg.message == WM_APP_SETOPTION) {
+                    renderer.setOption(static_cast<int>(msg.wParam), static_cast<int>(msg.lParam));
+                    scheduler.invalidate();
+                } else if (msg.message == WM_APP_RECORD) {
+                    std::string *path = reinterpret_cast<std::string*>(msg.wParam);
+
+                    if (path)
+                        renderer.startRecording(path->c_str());
+                    else
+                        renderer.stopRecording();
+
+                    delete path;
                 } else {
                     TranslateMessage(&msg);
                     DispatchMessage(&msg);
                 }
             } else {
-                renderer.render();
+                // blocks until there is a new frame, a message or a timeout, and only
+                // presents if something changed
+                frame_scheduler::run_once(scheduler, renderer, clock);
 
-                // As a safety net against broken vsync, we cap the FPS at 100
-                uint64_t previous = last;
-                uint64_t now = last = util::milliseconds_now();
-                if ((now - previous) < 10)
-                    Sleep(10 - static_cast<DWORD>(now - previous));
+                uint64_t now = clock.now();
+                if (now - lastStats >= RENDER_STATS_LOG_INTERVAL) {
+                    const frame_scheduler::stats& counts = scheduler.counts();
+                    logger << "Render loop: active=" << counts.active << " idle=" << counts.idle << std::endl;
 
-                //TODO: display fps?
-                //logger << "FPS: " << 1000.0f/static_cast<float>(now - previous) << std::endl;
+                    lastStats = now;
+                }
             }
         }
-
-        return 0;
     }
 };
 
@@ -149,6 +232,10 @@ namespace ViewWindow {
                 int *xywh = reinterpret_cast<int*>(wp);
 
                 m_renderer.sendNewScreen(xywh[0], xywh[1], xywh[2], xywh[3]);
+            } else if (msgid == WM_APP_SETOPTION) {
+                m_renderer.sendOption(static_cast<int>(wp), static_cast<int>(lp));
+            } else if (msgid == WM_APP_RECORD) {
+                m_renderer.sendRecord(reinterpret_cast<const char*>(wp));
             }
 
             return win32::window::handleMessage(msgid, wp, lp);
@@ -167,6 +254,16 @@ namespace ViewWindow {
 
         SendMessage(view, WM_APP_SETSCREEN, reinterpret_cast<WPARAM>(&xywh), 0);
     }
+
+    inline void setOption(HWND view, int option, int value)
+    {
+        SendMessage(view, WM_APP_SETOPTION, static_cast<WPARAM>(option), static_cast<LPARAM>(value));
+    }
+
+    inline void record(HWND view, const char *path)
+    {
+        SendMessage(view, WM_APP_RECORD, reinterpret_cast<WPARAM>(path), 0);
+    }
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -175,14 +272,58 @@ namespace ViewWindow {
 EXPORT HWND SV_CreateView(HWND parent, int x, int y, int w, int h)
 {
     if (util::check_windows_version(6, 2))
-        return ViewWindow::create<DuplicationSource>(parent, x, y, w, h);
+        return ViewWindow::create<HubSource>(parent, x, y, w, h);
     else if (util::check_windows_version<std::equal_to<DWORD>>(6, 1))
         return ViewWindow::create<SevenDwmSource>(parent, x, y, w, h);
     else
         return NULL;
 }
 
+EXPORT HWND SV_CreateRegionView(HWND parent, int x, int y, int w, int h)
+{
+    // only duplicating a display by ourselves lets us copy just a part of it
+    if (util::check_windows_version(6, 2))
+        return ViewWindow::create<DuplicationSource>(parent, x, y, w, h);
+    else
+        return NULL;
+}
+
+EXPORT HWND SV_CreateSpanningView(HWND parent, int x, int y, int w, int h)
+{
+    // stitched from the capture hubs of the outputs
+    if (util::check_windows_version(6, 2))
+        return ViewWindow::create<SpanningSource>(parent, x, y, w, h);
+    else
+        return NULL;
+}
+
 EXPORT void SV_ChangeScreen(HWND view, int x, int y, int w, int h)
 {
     ViewWindow::setScreen(view, x, y, w, h);
+}
+
+EXPORT void SV_SetViewOption(HWND view, int option, int value)
+{
+    ViewWindow::setOption(view, option, value);
+}
+
+EXPORT void SV_StartRecording(HWND view, const char *path)
+{
+    if (path)
+        ViewWindow::record(view, path);
+}
+
+EXPORT void SV_StopRecording(HWND view)
+{
+    ViewWindow::record(view, nullptr);
+}
+
+EXPORT int SV_GetStats(SV_Stats *out)
+{
+    if (!out || out->size != sizeof(SV_Stats))
+        return 0;
+
+    stats::collect(*out, util::microseconds_now());
+
+    return 1;
 }
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include "view_geometry.hpp"
+
+#include "view_options.hpp"
+
+#include <cstdint>
+
+namespace {
+    // a * b / c, rounded, without overflowing for any screen size
+    int32_t scaleRounded(int32_t a, int32_t b, int32_t c)
+    {
+        return static_cast<int32_t>((2 * static_cast<int64_t>(a) * b + c) / (2 * static_cast<int64_t>(c)));
+    }
+}
+
+damage::rect
+view_geometry::desktop_rect(int desktopWidth, int desktopHeight, int viewWidth, int viewHeight, int mode)
+{
+    damage::rect view = { 0, 0, viewWidth > 0 ? viewWidth : 0, viewHeight > 0 ? viewHeight : 0 };
+
+    if (desktopWidth <= 0 || desktopHeight <= 0 || damage::empty(view))
+        return view;
+
+    int32_t width  = view.right;
+    int32_t height = view.bottom;
+
+    // which side of the view the desktop spans, the other one is scaled to match
+    bool viewIsWider = static_cast<int64_t>(view.right) * desktopHeight > static_cast<int64_t>(view.bottom) * desktopWidth;
+
+    if (mode == SV_ASPECT_FIT || mode == SV_ASPECT_FILL) {
+        if (viewIsWider == (mode == SV_ASPECT_FIT))
+            width = scaleRounded(view.bottom, desktopWidth, desktopHeight);
+        else
+            height = scaleRounded(view.right, desktopHeight, desktopWidth);
+    } else if (mode == SV_ASPECT_NATIVE) {
+        width  = desktopWidth;
+        height = desktopHeight;
+    } else {
+        return view;
+    }
+
+    damage::rect r = {
+        (view.right  - width)  / 2,
+        (view.bottom - height) / 2,
+        0,
+        0
+    };
+    r.right  = r.left + width;
+    r.bottom = r.top  + height;
+
+    return r;
+}
+
+bool
+view_geometry::integer_scale(int srcWidth, int srcHeight, const damage::rect& r)
+{
+    int32_t width  = damage::width(r);
+    int32_t height = damage::height(r);
+
+    return srcWidth > 0 && srcHeight > 0 &&
+           width >= srcWidth && height >= srcHeight &&
+           width % srcWidth == 0 && height % srcHeight == 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "damage.hpp"
+
+/** @file view_geometry.hpp
+ *
+ * Where the desktop ends up in a view, depending on the aspect mode of the view (see
+ * SV_OPTION_ASPECT), and whether it can be drawn point sampled. Shared by the D3D10 and the CPU
+ * renderer.
+ */
+namespace view_geometry {
+    /**
+     * The rectangle of the view the desktop is drawn to, in view pixels
+     *
+     * SV_ASPECT_STRETCH covers the view. SV_ASPECT_FIT scales the desktop to fit into the view,
+     * SV_ASPECT_FILL scales it to cover the view, both keeping the aspect ratio. SV_ASPECT_NATIVE
+     * doesn't scale at all. The result is centered and can extend beyond the view, which crops
+     * the desktop. Unknown modes stretch.
+     */
+    damage::rect desktop_rect(int desktopWidth, int desktopHeight, int viewWidth, int viewHeight, int mode);
+
+    /**
+     * Whether drawing a srcWidth x srcHeight texture to @a r magnifies it by whole numbers
+     * (1 included), so every view pixel shows exactly one texel. Point sampling is as accurate as
+     * bilinear filtering then, and keeps the pixels sharp.
+     *
+     * Whole number minifications don't count: point sampling would skip texels. The thumbnail
+     * pyramid covers those.
+     */
+    bool integer_scale(int srcWidth, int srcHeight, const damage::rect& r);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// Options of a view - C API, keep in sync with dllapi.h
+// SV_SetViewOption itself is exported by view.cpp
+//////////////////////////////////////////////////////////////////////
+extern "C" {
+
+enum SV_ViewOption {
+    SV_OPTION_THUMBNAIL    = 0, // 1: sample a downscaled copy of the desktop matching the view size
+    SV_OPTION_ZERO_COPY    = 1, // 1: draw straight from the captured frame instead of a copy, if the source can
+    SV_OPTION_ASPECT       = 2, // one of SV_ViewAspect
+    SV_OPTION_CAPTURE_RATE = 3, // frames per second of sources capturing at a fixed rate, 0 stops capturing
+};
+
+enum SV_ViewAspect {
+    SV_ASPECT_STRETCH = 0, // the desktop covers the view, whatever its aspect ratio
+    SV_ASPECT_FIT     = 1, // the whole desktop, with bars left and right or above and below
+    SV_ASPECT_FILL    = 2, // the view covered, the desktop cropped on two sides
+    SV_ASPECT_NATIVE  = 3, // one desktop pixel per view pixel, centered, cropped if needed
+};
+
+} // extern "C"